@@ -71,6 +71,31 @@ XMFLOAT3 & Camera::GetPosition()
 	return position;
 }
 
+void Camera::BeginStep()
+{
+	previousPosition = position;
+}
+
+XMFLOAT3 Camera::GetInterpolatedPosition(float interpolation)
+{
+	XMFLOAT3 result;
+	XMStoreFloat3(&result, XMVectorLerp(XMLoadFloat3(&previousPosition), XMLoadFloat3(&position), interpolation));
+	return result;
+}
+
+// --------------------------------------------------------
+// Only the position is blended, the view direction is the
+// one of the last step
+// --------------------------------------------------------
+XMFLOAT4X4 Camera::GetInterpolatedViewMatrix(float interpolation)
+{
+	XMFLOAT3 interpolatedPosition = GetInterpolatedPosition(interpolation);
+
+	XMFLOAT4X4 result;
+	XMStoreFloat4x4(&result, XMMatrixTranspose(XMMatrixLookToLH(XMLoadFloat3(&interpolatedPosition), XMLoadFloat3(&direction), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))));
+	return result;
+}
+
 void Camera::HandleKeyboardInput(float moveSpeed)
 {
 	if (InputManager::Instance()->isForwardPressed())
@@ -109,6 +134,7 @@ Camera::Camera()
 	rotationX = 0.0f;
 	rotationY = 0.0f;
 	position = { 0.0f, 0.0f, -5.0f };
+	previousPosition = position;
 	direction = { 0.0f, 0.0f, -1.0f };
 	up = { 0.0f, 1.0f, 0.0f };
 
@@ -14,6 +14,7 @@ private:
 	XMFLOAT4X4 viewMatrix;
 	XMFLOAT4X4 projectionMatrix;
 	XMFLOAT3 position;
+	XMFLOAT3 previousPosition;	// At the start of the current simulation step
 	XMFLOAT3 direction;
 	XMFLOAT3 up;
 	float rotationX;
@@ -34,5 +35,12 @@ public:
 	void MoveSideways(float val);
 	void MoveVertical(float val);
 	XMFLOAT3& GetPosition();
+
+	// Keeps the current position as the previous one, call at the start of every simulation step
+	void BeginStep();
+
+	// Position and view matrix (transposed for HLSL) between the previous and current step
+	XMFLOAT3 GetInterpolatedPosition(float interpolation);
+	XMFLOAT4X4 GetInterpolatedViewMatrix(float interpolation);
 };
 
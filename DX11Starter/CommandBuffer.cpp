@@ -0,0 +1,620 @@
+#include "CommandBuffer.h"
+#include "JobSystem.h"
+#include "Vertex.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static bool SortKeyLess(const DrawPacket* a, const DrawPacket* b)
+{
+	return a->SortKey < b->SortKey;
+}
+
+// --------------------------------------------------------
+// Command buffer
+// --------------------------------------------------------
+CommandBuffer::CommandBuffer(unsigned int chunkSize)
+{
+	this->chunkSize = chunkSize;
+	currentChunk = 0;
+}
+
+CommandBuffer::~CommandBuffer()
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+		delete[] chunks[i].Memory;
+}
+
+void CommandBuffer::Reset()
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+		chunks[i].Used = 0;
+	currentChunk = 0;
+	packets.clear();
+}
+
+DrawPacket * CommandBuffer::AddDraw()
+{
+	DrawPacket* packet = (DrawPacket*)Allocate(sizeof(DrawPacket), __alignof(DrawPacket));
+	packets.push_back(packet);
+	return packet;
+}
+
+unsigned int CommandBuffer::GetBytes() const
+{
+	unsigned int bytes = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+		bytes += chunks[i].Used;
+	return bytes;
+}
+
+// --------------------------------------------------------
+// Bumps through the current chunk, moving on to the next one
+// (or a new one) when it's full.  Nothing is ever freed
+// individually.
+// --------------------------------------------------------
+void * CommandBuffer::Allocate(unsigned int size, unsigned int alignment)
+{
+	while (currentChunk < chunks.size())
+	{
+		Chunk& chunk = chunks[currentChunk];
+		unsigned int offset = (chunk.Used + alignment - 1) & ~(alignment - 1);
+		if (offset + size <= chunkSize)
+		{
+			chunk.Used = offset + size;
+			return chunk.Memory + offset;
+		}
+		currentChunk++;
+	}
+
+	Chunk chunk;
+	chunk.Memory = new unsigned char[chunkSize];
+	chunk.Used = size;
+	chunks.push_back(chunk);
+	currentChunk = (unsigned int)chunks.size() - 1;
+	return chunk.Memory;
+}
+
+// --------------------------------------------------------
+// Null backend
+// --------------------------------------------------------
+NullCommandBackend::NullCommandBackend(bool keepPackets)
+{
+	KeepPackets = keepPackets;
+	Draws = 0;
+	StateChanges = 0;
+	Indices = 0;
+}
+
+void NullCommandBackend::Submit(DrawPacket * const * packets, unsigned int count)
+{
+	const DrawPacket* previous = nullptr;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const DrawPacket* packet = packets[i];
+		if (!previous || previous->State != packet->State) StateChanges++;
+		if (!previous || previous->MaterialObj != packet->MaterialObj) StateChanges++;
+		if (!previous || previous->VertexBuffer != packet->VertexBuffer) StateChanges++;
+		if (!previous || previous->IndexBuffer != packet->IndexBuffer) StateChanges++;
+
+		Draws++;
+		Indices += packet->IndexCount;
+		if (KeepPackets)
+			Submitted.push_back(*packet);
+		previous = packet;
+	}
+}
+
+// --------------------------------------------------------
+// D3D11 backend
+// --------------------------------------------------------
+D3D11CommandBackend::D3D11CommandBackend(ID3D11DeviceContext * context, PipelineStateCache * pipelineStates)
+{
+	this->context = context;
+	this->pipelineStates = pipelineStates;
+	recorder = nullptr;
+	instanceBuffer = nullptr;
+	instanceCapacity = 0;
+	VertexBufferBinds = 0;
+	IndexBufferBinds = 0;
+	ZeroMemory(&Instancing, sizeof(InstancingStats));
+}
+
+D3D11CommandBackend::~D3D11CommandBackend()
+{
+	if (instanceBuffer) { instanceBuffer->Release(); }
+}
+
+// --------------------------------------------------------
+// Packets whose vertex shader reads per-instance data are
+// always drawn instanced.  Consecutive ones drawing the same
+// geometry with materials of one bind group share a draw,
+// however their textures' slices differ.
+// --------------------------------------------------------
+static bool IsInstanced(const DrawPacket& packet)
+{
+	return packet.MaterialObj->GetVertexShader()->GetPerInstanceCompatible();
+}
+
+static bool CanShareDraw(const DrawPacket& a, const DrawPacket& b)
+{
+	return
+		a.State == b.State &&
+		a.MaterialObj->GetBindGroup() == b.MaterialObj->GetBindGroup() &&
+		a.View == b.View &&
+		a.VertexBuffer == b.VertexBuffer &&
+		a.AttributeBuffer == b.AttributeBuffer &&
+		a.IndexBuffer == b.IndexBuffer &&
+		a.VertexStride == b.VertexStride &&
+		a.IndexCount == b.IndexCount &&
+		a.StartIndex == b.StartIndex &&
+		a.BaseVertex == b.BaseVertex;
+}
+
+// --------------------------------------------------------
+// Splits the packets into draws and gathers the instance
+// data of the instanced ones, in draw order
+// --------------------------------------------------------
+void D3D11CommandBackend::BuildDraws(DrawPacket * const * packets, unsigned int count)
+{
+	draws.clear();
+	instances.clear();
+
+	unsigned int i = 0;
+	while (i < count)
+	{
+		Draw draw;
+		draw.First = i;
+		draw.Count = 1;
+		draw.FirstInstance = 0xffffffff;
+
+		if (IsInstanced(*packets[i]))
+		{
+			while (i + draw.Count < count &&
+				IsInstanced(*packets[i + draw.Count]) &&
+				CanShareDraw(*packets[i], *packets[i + draw.Count]))
+				draw.Count++;
+
+			draw.FirstInstance = (unsigned int)instances.size();
+			for (unsigned int p = i; p < i + draw.Count; p++)
+			{
+				InstanceData instance;
+				instance.World = packets[p]->World;
+				instance.TextureSlice = (float)packets[p]->MaterialObj->GetTextureSlice();
+				instances.push_back(instance);
+			}
+		}
+
+		draws.push_back(draw);
+		i += draw.Count;
+	}
+}
+
+// --------------------------------------------------------
+// The whole frame's instance data goes up in one discarding
+// map, growing the buffer to the next power of two if needed
+// --------------------------------------------------------
+bool D3D11CommandBackend::UploadInstances()
+{
+	if (instances.empty())
+		return true;
+
+	if (instances.size() > instanceCapacity)
+	{
+		if (instanceBuffer) { instanceBuffer->Release(); instanceBuffer = nullptr; }
+		instanceCapacity = 256;
+		while (instanceCapacity < instances.size())
+			instanceCapacity *= 2;
+
+		ID3D11Device* device = nullptr;
+		context->GetDevice(&device);
+		D3D11_BUFFER_DESC desc = {};
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.ByteWidth = instanceCapacity * sizeof(InstanceData);
+		desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		HRESULT hr = device->CreateBuffer(&desc, 0, &instanceBuffer);
+		device->Release();
+		if (FAILED(hr))
+		{
+			instanceBuffer = nullptr;
+			instanceCapacity = 0;
+			return false;
+		}
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return false;
+	memcpy(mapped.pData, &instances[0], instances.size() * sizeof(InstanceData));
+	context->Unmap(instanceBuffer, 0);
+
+	UINT stride = sizeof(InstanceData);
+	UINT offset = 0;
+	context->IASetVertexBuffers(INSTANCE_INPUT_SLOT, 1, &instanceBuffer, &stride, &offset);
+	VertexBufferBinds++;
+	if (recorder)
+		recorder->RecordVertexData(INSTANCE_INPUT_SLOT, &instances[0], (unsigned int)(instances.size() * sizeof(InstanceData)), stride);
+	return true;
+}
+
+// --------------------------------------------------------
+// Per-draw constants go through the material every draw;
+// the pixel shader, material, pipeline state and geometry
+// are only bound when they change.  Materials of one bind
+// group count as the same material.
+// --------------------------------------------------------
+void D3D11CommandBackend::Submit(DrawPacket * const * packets, unsigned int count)
+{
+	SimplePixelShader* boundPixelShader = nullptr;
+	Material* boundMaterial = nullptr;
+	ID3D11Buffer* boundVertexBuffer = nullptr;
+	ID3D11Buffer* boundAttributeBuffer = nullptr;
+	unsigned int boundVertexStride = 0;
+	ID3D11Buffer* boundIndexBuffer = nullptr;
+	pipelineStates->Invalidate();
+	VertexBufferBinds = 0;
+	IndexBufferBinds = 0;
+	ZeroMemory(&Instancing, sizeof(InstancingStats));
+
+	BuildDraws(packets, count);
+	bool instancing = UploadInstances();
+
+	for (size_t d = 0; d < draws.size(); d++)
+	{
+		const Draw& draw = draws[d];
+		const DrawPacket& packet = *packets[draw.First];
+		Material* material = packet.MaterialObj;
+		SimpleVertexShader* vertexShader = material->GetVertexShader();
+		SimplePixelShader* pixelShader = material->GetPixelShader();
+		bool instanced = draw.FirstInstance != 0xffffffff;
+		if (instanced && !instancing)
+			continue;
+
+		material->SetTransforms(packet.World, packet.View->View, packet.View->Projection);
+		vertexShader->CopyAllBufferData();
+		if (recorder)
+			recorder->RecordConstants(vertexShader, DS_STAGE_VERTEX);
+
+		// Light buffers stay bound, only look up their slots again for a new shader
+		if (pixelShader != boundPixelShader)
+		{
+			boundPixelShader = pixelShader;
+			if (PixelShaderChanged)
+				PixelShaderChanged(pixelShader);
+		}
+
+		if (!boundMaterial || material->GetBindGroup() != boundMaterial->GetBindGroup())
+		{
+			boundMaterial = material;
+			material->Bind();
+			Instancing.MaterialBinds++;
+			if (recorder)
+				recorder->RecordConstants(pixelShader, DS_STAGE_PIXEL);
+		}
+
+		// The constant buffers are bound every draw as their contents move
+		VertexStreams streams = packet.AttributeBuffer ? VERTEX_STREAMS_SPLIT : VERTEX_STREAMS_INTERLEAVED;
+		if (packet.State)
+		{
+			pipelineStates->Bind(packet.State, streams);
+			vertexShader->SetConstantBuffers();
+			pixelShader->SetConstantBuffers();
+		}
+		else
+		{
+			pipelineStates->Invalidate();
+			vertexShader->SetShader();
+			pixelShader->SetShader();
+			if (instanced && streams == VERTEX_STREAMS_SPLIT)
+				context->IASetInputLayout(vertexShader->GetInputLayout(VertexFormat<InstancedSplitVertex>::Elements(), VertexFormat<InstancedSplitVertex>::ElementCount));
+			else if (instanced)
+				context->IASetInputLayout(vertexShader->GetInputLayout(VertexFormat<InstancedVertex>::Elements(), VertexFormat<InstancedVertex>::ElementCount));
+			else if (streams == VERTEX_STREAMS_SPLIT)
+				context->IASetInputLayout(vertexShader->GetInputLayout(VertexFormat<SplitVertex>::Elements(), VertexFormat<SplitVertex>::ElementCount));
+		}
+
+		if (recorder)
+		{
+			DrawStreamVertexFormat format = instanced ?
+				(streams == VERTEX_STREAMS_SPLIT ? DS_VERTEX_INSTANCED_SPLIT : DS_VERTEX_INSTANCED) :
+				(streams == VERTEX_STREAMS_SPLIT ? DS_VERTEX_SPLIT : DS_VERTEX_REFLECTED);
+			RecordMaterial(material);
+			recorder->RecordPipelineState(packet.State, vertexShader, format);
+		}
+
+		if (packet.VertexBuffer != boundVertexBuffer || packet.VertexStride != boundVertexStride)
+		{
+			boundVertexBuffer = packet.VertexBuffer;
+			boundVertexStride = packet.VertexStride;
+			UINT offset = 0;
+			context->IASetVertexBuffers(0, 1, &boundVertexBuffer, &packet.VertexStride, &offset);
+			VertexBufferBinds++;
+			if (recorder)
+				recorder->RecordVertexBuffer(0, boundVertexBuffer, packet.VertexStride, 0);
+		}
+
+		// Interleaved draws leave slot 1 alone, their layout doesn't read it
+		if (packet.AttributeBuffer && packet.AttributeBuffer != boundAttributeBuffer)
+		{
+			boundAttributeBuffer = packet.AttributeBuffer;
+			UINT stride = sizeof(VertexAttributes);
+			UINT offset = 0;
+			context->IASetVertexBuffers(1, 1, &boundAttributeBuffer, &stride, &offset);
+			VertexBufferBinds++;
+			if (recorder)
+				recorder->RecordVertexBuffer(1, boundAttributeBuffer, stride, 0);
+		}
+
+		if (packet.IndexBuffer != boundIndexBuffer)
+		{
+			boundIndexBuffer = packet.IndexBuffer;
+			context->IASetIndexBuffer(boundIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+			IndexBufferBinds++;
+			if (recorder)
+				recorder->RecordIndexBuffer(boundIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		}
+
+		if (instanced)
+		{
+			context->DrawIndexedInstanced(packet.IndexCount, draw.Count, packet.StartIndex, packet.BaseVertex, draw.FirstInstance);
+			if (recorder)
+				recorder->RecordDrawIndexedInstanced(packet.IndexCount, draw.Count, packet.StartIndex, packet.BaseVertex, draw.FirstInstance);
+		}
+		else
+		{
+			context->DrawIndexed(packet.IndexCount, packet.StartIndex, packet.BaseVertex);
+			if (recorder)
+				recorder->RecordDrawIndexed(packet.IndexCount, packet.StartIndex, packet.BaseVertex);
+		}
+
+		Instancing.Packets += draw.Count;
+		Instancing.Draws++;
+		if (draw.Count > 1)
+			Instancing.InstancedDraws++;
+	}
+}
+
+// --------------------------------------------------------
+// Records the shaders and the texture and sampler binds that
+// Material::Bind made for this draw.  The pipeline state goes
+// after it, as the shaders' binds reset the input layout.
+// --------------------------------------------------------
+void D3D11CommandBackend::RecordMaterial(Material * material)
+{
+	SimplePixelShader* pixelShader = material->GetPixelShader();
+	recorder->RecordShaders(material->GetVertexShader(), pixelShader);
+
+	const SimpleSRV* srvInfo = pixelShader->GetShaderResourceViewInfo("diffuseTexture");
+	if (srvInfo)
+		recorder->RecordTexture(DS_STAGE_PIXEL, srvInfo->BindIndex, material->GetSRV());
+
+	const SimpleSampler* samplerInfo = pixelShader->GetSamplerInfo("basicSampler");
+	if (samplerInfo)
+		recorder->RecordSampler(DS_STAGE_PIXEL, samplerInfo->BindIndex, material->GetSamplerState());
+}
+
+// --------------------------------------------------------
+// Command queue
+// --------------------------------------------------------
+CommandQueue::CommandQueue()
+{
+	ZeroMemory(&stats, sizeof(CommandQueueStats));
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+}
+
+CommandQueue::~CommandQueue()
+{
+	for (size_t i = 0; i < buffers.size(); i++)
+		delete buffers[i];
+}
+
+void CommandQueue::Record(unsigned int count, unsigned int sliceCount, const std::function<void(unsigned int, unsigned int, CommandBuffer&)>& record)
+{
+	__int64 start, recorded, end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	if (sliceCount == 0)
+		sliceCount = 1;
+	if (sliceCount > count)
+		sliceCount = count > 0 ? count : 1;
+	while (buffers.size() < sliceCount)
+		buffers.push_back(new CommandBuffer());
+
+	auto recordSlices = [&](unsigned int begin, unsigned int end)
+	{
+		for (unsigned int s = begin; s < end; s++)
+		{
+			CommandBuffer& buffer = *buffers[s];
+			buffer.Reset();
+			record(
+				(unsigned int)((unsigned long long)count * s / sliceCount),
+				(unsigned int)((unsigned long long)count * (s + 1) / sliceCount),
+				buffer);
+
+			std::vector<DrawPacket*>& packets = buffer.GetPackets();
+			std::sort(packets.begin(), packets.end(), SortKeyLess);
+		}
+	};
+
+	JobSystem* jobs = JobSystem::Instance();
+	if (jobs && sliceCount > 1)
+		jobs->ParallelFor(sliceCount, 1, recordSlices);
+	else
+		recordSlices(0, sliceCount);
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&recorded);
+	Merge(sliceCount);
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+
+	stats.Packets = (unsigned int)merged.size();
+	stats.Slices = sliceCount;
+	stats.Bytes = 0;
+	for (unsigned int s = 0; s < sliceCount; s++)
+		stats.Bytes += buffers[s]->GetBytes();
+	stats.RecordMs = (float)((recorded - start) * perfCounterSeconds * 1000.0);
+	stats.MergeMs = (float)((end - recorded) * perfCounterSeconds * 1000.0);
+}
+
+// --------------------------------------------------------
+// Bottom-up merge of the sorted slices: neighbouring runs are
+// merged pairwise until one is left
+// --------------------------------------------------------
+void CommandQueue::Merge(unsigned int sliceCount)
+{
+	merged.clear();
+	std::vector<size_t> runs;
+	for (unsigned int s = 0; s < sliceCount; s++)
+	{
+		runs.push_back(merged.size());
+		std::vector<DrawPacket*>& packets = buffers[s]->GetPackets();
+		merged.insert(merged.end(), packets.begin(), packets.end());
+	}
+	runs.push_back(merged.size());
+
+	scratch.resize(merged.size());
+	while (runs.size() > 2)
+	{
+		std::vector<size_t> mergedRuns;
+		for (size_t r = 0; r + 1 < runs.size(); r += 2)
+		{
+			mergedRuns.push_back(runs[r]);
+			size_t middle = runs[r + 1];
+			size_t last = r + 2 < runs.size() ? runs[r + 2] : middle;
+			std::merge(
+				merged.begin() + runs[r], merged.begin() + middle,
+				merged.begin() + middle, merged.begin() + last,
+				scratch.begin() + runs[r], SortKeyLess);
+		}
+		mergedRuns.push_back(merged.size());
+		merged.swap(scratch);
+		runs.swap(mergedRuns);
+	}
+}
+
+void CommandQueue::Submit(CommandBackend * backend)
+{
+	__int64 start, end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	if (!merged.empty())
+		backend->Submit(&merged[0], (unsigned int)merged.size());
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.SubmitMs = (float)((end - start) * perfCounterSeconds * 1000.0);
+}
+
+// --------------------------------------------------------
+// Records synthetic draws spread over a few states, materials
+// and meshes, so sorting and merging have real work to do.
+// Nothing is dereferenced by the null backend.
+// --------------------------------------------------------
+int RunCommandQueueBenchmark(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	unsigned int draws = 100000;
+	unsigned int passes = 20;
+
+	while (args >> arg)
+	{
+		if (arg != "--command-benchmark")
+			draws = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+	}
+
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+
+	JobSystem jobs;
+	CommandQueue queue;
+	NullCommandBackend backend;
+	DrawView view = {};
+
+	auto record = [&](unsigned int begin, unsigned int end, CommandBuffer& buffer)
+	{
+		for (unsigned int i = begin; i < end; i++)
+		{
+			// Scatter the keys so every slice holds every state
+			unsigned int hash = i * 2654435761u;
+			unsigned int state = hash >> 28;
+			unsigned int material = (hash >> 16) & 0xff;
+			unsigned int mesh = hash & 0x3f;
+
+			DrawPacket* packet = buffer.AddDraw();
+			packet->SortKey = MakeDrawSortKey(state, material, mesh, i);
+			packet->State = (const PipelineState*)(size_t)(state + 1);
+			packet->MaterialObj = (Material*)(size_t)(material + 1);
+			packet->View = &view;
+			packet->VertexBuffer = (ID3D11Buffer*)(size_t)(mesh + 1);
+			packet->AttributeBuffer = nullptr;
+			packet->IndexBuffer = packet->VertexBuffer;
+			packet->VertexStride = sizeof(Vertex);
+			packet->IndexCount = 36;
+			packet->StartIndex = 0;
+			packet->BaseVertex = 0;
+			XMStoreFloat4x4(&packet->World, XMMatrixTranspose(XMMatrixTranslation((float)(i & 255), (float)(i >> 8), 0.0f)));
+		}
+	};
+
+	// Whatever the slicing, the merged list must be the one a
+	// single sort of every packet gives
+	std::vector<unsigned long long> expectedKeys(draws);
+	for (unsigned int i = 0; i < draws; i++)
+	{
+		unsigned int hash = i * 2654435761u;
+		expectedKeys[i] = MakeDrawSortKey(hash >> 28, (hash >> 16) & 0xff, hash & 0x3f, i);
+	}
+	std::sort(expectedKeys.begin(), expectedKeys.end());
+
+	std::ostringstream report;
+	report << draws << " draws, " << passes << " passes, " << jobs.GetThreadCount() << " threads (headless)\n";
+	bool ordered = true;
+	for (unsigned int slices = 1; slices <= jobs.GetThreadCount(); slices *= 2)
+	{
+		// One untimed pass keeping the packets, to check the merge
+		NullCommandBackend checker(true);
+		queue.Record(draws, slices, record);
+		queue.Submit(&checker);
+
+		bool sliceOrdered = checker.Submitted.size() == draws;
+		for (unsigned int i = 0; sliceOrdered && i < draws; i++)
+		{
+			if (checker.Submitted[i].SortKey != expectedKeys[i] ||
+				(i > 0 && checker.Submitted[i].SortKey < checker.Submitted[i - 1].SortKey))
+				sliceOrdered = false;
+		}
+		if (!sliceOrdered)
+		{
+			char line[128];
+			sprintf_s(line, "%2u slices: %u packets submitted, merge order FAILED\n", slices, (unsigned int)checker.Submitted.size());
+			report << line;
+			ordered = false;
+		}
+
+		double recordMs = 0.0, mergeMs = 0.0, submitMs = 0.0;
+		for (unsigned int p = 0; p < passes; p++)
+		{
+			queue.Record(draws, slices, record);
+			queue.Submit(&backend);
+			recordMs += queue.GetStats().RecordMs;
+			mergeMs += queue.GetStats().MergeMs;
+			submitMs += queue.GetStats().SubmitMs;
+		}
+
+		char line[256];
+		sprintf_s(line, "%2u slices: record %.3fms  merge %.3fms  submit %.3fms  total %.3fms\n",
+			slices, recordMs / passes, mergeMs / passes, submitMs / passes, (recordMs + mergeMs + submitMs) / passes);
+		report << line;
+	}
+
+	report << (ordered ? "merge order: every slice count matches a single sort\n" : "merge order: FAILED\n");
+
+	printf("%s", report.str().c_str());
+	std::ofstream results("command_benchmark.results.txt", std::ios::app);
+	results << report.str();
+	return ordered ? 0 : 1;
+}
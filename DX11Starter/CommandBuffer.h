@@ -0,0 +1,249 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Material.h"
+#include "PipelineState.h"
+#include "DrawStream.h"
+
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Camera constants shared by every draw of one view,
+// transposed for HLSL
+// --------------------------------------------------------
+struct DrawView
+{
+	XMFLOAT4X4 View;
+	XMFLOAT4X4 Projection;
+};
+
+// --------------------------------------------------------
+// Everything one draw needs, with no reference to what was
+// drawn before it.  Sorted by SortKey before submission.
+// --------------------------------------------------------
+struct DrawPacket
+{
+	unsigned long long SortKey;
+	const PipelineState* State;		// Null to bind the material's shaders directly
+	Material* MaterialObj;
+	const DrawView* View;
+	ID3D11Buffer* VertexBuffer;		// Positions only if there's an attribute buffer
+	ID3D11Buffer* AttributeBuffer;	// Slot 1 of split stream meshes, null for interleaved
+	ID3D11Buffer* IndexBuffer;
+	unsigned int VertexStride;
+	unsigned int IndexCount;
+	unsigned int StartIndex;
+	int BaseVertex;
+	XMFLOAT4X4 World;				// Transposed for HLSL
+};
+
+// Orders by pipeline state (16 bits), then material bind group
+// (16 bits), then mesh (12 bits), so draws that can share an
+// instanced draw end up next to each other, then submission
+// order (20 bits)
+inline unsigned long long MakeDrawSortKey(unsigned int stateId, unsigned int materialId, unsigned int meshId, unsigned int order)
+{
+	return
+		((unsigned long long)(stateId & 0xffff) << 48) |
+		((unsigned long long)(materialId & 0xffff) << 32) |
+		((unsigned long long)(meshId & 0xfff) << 20) |
+		(unsigned long long)(order & 0xfffff);
+}
+
+// --------------------------------------------------------
+// Draw packets recorded by one thread
+//
+// Packets live in chunks of a linear allocator that is reset,
+// not freed, every frame, so recording allocates nothing once
+// the chunks have grown to the frame's size.  Packet pointers
+// stay valid until the next Reset().
+// --------------------------------------------------------
+class CommandBuffer
+{
+public:
+	CommandBuffer(unsigned int chunkSize = 64 * 1024);
+	~CommandBuffer();
+
+	// Forgets every packet, keeping the memory
+	void Reset();
+
+	// A new packet to fill in
+	DrawPacket* AddDraw();
+
+	std::vector<DrawPacket*>& GetPackets() { return packets; }
+	unsigned int GetPacketCount() const { return (unsigned int)packets.size(); }
+
+	// Bytes of chunk memory in use
+	unsigned int GetBytes() const;
+
+private:
+	struct Chunk
+	{
+		unsigned char* Memory;
+		unsigned int Used;
+	};
+
+	unsigned int chunkSize;
+	std::vector<Chunk> chunks;
+	unsigned int currentChunk;
+	std::vector<DrawPacket*> packets;
+
+	void* Allocate(unsigned int size, unsigned int alignment);
+};
+
+// --------------------------------------------------------
+// Where merged packets get translated to API calls
+// --------------------------------------------------------
+class CommandBackend
+{
+public:
+	virtual ~CommandBackend() { }
+
+	// Submits count packets in order, as one pass
+	virtual void Submit(DrawPacket* const* packets, unsigned int count) = 0;
+};
+
+// --------------------------------------------------------
+// Headless backend: walks the packets, counting the state
+// changes a real backend would make, and optionally keeps a
+// copy of every packet so tests can check the order (the
+// --command-benchmark checks the merge with it)
+// --------------------------------------------------------
+class NullCommandBackend : public CommandBackend
+{
+public:
+	NullCommandBackend(bool keepPackets = false);
+
+	void Submit(DrawPacket* const* packets, unsigned int count);
+
+	bool KeepPackets;
+	std::vector<DrawPacket> Submitted;
+	unsigned int Draws;
+	unsigned int StateChanges;
+	unsigned long long Indices;
+};
+
+// --------------------------------------------------------
+// Draw calls of the last Submit()
+// --------------------------------------------------------
+struct InstancingStats
+{
+	unsigned int Packets;
+	unsigned int Draws;				// API draw calls
+	unsigned int InstancedDraws;	// Draws covering more than one packet
+	unsigned int MaterialBinds;		// Texture and sampler table binds
+};
+
+// --------------------------------------------------------
+// D3D11 backend: binds through PipelineStateCache, Material
+// and SimpleShader, skipping whatever matches the previous
+// packet.  Packets whose vertex shader reads per-instance
+// data become instanced draws, with their world matrix and
+// texture slice in an instance buffer written once per
+// Submit().
+// --------------------------------------------------------
+class D3D11CommandBackend : public CommandBackend
+{
+public:
+	D3D11CommandBackend(ID3D11DeviceContext* context, PipelineStateCache* pipelineStates);
+	~D3D11CommandBackend();
+
+	void Submit(DrawPacket* const* packets, unsigned int count);
+
+	// Called when a packet uses a different pixel shader than
+	// the last one, before its material is bound
+	std::function<void(SimplePixelShader*)> PixelShaderChanged;
+
+	// Every translated call is also recorded while set
+	void SetRecorder(DrawStreamRecorder* recorder) { this->recorder = recorder; }
+
+	// Geometry binds of the last Submit()
+	unsigned int VertexBufferBinds;
+	unsigned int IndexBufferBinds;
+	InstancingStats Instancing;
+
+private:
+	// Packets [First, First + Count) drawn by one call
+	struct Draw
+	{
+		unsigned int First;
+		unsigned int Count;
+		unsigned int FirstInstance;		// In the instance buffer, -1 if not instanced
+	};
+
+	ID3D11DeviceContext* context;
+	PipelineStateCache* pipelineStates;
+	DrawStreamRecorder* recorder;
+
+	std::vector<Draw> draws;
+	std::vector<InstanceData> instances;
+	ID3D11Buffer* instanceBuffer;
+	unsigned int instanceCapacity;
+
+	void BuildDraws(DrawPacket* const* packets, unsigned int count);
+	bool UploadInstances();
+
+	void RecordMaterial(Material* material);
+};
+
+// --------------------------------------------------------
+// Timings of the last frame's draw packets
+// --------------------------------------------------------
+struct CommandQueueStats
+{
+	unsigned int Packets;
+	unsigned int Slices;		// Command buffers recorded in parallel
+	unsigned int Bytes;
+	float RecordMs;				// Recording and sorting each slice
+	float MergeMs;
+	float SubmitMs;
+};
+
+// --------------------------------------------------------
+// Records draws in parallel and submits them in order
+//
+// The draw list is split into slices, each recorded into its
+// own CommandBuffer and sorted by the JobSystem.  The sorted
+// slices are then merged into one list, which a single thread
+// hands to a backend.  Recording only reads shared data, so
+// the only API calls are made during Submit().
+// --------------------------------------------------------
+class CommandQueue
+{
+public:
+	CommandQueue();
+	~CommandQueue();
+
+	// Calls record(begin, end, buffer) over slices of [0, count),
+	// at most sliceCount of them, on worker threads, then sorts
+	// and merges the packets
+	void Record(unsigned int count, unsigned int sliceCount, const std::function<void(unsigned int, unsigned int, CommandBuffer&)>& record);
+
+	// Hands the merged packets to a backend
+	void Submit(CommandBackend* backend);
+
+	const std::vector<DrawPacket*>& GetPackets() const { return merged; }
+	const CommandQueueStats& GetStats() const { return stats; }
+
+private:
+	std::vector<CommandBuffer*> buffers;
+	std::vector<DrawPacket*> merged;
+	std::vector<DrawPacket*> scratch;
+	CommandQueueStats stats;
+	double perfCounterSeconds;
+
+	void Merge(unsigned int sliceCount);
+};
+
+// --------------------------------------------------------
+// Command line benchmark of recording, merging and headless
+// submission with an increasing number of slices:
+//   --command-benchmark [draws]
+//
+// Returns the process exit code, 1 if a slice count's merged
+// packets differ from a single sorted list
+// --------------------------------------------------------
+int RunCommandQueueBenchmark(const std::string& commandLine);
@@ -0,0 +1,276 @@
+#include "ConstantBufferRing.h"
+#include <thread>
+
+ConstantBufferRing* ConstantBufferRing::instance;
+
+ConstantBufferRing::ConstantBufferRing(ID3D11Device * device, ID3D11DeviceContext * context, unsigned int ringSize)
+	: ring(ringSize, 256)
+{
+	instance = this;
+	this->device = device;
+	this->context = context;
+	context1 = nullptr;
+	ringBuffer = nullptr;
+	offsetBinding = false;
+	ringMapped = false;
+	ZeroMemory(&stats, sizeof(ConstantBufferStats));
+
+	for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		frameQueries[i] = nullptr;
+		queryFrames[i] = 0;
+	}
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+
+	// Offset binding needs the 11.1 runtime and driver support for
+	// both offsetting and NO_OVERWRITE on dynamic constant buffers
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting ||
+		!options.MapNoOverwriteOnDynamicConstantBuffer)
+		return;
+
+	if (FAILED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&context1)))
+		return;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = ringSize;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(device->CreateBuffer(&desc, 0, &ringBuffer)))
+		return;
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		if (FAILED(device->CreateQuery(&queryDesc, &frameQueries[i])))
+			return;
+	}
+
+	offsetBinding = true;
+}
+
+
+ConstantBufferRing::~ConstantBufferRing()
+{
+	for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		if (frameQueries[i]) { frameQueries[i]->Release(); }
+	}
+
+	for (std::unordered_map<unsigned int, BufferPool>::iterator it = pools.begin(); it != pools.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.Buffers.size(); i++)
+			it->second.Buffers[i]->Release();
+	}
+
+	if (ringBuffer) { ringBuffer->Release(); }
+	if (context1) { context1->Release(); }
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+ConstantBufferRing * ConstantBufferRing::Instance()
+{
+	return instance;
+}
+
+// --------------------------------------------------------
+// Retires every frame the GPU has finished, without waiting
+// --------------------------------------------------------
+void ConstantBufferRing::BeginFrame()
+{
+	while (offsetBinding && ring.HasFramesInFlight() && IsFrameDone(ring.GetOldestFrame(), false))
+		ring.Retire(ring.GetOldestFrame());
+
+	for (std::unordered_map<unsigned int, BufferPool>::iterator it = pools.begin(); it != pools.end(); ++it)
+		it->second.Next = 0;
+
+	stats.Uploads = 0;
+	stats.BytesUploaded = 0;
+	stats.WrapStalls = 0;
+	stats.StallMs = 0.0f;
+	stats.OffsetBinding = offsetBinding;
+}
+
+// --------------------------------------------------------
+// Closes the frame and queues an event query behind it
+// --------------------------------------------------------
+void ConstantBufferRing::EndFrame()
+{
+	unsigned long long frame = ring.EndFrame();
+	if (!offsetBinding)
+	{
+		ring.Retire(frame);
+		return;
+	}
+
+	// The query slot may still belong to an older frame
+	unsigned int slot = (unsigned int)(frame % MAX_FRAMES_IN_FLIGHT);
+	if (queryFrames[slot] != 0 && ring.HasFramesInFlight() && ring.GetOldestFrame() <= queryFrames[slot])
+	{
+		IsFrameDone(queryFrames[slot], true);
+		ring.Retire(queryFrames[slot]);
+	}
+
+	context->End(frameQueries[slot]);
+	queryFrames[slot] = frame;
+}
+
+ConstantBufferAllocation ConstantBufferRing::Upload(const void * data, unsigned int size)
+{
+	stats.Uploads++;
+	return offsetBinding ? UploadToRing(data, size) : UploadToPool(data, size);
+}
+
+bool ConstantBufferRing::IsCurrent(const ConstantBufferAllocation & allocation) const
+{
+	return allocation.Buffer && allocation.Frame == ring.GetCurrentFrame();
+}
+
+void ConstantBufferRing::Bind(ConstantBufferStage stage, unsigned int slot, const ConstantBufferAllocation & allocation)
+{
+	if (allocation.NumConstants > 0 && context1)
+	{
+		switch (stage)
+		{
+		case CB_STAGE_VERTEX:	context1->VSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		case CB_STAGE_HULL:		context1->HSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		case CB_STAGE_DOMAIN:	context1->DSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		case CB_STAGE_GEOMETRY:	context1->GSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		case CB_STAGE_PIXEL:	context1->PSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		case CB_STAGE_COMPUTE:	context1->CSSetConstantBuffers1(slot, 1, &allocation.Buffer, &allocation.FirstConstant, &allocation.NumConstants); break;
+		}
+		return;
+	}
+
+	switch (stage)
+	{
+	case CB_STAGE_VERTEX:	context->VSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	case CB_STAGE_HULL:		context->HSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	case CB_STAGE_DOMAIN:	context->DSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	case CB_STAGE_GEOMETRY:	context->GSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	case CB_STAGE_PIXEL:	context->PSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	case CB_STAGE_COMPUTE:	context->CSSetConstantBuffers(slot, 1, &allocation.Buffer); break;
+	}
+}
+
+// --------------------------------------------------------
+// Checks a frame's event query
+//
+// wait - Spin until the GPU gets there instead of returning false
+// --------------------------------------------------------
+bool ConstantBufferRing::IsFrameDone(unsigned long long frame, bool wait)
+{
+	unsigned int slot = (unsigned int)(frame % MAX_FRAMES_IN_FLIGHT);
+
+	// Slot was reused, so the frame finished long ago
+	if (queryFrames[slot] != frame)
+		return true;
+
+	while (true)
+	{
+		BOOL done = FALSE;
+		HRESULT hr = context->GetData(frameQueries[slot], &done, sizeof(BOOL), wait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH);
+		if (hr == S_OK && done)
+			return true;
+		if (FAILED(hr) || !wait)
+			return false;
+
+		std::this_thread::yield();
+	}
+}
+
+// --------------------------------------------------------
+// Suballocates from the ring.  When it's full, waits for the
+// oldest frame in flight (a wraparound stall).
+// --------------------------------------------------------
+ConstantBufferAllocation ConstantBufferRing::UploadToRing(const void * data, unsigned int size)
+{
+	unsigned int offset = ring.Allocate(size);
+	if (offset == RingAllocator::INVALID_OFFSET)
+	{
+		__int64 start, end;
+		QueryPerformanceCounter((LARGE_INTEGER*)&start);
+		stats.WrapStalls++;
+
+		while (offset == RingAllocator::INVALID_OFFSET && ring.HasFramesInFlight())
+		{
+			IsFrameDone(ring.GetOldestFrame(), true);
+			ring.Retire(ring.GetOldestFrame());
+			offset = ring.Allocate(size);
+		}
+
+		QueryPerformanceCounter((LARGE_INTEGER*)&end);
+		stats.StallMs += (float)((end - start) * perfCounterSeconds * 1000.0);
+
+		// A single frame bigger than the ring spills into the pools
+		if (offset == RingAllocator::INVALID_OFFSET)
+			return UploadToPool(data, size);
+	}
+
+	// The first map has to discard, after that nothing in use is ever written
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(ringBuffer, 0, ringMapped ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return UploadToPool(data, size);
+	memcpy((unsigned char*)mapped.pData + offset, data, size);
+	context->Unmap(ringBuffer, 0);
+	ringMapped = true;
+
+	unsigned int alignedSize = (size + 255) & ~255u;
+	stats.BytesUploaded += alignedSize;
+
+	ConstantBufferAllocation allocation;
+	allocation.Buffer = ringBuffer;
+	allocation.FirstConstant = offset / 16;
+	allocation.NumConstants = alignedSize / 16;
+	allocation.Frame = ring.GetCurrentFrame();
+	return allocation;
+}
+
+// --------------------------------------------------------
+// Uses the next free dynamic buffer of this size, creating
+// one if every buffer of the pool was already used this frame
+// --------------------------------------------------------
+ConstantBufferAllocation ConstantBufferRing::UploadToPool(const void * data, unsigned int size)
+{
+	ConstantBufferAllocation allocation = {};
+	unsigned int bufferSize = (size + 15) & ~15u;
+	BufferPool& pool = pools[bufferSize];
+
+	if (pool.Next == pool.Buffers.size())
+	{
+		D3D11_BUFFER_DESC desc = {};
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.ByteWidth = bufferSize;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		ID3D11Buffer* buffer = nullptr;
+		if (FAILED(device->CreateBuffer(&desc, 0, &buffer)))
+			return allocation;
+
+		pool.Buffers.push_back(buffer);
+		stats.PooledBuffers++;
+	}
+
+	ID3D11Buffer* buffer = pool.Buffers[pool.Next];
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return allocation;
+	memcpy(mapped.pData, data, size);
+	context->Unmap(buffer, 0);
+	pool.Next++;
+
+	stats.BytesUploaded += bufferSize;
+
+	allocation.Buffer = buffer;
+	allocation.Frame = ring.GetCurrentFrame();
+	return allocation;
+}
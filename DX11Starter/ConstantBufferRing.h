@@ -0,0 +1,110 @@
+#pragma once
+#include <d3d11_1.h>
+#include <unordered_map>
+#include <vector>
+#include "RingAllocator.h"
+
+// --------------------------------------------------------
+// Where a constant buffer's current contents live on the GPU.
+// NumConstants is 0 when the whole buffer is bound.
+// --------------------------------------------------------
+struct ConstantBufferAllocation
+{
+	ID3D11Buffer* Buffer;
+	unsigned int FirstConstant;		// In 16 byte constants
+	unsigned int NumConstants;
+	unsigned long long Frame;		// Only valid during this frame
+};
+
+enum ConstantBufferStage
+{
+	CB_STAGE_VERTEX,
+	CB_STAGE_HULL,
+	CB_STAGE_DOMAIN,
+	CB_STAGE_GEOMETRY,
+	CB_STAGE_PIXEL,
+	CB_STAGE_COMPUTE
+};
+
+// --------------------------------------------------------
+// Per-frame statistics of constant buffer uploads
+// --------------------------------------------------------
+struct ConstantBufferStats
+{
+	unsigned int Uploads;
+	unsigned int BytesUploaded;		// Including 256 byte alignment
+	unsigned int WrapStalls;		// Times the ring was full and had to wait for the GPU
+	float StallMs;
+	unsigned int PooledBuffers;		// Dynamic buffers in the fallback pools
+	bool OffsetBinding;				// Ring with offset binding, or pooled fallback
+};
+
+// --------------------------------------------------------
+// Per-frame constant buffer memory
+//
+// With D3D 11.1 constant buffer offsetting, every upload is
+// a 256 byte aligned slice of one large dynamic buffer, written
+// with MAP_WRITE_NO_OVERWRITE and bound with *SetConstantBuffers1.
+// An event query per frame tells when the GPU is done with a
+// frame's slices.  Without offsetting, uploads go to pooled
+// dynamic buffers of the same size, each used once per frame
+// with MAP_WRITE_DISCARD.
+// --------------------------------------------------------
+class ConstantBufferRing
+{
+	static ConstantBufferRing* instance;
+
+public:
+	static const unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+
+	ConstantBufferRing(ID3D11Device* device, ID3D11DeviceContext* context, unsigned int ringSize = 4 * 1024 * 1024);
+	~ConstantBufferRing();
+	static ConstantBufferRing* Instance();
+
+	// Frees the memory of frames the GPU has finished
+	void BeginFrame();
+
+	// Marks the end of this frame's uploads
+	void EndFrame();
+
+	// Copies size bytes of constants to GPU memory for this frame
+	ConstantBufferAllocation Upload(const void* data, unsigned int size);
+
+	// True if the allocation was made this frame and its memory is still valid
+	bool IsCurrent(const ConstantBufferAllocation& allocation) const;
+
+	// Binds an allocation (or a whole buffer, if NumConstants is 0) to a stage
+	void Bind(ConstantBufferStage stage, unsigned int slot, const ConstantBufferAllocation& allocation);
+
+	const ConstantBufferStats& GetStats() const { return stats; }
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	ID3D11DeviceContext1* context1;
+
+	// Ring path
+	RingAllocator ring;
+	ID3D11Buffer* ringBuffer;
+	bool offsetBinding;
+	bool ringMapped;
+
+	// Event queries of frames in flight, by frame id
+	ID3D11Query* frameQueries[MAX_FRAMES_IN_FLIGHT];
+	unsigned long long queryFrames[MAX_FRAMES_IN_FLIGHT];
+
+	// Fallback path, per size pools used round robin each frame
+	struct BufferPool
+	{
+		std::vector<ID3D11Buffer*> Buffers;
+		unsigned int Next;
+	};
+	std::unordered_map<unsigned int, BufferPool> pools;
+
+	ConstantBufferStats stats;
+	double perfCounterSeconds;
+
+	bool IsFrameDone(unsigned long long frame, bool wait);
+	ConstantBufferAllocation UploadToRing(const void* data, unsigned int size);
+	ConstantBufferAllocation UploadToPool(const void* data, unsigned int size);
+};
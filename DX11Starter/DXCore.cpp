@@ -1,7 +1,16 @@
 #include "DXCore.h"
 
 #include <WindowsX.h>
+#include <mmsystem.h>
 #include <sstream>
+#include <math.h>
+
+#pragma comment(lib, "winmm.lib")
+
+// Older SDKs don't know the high resolution timer flag (Windows 10 1803+)
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 
 // Define the static instance variable so our OS-level 
 // message handling function below can talk to our object
@@ -57,6 +66,31 @@ DXCore::DXCore(
 	backBufferRTV = 0;
 	depthStencilView = 0;
 
+	// 60 simulation steps per second, uncapped frame rate
+	fixedTimeStep = 1.0f / 60.0f;
+	maxStepsPerFrame = 8;
+	pendingSteps = 0;
+	simulationStep = 0;
+	interpolation = 0.0f;
+	accumulator = 0.0f;
+
+	frameRateCap = 0.0f;
+	backgroundFrameRate = 10.0f;
+	windowActive = true;
+	windowMinimized = false;
+	nextFrameTime = 0;
+
+	// A high resolution waitable timer sleeps to within a fraction
+	// of a millisecond; older Windows versions get a regular timer
+	// and a 1ms scheduler period instead
+	pacingTimer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	pacingTimerHighResolution = pacingTimer != NULL;
+	if (!pacingTimer)
+	{
+		pacingTimer = CreateWaitableTimer(NULL, TRUE, NULL);
+		timeBeginPeriod(1);
+	}
+
 	// Query performance counter for accurate timing information
 	__int64 perfFreq;
 	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
@@ -75,6 +109,9 @@ DXCore::~DXCore()
 	if (swapChain) { swapChain->Release();}
 	if (context) { context->Release();}
 	if (device) { device->Release();}
+
+	if (pacingTimer) { CloseHandle(pacingTimer); }
+	if (!pacingTimerHighResolution) { timeEndPeriod(1); }
 }
 
 // --------------------------------------------------------
@@ -372,9 +409,13 @@ HRESULT DXCore::Run()
 			if(titleBarStats)
 				UpdateTitleBarStats();
 
-			// The game loop
-			Update(deltaTime, totalTime);
+			// The game loop: as many fixed steps as the elapsed
+			// time allows, one interpolated frame, then wait until
+			// the next frame is due
+			AccumulateSteps();
+			StepSimulation();
 			Draw(deltaTime, totalTime);
+			PaceFrame();
 		}
 	}
 
@@ -385,14 +426,108 @@ HRESULT DXCore::Run()
 
 
 // --------------------------------------------------------
-// Sends an OS-level Quit message to our process, which
-// will be handled by our message processing function
+// Asks the window to close, which ends in an OS-level Quit
+// message handled by our message processing function.
+// Posting to the window (not the thread) makes this safe to
+// call from a worker thread.
 // --------------------------------------------------------
 void DXCore::Quit()
 {
-	PostQuitMessage(0);
+	PostMessage(hWnd, WM_CLOSE, 0, 0);
+}
+
+
+void DXCore::SetFrameRateCap(float framesPerSecond)
+{
+	frameRateCap = framesPerSecond;
+}
+
+void DXCore::SetBackgroundFrameRate(float framesPerSecond)
+{
+	backgroundFrameRate = framesPerSecond;
+}
+
+// --------------------------------------------------------
+// Calls Update() once for each step of this frame, with the
+// fixed step as the delta and the simulated (not real) time
+// --------------------------------------------------------
+void DXCore::StepSimulation()
+{
+	for (unsigned int i = 0; i < pendingSteps; i++)
+	{
+		simulationStep++;
+		Update(fixedTimeStep, (float)(simulationStep * (double)fixedTimeStep));
+	}
+}
+
+// --------------------------------------------------------
+// Adds this frame's time to the accumulator and takes as many
+// whole steps out of it as fit.  Long hitches (and time spent
+// in the debugger) are dropped rather than simulated.
+// --------------------------------------------------------
+void DXCore::AccumulateSteps()
+{
+	accumulator += min(deltaTime, 0.25f);
+
+	pendingSteps = 0;
+	while (accumulator >= fixedTimeStep && pendingSteps < maxStepsPerFrame)
+	{
+		accumulator -= fixedTimeStep;
+		pendingSteps++;
+	}
+
+	if (accumulator >= fixedTimeStep)
+		accumulator = fmodf(accumulator, fixedTimeStep);
+
+	interpolation = accumulator / fixedTimeStep;
 }
 
+// --------------------------------------------------------
+// Waits for the next frame slot of the current frame rate cap
+//
+// Most of the wait sleeps on the waitable timer, the last
+// fraction of a millisecond (or two, with a regular timer)
+// spins on the performance counter for accuracy.  Frames are
+// scheduled on a fixed grid, so a late frame doesn't push the
+// following ones back; a frame later than a whole interval
+// restarts the grid.
+// --------------------------------------------------------
+void DXCore::PaceFrame()
+{
+	float cap = (windowActive && !windowMinimized) ? frameRateCap : backgroundFrameRate;
+	if (cap <= 0.0f)
+	{
+		nextFrameTime = 0;
+		return;
+	}
+
+	__int64 interval = (__int64)(1.0 / (cap * perfCounterSeconds));
+	__int64 now;
+	QueryPerformanceCounter((LARGE_INTEGER*)&now);
+
+	if (nextFrameTime == 0 || now - nextFrameTime > interval)
+		nextFrameTime = now;
+	nextFrameTime += interval;
+
+	__int64 spinTicks = (__int64)((pacingTimerHighResolution ? 0.0005 : 0.002) / perfCounterSeconds);
+	__int64 remaining = nextFrameTime - now;
+	if (pacingTimer && remaining > spinTicks)
+	{
+		// Relative due time, in 100ns units
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -(__int64)((remaining - spinTicks) * perfCounterSeconds * 10000000.0);
+		if (SetWaitableTimer(pacingTimer, &dueTime, 0, NULL, NULL, FALSE))
+			WaitForSingleObject(pacingTimer, INFINITE);
+	}
+
+	while (true)
+	{
+		QueryPerformanceCounter((LARGE_INTEGER*)&now);
+		if (now >= nextFrameTime)
+			break;
+		YieldProcessor();
+	}
+}
 
 // --------------------------------------------------------
 // Uses high resolution time stamps to get very accurate
@@ -535,6 +670,9 @@ LRESULT DXCore::ProcessMessage(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 
 	// Sent when the window size changes
 	case WM_SIZE:
+		// Minimized windows are throttled to the background rate
+		windowMinimized = wParam == SIZE_MINIMIZED;
+
 		// Save the new client area dimensions.
 		width = LOWORD(lParam);
 		height = HIWORD(lParam);
@@ -546,6 +684,11 @@ LRESULT DXCore::ProcessMessage(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 
 		return 0;
 
+	// The app gains or loses focus, unfocused it's throttled
+	case WM_ACTIVATEAPP:
+		windowActive = wParam != FALSE;
+		return 0;
+
 	// Mouse button being pressed (while the cursor is currently over our window)
 	case WM_LBUTTONDOWN:
 	case WM_MBUTTONDOWN:
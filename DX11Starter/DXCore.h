@@ -37,12 +37,23 @@ public:
 	HRESULT Run();				
 	void Quit();
 	virtual void OnResize();
+
+	// Frame pacing: frames per second while focused and while in
+	// the background or minimized, 0 for no cap
+	void SetFrameRateCap(float framesPerSecond);
+	void SetBackgroundFrameRate(float framesPerSecond);
 	
 	// Pure virtual methods for setup and game functionality
+	//  - Update() is one fixed simulation step (see fixedTimeStep)
+	//  - Draw() is once per frame, with real time
 	virtual void Init()										= 0;
 	virtual void Update(float deltaTime, float totalTime)	= 0;
 	virtual void Draw(float deltaTime, float totalTime)		= 0;
 
+	// Runs this frame's fixed steps by calling Update() for each.
+	// Override to run them elsewhere (e.g. on a worker thread).
+	virtual void StepSimulation();
+
 	// Convenience methods for handling mouse input, since we
 	// can easily grab mouse input from OS-level messages
 	virtual void OnMouseDown (WPARAM buttonState, int x, int y) { }
@@ -72,6 +83,16 @@ protected:
 	// Helper function for allocating a console window
 	void CreateConsoleWindow(int bufferLines, int bufferColumns, int windowLines, int windowColumns);
 
+	// Fixed timestep simulation.  Real time is accumulated and
+	// spent in whole steps, so the simulation is independent of
+	// the frame rate; rendering interpolates between the last
+	// two steps by the leftover fraction.
+	float fixedTimeStep;				// Seconds per Update()
+	unsigned int maxStepsPerFrame;		// Catch-up limit after a hitch, the rest is dropped
+	unsigned int pendingSteps;			// Steps StepSimulation() runs this frame
+	unsigned long long simulationStep;	// Steps run so far
+	float interpolation;				// [0, 1) from the last step towards the next one
+
 private:
 	// Timing related data
 	double perfCounterSeconds;
@@ -85,7 +106,21 @@ private:
 	int fpsFrameCount;
 	float fpsTimeElapsed;
 	
+	// Fixed timestep
+	float accumulator;			// Real time not yet simulated
+
+	// Frame pacing
+	float frameRateCap;
+	float backgroundFrameRate;
+	bool windowActive;
+	bool windowMinimized;
+	__int64 nextFrameTime;		// Performance counter value the next frame may start at
+	HANDLE pacingTimer;
+	bool pacingTimerHighResolution;
+	
 	void UpdateTimer();			// Updates the timer for this frame
 	void UpdateTitleBarStats();	// Puts debug info in the title bar
+	void AccumulateSteps();		// Turns this frame's time into fixed steps
+	void PaceFrame();			// Waits until the next frame is due
 };
 
@@ -0,0 +1,30 @@
+
+// Same transforms as VertexShader.hlsl, so both write the same depth
+cbuffer externalData : register(b0)
+{
+	matrix world;
+	matrix view;
+	matrix projection;
+};
+
+// Only the position is read, so split stream meshes bind
+// nothing but their 12 byte position stream
+struct VertexShaderInput
+{
+	float3 position		: POSITION;
+};
+
+// --------------------------------------------------------
+// Depth-only pass: no pixel shader is bound, so this is all
+// that runs per vertex.  The position must be computed exactly
+// like the scene's vertex shader does, or the scene pass will
+// fail its depth test against the prepass.  Both shaders use
+// the same expression and mark it precise, so the compiler
+// can't reorder or fuse it differently in either.
+// --------------------------------------------------------
+float4 main(VertexShaderInput input) : SV_POSITION
+{
+	matrix worldViewProj = mul(mul(world, view), projection);
+	precise float4 position = mul(float4(input.position, 1.0f), worldViewProj);
+	return position;
+}
@@ -0,0 +1,1165 @@
+#include "DrawStream.h"
+#include "PipelineState.h"
+#include <fstream>
+#include <sstream>
+#include <cfloat>
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ RECORDER ------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+DrawStreamRecorder::DrawStreamRecorder(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	this->device = device;
+	this->context = context;
+	drawCount = 0;
+}
+
+
+DrawStreamRecorder::~DrawStreamRecorder()
+{
+}
+
+void DrawStreamRecorder::Begin()
+{
+	shaderIds.clear();
+	bufferIds.clear();
+	textureIds.clear();
+	samplerIds.clear();
+	shaderHeaders.clear();
+	shaderData.clear();
+	bufferHeaders.clear();
+	bufferData.clear();
+	pipelineStates.clear();
+	commands.clear();
+	drawCount = 0;
+}
+
+void DrawStreamRecorder::RecordShaders(SimpleVertexShader * vertexShader, SimplePixelShader * pixelShader)
+{
+	unsigned int vs = GetShaderId(vertexShader, DS_STAGE_VERTEX);
+	unsigned int ps = GetShaderId(pixelShader, DS_STAGE_PIXEL);
+
+	commands.push_back(DS_SET_SHADERS);
+	Write(vs);
+	Write(ps);
+}
+
+void DrawStreamRecorder::RecordPipelineState(const PipelineState * state, SimpleVertexShader * vertexShader, DrawStreamVertexFormat format)
+{
+	DrawStreamPipelineState recorded;
+	ZeroMemory(&recorded, sizeof(DrawStreamPipelineState));
+	recorded.VertexShader = GetShaderId(vertexShader, DS_STAGE_VERTEX);
+	recorded.VertexFormat = format;
+
+	if (state)
+	{
+		recorded.Topology = state->GetTopology();
+		state->GetBlendState()->GetDesc(&recorded.Blend);
+		state->GetRasterizerState()->GetDesc(&recorded.Rasterizer);
+		state->GetDepthStencilState()->GetDesc(&recorded.DepthStencil);
+	}
+	else
+	{
+		PipelineStateDesc defaults;
+		defaults.SetDefaults();
+		recorded.Topology = defaults.Topology;
+		recorded.Blend = defaults.Blend;
+		recorded.Rasterizer = defaults.Rasterizer;
+		recorded.DepthStencil = defaults.DepthStencil;
+	}
+
+	unsigned int id = 0;
+	while (id < pipelineStates.size() && memcmp(&pipelineStates[id], &recorded, sizeof(DrawStreamPipelineState)) != 0)
+		id++;
+	if (id == pipelineStates.size())
+		pipelineStates.push_back(recorded);
+
+	commands.push_back(DS_SET_PIPELINE_STATE);
+	Write(id);
+}
+
+// --------------------------------------------------------
+// Records the contents of all of a shader's constant buffers,
+// the equivalent of CopyAllBufferData()
+// --------------------------------------------------------
+void DrawStreamRecorder::RecordConstants(ISimpleShader * shader, DrawStreamStage stage)
+{
+	unsigned int id = GetShaderId(shader, stage);
+
+	for (unsigned int b = 0; b < shader->GetBufferCount(); b++)
+	{
+		const SimpleConstantBuffer* cb = shader->GetBufferInfo(b);
+
+		commands.push_back(DS_SET_CONSTANTS);
+		Write(id);
+		Write(b);
+		Write(cb->Size);
+		Write(cb->LocalDataBuffer, cb->Size);
+	}
+}
+
+void DrawStreamRecorder::RecordVertexBuffer(unsigned int slot, ID3D11Buffer * buffer, unsigned int stride, unsigned int offset)
+{
+	unsigned int id = GetBufferId(buffer);
+
+	commands.push_back(DS_SET_VERTEX_BUFFER);
+	Write(slot);
+	Write(id);
+	Write(stride);
+	Write(offset);
+}
+
+void DrawStreamRecorder::RecordVertexData(unsigned int slot, const void * data, unsigned int size, unsigned int stride)
+{
+	unsigned int id = (unsigned int)bufferHeaders.size();
+	AddBlob(bufferHeaders, bufferData, D3D11_BIND_VERTEX_BUFFER, data, size);
+
+	commands.push_back(DS_SET_VERTEX_BUFFER);
+	Write(slot);
+	Write(id);
+	Write(stride);
+	Write(0u);
+}
+
+void DrawStreamRecorder::RecordIndexBuffer(ID3D11Buffer * buffer, DXGI_FORMAT format, unsigned int offset)
+{
+	unsigned int id = GetBufferId(buffer);
+
+	commands.push_back(DS_SET_INDEX_BUFFER);
+	Write(id);
+	Write((unsigned int)format);
+	Write(offset);
+}
+
+// --------------------------------------------------------
+// The view's dimension is kept so the replay can bind a
+// placeholder the shader accepts
+// --------------------------------------------------------
+void DrawStreamRecorder::RecordTexture(DrawStreamStage stage, unsigned int slot, ID3D11ShaderResourceView * srv)
+{
+	D3D11_SHADER_RESOURCE_VIEW_DESC desc;
+	desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	if (srv)
+		srv->GetDesc(&desc);
+
+	commands.push_back(DS_SET_TEXTURE);
+	Write((unsigned int)stage);
+	Write(slot);
+	Write(GetId(textureIds, srv));
+	Write((unsigned int)desc.ViewDimension);
+}
+
+void DrawStreamRecorder::RecordSampler(DrawStreamStage stage, unsigned int slot, ID3D11SamplerState * sampler)
+{
+	commands.push_back(DS_SET_SAMPLER);
+	Write((unsigned int)stage);
+	Write(slot);
+	Write(GetId(samplerIds, sampler));
+}
+
+void DrawStreamRecorder::RecordDrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex)
+{
+	commands.push_back(DS_DRAW_INDEXED);
+	Write(indexCount);
+	Write(startIndex);
+	Write((unsigned int)baseVertex);
+	drawCount++;
+}
+
+void DrawStreamRecorder::RecordDrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance)
+{
+	commands.push_back(DS_DRAW_INDEXED_INSTANCED);
+	Write(indexCount);
+	Write(instanceCount);
+	Write(startIndex);
+	Write((unsigned int)baseVertex);
+	Write(startInstance);
+	drawCount++;
+}
+
+// --------------------------------------------------------
+// Writes the header, the shader and buffer blobs, the
+// pipeline states and then the command stream
+// --------------------------------------------------------
+bool DrawStreamRecorder::Save(const std::string & path)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open())
+		return false;
+
+	DrawStreamHeader header;
+	header.Magic = DRAW_STREAM_MAGIC;
+	header.Version = DRAW_STREAM_VERSION;
+	header.ShaderCount = (unsigned int)shaderHeaders.size();
+	header.BufferCount = (unsigned int)bufferHeaders.size();
+	header.TextureCount = (unsigned int)textureIds.size();
+	header.SamplerCount = (unsigned int)samplerIds.size();
+	header.StateCount = (unsigned int)pipelineStates.size();
+	header.CommandBytes = (unsigned int)commands.size();
+	header.DrawCount = drawCount;
+	out.write((const char*)&header, sizeof(header));
+
+	// Blob headers are interleaved with their data
+	size_t offset = 0;
+	for (size_t i = 0; i < shaderHeaders.size(); i++)
+	{
+		out.write((const char*)&shaderHeaders[i], sizeof(DrawStreamBlobHeader));
+		out.write((const char*)&shaderData[offset], shaderHeaders[i].Size);
+		offset += shaderHeaders[i].Size;
+	}
+
+	offset = 0;
+	for (size_t i = 0; i < bufferHeaders.size(); i++)
+	{
+		out.write((const char*)&bufferHeaders[i], sizeof(DrawStreamBlobHeader));
+		if (bufferHeaders[i].Size > 0)
+			out.write((const char*)&bufferData[offset], bufferHeaders[i].Size);
+		offset += bufferHeaders[i].Size;
+	}
+
+	if (!pipelineStates.empty())
+		out.write((const char*)&pipelineStates[0], pipelineStates.size() * sizeof(DrawStreamPipelineState));
+
+	if (!commands.empty())
+		out.write((const char*)&commands[0], commands.size());
+
+	return out.good();
+}
+
+// --------------------------------------------------------
+// Returns the capture id of a shader, adding its bytecode
+// the first time it's seen
+// --------------------------------------------------------
+unsigned int DrawStreamRecorder::GetShaderId(ISimpleShader * shader, DrawStreamStage stage)
+{
+	std::unordered_map<const void*, unsigned int>::iterator it = shaderIds.find(shader);
+	if (it != shaderIds.end())
+		return it->second;
+
+	ID3DBlob* blob = shader->GetShaderBlob();
+	AddBlob(shaderHeaders, shaderData, stage, blob->GetBufferPointer(), (unsigned int)blob->GetBufferSize());
+	return GetId(shaderIds, shader);
+}
+
+// --------------------------------------------------------
+// Returns the capture id of a vertex or index buffer, reading
+// its contents back from the GPU the first time it's seen
+// --------------------------------------------------------
+unsigned int DrawStreamRecorder::GetBufferId(ID3D11Buffer * buffer)
+{
+	std::unordered_map<const void*, unsigned int>::iterator it = bufferIds.find(buffer);
+	if (it != bufferIds.end())
+		return it->second;
+
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+
+	std::vector<unsigned char> data;
+	if (!ReadBuffer(buffer, data))
+		data.clear();
+
+	// Ids count every blob, including recorded vertex data
+	unsigned int id = (unsigned int)bufferHeaders.size();
+	AddBlob(bufferHeaders, bufferData, desc.BindFlags, data.empty() ? nullptr : &data[0], (unsigned int)data.size());
+	bufferIds[buffer] = id;
+	return id;
+}
+
+unsigned int DrawStreamRecorder::GetId(std::unordered_map<const void*, unsigned int>& ids, const void * object)
+{
+	std::unordered_map<const void*, unsigned int>::iterator it = ids.find(object);
+	if (it != ids.end())
+		return it->second;
+
+	unsigned int id = (unsigned int)ids.size();
+	ids[object] = id;
+	return id;
+}
+
+// --------------------------------------------------------
+// Copies a buffer to a staging buffer and reads it on the CPU.
+// Slow, but captures are rare.
+// --------------------------------------------------------
+bool DrawStreamRecorder::ReadBuffer(ID3D11Buffer * buffer, std::vector<unsigned char>& data)
+{
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	desc.MiscFlags = 0;
+	desc.StructureByteStride = 0;
+
+	ID3D11Buffer* staging = nullptr;
+	if (FAILED(device->CreateBuffer(&desc, 0, &staging)))
+		return false;
+
+	context->CopyResource(staging, buffer);
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	bool result = false;
+	if (SUCCEEDED(context->Map(staging, 0, D3D11_MAP_READ, 0, &mapped)))
+	{
+		data.resize(desc.ByteWidth);
+		memcpy(&data[0], mapped.pData, desc.ByteWidth);
+		context->Unmap(staging, 0);
+		result = true;
+	}
+
+	staging->Release();
+	return result;
+}
+
+void DrawStreamRecorder::AddBlob(std::vector<DrawStreamBlobHeader>& headers, std::vector<unsigned char>& blobs, unsigned int type, const void * data, unsigned int size)
+{
+	DrawStreamBlobHeader header;
+	header.Type = type;
+	header.Size = size;
+	headers.push_back(header);
+
+	if (size > 0)
+		blobs.insert(blobs.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+void DrawStreamRecorder::Write(unsigned int value)
+{
+	Write(&value, sizeof(unsigned int));
+}
+
+void DrawStreamRecorder::Write(const void * data, unsigned int size)
+{
+	commands.insert(commands.end(), (const unsigned char*)data, (const unsigned char*)data + size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ BACKENDS ------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+NullDrawStreamBackend::NullDrawStreamBackend()
+{
+	stateChanges = 0;
+	constantBytes = 0;
+	indices = 0;
+}
+
+D3D11DrawStreamBackend::D3D11DrawStreamBackend(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	this->device = device;
+	this->context = context;
+	placeholderTexture = nullptr;
+	placeholderSRV = nullptr;
+	placeholderArraySRV = nullptr;
+	placeholderSampler = nullptr;
+}
+
+D3D11DrawStreamBackend::~D3D11DrawStreamBackend()
+{
+	for (size_t i = 0; i < vertexShaders.size(); i++)
+		delete vertexShaders[i];
+	for (size_t i = 0; i < pixelShaders.size(); i++)
+		delete pixelShaders[i];
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		if (buffers[i]) { buffers[i]->Release(); }
+	}
+
+	for (size_t i = 0; i < states.size(); i++)
+	{
+		if (states[i].Blend) { states[i].Blend->Release(); }
+		if (states[i].Rasterizer) { states[i].Rasterizer->Release(); }
+		if (states[i].DepthStencil) { states[i].DepthStencil->Release(); }
+	}
+
+	if (placeholderSRV) { placeholderSRV->Release(); }
+	if (placeholderArraySRV) { placeholderArraySRV->Release(); }
+	if (placeholderTexture) { placeholderTexture->Release(); }
+	if (placeholderSampler) { placeholderSampler->Release(); }
+}
+
+bool D3D11DrawStreamBackend::CreateShader(unsigned int id, DrawStreamStage stage, const void * bytecode, unsigned int size)
+{
+	if (vertexShaders.size() <= id)
+	{
+		vertexShaders.resize(id + 1, nullptr);
+		pixelShaders.resize(id + 1, nullptr);
+	}
+
+	if (stage == DS_STAGE_VERTEX)
+	{
+		vertexShaders[id] = new SimpleVertexShader(device, context);
+		return vertexShaders[id]->LoadShaderBlob(bytecode, size);
+	}
+
+	pixelShaders[id] = new SimplePixelShader(device, context);
+	return pixelShaders[id]->LoadShaderBlob(bytecode, size);
+}
+
+bool D3D11DrawStreamBackend::CreateBuffer(unsigned int id, unsigned int bindFlags, const void * data, unsigned int size)
+{
+	if (buffers.size() <= id)
+		buffers.resize(id + 1, nullptr);
+
+	// Buffers that couldn't be read back stay null
+	if (size == 0)
+		return true;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.ByteWidth = size;
+	desc.BindFlags = bindFlags;
+
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem = data;
+
+	return SUCCEEDED(device->CreateBuffer(&desc, &initialData, &buffers[id]));
+}
+
+// --------------------------------------------------------
+// Captures don't carry textures, every texture id binds a
+// single white texel (as a 2D texture or a one slice array)
+// and every sampler id a linear sampler
+// --------------------------------------------------------
+bool D3D11DrawStreamBackend::CreatePlaceholders(unsigned int textureCount, unsigned int samplerCount)
+{
+	unsigned int white = 0xffffffff;
+
+	D3D11_TEXTURE2D_DESC texDesc = {};
+	texDesc.Width = 1;
+	texDesc.Height = 1;
+	texDesc.MipLevels = 1;
+	texDesc.ArraySize = 1;
+	texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA texData = {};
+	texData.pSysMem = &white;
+	texData.SysMemPitch = sizeof(unsigned int);
+
+	if (FAILED(device->CreateTexture2D(&texDesc, &texData, &placeholderTexture)))
+		return false;
+	if (FAILED(device->CreateShaderResourceView(placeholderTexture, 0, &placeholderSRV)))
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC arrayDesc = {};
+	arrayDesc.Format = texDesc.Format;
+	arrayDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	arrayDesc.Texture2DArray.MipLevels = 1;
+	arrayDesc.Texture2DArray.ArraySize = 1;
+	if (FAILED(device->CreateShaderResourceView(placeholderTexture, &arrayDesc, &placeholderArraySRV)))
+		return false;
+
+	D3D11_SAMPLER_DESC sampDesc = {};
+	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+	sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+	return SUCCEEDED(device->CreateSamplerState(&sampDesc, &placeholderSampler));
+}
+
+bool D3D11DrawStreamBackend::CreatePipelineState(unsigned int id, const DrawStreamPipelineState & state)
+{
+	if (states.size() <= id)
+	{
+		State empty = {};
+		states.resize(id + 1, empty);
+	}
+
+	SimpleVertexShader* vertexShader = state.VertexShader < vertexShaders.size() ? vertexShaders[state.VertexShader] : nullptr;
+	if (!vertexShader)
+		return false;
+
+	State& created = states[id];
+	switch (state.VertexFormat)
+	{
+	case DS_VERTEX_SPLIT:
+		created.InputLayout = vertexShader->GetInputLayout(VertexFormat<SplitVertex>::Elements(), VertexFormat<SplitVertex>::ElementCount);
+		break;
+	case DS_VERTEX_INSTANCED:
+		created.InputLayout = vertexShader->GetInputLayout(VertexFormat<InstancedVertex>::Elements(), VertexFormat<InstancedVertex>::ElementCount);
+		break;
+	case DS_VERTEX_INSTANCED_SPLIT:
+		created.InputLayout = vertexShader->GetInputLayout(VertexFormat<InstancedSplitVertex>::Elements(), VertexFormat<InstancedSplitVertex>::ElementCount);
+		break;
+	default:
+		created.InputLayout = vertexShader->GetInputLayout();
+		break;
+	}
+	created.Topology = (D3D11_PRIMITIVE_TOPOLOGY)state.Topology;
+
+	return
+		SUCCEEDED(device->CreateBlendState(&state.Blend, &created.Blend)) &&
+		SUCCEEDED(device->CreateRasterizerState(&state.Rasterizer, &created.Rasterizer)) &&
+		SUCCEEDED(device->CreateDepthStencilState(&state.DepthStencil, &created.DepthStencil));
+}
+
+void D3D11DrawStreamBackend::SetShaders(unsigned int vertexShader, unsigned int pixelShader)
+{
+	if (vertexShader < vertexShaders.size() && vertexShaders[vertexShader])
+		vertexShaders[vertexShader]->SetShader();
+	if (pixelShader < pixelShaders.size() && pixelShaders[pixelShader])
+		pixelShaders[pixelShader]->SetShader();
+
+	// Shaders changed behind the renderer's back
+	if (PipelineStateCache::Instance())
+		PipelineStateCache::Instance()->Invalidate();
+}
+
+// --------------------------------------------------------
+// Comes after the shaders, whose SetShader() also sets their
+// own input layout
+// --------------------------------------------------------
+void D3D11DrawStreamBackend::SetPipelineState(unsigned int state)
+{
+	const State& bound = states[state];
+	context->IASetInputLayout(bound.InputLayout);
+	context->IASetPrimitiveTopology(bound.Topology);
+	context->RSSetState(bound.Rasterizer);
+	context->OMSetBlendState(bound.Blend, 0, 0xffffffff);
+	context->OMSetDepthStencilState(bound.DepthStencil, 0);
+
+	// Also behind the renderer's back
+	if (PipelineStateCache::Instance())
+		PipelineStateCache::Instance()->Invalidate();
+}
+
+void D3D11DrawStreamBackend::SetConstants(unsigned int shader, unsigned int index, const void * data, unsigned int size)
+{
+	if (shader >= vertexShaders.size())
+		return;
+
+	ISimpleShader* target = vertexShaders[shader];
+	if (!target)
+		target = pixelShaders[shader];
+	if (!target)
+		return;
+
+	// A size that doesn't match the buffer's sets nothing
+	if (target->SetBufferData(index, data, size))
+		target->CopyBufferData(index);
+}
+
+void D3D11DrawStreamBackend::SetVertexBuffer(unsigned int slot, unsigned int buffer, unsigned int stride, unsigned int offset)
+{
+	ID3D11Buffer* vb = buffer < buffers.size() ? buffers[buffer] : nullptr;
+	context->IASetVertexBuffers(slot, 1, &vb, &stride, &offset);
+}
+
+void D3D11DrawStreamBackend::SetIndexBuffer(unsigned int buffer, DXGI_FORMAT format, unsigned int offset)
+{
+	ID3D11Buffer* ib = buffer < buffers.size() ? buffers[buffer] : nullptr;
+	context->IASetIndexBuffer(ib, format, offset);
+}
+
+void D3D11DrawStreamBackend::SetTexture(DrawStreamStage stage, unsigned int slot, unsigned int texture, D3D11_SRV_DIMENSION dimension)
+{
+	ID3D11ShaderResourceView* srv = dimension == D3D11_SRV_DIMENSION_TEXTURE2DARRAY ? placeholderArraySRV : placeholderSRV;
+	if (stage == DS_STAGE_VERTEX)
+		context->VSSetShaderResources(slot, 1, &srv);
+	else
+		context->PSSetShaderResources(slot, 1, &srv);
+}
+
+void D3D11DrawStreamBackend::SetSampler(DrawStreamStage stage, unsigned int slot, unsigned int sampler)
+{
+	if (stage == DS_STAGE_VERTEX)
+		context->VSSetSamplers(slot, 1, &placeholderSampler);
+	else
+		context->PSSetSamplers(slot, 1, &placeholderSampler);
+}
+
+void D3D11DrawStreamBackend::DrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex)
+{
+	context->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void D3D11DrawStreamBackend::DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance)
+{
+	context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+// --------------------------------------------------------
+// Flushes so every pass pays for its own submission instead
+// of the driver batching passes together
+// --------------------------------------------------------
+void D3D11DrawStreamBackend::EndFrame()
+{
+	context->Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ PLAYER --------------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+DrawStreamPlayer::DrawStreamPlayer()
+{
+	ZeroMemory(&header, sizeof(DrawStreamHeader));
+	statesOffset = 0;
+	commandsOffset = 0;
+}
+
+bool DrawStreamPlayer::Load(const std::string & path)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in.is_open())
+		return false;
+
+	size_t size = (size_t)in.tellg();
+	if (size < sizeof(DrawStreamHeader))
+		return false;
+
+	file.resize(size);
+	in.seekg(0);
+	in.read((char*)&file[0], size);
+	if (!in.good())
+		return false;
+
+	return Parse();
+}
+
+bool DrawStreamPlayer::Load(const void * data, size_t size)
+{
+	if (size < sizeof(DrawStreamHeader))
+		return false;
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	file.assign(bytes, bytes + size);
+	return Parse();
+}
+
+bool DrawStreamPlayer::Parse()
+{
+	size_t size = file.size();
+	memcpy(&header, &file[0], sizeof(DrawStreamHeader));
+	if (header.Magic != DRAW_STREAM_MAGIC || header.Version != DRAW_STREAM_VERSION)
+		return false;
+
+	// Walk the blobs to find the states and command stream,
+	// comparing against what's left so nothing can wrap
+	size_t offset = sizeof(DrawStreamHeader);
+	unsigned long long blobCount = (unsigned long long)header.ShaderCount + header.BufferCount;
+	for (unsigned long long i = 0; i < blobCount; i++)
+	{
+		if (size - offset < sizeof(DrawStreamBlobHeader))
+			return false;
+
+		DrawStreamBlobHeader blob;
+		memcpy(&blob, &file[offset], sizeof(DrawStreamBlobHeader));
+		offset += sizeof(DrawStreamBlobHeader);
+		if (size - offset < blob.Size)
+			return false;
+		offset += blob.Size;
+	}
+
+	if ((size - offset) / sizeof(DrawStreamPipelineState) < header.StateCount)
+		return false;
+	statesOffset = (unsigned int)offset;
+	offset += header.StateCount * sizeof(DrawStreamPipelineState);
+
+	if (size - offset < header.CommandBytes)
+		return false;
+
+	commandsOffset = (unsigned int)offset;
+	return ValidateCommands();
+}
+
+// --------------------------------------------------------
+// Walks the command stream once, so Submit() can decode it
+// without checks: every opcode is known, every payload ends
+// inside the stream and every id is one the capture has
+// --------------------------------------------------------
+bool DrawStreamPlayer::ValidateCommands() const
+{
+	const unsigned char* command = file.data() + commandsOffset;
+	const unsigned char* end = command + header.CommandBytes;
+	unsigned int payload[5];
+
+	// Reads count uints of the payload, false if they run past the end
+	auto read = [&](unsigned int count)
+	{
+		if ((size_t)(end - command) < count * sizeof(unsigned int))
+			return false;
+		memcpy(payload, command, count * sizeof(unsigned int));
+		command += count * sizeof(unsigned int);
+		return true;
+	};
+
+	while (command < end)
+	{
+		unsigned char opcode = *command++;
+		switch (opcode)
+		{
+		case DS_SET_SHADERS:
+			if (!read(2) || payload[0] >= header.ShaderCount || payload[1] >= header.ShaderCount)
+				return false;
+			break;
+
+		case DS_SET_CONSTANTS:
+			if (!read(3) || payload[0] >= header.ShaderCount || (size_t)(end - command) < payload[2])
+				return false;
+			command += payload[2];
+			break;
+
+		case DS_SET_VERTEX_BUFFER:
+			if (!read(4) || payload[0] >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT || payload[1] >= header.BufferCount)
+				return false;
+			break;
+
+		case DS_SET_INDEX_BUFFER:
+			if (!read(3) || payload[0] >= header.BufferCount)
+				return false;
+			break;
+
+		case DS_SET_TEXTURE:
+			if (!read(4) || payload[0] > DS_STAGE_PIXEL || payload[1] >= D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT)
+				return false;
+			break;
+
+		case DS_SET_SAMPLER:
+			if (!read(3) || payload[0] > DS_STAGE_PIXEL || payload[1] >= D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT)
+				return false;
+			break;
+
+		case DS_DRAW_INDEXED:
+			if (!read(3))
+				return false;
+			break;
+
+		case DS_SET_PIPELINE_STATE:
+			if (!read(1) || payload[0] >= header.StateCount)
+				return false;
+			break;
+
+		case DS_DRAW_INDEXED_INSTANCED:
+			if (!read(5))
+				return false;
+			break;
+
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DrawStreamPlayer::Prepare(DrawStreamBackend * backend)
+{
+	size_t offset = sizeof(DrawStreamHeader);
+	for (unsigned int i = 0; i < header.ShaderCount + header.BufferCount; i++)
+	{
+		DrawStreamBlobHeader blob;
+		memcpy(&blob, &file[offset], sizeof(DrawStreamBlobHeader));
+		offset += sizeof(DrawStreamBlobHeader);
+
+		const void* data = blob.Size > 0 ? &file[offset] : nullptr;
+		bool created = i < header.ShaderCount ?
+			backend->CreateShader(i, (DrawStreamStage)blob.Type, data, blob.Size) :
+			backend->CreateBuffer(i - header.ShaderCount, blob.Type, data, blob.Size);
+		if (!created)
+			return false;
+
+		offset += blob.Size;
+	}
+
+	for (unsigned int i = 0; i < header.StateCount; i++)
+	{
+		DrawStreamPipelineState state;
+		memcpy(&state, &file[statesOffset + i * sizeof(DrawStreamPipelineState)], sizeof(DrawStreamPipelineState));
+		if (!backend->CreatePipelineState(i, state))
+			return false;
+	}
+
+	return backend->CreatePlaceholders(header.TextureCount, header.SamplerCount);
+}
+
+// --------------------------------------------------------
+// Decodes the command stream and hands every command to
+// the backend.  Load() already validated it.
+// --------------------------------------------------------
+void DrawStreamPlayer::Submit(DrawStreamBackend * backend)
+{
+	// The stream can be empty and end the file, so no indexing
+	const unsigned char* command = file.data() + commandsOffset;
+	const unsigned char* end = command + header.CommandBytes;
+
+	// Reads the next uint of the payload
+	auto read = [&command]()
+	{
+		unsigned int value;
+		memcpy(&value, command, sizeof(unsigned int));
+		command += sizeof(unsigned int);
+		return value;
+	};
+
+	while (command < end)
+	{
+		unsigned char opcode = *command++;
+		switch (opcode)
+		{
+		case DS_SET_SHADERS:
+		{
+			unsigned int vs = read();
+			unsigned int ps = read();
+			backend->SetShaders(vs, ps);
+		}
+			break;
+
+		case DS_SET_CONSTANTS:
+		{
+			unsigned int shader = read();
+			unsigned int index = read();
+			unsigned int size = read();
+			backend->SetConstants(shader, index, command, size);
+			command += size;
+		}
+			break;
+
+		case DS_SET_VERTEX_BUFFER:
+		{
+			unsigned int slot = read();
+			unsigned int buffer = read();
+			unsigned int stride = read();
+			unsigned int offset = read();
+			backend->SetVertexBuffer(slot, buffer, stride, offset);
+		}
+			break;
+
+		case DS_SET_INDEX_BUFFER:
+		{
+			unsigned int buffer = read();
+			unsigned int format = read();
+			unsigned int offset = read();
+			backend->SetIndexBuffer(buffer, (DXGI_FORMAT)format, offset);
+		}
+			break;
+
+		case DS_SET_TEXTURE:
+		{
+			unsigned int stage = read();
+			unsigned int slot = read();
+			unsigned int texture = read();
+			unsigned int dimension = read();
+			backend->SetTexture((DrawStreamStage)stage, slot, texture, (D3D11_SRV_DIMENSION)dimension);
+		}
+			break;
+
+		case DS_SET_SAMPLER:
+		{
+			unsigned int stage = read();
+			unsigned int slot = read();
+			unsigned int sampler = read();
+			backend->SetSampler((DrawStreamStage)stage, slot, sampler);
+		}
+			break;
+
+		case DS_DRAW_INDEXED:
+		{
+			unsigned int indexCount = read();
+			unsigned int startIndex = read();
+			int baseVertex = (int)read();
+			backend->DrawIndexed(indexCount, startIndex, baseVertex);
+		}
+			break;
+
+		case DS_SET_PIPELINE_STATE:
+			backend->SetPipelineState(read());
+			break;
+
+		case DS_DRAW_INDEXED_INSTANCED:
+		{
+			unsigned int indexCount = read();
+			unsigned int instanceCount = read();
+			unsigned int startIndex = read();
+			int baseVertex = (int)read();
+			unsigned int startInstance = read();
+			backend->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+		}
+			break;
+
+		default:
+			// Corrupt stream, stop rather than read garbage
+			return;
+		}
+	}
+
+	backend->EndFrame();
+}
+
+DrawStreamReplayStats DrawStreamPlayer::Benchmark(DrawStreamBackend * backend, unsigned int passes)
+{
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	double perfCounterMs = 1000.0 / (double)perfFreq;
+
+	DrawStreamReplayStats stats;
+	stats.Passes = passes;
+	stats.DrawsPerPass = header.DrawCount;
+	stats.CommandBytes = header.CommandBytes;
+	stats.AverageMs = 0.0;
+	stats.MinMs = DBL_MAX;
+	stats.MaxMs = 0.0;
+
+	double totalMs = 0.0;
+	for (unsigned int i = 0; i < passes; i++)
+	{
+		__int64 start, end;
+		QueryPerformanceCounter((LARGE_INTEGER*)&start);
+		Submit(backend);
+		QueryPerformanceCounter((LARGE_INTEGER*)&end);
+
+		double ms = (end - start) * perfCounterMs;
+		totalMs += ms;
+		stats.MinMs = min(stats.MinMs, ms);
+		stats.MaxMs = max(stats.MaxMs, ms);
+	}
+
+	if (passes > 0)
+		stats.AverageMs = totalMs / passes;
+	else
+		stats.MinMs = 0.0;
+
+	return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ REPLAY HARNESS ------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+// --------------------------------------------------------
+// A capture with one of each resource (a shader, a buffer, a
+// pipeline state, a texture and a sampler) around commands
+// --------------------------------------------------------
+static std::vector<unsigned char> BuildTestCapture(const std::vector<unsigned char>& commands, unsigned int drawCount)
+{
+	DrawStreamHeader header;
+	header.Magic = DRAW_STREAM_MAGIC;
+	header.Version = DRAW_STREAM_VERSION;
+	header.ShaderCount = 1;
+	header.BufferCount = 1;
+	header.TextureCount = 1;
+	header.SamplerCount = 1;
+	header.StateCount = 1;
+	header.CommandBytes = (unsigned int)commands.size();
+	header.DrawCount = drawCount;
+
+	std::vector<unsigned char> capture((const unsigned char*)&header, (const unsigned char*)&header + sizeof(header));
+
+	unsigned char bytecode[16] = {};
+	DrawStreamBlobHeader blob = { DS_STAGE_VERTEX, sizeof(bytecode) };
+	capture.insert(capture.end(), (const unsigned char*)&blob, (const unsigned char*)&blob + sizeof(blob));
+	capture.insert(capture.end(), bytecode, bytecode + sizeof(bytecode));
+
+	unsigned char vertices[36] = {};
+	blob.Type = D3D11_BIND_VERTEX_BUFFER;
+	blob.Size = sizeof(vertices);
+	capture.insert(capture.end(), (const unsigned char*)&blob, (const unsigned char*)&blob + sizeof(blob));
+	capture.insert(capture.end(), vertices, vertices + sizeof(vertices));
+
+	DrawStreamPipelineState state;
+	ZeroMemory(&state, sizeof(state));
+	capture.insert(capture.end(), (const unsigned char*)&state, (const unsigned char*)&state + sizeof(state));
+
+	capture.insert(capture.end(), commands.begin(), commands.end());
+	return capture;
+}
+
+// Writes commands the way DrawStreamRecorder does
+struct TestCommandWriter
+{
+	std::vector<unsigned char> Bytes;
+
+	TestCommandWriter& Op(unsigned char opcode) { Bytes.push_back(opcode); return *this; }
+	TestCommandWriter& Uint(unsigned int value)
+	{
+		Bytes.insert(Bytes.end(), (const unsigned char*)&value, (const unsigned char*)&value + sizeof(unsigned int));
+		return *this;
+	}
+};
+
+static bool SelfTestCase(std::ostringstream& report, const char* name, const std::vector<unsigned char>& capture, bool valid, unsigned long long expectedIndices)
+{
+	DrawStreamPlayer player;
+	bool loaded = player.Load(capture.data(), capture.size());
+
+	bool passed = loaded == valid;
+	if (passed && loaded)
+	{
+		NullDrawStreamBackend backend;
+		passed = player.Prepare(&backend);
+		player.Submit(&backend);
+		passed = passed && backend.indices == expectedIndices;
+	}
+
+	char line[256];
+	sprintf_s(line, "%-28s %s: %s\n", name, valid ? "accepted" : "rejected", passed ? "ok" : "FAILED");
+	report << line;
+	return passed;
+}
+
+// --------------------------------------------------------
+// Loads well formed captures, which must replay every index,
+// and captures broken in each way Load() has to reject
+// --------------------------------------------------------
+static int RunDrawStreamSelfTest()
+{
+	std::ostringstream report;
+	bool passed = true;
+
+	// One of every command, 3 + 3 x 4 indices
+	TestCommandWriter valid;
+	valid.Op(DS_SET_SHADERS).Uint(0).Uint(0);
+	valid.Op(DS_SET_PIPELINE_STATE).Uint(0);
+	valid.Op(DS_SET_CONSTANTS).Uint(0).Uint(0).Uint(16).Uint(0).Uint(0).Uint(0).Uint(0);
+	valid.Op(DS_SET_VERTEX_BUFFER).Uint(0).Uint(0).Uint(12).Uint(0);
+	valid.Op(DS_SET_INDEX_BUFFER).Uint(0).Uint(DXGI_FORMAT_R32_UINT).Uint(0);
+	valid.Op(DS_SET_TEXTURE).Uint(DS_STAGE_PIXEL).Uint(0).Uint(0).Uint(D3D11_SRV_DIMENSION_TEXTURE2D);
+	valid.Op(DS_SET_SAMPLER).Uint(DS_STAGE_PIXEL).Uint(0).Uint(0);
+	valid.Op(DS_DRAW_INDEXED).Uint(3).Uint(0).Uint(0);
+	valid.Op(DS_DRAW_INDEXED_INSTANCED).Uint(3).Uint(4).Uint(0).Uint(0).Uint(0);
+	std::vector<unsigned char> capture = BuildTestCapture(valid.Bytes, 2);
+	passed &= SelfTestCase(report, "well formed", capture, true, 15);
+
+	// A frame with nothing to draw ends the file with its stream
+	passed &= SelfTestCase(report, "no commands", BuildTestCapture(std::vector<unsigned char>(), 0), true, 0);
+
+	// The file ends before the stream the header promises
+	std::vector<unsigned char> truncatedFile(capture.begin(), capture.end() - 1);
+	passed &= SelfTestCase(report, "truncated file", truncatedFile, false, 0);
+
+	// The stream ends inside the last draw's payload
+	std::vector<unsigned char> truncatedCommand(valid.Bytes.begin(), valid.Bytes.end() - 1);
+	passed &= SelfTestCase(report, "truncated command", BuildTestCapture(truncatedCommand, 2), false, 0);
+
+	TestCommandWriter constantsSize;
+	constantsSize.Op(DS_SET_CONSTANTS).Uint(0).Uint(0).Uint(1024).Uint(0).Uint(0).Uint(0).Uint(0);
+	passed &= SelfTestCase(report, "constants past the end", BuildTestCapture(constantsSize.Bytes, 0), false, 0);
+
+	TestCommandWriter shaderId;
+	shaderId.Op(DS_SET_SHADERS).Uint(0).Uint(1);
+	passed &= SelfTestCase(report, "unknown shader id", BuildTestCapture(shaderId.Bytes, 0), false, 0);
+
+	TestCommandWriter bufferId;
+	bufferId.Op(DS_SET_VERTEX_BUFFER).Uint(0).Uint(1).Uint(12).Uint(0);
+	passed &= SelfTestCase(report, "unknown buffer id", BuildTestCapture(bufferId.Bytes, 0), false, 0);
+
+	TestCommandWriter stateId;
+	stateId.Op(DS_SET_PIPELINE_STATE).Uint(1);
+	passed &= SelfTestCase(report, "unknown state id", BuildTestCapture(stateId.Bytes, 0), false, 0);
+
+	TestCommandWriter vertexSlot;
+	vertexSlot.Op(DS_SET_VERTEX_BUFFER).Uint(D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT).Uint(0).Uint(12).Uint(0);
+	passed &= SelfTestCase(report, "vertex buffer slot", BuildTestCapture(vertexSlot.Bytes, 0), false, 0);
+
+	TestCommandWriter textureStage;
+	textureStage.Op(DS_SET_TEXTURE).Uint(DS_STAGE_PIXEL + 1).Uint(0).Uint(0).Uint(D3D11_SRV_DIMENSION_TEXTURE2D);
+	passed &= SelfTestCase(report, "texture stage", BuildTestCapture(textureStage.Bytes, 0), false, 0);
+
+	TestCommandWriter opcode;
+	opcode.Op(0xff);
+	passed &= SelfTestCase(report, "unknown opcode", BuildTestCapture(opcode.Bytes, 0), false, 0);
+
+	report << (passed ? "draw stream self test passed\n" : "draw stream self test FAILED\n");
+	printf("%s", report.str().c_str());
+
+	// The console goes away with the process, so keep a copy for scripts
+	std::ofstream results("replay-selftest.results.txt", std::ios::app);
+	results << report.str();
+	return passed ? 0 : 1;
+}
+
+// --------------------------------------------------------
+// Replays a capture from the command line and prints the
+// CPU submit cost (also appended to <capture>.results.txt).
+// Runs without a window: the D3D11 backend
+// uses a device with no swap chain, --headless skips the
+// device entirely.
+// --------------------------------------------------------
+int RunDrawStreamReplay(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	std::string path;
+	unsigned int passes = 1000;
+	bool headless = false;
+	bool selfTest = false;
+
+	while (args >> arg)
+	{
+		if (arg == "--replay")
+			args >> path;
+		else if (arg == "--replay-selftest")
+			selfTest = true;
+		else if (arg == "--headless")
+			headless = true;
+		else
+			passes = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+	}
+
+	// Results go to a console, like the debug stats
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+
+	if (selfTest)
+		return RunDrawStreamSelfTest();
+
+	DrawStreamPlayer player;
+	if (!player.Load(path))
+	{
+		printf("Could not load draw stream capture '%s'\n", path.c_str());
+		return 1;
+	}
+
+	ID3D11Device* device = nullptr;
+	ID3D11DeviceContext* context = nullptr;
+	DrawStreamBackend* backend = nullptr;
+	if (headless)
+	{
+		backend = new NullDrawStreamBackend();
+	}
+	else
+	{
+		HRESULT hr = D3D11CreateDevice(0, D3D_DRIVER_TYPE_HARDWARE, 0, 0, 0, 0, D3D11_SDK_VERSION, &device, 0, &context);
+		if (FAILED(hr))
+		{
+			printf("Could not create a D3D11 device\n");
+			return 1;
+		}
+		backend = new D3D11DrawStreamBackend(device, context);
+	}
+
+	int result = 0;
+	if (player.Prepare(backend))
+	{
+		// One untimed pass to warm up the driver and caches
+		player.Submit(backend);
+
+		DrawStreamReplayStats stats = player.Benchmark(backend, passes);
+		char report[512];
+		sprintf_s(report, "%s: %u draws, %u command bytes, %u passes%s\n"
+			"submit: avg %.4fms  min %.4fms  max %.4fms  (%.3fus per draw)\n",
+			path.c_str(), stats.DrawsPerPass, stats.CommandBytes, stats.Passes, headless ? " (headless)" : "",
+			stats.AverageMs, stats.MinMs, stats.MaxMs,
+			stats.DrawsPerPass > 0 ? stats.AverageMs * 1000.0 / stats.DrawsPerPass : 0.0);
+		printf("%s", report);
+
+		// The console goes away with the process, so keep a copy for scripts
+		std::ofstream results(path + ".results.txt", std::ios::app);
+		results << report;
+	}
+	else
+	{
+		printf("Could not create the capture's resources\n");
+		result = 1;
+	}
+
+	delete backend;
+	if (context) { context->Release(); }
+	if (device) { device->Release(); }
+
+	return result;
+}
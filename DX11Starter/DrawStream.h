@@ -0,0 +1,341 @@
+#pragma once
+#include <d3d11.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SimpleShader.h"
+
+// --------------------------------------------------------
+// Draw stream captures
+//
+// A capture is one frame's exact sequence of shader, constant
+// buffer, pipeline state, geometry and texture binds plus the
+// draw calls, in a compact binary file.  Shader bytecode and vertex/index data
+// are stored in the file so it can be replayed without the
+// original assets; textures are only stored as ids and replaced
+// with a placeholder on replay.
+//
+// File layout:
+//   DrawStreamHeader
+//   ShaderCount  x (DrawStreamBlobHeader + bytecode)
+//   BufferCount  x (DrawStreamBlobHeader + vertex/index data)
+//   StateCount   x DrawStreamPipelineState
+//   CommandBytes of commands (one opcode byte + payload each)
+//
+// Buffers the CPU writes every frame, like instance data, are
+// stored once per bind with the contents it had.
+// --------------------------------------------------------
+
+#define DRAW_STREAM_MAGIC 0x31435344	// "DSC1"
+#define DRAW_STREAM_VERSION 2
+
+enum DrawStreamOpcode
+{
+	DS_SET_SHADERS = 1,		// uint vertex shader id, uint pixel shader id
+	DS_SET_CONSTANTS,		// uint shader id, uint buffer index, uint size, data
+	DS_SET_VERTEX_BUFFER,	// uint slot, uint buffer id, uint stride, uint offset
+	DS_SET_INDEX_BUFFER,	// uint buffer id, uint format, uint offset
+	DS_SET_TEXTURE,			// uint stage, uint slot, uint texture id, uint D3D11_SRV_DIMENSION
+	DS_SET_SAMPLER,			// uint stage, uint slot, uint sampler id
+	DS_DRAW_INDEXED,		// uint index count, uint start index, int base vertex
+	DS_SET_PIPELINE_STATE,	// uint state id
+	DS_DRAW_INDEXED_INSTANCED	// uint index count, uint instance count, uint start index, int base vertex, uint start instance
+};
+
+enum DrawStreamStage
+{
+	DS_STAGE_VERTEX = 0,
+	DS_STAGE_PIXEL = 1
+};
+
+// Input layout of a pipeline state, rebuilt from the vertex
+// shader on replay
+enum DrawStreamVertexFormat
+{
+	DS_VERTEX_REFLECTED = 0,		// The shader's own layout
+	DS_VERTEX_SPLIT,
+	DS_VERTEX_INSTANCED,
+	DS_VERTEX_INSTANCED_SPLIT
+};
+
+struct DrawStreamHeader
+{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned int ShaderCount;
+	unsigned int BufferCount;
+	unsigned int TextureCount;
+	unsigned int SamplerCount;
+	unsigned int StateCount;
+	unsigned int CommandBytes;
+	unsigned int DrawCount;
+};
+
+struct DrawStreamBlobHeader
+{
+	unsigned int Type;		// DrawStreamStage for shaders, D3D11_BIND flags for buffers
+	unsigned int Size;
+};
+
+// --------------------------------------------------------
+// Everything PipelineStateCache::Bind() sets apart from the
+// shaders, which DS_SET_SHADERS binds
+// --------------------------------------------------------
+struct DrawStreamPipelineState
+{
+	unsigned int VertexShader;		// Shader id the input layout is made for
+	unsigned int VertexFormat;		// DrawStreamVertexFormat
+	unsigned int Topology;
+	D3D11_BLEND_DESC Blend;
+	D3D11_RASTERIZER_DESC Rasterizer;
+	D3D11_DEPTH_STENCIL_DESC DepthStencil;
+};
+
+class PipelineState;
+
+// --------------------------------------------------------
+// Records what the renderer submits into a capture
+//
+// Every call is recorded as is, redundant binds included, so a
+// replay costs what the original frame cost.
+// --------------------------------------------------------
+class DrawStreamRecorder
+{
+public:
+	DrawStreamRecorder(ID3D11Device* device, ID3D11DeviceContext* context);
+	~DrawStreamRecorder();
+
+	// Clears everything recorded so far
+	void Begin();
+
+	void RecordShaders(SimpleVertexShader* vertexShader, SimplePixelShader* pixelShader);
+
+	// The state's fixed function states and the input layout
+	// for the format.  A null state records D3D11's defaults,
+	// which is what binding only the shaders leaves in place.
+	void RecordPipelineState(const PipelineState* state, SimpleVertexShader* vertexShader, DrawStreamVertexFormat format);
+
+	void RecordConstants(ISimpleShader* shader, DrawStreamStage stage);
+	void RecordVertexBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int stride, unsigned int offset);
+
+	// Binds a copy of data the CPU just wrote to a dynamic
+	// vertex buffer, stored as a buffer of its own
+	void RecordVertexData(unsigned int slot, const void* data, unsigned int size, unsigned int stride);
+	void RecordIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, unsigned int offset);
+	void RecordTexture(DrawStreamStage stage, unsigned int slot, ID3D11ShaderResourceView* srv);
+	void RecordSampler(DrawStreamStage stage, unsigned int slot, ID3D11SamplerState* sampler);
+	void RecordDrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex);
+	void RecordDrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance);
+
+	// Writes the capture to disk, returns false if the file couldn't be written
+	bool Save(const std::string& path);
+
+	unsigned int GetDrawCount() const { return drawCount; }
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+
+	// Objects seen so far, mapped to their id in the capture
+	std::unordered_map<const void*, unsigned int> shaderIds;
+	std::unordered_map<const void*, unsigned int> bufferIds;
+	std::unordered_map<const void*, unsigned int> textureIds;
+	std::unordered_map<const void*, unsigned int> samplerIds;
+
+	// Shader bytecode and buffer contents, in id order
+	std::vector<DrawStreamBlobHeader> shaderHeaders;
+	std::vector<unsigned char> shaderData;
+	std::vector<DrawStreamBlobHeader> bufferHeaders;
+	std::vector<unsigned char> bufferData;
+
+	// Distinct pipeline states, in id order.  There are few,
+	// so they're found by comparing.
+	std::vector<DrawStreamPipelineState> pipelineStates;
+
+	std::vector<unsigned char> commands;
+	unsigned int drawCount;
+
+	unsigned int GetShaderId(ISimpleShader* shader, DrawStreamStage stage);
+	unsigned int GetBufferId(ID3D11Buffer* buffer);
+	unsigned int GetId(std::unordered_map<const void*, unsigned int>& ids, const void* object);
+	bool ReadBuffer(ID3D11Buffer* buffer, std::vector<unsigned char>& data);
+	void AddBlob(std::vector<DrawStreamBlobHeader>& headers, std::vector<unsigned char>& blobs, unsigned int type, const void* data, unsigned int size);
+
+	void Write(unsigned int value);
+	void Write(const void* data, unsigned int size);
+};
+
+// --------------------------------------------------------
+// Where a replayed capture gets submitted to
+// --------------------------------------------------------
+class DrawStreamBackend
+{
+public:
+	virtual ~DrawStreamBackend() { }
+
+	// Resource creation, called once when the capture is loaded
+	virtual bool CreateShader(unsigned int id, DrawStreamStage stage, const void* bytecode, unsigned int size) = 0;
+	virtual bool CreateBuffer(unsigned int id, unsigned int bindFlags, const void* data, unsigned int size) = 0;
+	virtual bool CreatePlaceholders(unsigned int textureCount, unsigned int samplerCount) = 0;
+	virtual bool CreatePipelineState(unsigned int id, const DrawStreamPipelineState& state) = 0;
+
+	// Commands.  Ids and sizes are checked when the capture is
+	// loaded; constant data must still match the buffer's size.
+	virtual void SetShaders(unsigned int vertexShader, unsigned int pixelShader) = 0;
+	virtual void SetPipelineState(unsigned int state) = 0;
+	virtual void SetConstants(unsigned int shader, unsigned int index, const void* data, unsigned int size) = 0;
+	virtual void SetVertexBuffer(unsigned int slot, unsigned int buffer, unsigned int stride, unsigned int offset) = 0;
+	virtual void SetIndexBuffer(unsigned int buffer, DXGI_FORMAT format, unsigned int offset) = 0;
+	virtual void SetTexture(DrawStreamStage stage, unsigned int slot, unsigned int texture, D3D11_SRV_DIMENSION dimension) = 0;
+	virtual void SetSampler(DrawStreamStage stage, unsigned int slot, unsigned int sampler) = 0;
+	virtual void DrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex) = 0;
+	virtual void DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance) = 0;
+
+	// Called after every pass over the capture
+	virtual void EndFrame() { }
+};
+
+// --------------------------------------------------------
+// Headless backend: decodes and dispatches every command but
+// never touches a GPU.  Measures the cost of the stream itself.
+// --------------------------------------------------------
+class NullDrawStreamBackend : public DrawStreamBackend
+{
+public:
+	NullDrawStreamBackend();
+
+	bool CreateShader(unsigned int id, DrawStreamStage stage, const void* bytecode, unsigned int size) { return true; }
+	bool CreateBuffer(unsigned int id, unsigned int bindFlags, const void* data, unsigned int size) { return true; }
+	bool CreatePlaceholders(unsigned int textureCount, unsigned int samplerCount) { return true; }
+	bool CreatePipelineState(unsigned int id, const DrawStreamPipelineState& state) { return true; }
+
+	void SetShaders(unsigned int vertexShader, unsigned int pixelShader) { stateChanges++; }
+	void SetPipelineState(unsigned int state) { stateChanges++; }
+	void SetConstants(unsigned int shader, unsigned int index, const void* data, unsigned int size) { constantBytes += size; }
+	void SetVertexBuffer(unsigned int slot, unsigned int buffer, unsigned int stride, unsigned int offset) { stateChanges++; }
+	void SetIndexBuffer(unsigned int buffer, DXGI_FORMAT format, unsigned int offset) { stateChanges++; }
+	void SetTexture(DrawStreamStage stage, unsigned int slot, unsigned int texture, D3D11_SRV_DIMENSION dimension) { stateChanges++; }
+	void SetSampler(DrawStreamStage stage, unsigned int slot, unsigned int sampler) { stateChanges++; }
+	void DrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex) { indices += indexCount; }
+	void DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance) { indices += (unsigned long long)indexCount * instanceCount; }
+
+	unsigned int stateChanges;
+	unsigned long long constantBytes;
+	unsigned long long indices;
+};
+
+// --------------------------------------------------------
+// D3D11 backend: resubmits through SimpleShader exactly like
+// the Renderer does, so changes to that path show up in the
+// timings
+// --------------------------------------------------------
+class D3D11DrawStreamBackend : public DrawStreamBackend
+{
+public:
+	D3D11DrawStreamBackend(ID3D11Device* device, ID3D11DeviceContext* context);
+	~D3D11DrawStreamBackend();
+
+	bool CreateShader(unsigned int id, DrawStreamStage stage, const void* bytecode, unsigned int size);
+	bool CreateBuffer(unsigned int id, unsigned int bindFlags, const void* data, unsigned int size);
+	bool CreatePlaceholders(unsigned int textureCount, unsigned int samplerCount);
+	bool CreatePipelineState(unsigned int id, const DrawStreamPipelineState& state);
+
+	void SetShaders(unsigned int vertexShader, unsigned int pixelShader);
+	void SetPipelineState(unsigned int state);
+	void SetConstants(unsigned int shader, unsigned int index, const void* data, unsigned int size);
+	void SetVertexBuffer(unsigned int slot, unsigned int buffer, unsigned int stride, unsigned int offset);
+	void SetIndexBuffer(unsigned int buffer, DXGI_FORMAT format, unsigned int offset);
+	void SetTexture(DrawStreamStage stage, unsigned int slot, unsigned int texture, D3D11_SRV_DIMENSION dimension);
+	void SetSampler(DrawStreamStage stage, unsigned int slot, unsigned int sampler);
+	void DrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex);
+	void DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex, unsigned int startInstance);
+	void EndFrame();
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+
+	// Indexed by id, only one of the two is set per shader id
+	std::vector<SimpleVertexShader*> vertexShaders;
+	std::vector<SimplePixelShader*> pixelShaders;
+	std::vector<ID3D11Buffer*> buffers;
+
+	// Input layouts belong to the vertex shaders, the states are owned
+	struct State
+	{
+		ID3D11InputLayout* InputLayout;
+		ID3D11BlendState* Blend;
+		ID3D11RasterizerState* Rasterizer;
+		ID3D11DepthStencilState* DepthStencil;
+		D3D11_PRIMITIVE_TOPOLOGY Topology;
+	};
+	std::vector<State> states;
+
+	// Every texture and sampler id maps to these, with a view
+	// of the texture as a one slice array for array bindings
+	ID3D11Texture2D* placeholderTexture;
+	ID3D11ShaderResourceView* placeholderSRV;
+	ID3D11ShaderResourceView* placeholderArraySRV;
+	ID3D11SamplerState* placeholderSampler;
+};
+
+// --------------------------------------------------------
+// Per pass timings of a replay
+// --------------------------------------------------------
+struct DrawStreamReplayStats
+{
+	unsigned int Passes;
+	unsigned int DrawsPerPass;
+	unsigned int CommandBytes;
+	double AverageMs;
+	double MinMs;
+	double MaxMs;
+};
+
+// --------------------------------------------------------
+// Loads a capture and resubmits it to a backend
+// --------------------------------------------------------
+class DrawStreamPlayer
+{
+public:
+	DrawStreamPlayer();
+
+	// Reads a capture file, returns false if it's missing or
+	// malformed.  Every command is checked to be whole and to
+	// refer to resources in the capture.
+	bool Load(const std::string& path);
+
+	// Same, from a capture already in memory
+	bool Load(const void* data, size_t size);
+
+	// Creates the capture's resources on a backend
+	bool Prepare(DrawStreamBackend* backend);
+
+	// Submits the whole capture once
+	void Submit(DrawStreamBackend* backend);
+
+	// Submits the capture passes times and times every pass
+	DrawStreamReplayStats Benchmark(DrawStreamBackend* backend, unsigned int passes);
+
+private:
+	DrawStreamHeader header;
+	std::vector<unsigned char> file;
+	unsigned int statesOffset;
+	unsigned int commandsOffset;
+
+	// Checks the loaded file and finds its sections
+	bool Parse();
+	bool ValidateCommands() const;
+};
+
+// --------------------------------------------------------
+// Command line replay harness:
+//   --replay <capture> [passes] [--headless]
+//   --replay-selftest
+//
+// The self test loads built-in captures, well formed and
+// broken in each way Load() must catch, with no device.
+//
+// Returns the process exit code
+// --------------------------------------------------------
+int RunDrawStreamReplay(const std::string& commandLine);
@@ -0,0 +1,225 @@
+#include "DynamicMesh.h"
+#include <algorithm>
+
+DynamicMeshStats DynamicMesh::stats;
+
+DynamicMesh::DynamicMesh(ID3D11Device * device, unsigned int maxVertices, unsigned int maxIndices,
+	const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax)
+	: Mesh()
+{
+	this->maxVertices = maxVertices;
+	this->maxIndices = maxIndices;
+	this->boundsMin = boundsMin;
+	this->boundsMax = boundsMax;
+	dynamicVertexBuffer = nullptr;
+	dynamicIndexBuffer = nullptr;
+	current = 0;
+	changed = false;
+	everMapped = false;
+	uploadedFrame = 0;
+
+	for (unsigned int i = 0; i < COPIES; i++)
+	{
+		copies[i].Valid = false;
+		copies[i].LastUsedFrame = 0;
+	}
+
+	D3D11_BUFFER_DESC vbd = {};
+	vbd.Usage = D3D11_USAGE_DYNAMIC;
+	vbd.ByteWidth = sizeof(Vertex) * maxVertices * COPIES;
+	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	vbd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	device->CreateBuffer(&vbd, 0, &dynamicVertexBuffer);
+
+	D3D11_BUFFER_DESC ibd = {};
+	ibd.Usage = D3D11_USAGE_DYNAMIC;
+	ibd.ByteWidth = sizeof(UINT) * maxIndices * COPIES;
+	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	ibd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	device->CreateBuffer(&ibd, 0, &dynamicIndexBuffer);
+}
+
+DynamicMesh::~DynamicMesh()
+{
+	if (dynamicVertexBuffer) { dynamicVertexBuffer->Release(); }
+	if (dynamicIndexBuffer) { dynamicIndexBuffer->Release(); }
+}
+
+void DynamicMesh::ResetFrameStats()
+{
+	ZeroMemory(&stats, sizeof(DynamicMeshStats));
+}
+
+void DynamicMesh::SetVertices(unsigned int first, const Vertex * vertices, unsigned int count)
+{
+	if (first >= maxVertices)
+		return;
+	count = min(count, maxVertices - first);
+	if (count == 0)
+		return;
+
+	if (this->vertices.size() < first + count)
+		this->vertices.resize(first + count);
+	memcpy(&this->vertices[first], vertices, count * sizeof(Vertex));
+
+	for (unsigned int i = 0; i < COPIES; i++)
+	{
+		if (copies[i].Valid)
+			AddRange(copies[i].PendingVertices, first, count);
+	}
+	changed = true;
+}
+
+void DynamicMesh::SetIndices(unsigned int first, const UINT * indices, unsigned int count)
+{
+	if (first >= maxIndices)
+		return;
+	count = min(count, maxIndices - first);
+	if (count == 0)
+		return;
+
+	if (this->indices.size() < first + count)
+		this->indices.resize(first + count);
+	memcpy(&this->indices[first], indices, count * sizeof(UINT));
+
+	for (unsigned int i = 0; i < COPIES; i++)
+	{
+		if (copies[i].Valid)
+			AddRange(copies[i].PendingIndices, first, count);
+	}
+	changed = true;
+}
+
+void DynamicMesh::SetIndexCount(unsigned int count)
+{
+	indexCount = (int)min(count, maxIndices);
+}
+
+// --------------------------------------------------------
+// Merges the range into one it overlaps or touches.  Too many
+// separate ranges collapse into one that covers them all,
+// trading a few unchanged bytes for fewer copies.
+// --------------------------------------------------------
+void DynamicMesh::AddRange(std::vector<Range>& ranges, unsigned int first, unsigned int count)
+{
+	unsigned int end = first + count;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		unsigned int rangeEnd = ranges[i].First + ranges[i].Count;
+		if (first <= rangeEnd && ranges[i].First <= end)
+		{
+			ranges[i].First = min(ranges[i].First, first);
+			ranges[i].Count = max(rangeEnd, end) - ranges[i].First;
+			return;
+		}
+	}
+
+	if (ranges.size() < MAX_RANGES)
+	{
+		Range range = { first, count };
+		ranges.push_back(range);
+		return;
+	}
+
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		first = min(first, ranges[i].First);
+		end = max(end, ranges[i].First + ranges[i].Count);
+	}
+	ranges.resize(1);
+	ranges[0].First = first;
+	ranges[0].Count = end - first;
+}
+
+template<typename T>
+unsigned int DynamicMesh::WriteCopy(T * copy, const std::vector<T>& source, const std::vector<Range>& pending, bool whole)
+{
+	if (source.empty())
+		return 0;
+
+	if (whole)
+	{
+		memcpy(copy, &source[0], source.size() * sizeof(T));
+		return (unsigned int)(source.size() * sizeof(T));
+	}
+
+	unsigned int bytes = 0;
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		memcpy(copy + pending[i].First, &source[pending[i].First], pending[i].Count * sizeof(T));
+		bytes += pending[i].Count * sizeof(T);
+	}
+	return bytes;
+}
+
+// --------------------------------------------------------
+// Unchanged meshes keep drawing their current copy.  Changed
+// ones move on to the next copy, which only needs what
+// changed since it was last written, unless the GPU may still
+// be reading it, in which case both buffers are discarded
+// (the driver hands out fresh memory, frames in flight keep
+// the old) and every copy starts over.
+// --------------------------------------------------------
+void DynamicMesh::Upload(ID3D11DeviceContext * context, FrameFence * fence)
+{
+	if (!dynamicVertexBuffer || !dynamicIndexBuffer)
+		return;
+
+	unsigned long long frame = fence->GetCurrentFrame();
+	if (uploadedFrame == frame)
+		return;
+	uploadedFrame = frame;
+	stats.Meshes++;
+
+	if (!changed)
+	{
+		copies[current].LastUsedFrame = frame;
+		return;
+	}
+
+	unsigned int next = (current + 1) % COPIES;
+	bool discard = !everMapped || !fence->IsComplete(copies[next].LastUsedFrame);
+	if (discard)
+	{
+		for (unsigned int i = 0; i < COPIES; i++)
+		{
+			copies[i].Valid = false;
+			copies[i].PendingVertices.clear();
+			copies[i].PendingIndices.clear();
+		}
+	}
+
+	Copy& copy = copies[next];
+	D3D11_MAP mapType = discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+	D3D11_MAPPED_SUBRESOURCE mapped;
+
+	if (FAILED(context->Map(dynamicVertexBuffer, 0, mapType, 0, &mapped)))
+		return;
+	stats.VertexBytes += WriteCopy((Vertex*)mapped.pData + next * maxVertices, vertices, copy.PendingVertices, !copy.Valid);
+	context->Unmap(dynamicVertexBuffer, 0);
+
+	if (!copy.Valid || !copy.PendingIndices.empty())
+	{
+		if (FAILED(context->Map(dynamicIndexBuffer, 0, mapType, 0, &mapped)))
+		{
+			// Start over with a discard next frame
+			everMapped = false;
+			return;
+		}
+		stats.IndexBytes += WriteCopy((UINT*)mapped.pData + next * maxIndices, indices, copy.PendingIndices, !copy.Valid);
+		context->Unmap(dynamicIndexBuffer, 0);
+	}
+
+	stats.Uploads++;
+	stats.WholeBytes += (unsigned int)(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(UINT));
+	if (discard)
+		stats.Discards++;
+
+	copy.Valid = true;
+	copy.PendingVertices.clear();
+	copy.PendingIndices.clear();
+	copy.LastUsedFrame = frame;
+	current = next;
+	changed = false;
+	everMapped = true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "Mesh.h"
+#include "FrameFence.h"
+
+// --------------------------------------------------------
+// Per-frame statistics of every dynamic mesh
+// --------------------------------------------------------
+struct DynamicMeshStats
+{
+	unsigned int Meshes;			// Drawn this frame
+	unsigned int Uploads;			// Meshes that changed and were written
+	unsigned int VertexBytes;		// Actually written
+	unsigned int IndexBytes;
+	unsigned int WholeBytes;		// What rewriting the changed meshes whole would have cost
+	unsigned int Discards;			// Writes that had to rename the buffers
+};
+
+// --------------------------------------------------------
+// Mesh whose geometry changes while it's drawn (trails,
+// debug lines, deformed surfaces)
+//
+// The vertex and index buffers are D3D11_USAGE_DYNAMIC and
+// hold COPIES of the mesh one after another.  Every frame the
+// mesh changed, the next copy is brought up to date and
+// drawn, with MAP_WRITE_NO_OVERWRITE and only the ranges that
+// changed since that copy was last written, so a frame costs
+// the bytes that changed rather than the whole mesh.  A copy
+// is only reused once the frame fence says the GPU is done
+// with the last frame that drew it.  When it isn't (or on the
+// first write) the buffers are mapped with MAP_WRITE_DISCARD
+// instead and the copy is written whole.
+//
+// Edit and draw from the thread that owns the immediate
+// context; the bounds are fixed, so give ones that hold every
+// shape the mesh will take.
+// --------------------------------------------------------
+class DynamicMesh : public Mesh
+{
+public:
+	static const unsigned int COPIES = 3;
+
+	DynamicMesh(ID3D11Device* device, unsigned int maxVertices, unsigned int maxIndices,
+		const DirectX::XMFLOAT3& boundsMin, const DirectX::XMFLOAT3& boundsMax);
+	~DynamicMesh();
+
+	// Change part of the geometry.  Indices are relative to the
+	// mesh's first vertex.  Nothing reaches the GPU until Upload().
+	void SetVertices(unsigned int first, const Vertex* vertices, unsigned int count);
+	void SetIndices(unsigned int first, const UINT* indices, unsigned int count);
+
+	// How many indices are drawn
+	void SetIndexCount(unsigned int count);
+
+	unsigned int GetMaxVertices() const { return maxVertices; }
+	unsigned int GetMaxIndices() const { return maxIndices; }
+
+	// Brings the copy drawn this frame up to date, once per frame
+	void Upload(ID3D11DeviceContext* context, FrameFence* fence);
+
+	bool IsDynamic() const { return true; }
+	ID3D11Buffer* GetVertexBuffer() const { return dynamicVertexBuffer; }
+	ID3D11Buffer* GetIndexBuffer() const { return dynamicIndexBuffer; }
+	int GetBaseVertex() const { return (int)(current * maxVertices); }
+	unsigned int GetStartIndex() const { return current * maxIndices; }
+
+	static const DynamicMeshStats& GetFrameStats() { return stats; }
+	static void ResetFrameStats();
+
+private:
+	struct Range
+	{
+		unsigned int First;
+		unsigned int Count;
+	};
+
+	// One copy of the mesh in the buffers
+	struct Copy
+	{
+		bool Valid;								// Holds the mesh as of some earlier write
+		unsigned long long LastUsedFrame;
+		std::vector<Range> PendingVertices;		// Changed since this copy was written
+		std::vector<Range> PendingIndices;
+	};
+
+	// Past this many ranges a copy's pending list becomes one range
+	static const unsigned int MAX_RANGES = 16;
+
+	ID3D11Buffer* dynamicVertexBuffer;
+	ID3D11Buffer* dynamicIndexBuffer;
+	unsigned int maxVertices;
+	unsigned int maxIndices;
+
+	// CPU copy of the geometry, up to the highest element set
+	std::vector<Vertex> vertices;
+	std::vector<UINT> indices;
+
+	Copy copies[COPIES];
+	unsigned int current;
+	bool changed;
+	bool everMapped;
+	unsigned long long uploadedFrame;
+
+	static DynamicMeshStats stats;
+
+	static void AddRange(std::vector<Range>& ranges, unsigned int first, unsigned int count);
+
+	// Writes a copy's pending ranges, or all of it, and returns the bytes written
+	template<typename T>
+	static unsigned int WriteCopy(T* copy, const std::vector<T>& source, const std::vector<Range>& pending, bool whole);
+};
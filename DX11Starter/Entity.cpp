@@ -6,6 +6,8 @@ Entity::Entity(Mesh * Object, Material* materialInput)
 {
 	meshObj = Object;
 	material = materialInput;
+	occluder = false;
+	staticGeometry = false;
 	SetScale(1.0f, 1.0f, 1.0f);
 
 	XMStoreFloat4(&rotation, XMQuaternionIdentity());
@@ -14,6 +16,7 @@ Entity::Entity(Mesh * Object, Material* materialInput)
 	SetTranslation(0.0f, 0.0f, 0.0f);
 
 	XMStoreFloat4x4(&worldMatrix, XMMatrixTranspose(XMMatrixIdentity()));
+	BeginStep();
 }
 
 
@@ -88,15 +91,103 @@ XMFLOAT4X4& Entity::GetWorldMatrix()
 	return worldMatrix;
 }
 
+void Entity::BeginStep()
+{
+	previousPosition = position;
+	previousScale = scale;
+	XMStoreFloat4(&previousRotation, XMQuaternionRotationMatrix(XMLoadFloat4x4(&rotationMatrix)));
+}
+
+// --------------------------------------------------------
+// Blends position and scale linearly and the rotation
+// spherically.  The rotation comes from the matrix, since
+// SetRotationAboutZ doesn't keep the quaternion up to date.
+// --------------------------------------------------------
+XMFLOAT4X4 Entity::GetInterpolatedWorldMatrix(float interpolation)
+{
+	XMFLOAT4X4 result;
+	XMStoreFloat4x4(&result, XMMatrixTranspose(GetInterpolatedWorldMatrixCPU(interpolation)));
+	return result;
+}
+
+XMMATRIX Entity::GetInterpolatedWorldMatrixCPU(float interpolation)
+{
+	XMVECTOR rotationQuat = XMQuaternionSlerp(
+		XMLoadFloat4(&previousRotation),
+		XMQuaternionRotationMatrix(XMLoadFloat4x4(&rotationMatrix)),
+		interpolation);
+
+	return
+		XMMatrixScalingFromVector(XMVectorLerp(XMLoadFloat3(&previousScale), XMLoadFloat3(&scale), interpolation)) *
+		XMMatrixRotationQuaternion(rotationQuat) *
+		XMMatrixTranslationFromVector(XMVectorLerp(XMLoadFloat3(&previousPosition), XMLoadFloat3(&position), interpolation));
+}
+
+XMMATRIX Entity::GetWorldMatrixCPU()
+{
+	return XMLoadFloat4x4(&scaleMatrix) * XMLoadFloat4x4(&rotationMatrix) * XMLoadFloat4x4(&translationMatrix);
+}
+
+// Transforms the local box as center/extents, the new extents
+// are the local extents projected on the absolute matrix axes
+static void TransformBounds(const XMFLOAT3& localMin, const XMFLOAT3& localMax, const XMMATRIX& world, XMVECTOR& worldMin, XMVECTOR& worldMax)
+{
+	XMVECTOR center = (XMLoadFloat3(&localMin) + XMLoadFloat3(&localMax)) * 0.5f;
+	XMVECTOR extents = (XMLoadFloat3(&localMax) - XMLoadFloat3(&localMin)) * 0.5f;
+
+	XMVECTOR worldCenter = XMVector3Transform(center, world);
+	XMVECTOR worldExtents =
+		XMVectorAbs(world.r[0]) * XMVectorSplatX(extents) +
+		XMVectorAbs(world.r[1]) * XMVectorSplatY(extents) +
+		XMVectorAbs(world.r[2]) * XMVectorSplatZ(extents);
+
+	worldMin = worldCenter - worldExtents;
+	worldMax = worldCenter + worldExtents;
+}
+
+// --------------------------------------------------------
+// Rendering draws between the previous and current step, so
+// culling has to hold for both ends.  Positions and scales in
+// between stay inside the union; a rotation can poke a corner
+// out slightly, by far less than a step's movement.
+// --------------------------------------------------------
+void Entity::GetWorldBounds(XMFLOAT3 & boundsMin, XMFLOAT3 & boundsMax)
+{
+	XMMATRIX previousWorld = GetInterpolatedWorldMatrixCPU(0.0f);
+	XMMATRIX currentWorld = GetWorldMatrixCPU();
+
+	XMVECTOR previousMin, previousMax, currentMin, currentMax;
+	TransformBounds(meshObj->GetBoundsMin(), meshObj->GetBoundsMax(), previousWorld, previousMin, previousMax);
+	TransformBounds(meshObj->GetBoundsMin(), meshObj->GetBoundsMax(), currentWorld, currentMin, currentMax);
+
+	XMStoreFloat3(&boundsMin, XMVectorMin(previousMin, currentMin));
+	XMStoreFloat3(&boundsMax, XMVectorMax(previousMax, currentMax));
+}
+
+void Entity::SetOccluder(bool isOccluder)
+{
+	occluder = isOccluder;
+}
+
+bool Entity::IsOccluder()
+{
+	return occluder;
+}
+
+void Entity::SetStatic(bool isStatic)
+{
+	staticGeometry = isStatic;
+}
+
+bool Entity::IsStatic()
+{
+	return staticGeometry;
+}
+
 void Entity::PrepareMaterial(XMFLOAT4X4 camViewMatrix, XMFLOAT4X4 camProjectionMatrix)
 {
 	CalculateWorldMatrix();
-	material->GetVertexShader()->SetMatrix4x4("world", worldMatrix);
-	material->GetVertexShader()->SetMatrix4x4("view", camViewMatrix);
-	material->GetVertexShader()->SetMatrix4x4("projection", camProjectionMatrix);
-	material->GetPixelShader()->SetShaderResourceView("diffuseTexture", material->GetSRV());
-	material->GetPixelShader()->SetSamplerState("basicSampler", material->GetSamplerState());
-
+	material->Prepare(worldMatrix, camViewMatrix, camProjectionMatrix);
 }
 
 Material * Entity::GetMaterial()
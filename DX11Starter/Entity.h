@@ -25,6 +25,17 @@ private:
 	// Material obj pointer
 	Material* material;
 
+	// Is this entity rasterized into the occlusion buffer?
+	bool occluder;
+
+	// Never moves, so it can be batched with other static entities
+	bool staticGeometry;
+
+	// Transform at the start of the current simulation step
+	XMFLOAT3 previousPosition;
+	XMFLOAT3 previousScale;
+	XMFLOAT4 previousRotation;
+
 public:
 	Entity(Mesh* Object, Material* materialInput);
 	~Entity();
@@ -38,6 +49,32 @@ public:
 	Mesh* GetMesh();
 	XMFLOAT4X4& GetWorldMatrix();
 
+	// Keeps the current transform as the previous one, call at the start of every simulation step
+	void BeginStep();
+
+	// World matrix between the previous and current step (transposed for HLSL)
+	XMFLOAT4X4 GetInterpolatedWorldMatrix(float interpolation);
+
+	// Untransposed world matrix for CPU side work (culling etc.)
+	XMMATRIX GetWorldMatrixCPU();
+
+	// Untransposed GetInterpolatedWorldMatrix(), for CPU work that
+	// has to match what's drawn (occluder rasterization)
+	XMMATRIX GetInterpolatedWorldMatrixCPU(float interpolation);
+
+	// World space bounding box of the mesh over the current step:
+	// the union of the previous and current step's boxes, so it
+	// holds wherever in between the entity is drawn
+	void GetWorldBounds(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax);
+
+	// Occluder flag
+	void SetOccluder(bool isOccluder);
+	bool IsOccluder();
+
+	// Static flag, set before the renderer builds its batches
+	void SetStatic(bool isStatic);
+	bool IsStatic();
+
 	// Set WVP
 	void PrepareMaterial(XMFLOAT4X4 camViewMatrix, XMFLOAT4X4 camProjectionMatrix);
 
@@ -0,0 +1,84 @@
+#include "FrameFence.h"
+#include <thread>
+
+FrameFence::FrameFence(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	this->context = context;
+	currentFrame = 1;
+	completedFrame = 0;
+	stalls = 0;
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		queryFrames[i] = 0;
+		if (FAILED(device->CreateQuery(&queryDesc, &queries[i])))
+			queries[i] = nullptr;
+	}
+}
+
+FrameFence::~FrameFence()
+{
+	for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		if (queries[i]) { queries[i]->Release(); }
+	}
+}
+
+unsigned long long FrameFence::EndFrame()
+{
+	unsigned int slot = (unsigned int)(currentFrame % MAX_FRAMES_IN_FLIGHT);
+	if (!queries[slot])
+		return currentFrame++;
+
+	// The slot still belongs to the oldest frame in flight
+	if (queryFrames[slot] != 0 && !IsComplete(queryFrames[slot]))
+	{
+		stalls++;
+		Poll(queryFrames[slot], true);
+	}
+
+	context->End(queries[slot]);
+	queryFrames[slot] = currentFrame;
+	return currentFrame++;
+}
+
+bool FrameFence::IsComplete(unsigned long long frame)
+{
+	if (frame <= completedFrame)
+		return true;
+	if (frame >= currentFrame)
+		return false;
+
+	// Slot was reused, which EndFrame() only does once it's done
+	unsigned int slot = (unsigned int)(frame % MAX_FRAMES_IN_FLIGHT);
+	if (queries[slot] && queryFrames[slot] != frame)
+		return true;
+
+	return queries[slot] && Poll(frame, false);
+}
+
+// --------------------------------------------------------
+// The GPU finishes frames in order, so a done frame means
+// every earlier one is done too
+// --------------------------------------------------------
+bool FrameFence::Poll(unsigned long long frame, bool wait)
+{
+	unsigned int slot = (unsigned int)(frame % MAX_FRAMES_IN_FLIGHT);
+	while (true)
+	{
+		BOOL done = FALSE;
+		HRESULT hr = context->GetData(queries[slot], &done, sizeof(BOOL), wait ? 0 : D3D11_ASYNC_GETDATA_DONOTFLUSH);
+		if (hr == S_OK && done)
+		{
+			if (frame > completedFrame)
+				completedFrame = frame;
+			return true;
+		}
+		if (FAILED(hr) || !wait)
+			return false;
+
+		std::this_thread::yield();
+	}
+}
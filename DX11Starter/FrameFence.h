@@ -0,0 +1,43 @@
+#pragma once
+#include <d3d11.h>
+
+// --------------------------------------------------------
+// Tells when the GPU has finished a frame
+//
+// An event query is queued behind every frame's commands.
+// Frame ids start at 1, so 0 can stand for "never used" and
+// is always complete.  At most MAX_FRAMES_IN_FLIGHT frames
+// are queued: EndFrame() waits for the oldest one before its
+// query is reused, so anything older is known to be done.
+// --------------------------------------------------------
+class FrameFence
+{
+public:
+	static const unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+
+	FrameFence(ID3D11Device* device, ID3D11DeviceContext* context);
+	~FrameFence();
+
+	// Id of the frame being recorded
+	unsigned long long GetCurrentFrame() const { return currentFrame; }
+
+	// Queues the frame's query and opens the next frame
+	unsigned long long EndFrame();
+
+	// True once the GPU is done with the frame, never waits.
+	// Without queries nothing in flight is ever reported done.
+	bool IsComplete(unsigned long long frame);
+
+	// Times EndFrame() had to wait for the GPU
+	unsigned int GetStalls() const { return stalls; }
+
+private:
+	ID3D11DeviceContext* context;
+	ID3D11Query* queries[MAX_FRAMES_IN_FLIGHT];
+	unsigned long long queryFrames[MAX_FRAMES_IN_FLIGHT];
+	unsigned long long currentFrame;
+	unsigned long long completedFrame;		// Newest frame known to be done
+	unsigned int stalls;
+
+	bool Poll(unsigned long long frame, bool wait);
+};
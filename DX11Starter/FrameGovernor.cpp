@@ -0,0 +1,348 @@
+#include "FrameGovernor.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+
+void FrameGovernorSettings::SetDefaults()
+{
+	TargetMs = 1000.0f / 60.0f;
+	Smoothing = 0.1f;
+
+	Kp = 1.0f;
+	Ki = 0.05f;
+	Kd = 0.5f;
+	IntegralLimit = 4.0f;
+
+	DegradeThreshold = 0.1f;
+	UpgradeThreshold = 0.25f;
+	HoldFrames = 15;
+
+	MinResolutionScale = 0.5f;
+	ResolutionStep = 0.1f;
+	MaxLodBias = 2.0f;
+	LodBiasStep = 0.5f;
+	MinLights = 8;
+	MaxLights = UINT_MAX;
+}
+
+FrameGovernor::FrameGovernor()
+{
+	settings.SetDefaults();
+	Reset();
+}
+
+FrameGovernor::FrameGovernor(const FrameGovernorSettings & settings)
+{
+	this->settings = settings;
+	Reset();
+}
+
+void FrameGovernor::Reset()
+{
+	quality.ResolutionScale = 1.0f;
+	quality.LodBias = 0.0f;
+	quality.MaxLights = settings.MaxLights;
+	decisions.clear();
+	drops.clear();
+
+	frame = 0;
+	filteredCpuMs = 0.0f;
+	filteredGpuMs = -1.0f;
+	integral = 0.0f;
+	previousError = 0.0f;
+	framesSinceChange = 0;
+}
+
+void FrameGovernor::SetLightCount(unsigned int count)
+{
+	settings.MaxLights = count;
+	if (quality.MaxLights > count)
+		quality.MaxLights = count;
+}
+
+float FrameGovernor::GetFilteredMs() const
+{
+	return filteredGpuMs > filteredCpuMs ? filteredGpuMs : filteredCpuMs;
+}
+
+// --------------------------------------------------------
+// Steps are taken in hundredths so a scale or bias walked
+// down and back up lands on the value it started from
+// --------------------------------------------------------
+static float Quantize(float value)
+{
+	return floorf(value * 100.0f + 0.5f) / 100.0f;
+}
+
+const FrameQuality & FrameGovernor::Update(float cpuMs, float gpuMs)
+{
+	frame++;
+
+	// Start the filters at the first time seen, rather than
+	// climbing up to it from zero
+	if (frame == 1)
+		filteredCpuMs = cpuMs;
+	else
+		filteredCpuMs += (cpuMs - filteredCpuMs) * settings.Smoothing;
+
+	if (gpuMs >= 0.0f)
+	{
+		if (filteredGpuMs < 0.0f)
+			filteredGpuMs = gpuMs;
+		else
+			filteredGpuMs += (gpuMs - filteredGpuMs) * settings.Smoothing;
+	}
+
+	// Whichever side is slower sets the frame time
+	bool gpuBound = filteredGpuMs > filteredCpuMs;
+	float error = (GetFilteredMs() - settings.TargetMs) / settings.TargetMs;
+
+	integral += error;
+	if (integral > settings.IntegralLimit) integral = settings.IntegralLimit;
+	if (integral < -settings.IntegralLimit) integral = -settings.IntegralLimit;
+
+	float derivative = frame == 1 ? 0.0f : error - previousError;
+	previousError = error;
+
+	float output = settings.Kp * error + settings.Ki * integral + settings.Kd * derivative;
+
+	framesSinceChange++;
+	if (framesSinceChange < settings.HoldFrames)
+		return quality;
+
+	FrameGovernorDecision decision;
+	decision.Frame = frame;
+	decision.CpuMs = filteredCpuMs;
+	decision.GpuMs = filteredGpuMs;
+	decision.Output = output;
+	decision.GpuBound = gpuBound;
+
+	bool changed = false;
+	if (output > settings.DegradeThreshold)
+		changed = Degrade(gpuBound, decision);
+	else if (output < -settings.UpgradeThreshold && error < -settings.UpgradeThreshold)
+		changed = Upgrade(decision);
+
+	if (changed)
+	{
+		decisions.push_back(decision);
+
+		// What built up led to this change; the next one has to
+		// be earned by what comes after it
+		integral = 0.0f;
+		framesSinceChange = 0;
+	}
+	return quality;
+}
+
+bool FrameGovernor::Degrade(bool gpuBound, FrameGovernorDecision & decision)
+{
+	// Resolution only helps when the GPU is what's slow; fewer
+	// lights also means less culling and binning on the CPU
+	static const FrameGovernorKnob gpuOrder[] = { FRAME_GOVERNOR_RESOLUTION, FRAME_GOVERNOR_LOD_BIAS, FRAME_GOVERNOR_LIGHTS };
+	static const FrameGovernorKnob cpuOrder[] = { FRAME_GOVERNOR_LIGHTS, FRAME_GOVERNOR_LOD_BIAS };
+	const FrameGovernorKnob* order = gpuBound ? gpuOrder : cpuOrder;
+	unsigned int count = gpuBound ? 3 : 2;
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		decision.Knob = order[i];
+		switch (decision.Knob)
+		{
+		case FRAME_GOVERNOR_RESOLUTION:
+			if (quality.ResolutionScale <= settings.MinResolutionScale)
+				continue;
+			decision.From = quality.ResolutionScale;
+			quality.ResolutionScale = Quantize(quality.ResolutionScale - settings.ResolutionStep);
+			if (quality.ResolutionScale < settings.MinResolutionScale) quality.ResolutionScale = settings.MinResolutionScale;
+			decision.To = quality.ResolutionScale;
+			break;
+
+		case FRAME_GOVERNOR_LOD_BIAS:
+			if (quality.LodBias >= settings.MaxLodBias)
+				continue;
+			decision.From = quality.LodBias;
+			quality.LodBias = Quantize(quality.LodBias + settings.LodBiasStep);
+			if (quality.LodBias > settings.MaxLodBias) quality.LodBias = settings.MaxLodBias;
+			decision.To = quality.LodBias;
+			break;
+
+		case FRAME_GOVERNOR_LIGHTS:
+			if (settings.MaxLights == UINT_MAX || quality.MaxLights <= settings.MinLights)
+				continue;
+			decision.From = (float)quality.MaxLights;
+			quality.MaxLights /= 2;
+			if (quality.MaxLights < settings.MinLights) quality.MaxLights = settings.MinLights;
+			decision.To = (float)quality.MaxLights;
+			break;
+		}
+
+		drops.push_back(decision.Knob);
+		return true;
+	}
+
+	// Already as cheap as allowed
+	return false;
+}
+
+// --------------------------------------------------------
+// Gives back the newest drop, so quality comes back in the
+// reverse of the order it went
+// --------------------------------------------------------
+bool FrameGovernor::Upgrade(FrameGovernorDecision & decision)
+{
+	if (drops.empty())
+		return false;
+
+	decision.Knob = drops.back();
+	drops.pop_back();
+
+	switch (decision.Knob)
+	{
+	case FRAME_GOVERNOR_RESOLUTION:
+		decision.From = quality.ResolutionScale;
+		quality.ResolutionScale = Quantize(quality.ResolutionScale + settings.ResolutionStep);
+		if (quality.ResolutionScale > 1.0f) quality.ResolutionScale = 1.0f;
+		decision.To = quality.ResolutionScale;
+		break;
+
+	case FRAME_GOVERNOR_LOD_BIAS:
+		decision.From = quality.LodBias;
+		quality.LodBias = Quantize(quality.LodBias - settings.LodBiasStep);
+		if (quality.LodBias < 0.0f) quality.LodBias = 0.0f;
+		decision.To = quality.LodBias;
+		break;
+
+	case FRAME_GOVERNOR_LIGHTS:
+		// Doubled without overflowing, and never past the lights there are
+		decision.From = (float)quality.MaxLights;
+		quality.MaxLights = quality.MaxLights > settings.MaxLights / 2 ? settings.MaxLights : quality.MaxLights * 2;
+		decision.To = (float)quality.MaxLights;
+		break;
+	}
+	return true;
+}
+
+std::string FrameGovernor::DescribeDecision(const FrameGovernorDecision & decision)
+{
+	static const char* knobNames[] = { "resolution scale", "LOD bias", "max lights" };
+
+	// The LOD bias goes up as quality goes down
+	bool degrade = decision.Knob == FRAME_GOVERNOR_LOD_BIAS ? decision.To > decision.From : decision.To < decision.From;
+
+	char line[256];
+	snprintf(line, sizeof(line), "frame %u: %s, %s bound (cpu %.2fms, gpu %.2fms), output %+.3f: %s %g -> %g",
+		decision.Frame, degrade ? "degrade" : "upgrade",
+		decision.GpuBound ? "GPU" : "CPU", decision.CpuMs, decision.GpuMs, decision.Output,
+		knobNames[decision.Knob], decision.From, decision.To);
+	return line;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ REPLAY HARNESS ------------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned int ReplayFrameTrace(std::istream & trace, FrameGovernor & governor, std::ostream & report)
+{
+	const FrameGovernorSettings& settings = governor.GetSettings();
+	unsigned int frames = 0;
+	unsigned int overBudget = 0;
+	double totalMs = 0.0;
+	size_t reported = governor.GetDecisions().size();
+
+	std::string line;
+	while (std::getline(trace, line))
+	{
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.resize(comment);
+
+		float cpuMs, gpuMs;
+		int read = sscanf(line.c_str(), "%f %f", &cpuMs, &gpuMs);
+		if (read < 1)
+			continue;
+		if (read < 2)
+			gpuMs = -1.0f;
+
+		frames++;
+		float frameMs = gpuMs > cpuMs ? gpuMs : cpuMs;
+		totalMs += frameMs;
+		if (frameMs > settings.TargetMs)
+			overBudget++;
+
+		governor.Update(cpuMs, gpuMs);
+
+		const std::vector<FrameGovernorDecision>& decisions = governor.GetDecisions();
+		for (; reported < decisions.size(); reported++)
+			report << FrameGovernor::DescribeDecision(decisions[reported]) << "\n";
+	}
+
+	const FrameQuality& quality = governor.GetQuality();
+	char summary[512];
+	snprintf(summary, sizeof(summary),
+		"%u frames, budget %.2fms, average %.2fms, %u over budget, %u decisions\n"
+		"final: resolution scale %g, LOD bias %g, max lights %u\n",
+		frames, settings.TargetMs, frames > 0 ? totalMs / frames : 0.0, overBudget,
+		(unsigned int)governor.GetDecisions().size(),
+		quality.ResolutionScale, quality.LodBias, quality.MaxLights);
+	report << summary;
+	return frames;
+}
+
+// --------------------------------------------------------
+// Replays a trace recorded with the game's --governor-trace
+// and prints what the governor would have decided (also
+// appended to <trace>.results.txt).  The trace's times are
+// fixed, so this checks the controller's reactions, not how
+// much a change would have saved.
+// --------------------------------------------------------
+int RunFrameGovernorReplay(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	std::string path;
+	FrameGovernorSettings settings;
+	settings.SetDefaults();
+	unsigned int numbers = 0;
+
+	while (args >> arg)
+	{
+		if (arg == "--governor-replay")
+			args >> path;
+		else if (numbers++ == 0)
+			settings.TargetMs = (float)atof(arg.c_str());
+		else
+			settings.MaxLights = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+	}
+
+#if defined(_WIN32)
+	// Results go to a console, like the debug stats
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+#endif
+
+	std::ifstream trace(path.c_str());
+	if (!trace)
+	{
+		printf("Could not open frame trace '%s'\n", path.c_str());
+		return 1;
+	}
+
+	FrameGovernor governor(settings);
+	std::ostringstream report;
+	report << path << ":\n";
+	ReplayFrameTrace(trace, governor, report);
+	printf("%s", report.str().c_str());
+
+	// The console goes away with the process, so keep a copy for scripts
+	std::ofstream results((path + ".results.txt").c_str(), std::ios::app);
+	results << report.str();
+	return 0;
+}
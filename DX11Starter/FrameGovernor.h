@@ -0,0 +1,149 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Tuning of the governor.  SetDefaults() aims at 60Hz.
+// --------------------------------------------------------
+struct FrameGovernorSettings
+{
+	float TargetMs;					// Frame budget
+	float Smoothing;				// Weight of the newest frame in the filtered times
+
+	// Controller gains, on the error as a fraction of the budget
+	float Kp;
+	float Ki;
+	float Kd;
+	float IntegralLimit;
+
+	// Hysteresis: quality drops once the output is above the
+	// first, and only comes back once both the output and the
+	// error are below minus the second, with HoldFrames between
+	// any two changes
+	float DegradeThreshold;
+	float UpgradeThreshold;
+	unsigned int HoldFrames;
+
+	float MinResolutionScale;
+	float ResolutionStep;
+	float MaxLodBias;
+	float LodBiasStep;
+	unsigned int MinLights;			// Halved per step down to this
+	unsigned int MaxLights;			// Lights there are to shade, UINT_MAX if unknown
+
+	void SetDefaults();
+};
+
+// --------------------------------------------------------
+// What the renderer should use for the next frame
+// --------------------------------------------------------
+struct FrameQuality
+{
+	float ResolutionScale;			// Of each axis of the back buffer
+	float LodBias;					// Added to the texture mip level
+	unsigned int MaxLights;			// Point and spot lights shaded, UINT_MAX for all
+};
+
+enum FrameGovernorKnob
+{
+	FRAME_GOVERNOR_RESOLUTION,
+	FRAME_GOVERNOR_LOD_BIAS,
+	FRAME_GOVERNOR_LIGHTS
+};
+
+// --------------------------------------------------------
+// One quality change and what led to it
+// --------------------------------------------------------
+struct FrameGovernorDecision
+{
+	unsigned int Frame;
+	float CpuMs;					// Filtered
+	float GpuMs;
+	float Output;					// Controller output that crossed a threshold
+	bool GpuBound;
+	FrameGovernorKnob Knob;
+	float From;
+	float To;
+};
+
+// --------------------------------------------------------
+// Keeps the frame time within a budget by trading quality
+//
+// Fed the CPU and GPU time of every frame, it filters both
+// and runs a PID controller on the slower one's distance from
+// the budget.  When the output crosses a threshold it moves
+// one knob one step:
+//  - over budget and GPU bound: resolution scale, then LOD
+//    bias, then light count
+//  - over budget and CPU bound: light count, then LOD bias
+//    (resolution costs the CPU nothing)
+//  - well under budget: the drops are undone, newest first
+// The integral is cleared after every change, and nothing
+// changes for HoldFrames frames, so a change shows up in the
+// filtered times before the next is considered.
+//
+// Every change is logged.  The governor only does arithmetic
+// on what it's fed, so replaying a recorded trace gives the
+// same decisions on any platform (see ReplayFrameTrace()).
+// --------------------------------------------------------
+class FrameGovernor
+{
+public:
+	FrameGovernor();
+	FrameGovernor(const FrameGovernorSettings& settings);
+
+	// Back to full quality with no history
+	void Reset();
+
+	// Number of point and spot lights in the scene.  Until it's
+	// known the lights aren't capped, and aren't a knob.
+	void SetLightCount(unsigned int count);
+
+	// Feeds one frame's times and returns the quality for the
+	// next one.  A negative GPU time means it isn't known yet.
+	const FrameQuality& Update(float cpuMs, float gpuMs);
+
+	const FrameQuality& GetQuality() const { return quality; }
+	const FrameGovernorSettings& GetSettings() const { return settings; }
+	unsigned int GetFrame() const { return frame; }
+	float GetFilteredMs() const;
+
+	// Every change since Reset(), oldest first
+	const std::vector<FrameGovernorDecision>& GetDecisions() const { return decisions; }
+
+	static std::string DescribeDecision(const FrameGovernorDecision& decision);
+
+private:
+	FrameGovernorSettings settings;
+	FrameQuality quality;
+	std::vector<FrameGovernorDecision> decisions;
+
+	unsigned int frame;
+	float filteredCpuMs;
+	float filteredGpuMs;
+	float integral;
+	float previousError;
+	unsigned int framesSinceChange;
+	std::vector<FrameGovernorKnob> drops;	// Knobs stepped down, oldest first
+
+	// Move one knob one step, filling in the decision
+	bool Degrade(bool gpuBound, FrameGovernorDecision& decision);
+	bool Upgrade(FrameGovernorDecision& decision);
+};
+
+// --------------------------------------------------------
+// Feeds a trace of "cpuMs gpuMs" lines ('#' starts a comment)
+// to the governor, writing every decision and a summary to
+// the report.  Returns the number of frames read.
+// --------------------------------------------------------
+unsigned int ReplayFrameTrace(std::istream& trace, FrameGovernor& governor, std::ostream& report);
+
+// --------------------------------------------------------
+// Command line replay of a recorded trace:
+//   --governor-replay trace.txt [budgetMs [lights]]
+//
+// Returns the process exit code
+// --------------------------------------------------------
+int RunFrameGovernorReplay(const std::string& commandLine);
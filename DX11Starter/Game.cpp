@@ -1,5 +1,7 @@
 #include "Game.h"
+#include "ShaderConstants.h"
 #include "Vertex.h"
+#include <algorithm>
 
 // For the DirectX Math library
 using namespace DirectX;
@@ -34,9 +36,39 @@ Game::Game(HINSTANCE hInstance)
 	// Initialize fields
 	vertexShader = 0;
 	pixelShader = 0;
+	depthShader = 0;
+	instancedVertexShader = 0;
+	arrayPixelShader = 0;
+	shaderLibrary = 0;
+	earthSpecSRV = 0;
+	textureArrays = 0;
+	inputLayoutCache = 0;
+	geometryHeap = 0;
+	rippleMesh = 0;
+	rippleRowBegin = 0;
+	rippleRowEnd = 0;
+	samplerLodBias = 0.0f;
+	upscaleVertexShader = 0;
+	upscalePixelShader = 0;
+	upscaleSampler = 0;
+	gpuTimer = 0;
+	frameGovernor = new FrameGovernor();
+	resolutionScale = 1.0f;
+	frameStartTime = 0;
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterMs = 1000.0 / (double)perfFreq;
+
+	// Start the worker threads before anything that might use them
+	jobSystem = new JobSystem();
 
 	// Initialize renderer
 	renderer = new Renderer();
+	renderGraph = new RenderGraph();
+
+	// Initialize the scene's lights
+	lightManager = new LightManager();
 
 	// Initialize InputMgr
 	inputMgr = new InputManager();
@@ -44,6 +76,14 @@ Game::Game(HINSTANCE hInstance)
 	// Initialize Camera
 	camera = new Camera();
 
+	lastStatsTime = 0.0f;
+
+	simulationSnapshot = &snapshots[0];
+	renderSnapshot = &snapshots[1];
+	snapshotFrame = 0;
+	pipelineEnabled = true;
+	simulationPending = false;
+
 #if defined(DEBUG) || defined(_DEBUG)
 	// Do we want a console window?  Probably only in debug mode
 	CreateConsoleWindow(500, 120, 32, 120);
@@ -59,20 +99,44 @@ Game::Game(HINSTANCE hInstance)
 Game::~Game()
 {
 	// Delete our simple shader objects, which
-	// will clean up their own internal DirectX stuff
-	delete vertexShader;
-	delete pixelShader;
+	// will clean up their own internal DirectX stuff.
+	// Permutations belong to the library.
+	if (shaderLibrary)
+	{
+		delete shaderLibrary;
+	}
+	else
+	{
+		delete vertexShader;
+		delete pixelShader;
+		delete depthShader;
+	}
+	delete upscaleVertexShader;
+	delete upscalePixelShader;
+
+	// After the shaders, which hold their own references
+	delete inputLayoutCache;
 
 	//Release texture D3D resources
 	if (earthSRV) { earthSRV->Release(); }
 	if (crateSRV) { crateSRV->Release(); }
 	if (metalSRV) { metalSRV->Release(); }
 	if (metalRustSRV) { metalRustSRV->Release(); }
+	if (earthSpecSRV) { earthSpecSRV->Release(); }
+	delete textureArrays;
 	if (sampler) { sampler->Release(); }
+	if (upscaleSampler) { upscaleSampler->Release(); }
+
+	delete gpuTimer;
+	delete frameGovernor;
 
 	// Delete renderer
+	delete renderGraph;
 	delete renderer;
 
+	// Delete lights
+	delete lightManager;
+
 	// Delete InputMgr
 	delete inputMgr;
 
@@ -89,6 +153,9 @@ Game::~Game()
 		mesh = NULL;
 	}
 
+	// After the meshes, which free their geometry in it
+	delete geometryHeap;
+
 	meshObjs.clear();
 
 	// Delete Entity Objs
@@ -108,6 +175,9 @@ Game::~Game()
 	}
 
 	materials.clear();
+
+	// Stop the worker threads last
+	delete jobSystem;
 }
 
 // --------------------------------------------------------
@@ -119,9 +189,16 @@ void Game::Init()
 	// Helper methods for loading shaders, creating some basic
 	// geometry to draw and some simple camera matrices.
 	//  - You'll be expanding and/or replacing these later
+	inputLayoutCache = new InputLayoutCache(device);
 	LoadShaders();
 	CreateMatrices();
 
+	// Renderer and light GPU resources
+	renderer->Init(device);
+	renderer->SetDepthShader(depthShader);
+	lightManager->Init(device);
+	gpuTimer = new GpuTimer(device, context);
+
 	// Load textures
 	if (S_OK !=
 		CreateWICTextureFromFile(
@@ -159,6 +236,26 @@ void Game::Init()
 			&metalRustSRV))
 		return;
 
+	if (S_OK !=
+		CreateWICTextureFromFile(
+			device,
+			context,
+			L"./Assets/Textures/earthSpec.jpg",
+			0, // We don't need a reference to the raw pixels
+			&earthSpecSRV))
+		return;
+
+	// Textures of the same size and format become slices of one
+	// array, so their materials bind the same SRV
+	textureArrays = new TextureArrayPacker();
+	earthTexture = textureArrays->Add(earthSRV);
+	crateTexture = textureArrays->Add(crateSRV);
+	metalTexture = textureArrays->Add(metalSRV);
+	metalRustTexture = textureArrays->Add(metalRustSRV);
+	earthSpecTexture = textureArrays->Add(earthSpecSRV);
+	textureArrays->Build(device, context);
+	printf("\n%s", textureArrays->Describe().c_str());
+
 	// Create a sampler decription
 	D3D11_SAMPLER_DESC sampDesc = {};
 	sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
@@ -170,7 +267,21 @@ void Game::Init()
 	// Create sampler from description
 	device->CreateSamplerState(&sampDesc, &sampler);
 
+	// Bilinear and clamped, so the upscale never wraps to the far edge
+	D3D11_SAMPLER_DESC upscaleDesc = {};
+	upscaleDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	upscaleDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	upscaleDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	upscaleDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	upscaleDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	device->CreateSamplerState(&upscaleDesc, &upscaleSampler);
+
+	geometryHeap = new GeometryHeap(device, context);
 	CreateBasicGeometry();
+	printf("\n%s", geometryHeap->Describe().c_str());
+
+	if (renderer->BuildStaticBatches(device, entities))
+		printf("\n%s", renderer->DescribeStaticBatches().c_str());
 
 	
 
@@ -179,27 +290,71 @@ void Game::Init()
 	light.AmbientColor = XMFLOAT4(0.1f, 0.1f, 0.1f, 1.0f);
 	light.DiffuseColor = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
 	light.Direction = XMFLOAT3(1.0f, -1.0f, 0.0f);
+	light.Padding = 0.0f;
 
 	//Init Light 2
 	DirectionalLight light2;
 	light2.AmbientColor = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
 	light2.DiffuseColor = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
 	light2.Direction = XMFLOAT3(1.0f, 1.0f, 0.0f);
+	light2.Padding = 0.0f;
 
-	dirLights.push_back(light);
-	dirLights.push_back(light2);
+	lightManager->AddDirectionalLight(light);
+	lightManager->AddDirectionalLight(light2);
 
 	//Init Point Light 1
 	PointLight pLight;
 	pLight.Color = XMFLOAT4(1.0f, 0.57f, 0.17f, 1.0f);
 	pLight.Position = XMFLOAT3(2.0f, 0.0f, 0.0f);
+	pLight.Range = 6.0f;
+
+	lightManager->AddPointLight(pLight);
+
+	//Init Spot Light 1, shining down on the scene
+	SpotLight sLight;
+	sLight.Color = XMFLOAT4(0.3f, 0.5f, 1.0f, 1.0f);
+	sLight.Position = XMFLOAT3(0.0f, 5.0f, 0.0f);
+	sLight.Range = 10.0f;
+	sLight.Direction = XMFLOAT3(0.0f, -1.0f, 0.0f);
+	sLight.SpotAngle = cosf(0.35f);
+
+	lightManager->AddSpotLight(sLight);
+
+	// Lots of small lights to exercise the clustered lighting
+	CreateLightField(1024);
+
+	// The governor can only take lights away from these
+	frameGovernor->SetLightCount((unsigned int)(lightManager->GetPointLights().size() + lightManager->GetSpotLights().size()));
+
+	// The primitive topology is part of each material's
+	// PipelineState, along with the shaders and fixed function states
+}
 
-	pointLights.push_back(pLight);
+// --------------------------------------------------------
+// Scatters small point lights with varying colours around
+// the scene.  Uses a fixed seed so every run looks the same.
+// --------------------------------------------------------
+void Game::CreateLightField(unsigned int count)
+{
+	unsigned int seed = 12345;
+	auto random01 = [&seed]()
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) / 16777216.0f;
+	};
 
-	// Tell the input assembler stage of the pipeline what kind of
-	// geometric primitives (points, lines or triangles) we want to draw.  
-	// Essentially: "What kind of shape should the GPU draw with our data?"
-	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	for (unsigned int i = 0; i < count; i++)
+	{
+		PointLight light;
+		light.Position = XMFLOAT3(
+			random01() * 40.0f - 20.0f,
+			random01() * 6.0f - 3.0f,
+			random01() * 40.0f - 20.0f);
+		light.Color = XMFLOAT4(random01(), random01(), random01(), 1.0f);
+		light.Range = 0.5f + random01() * 1.5f;
+
+		lightManager->AddPointLight(light);
+	}
 }
 
 // --------------------------------------------------------
@@ -210,7 +365,70 @@ void Game::Init()
 // --------------------------------------------------------
 void Game::LoadShaders()
 {
-	vertexShader = new SimpleVertexShader(device, context);
+	// Build every variant from source when it's available (e.g.
+	// running from the project directory), using the cache
+	shaderLibrary = new ShaderPermutationLibrary(device, context, L"ShaderCache");
+	unsigned int vertexProgram = shaderLibrary->AddProgram(L"VertexShader.hlsl", SHADER_PROGRAM_VERTEX, SHADER_FEATURE_INSTANCING);
+	// Only the variants something draws with are built.  No material
+	// alpha tests and the clustered lights are always on, so
+	// ALPHA_TEST and DIRECTIONAL_ONLY would quadruple them for nothing.
+	unsigned int pixelProgram = shaderLibrary->AddProgram(L"PixelShader.hlsl", SHADER_PROGRAM_PIXEL, SHADER_FEATURE_TEXTURE_ARRAY);
+	unsigned int depthProgram = shaderLibrary->AddProgram(L"DepthVertexShader.hlsl", SHADER_PROGRAM_VERTEX, 0);
+	bool built = shaderLibrary->Build();
+
+	const ShaderPermutationStats& permutationStats = shaderLibrary->GetStats();
+	printf("\nShader permutations: %u variants, %u cached, %u compiled, %u failed in %.1fms",
+		permutationStats.Variants, permutationStats.CacheHits, permutationStats.Compiled,
+		permutationStats.Failed, permutationStats.BuildMs);
+
+	if (built)
+	{
+		vertexShader = shaderLibrary->GetVertexShader(vertexProgram, 0);
+		pixelShader = shaderLibrary->GetPixelShader(pixelProgram, 0);
+		depthShader = shaderLibrary->GetVertexShader(depthProgram, 0);
+		instancedVertexShader = shaderLibrary->GetVertexShader(vertexProgram, SHADER_FEATURE_INSTANCING);
+		arrayPixelShader = shaderLibrary->GetPixelShader(pixelProgram, SHADER_FEATURE_TEXTURE_ARRAY);
+	}
+	else
+	{
+		// Fall back to the .cso files built with the project
+		delete shaderLibrary;
+		shaderLibrary = 0;
+		LoadPrecompiledShaders();
+	}
+
+	// The upscale pass has no variants, so it always comes from the project build
+	upscaleVertexShader = new SimpleVertexShader(device, context);
+	if (!upscaleVertexShader->LoadShaderFile(L"Debug/UpscaleVertexShader.cso"))
+		upscaleVertexShader->LoadShaderFile(L"UpscaleVertexShader.cso");
+
+	upscalePixelShader = new SimplePixelShader(device, context);
+	if (!upscalePixelShader->LoadShaderFile(L"Debug/UpscalePixelShader.cso") &&
+		!upscalePixelShader->LoadShaderFile(L"UpscalePixelShader.cso"))
+	{
+		// Without it the scene is always drawn at full resolution
+		delete upscalePixelShader;
+		upscalePixelShader = 0;
+	}
+
+	const ShaderReflectionStats& reflectionStats = GetShaderReflectionStats();
+	printf("\nShader reflection: %u from cache, %u reflected, %.3fms",
+		reflectionStats.CacheHits, reflectionStats.Reflected, reflectionStats.ReflectionMs);
+
+	const InputLayoutCacheStats& layoutStats = inputLayoutCache->GetStats();
+	printf("\nInput layouts: %u created for %u vertex shaders, %u failed",
+		layoutStats.Created, layoutStats.Requests, layoutStats.Failed);
+}
+
+// --------------------------------------------------------
+// Loads the default variants compiled by the project build
+// --------------------------------------------------------
+void Game::LoadPrecompiledShaders()
+{
+	// The layout comes from the Vertex struct, so this shader
+	// needs no input signature reflection
+	vertexShader = new SimpleVertexShader(device, context,
+		VertexFormat<Vertex>::Elements(), VertexFormat<Vertex>::ElementCount);
 	if (!vertexShader->LoadShaderFile(L"Debug/VertexShader.cso"))
 		vertexShader->LoadShaderFile(L"VertexShader.cso");		
 
@@ -218,6 +436,12 @@ void Game::LoadShaders()
 	if(!pixelShader->LoadShaderFile(L"Debug/PixelShader.cso"))
 		pixelShader->LoadShaderFile(L"PixelShader.cso");
 
+	// Reads only the position, from either vertex layout
+	depthShader = new SimpleVertexShader(device, context,
+		VertexFormat<VertexPosition>::Elements(), VertexFormat<VertexPosition>::ElementCount);
+	if (!depthShader->LoadShaderFile(L"Debug/DepthVertexShader.cso"))
+		depthShader->LoadShaderFile(L"DepthVertexShader.cso");
+
 	// You'll notice that the code above attempts to load each
 	// compiled shader file (.cso) from two different relative paths.
 
@@ -275,6 +499,67 @@ void Game::CreateMatrices()
 }
 
 
+// Ripple grid: vertices per side, size, and the bump on it
+static const unsigned int rippleGridSize = 64;
+static const float rippleExtent = 16.0f;
+static const float rippleRadius = 2.0f;
+static const float rippleHeight = 0.75f;
+
+// --------------------------------------------------------
+// One row of the ripple grid with the bump centred at
+// (bumpX, bumpZ), in the grid's object space
+// --------------------------------------------------------
+static void BuildRippleRow(unsigned int row, float bumpX, float bumpZ, Vertex* vertices)
+{
+	float cellSize = rippleExtent / (rippleGridSize - 1);
+	float z = row * cellSize - rippleExtent * 0.5f;
+	for (unsigned int column = 0; column < rippleGridSize; column++)
+	{
+		float x = column * cellSize - rippleExtent * 0.5f;
+		float dx = x - bumpX;
+		float dz = z - bumpZ;
+		float t = 1.0f - (dx * dx + dz * dz) / (rippleRadius * rippleRadius);
+		if (t < 0.0f)
+			t = 0.0f;
+
+		// Height is t squared, the normal comes from its slope
+		float slope = -4.0f * rippleHeight * t / (rippleRadius * rippleRadius);
+		Vertex& vertex = vertices[column];
+		vertex.Position = XMFLOAT3(x, rippleHeight * t * t, z);
+		XMStoreFloat3(&vertex.Normal, XMVector3Normalize(XMVectorSet(-slope * dx, 1.0f, -slope * dz, 0.0f)));
+		vertex.UV = XMFLOAT2((float)column / (rippleGridSize - 1), (float)row / (rippleGridSize - 1));
+	}
+}
+
+// --------------------------------------------------------
+// Moves the bump along a circle.  Only the rows it covers
+// now or covered last frame change, so only those are set.
+// --------------------------------------------------------
+void Game::UpdateRipple(float totalTime)
+{
+	float bumpX = 4.0f * cosf(totalTime * 0.5f);
+	float bumpZ = 4.0f * sinf(totalTime * 0.5f);
+
+	float cellSize = rippleExtent / (rippleGridSize - 1);
+	float firstRowZ = -rippleExtent * 0.5f;
+	int begin = (int)floorf((bumpZ - rippleRadius - firstRowZ) / cellSize);
+	int end = (int)ceilf((bumpZ + rippleRadius - firstRowZ) / cellSize) + 1;
+	unsigned int rowBegin = (unsigned int)max(begin, 0);
+	unsigned int rowEnd = (unsigned int)min(end, (int)rippleGridSize);
+
+	unsigned int first = min(rowBegin, rippleRowBegin);
+	unsigned int last = max(rowEnd, rippleRowEnd);
+	rippleRowBegin = rowBegin;
+	rippleRowEnd = rowEnd;
+	if (first >= last)
+		return;
+
+	std::vector<Vertex> rows((last - first) * rippleGridSize);
+	for (unsigned int row = first; row < last; row++)
+		BuildRippleRow(row, bumpX, bumpZ, &rows[(row - first) * rippleGridSize]);
+	rippleMesh->SetVertices(first * rippleGridSize, &rows[0], (unsigned int)rows.size());
+}
+
 // --------------------------------------------------------
 // Creates the geometry we're going to draw - a single triangle for now
 // --------------------------------------------------------
@@ -282,38 +567,181 @@ void Game::CreateBasicGeometry()
 {
 	std::string pathModifier = "./Assets/Models/";
 
-	materials.push_back(new Material(vertexShader, pixelShader, earthSRV, sampler));	//0
-	materials.push_back(new Material(vertexShader, pixelShader, crateSRV, sampler));	//1
-	materials.push_back(new Material(vertexShader, pixelShader, metalSRV, sampler));	//2
-	materials.push_back(new Material(vertexShader, pixelShader, metalRustSRV, sampler));//3
+	// Positions and the other attributes in separate streams, so
+	// the depth prepass reads 12 bytes per vertex instead of 32
+	VertexStreams streams = VERTEX_STREAMS_SPLIT;
+
+	materials.push_back(CreateMaterial(earthSRV, earthTexture));			//0
+	materials.push_back(CreateMaterial(crateSRV, crateTexture));			//1
+	materials.push_back(CreateMaterial(metalSRV, metalTexture));			//2
+	materials.push_back(CreateMaterial(metalRustSRV, metalRustTexture));	//3
+	materials.push_back(CreateMaterial(earthSpecSRV, earthSpecTexture));	//4
 
-	meshObjs.push_back(new Mesh(pathModifier + "sphere.obj", device));
+	// Materials differing only by their slice share one instanced draw
+	Material::GroupByBinds(materials);
+
+	meshObjs.push_back(new Mesh(pathModifier + "sphere.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[0], materials[0]));
 
-	meshObjs.push_back(new Mesh(pathModifier + "cone.obj", device));
+	// The sphere sits in the middle of the scene, use it to hide what's behind it
+	entities[0]->SetOccluder(true);
+
+	meshObjs.push_back(new Mesh(pathModifier + "cone.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[1], materials[2]));
 
-	meshObjs.push_back(new Mesh(pathModifier + "cylinder.obj", device));
+	meshObjs.push_back(new Mesh(pathModifier + "cylinder.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[2], materials[2]));
 
-	meshObjs.push_back(new Mesh(pathModifier + "helix.obj", device));
+	meshObjs.push_back(new Mesh(pathModifier + "helix.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[3], materials[3]));
 
-	meshObjs.push_back(new Mesh(pathModifier + "torus.obj", device));
+	meshObjs.push_back(new Mesh(pathModifier + "torus.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[4], materials[2]));
 
-	meshObjs.push_back(new Mesh(pathModifier + "cube.obj", device));
+	meshObjs.push_back(new Mesh(pathModifier + "cube.obj", device, streams));
 
 	entities.push_back(new Entity(meshObjs[5], materials[1]));
 
+	// Static dressing: a ring of crates and metal posts around
+	// the scene, batched per material once it's placed
+	const unsigned int dressingCount = 48;
+	for (unsigned int i = 0; i < dressingCount; i++)
+	{
+		float angle = XM_2PI * i / dressingCount;
+		bool crate = (i % 2) == 0;
+		Entity* prop = new Entity(crate ? meshObjs[5] : meshObjs[2], crate ? materials[1] : materials[2]);
+		prop->SetTranslation(8.0f * cosf(angle), -3.0f, 8.0f * sinf(angle));
+		prop->SetScale(0.5f, crate ? 0.5f : 1.0f, 0.5f);
+		prop->SetStatic(true);
+		prop->CalculateWorldMatrix();
+		entities.push_back(prop);
+	}
+
+	// Moons circling above the scene, alternating between two
+	// textures of one array, so they're still one instanced draw
+	const unsigned int moonCount = 16;
+	for (unsigned int i = 0; i < moonCount; i++)
+	{
+		float angle = XM_2PI * i / moonCount;
+		Entity* moon = new Entity(meshObjs[0], materials[(i % 2) ? 4 : 0]);
+		moon->SetTranslation(5.0f * cosf(angle), 3.0f, 5.0f * sinf(angle));
+		moon->SetScale(0.4f, 0.4f, 0.4f);
+		moon->CalculateWorldMatrix();
+		entities.push_back(moon);
+	}
+
+	// A flat grid below the dressing, deformed every frame by UpdateRipple()
+	const unsigned int rippleVertices = rippleGridSize * rippleGridSize;
+	const unsigned int rippleIndices = (rippleGridSize - 1) * (rippleGridSize - 1) * 6;
+	rippleMesh = new DynamicMesh(device, rippleVertices, rippleIndices,
+		XMFLOAT3(-rippleExtent * 0.5f, 0.0f, -rippleExtent * 0.5f),
+		XMFLOAT3(rippleExtent * 0.5f, rippleHeight, rippleExtent * 0.5f));
+	meshObjs.push_back(rippleMesh);
+
+	std::vector<Vertex> gridVertices(rippleVertices);
+	std::vector<UINT> gridIndices;
+	gridIndices.reserve(rippleIndices);
+	// Starts with the bump off the grid, so flat
+	for (unsigned int row = 0; row < rippleGridSize; row++)
+		BuildRippleRow(row, 0.0f, rippleExtent, &gridVertices[row * rippleGridSize]);
+	for (unsigned int row = 0; row + 1 < rippleGridSize; row++)
+	{
+		for (unsigned int column = 0; column + 1 < rippleGridSize; column++)
+		{
+			// Clockwise seen from above
+			UINT corner = row * rippleGridSize + column;
+			gridIndices.push_back(corner);
+			gridIndices.push_back(corner + rippleGridSize);
+			gridIndices.push_back(corner + 1);
+			gridIndices.push_back(corner + 1);
+			gridIndices.push_back(corner + rippleGridSize);
+			gridIndices.push_back(corner + rippleGridSize + 1);
+		}
+	}
+	rippleMesh->SetVertices(0, &gridVertices[0], rippleVertices);
+	rippleMesh->SetIndices(0, &gridIndices[0], rippleIndices);
+	rippleMesh->SetIndexCount(rippleIndices);
+	rippleRowBegin = rippleGridSize;
+	rippleRowEnd = 0;
+
+	Entity* ripple = new Entity(rippleMesh, materials[0]);
+	ripple->SetTranslation(0.0f, -4.5f, 0.0f);
+	ripple->CalculateWorldMatrix();
+	entities.push_back(ripple);
 }
 
 
+// --------------------------------------------------------
+// Materials whose texture was packed sample its array with
+// the slice passed per instance; the rest bind the texture
+// with the default shaders
+// --------------------------------------------------------
+Material * Game::CreateMaterial(ID3D11ShaderResourceView * texture, TextureHandle arrayTexture)
+{
+	ID3D11ShaderResourceView* array = textureArrays->GetArray(arrayTexture);
+	if (!array || !instancedVertexShader || !arrayPixelShader)
+		return new Material(vertexShader, pixelShader, texture, sampler);
+
+	Material* material = new Material(instancedVertexShader, arrayPixelShader, array, sampler);
+	material->SetTextureSlice(textureArrays->GetSlice(arrayTexture));
+	return material;
+}
+
+// --------------------------------------------------------
+// Mip LOD bias is a sampler state, so a new bias is a new
+// sampler.  Materials that bound alike still do afterwards,
+// but the groups are worked out again all the same.
+// --------------------------------------------------------
+void Game::SetLodBias(float lodBias)
+{
+	D3D11_SAMPLER_DESC sampDesc;
+	sampler->GetDesc(&sampDesc);
+	sampDesc.MipLODBias = lodBias;
+
+	ID3D11SamplerState* biased = 0;
+	if (FAILED(device->CreateSamplerState(&sampDesc, &biased)))
+		return;
+
+	for (size_t i = 0; i < materials.size(); i++)
+		materials[i]->SetSamplerState(biased);
+	Material::GroupByBinds(materials);
+
+	sampler->Release();
+	sampler = biased;
+	samplerLodBias = lodBias;
+}
+
+void Game::SetFrameBudget(float milliseconds)
+{
+	FrameGovernorSettings settings = frameGovernor->GetSettings();
+	settings.TargetMs = milliseconds;
+	delete frameGovernor;
+	frameGovernor = new FrameGovernor(settings);
+}
+
+void Game::SetGovernorTrace(const std::string & path)
+{
+	governorTrace.open(path.c_str(), std::ios::app);
+}
+
+// --------------------------------------------------------
+// Hands the governor's choice to whatever uses each knob.
+// The tree has no mesh LODs, so the LOD bias only applies
+// to texture mips.
+// --------------------------------------------------------
+void Game::ApplyFrameQuality(const FrameQuality & quality)
+{
+	resolutionScale = upscalePixelShader ? quality.ResolutionScale : 1.0f;
+	renderer->SetMaxLights(quality.MaxLights);
+	if (quality.LodBias != samplerLodBias && sampler)
+		SetLodBias(quality.LodBias);
+}
+
 // --------------------------------------------------------
 // Handle resizing DirectX "stuff" to match the new window size.
 // For instance, updating our projection matrix's aspect ratio.
@@ -323,6 +751,9 @@ void Game::OnResize()
 	// Handle base-level DX resize stuff
 	DXCore::OnResize();
 
+	// Pooled textures are sized for the old window
+	renderGraph->ReleaseTextures();
+
 	//// Update our projection matrix since the window size changed
 	//XMMATRIX P = XMMatrixPerspectiveFovLH(
 	//	0.25f * 3.1415926535f,	// Field of View Angle
@@ -336,14 +767,64 @@ void Game::OnResize()
 }
 
 // --------------------------------------------------------
-// Update your game here - user input, move objects, AI, etc.
+// Runs this frame's simulation steps and extracts the snapshot
+//
+// When pipelined, this only starts the work, which runs on a
+// worker while Draw() submits the previous snapshot.
 // --------------------------------------------------------
-void Game::Update(float deltaTime, float totalTime)
+void Game::StepSimulation()
 {
+	QueryPerformanceCounter((LARGE_INTEGER*)&frameStartTime);
+
+	// Keys that control the engine itself are read on the main thread
 	// Quit if the escape key is pressed
 	if (GetAsyncKeyState(VK_ESCAPE))
 		Quit();
 
+	// Capture the next frame's draw stream for offline replay
+	if (GetAsyncKeyState(VK_F9) & 1)
+		renderer->CaptureNextFrame("frame.dsc");
+
+	// Toggle overlapping simulation and rendering
+	if (GetAsyncKeyState(VK_F8) & 1)
+		pipelineEnabled = !pipelineEnabled;
+
+	// Shader parameter microbenchmark
+	if (GetAsyncKeyState(VK_F10) & 1)
+		BenchmarkShaderParameters();
+
+	if (!pipelineEnabled)
+	{
+		DXCore::StepSimulation();
+		ExtractSnapshot(*simulationSnapshot);
+		return;
+	}
+
+	// Window messages are only handled between frames, so the
+	// worker has the scene, camera and input to itself until
+	// Draw() waits for it
+	RenderSnapshot* snapshot = simulationSnapshot;
+	jobSystem->Run([this, snapshot]()
+	{
+		DXCore::StepSimulation();
+		ExtractSnapshot(*snapshot);
+	}, &simulationJob);
+	simulationPending = true;
+}
+
+// --------------------------------------------------------
+// Update your game here - user input, move objects, AI, etc.
+//
+// Called once per fixed step, deltaTime is always the step
+// length and totalTime the simulated time
+// --------------------------------------------------------
+void Game::Update(float deltaTime, float totalTime)
+{
+	// Keep the transforms of the last step for interpolation
+	for (std::vector<Entity*>::iterator it = entities.begin(); it != entities.end(); ++it)
+		(*it)->BeginStep();
+	camera->BeginStep();
+
 #pragma region EnitityUpdates
 
 	entities[0]->SetTranslation(0.0f, 0.0f, 0.0f);
@@ -365,6 +846,76 @@ void Game::Update(float deltaTime, float totalTime)
 	camera->Update(deltaTime, totalTime);
 }
 
+// --------------------------------------------------------
+// Copies the state of this frame, interpolated between the
+// last two simulation steps, for the render side
+// --------------------------------------------------------
+void Game::ExtractSnapshot(RenderSnapshot & snapshot)
+{
+	snapshot.Frame = ++snapshotFrame;
+	snapshot.Interpolation = interpolation;
+	snapshot.TotalTime = (float)((simulationStep + interpolation) * (double)fixedTimeStep);
+	snapshot.View = camera->GetInterpolatedViewMatrix(interpolation);
+	snapshot.Projection = camera->GetProjectionMatrix();
+	snapshot.CameraPosition = camera->GetInterpolatedPosition(interpolation);
+	// Drawn to the top left of the targets at this size, then stretched
+	snapshot.ResolutionScale = resolutionScale;
+	snapshot.ScreenWidth = max(1u, (unsigned int)(width * resolutionScale + 0.5f));
+	snapshot.ScreenHeight = max(1u, (unsigned int)(height * resolutionScale + 0.5f));
+
+	renderer->Extract(entities, lightManager, snapshot);
+}
+
+// --------------------------------------------------------
+// Sets what Material::Prepare sets for one entity (three
+// matrices, a texture and a sampler) many times over, once
+// with string names and once with resolved handles, and
+// prints the cost per entity of each
+// --------------------------------------------------------
+void Game::BenchmarkShaderParameters()
+{
+	const unsigned int iterations = 100000;
+	XMFLOAT4X4 world = entities[0]->GetWorldMatrix();
+	XMFLOAT4X4 view = camera->GetViewMatrix();
+	XMFLOAT4X4 projection = camera->GetProjectionMatrix();
+
+	__int64 perfFreq, start, end;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		vertexShader->SetMatrix4x4("world", world);
+		vertexShader->SetMatrix4x4("view", view);
+		vertexShader->SetMatrix4x4("projection", projection);
+		pixelShader->SetShaderResourceView("diffuseTexture", earthSRV);
+		pixelShader->SetSamplerState("basicSampler", sampler);
+	}
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	double stringNs = (end - start) * 1000000000.0 / perfFreq / iterations;
+
+	SimpleShaderParameter worldParameter = vertexShader->GetParameter(SHADER_NAME("world"));
+	SimpleShaderParameter viewParameter = vertexShader->GetParameter(SHADER_NAME("view"));
+	SimpleShaderParameter projectionParameter = vertexShader->GetParameter(SHADER_NAME("projection"));
+	SimpleShaderSlot textureSlot = pixelShader->GetShaderResourceViewSlot(SHADER_NAME("diffuseTexture"));
+	SimpleShaderSlot samplerSlot = pixelShader->GetSamplerSlot(SHADER_NAME("basicSampler"));
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		vertexShader->SetMatrix4x4(worldParameter, world);
+		vertexShader->SetMatrix4x4(viewParameter, view);
+		vertexShader->SetMatrix4x4(projectionParameter, projection);
+		pixelShader->SetShaderResourceView(textureSlot, earthSRV);
+		pixelShader->SetSamplerState(samplerSlot, sampler);
+	}
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	double handleNs = (end - start) * 1000000000.0 / perfFreq / iterations;
+
+	printf("\nShader parameters per entity: %.1fns by name, %.1fns with handles (%.1fx)",
+		stringNs, handleNs, handleNs > 0.0 ? stringNs / handleNs : 0.0);
+}
+
 // --------------------------------------------------------
 // Clear the screen, redraw everything, present to the user
 // --------------------------------------------------------
@@ -373,15 +924,18 @@ void Game::Draw(float deltaTime, float totalTime)
 	// Background color (Cornflower Blue in this case) for clearing
 	const float color[4] = {0.4f, 0.6f, 0.75f, 0.0f};
 
-	// Clear the render target and depth buffer (erases what's on the screen)
-	//  - Do this ONCE PER FRAME
-	//  - At the beginning of Draw (before drawing *anything*)
-	context->ClearRenderTargetView(backBufferRTV, color);
-	context->ClearDepthStencilView(
-		depthStencilView, 
-		D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
-		1.0f,
-		0);
+	// Serial frames draw what Update() just extracted, pipelined
+	// frames the previous snapshot while the next one is filled
+	if (!simulationPending)
+		std::swap(simulationSnapshot, renderSnapshot);
+
+	// Dynamic geometry is changed on this thread, the renderer uploads it
+	UpdateRipple(totalTime);
+
+	// The frame is described as passes over DXCore's targets
+	renderGraph->Reset();
+	RenderGraphResource backBuffer = renderGraph->ImportRenderTarget("Back Buffer", backBufferRTV);
+	RenderGraphResource depth = renderGraph->ImportDepthStencil("Depth", depthStencilView);
 
 #pragma region Old Code
 
@@ -439,16 +993,211 @@ void Game::Draw(float deltaTime, float totalTime)
 	//		0);    // Offset to add to each index when looking up vertices
 	//}
 #pragma endregion
-	//Set View and Projection matrices
-	vertexShader->SetMatrix4x4("view", camera->GetViewMatrix());
-	vertexShader->SetMatrix4x4("projection", camera->GetProjectionMatrix());
+	// Below full resolution the scene goes to the top left of a
+	// full size texture, so a new scale needs no new texture
+	const RenderSnapshot* snapshot = renderSnapshot;
+	bool upscale = snapshot->ResolutionScale < 1.0f && upscalePixelShader;
+	RenderGraphResource sceneColor = backBuffer;
+
+	renderGraph->AddPass("Scene",
+		[&](RenderGraphBuilder& builder)
+		{
+			if (upscale)
+			{
+				RenderGraphTextureDesc desc = { width, height, DXGI_FORMAT_R8G8B8A8_UNORM, D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE };
+				sceneColor = builder.CreateTexture("Scene Color", desc);
+			}
+			else
+			{
+				builder.Write(backBuffer);
+			}
+			builder.Write(depth);
+		},
+		[&](const RenderGraph& graph, ID3D11DeviceContext* context)
+		{
+			ID3D11RenderTargetView* rtv = graph.GetRenderTargetView(sceneColor);
+			ID3D11DepthStencilView* dsv = graph.GetDepthStencilView(depth);
+			context->OMSetRenderTargets(1, &rtv, dsv);
+
+			D3D11_VIEWPORT viewport = {};
+			viewport.Width = upscale ? (float)snapshot->ScreenWidth : (float)width;
+			viewport.Height = upscale ? (float)snapshot->ScreenHeight : (float)height;
+			viewport.MaxDepth = 1.0f;
+			context->RSSetViewports(1, &viewport);
+
+			// Clear the render target and depth buffer (erases what's on the screen)
+			//  - Do this ONCE PER FRAME
+			//  - At the beginning of Draw (before drawing *anything*)
+			context->ClearRenderTargetView(rtv, color);
+			context->ClearDepthStencilView(
+				dsv,
+				D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL,
+				1.0f,
+				0);
+
+			// Nothing to draw until the first simulated frame
+			if (snapshot->Frame != 0)
+				renderer->Draw(*snapshot, context, lightManager);
+		});
+
+	if (upscale)
+	{
+		renderGraph->AddPass("Upscale",
+			[&](RenderGraphBuilder& builder)
+			{
+				builder.Read(sceneColor);
+				builder.Write(backBuffer);
+			},
+			[&](const RenderGraph& graph, ID3D11DeviceContext* context)
+			{
+				ID3D11RenderTargetView* rtv = graph.GetRenderTargetView(backBuffer);
+				context->OMSetRenderTargets(1, &rtv, 0);
+
+				D3D11_VIEWPORT viewport = {};
+				viewport.Width = (float)width;
+				viewport.Height = (float)height;
+				viewport.MaxDepth = 1.0f;
+				context->RSSetViewports(1, &viewport);
+
+				// Fixed function defaults, whatever the scene left behind
+				context->OMSetBlendState(0, 0, 0xffffffff);
+				context->OMSetDepthStencilState(0, 0);
+				context->RSSetState(0);
+				context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+				UpscalePixelShaderExternalData constants;
+				constants.uvScale = XMFLOAT2((float)snapshot->ScreenWidth / width, (float)snapshot->ScreenHeight / height);
+				constants.uvMax = XMFLOAT2((snapshot->ScreenWidth - 0.5f) / width, (snapshot->ScreenHeight - 0.5f) / height);
+				upscalePixelShader->SetConstants(constants);
+				upscalePixelShader->SetShaderResourceView(upscalePixelShader->GetShaderResourceViewSlot(SHADER_NAME("sceneTexture")), graph.GetShaderResourceView(sceneColor));
+				upscalePixelShader->SetSamplerState(upscalePixelShader->GetSamplerSlot(SHADER_NAME("linearSampler")), upscaleSampler);
+				upscalePixelShader->CopyAllBufferData();
+				upscaleVertexShader->SetShader();
+				upscalePixelShader->SetShader();
+				context->Draw(3, 0);
+			});
+	}
+
+	gpuTimer->BeginFrame();
+	if (renderGraph->Compile())
+		renderGraph->Execute(device, context);
+	gpuTimer->EndFrame();
 
-	renderer->Draw(entities, context, camera->GetViewMatrix(), camera->GetProjectionMatrix(), &dirLights[0], &pointLights[0]);
+	// Present() waits when the GPU falls behind, which is the
+	// GPU's time, not the CPU's
+	__int64 presentStart, presentEnd;
+	QueryPerformanceCounter((LARGE_INTEGER*)&presentStart);
 
 	// Present the back buffer to the user
 	//  - Puts the final frame we're drawing into the window so the user can see it
 	//  - Do this exactly ONCE PER FRAME (always at the very end of the frame)
 	swapChain->Present(0, 0);
+	QueryPerformanceCounter((LARGE_INTEGER*)&presentEnd);
+
+	// Join the simulation, its snapshot is drawn next frame
+	if (simulationPending)
+	{
+		jobSystem->Wait(&simulationJob);
+		simulationPending = false;
+		std::swap(simulationSnapshot, renderSnapshot);
+	}
+
+	// Nothing is simulating and the last snapshot has been
+	// submitted, so fragmented geometry pages can move.  The
+	// snapshot drawn next was extracted with the old buffers.
+	if (geometryHeap->Compact() > 0)
+		renderer->RefreshGeometry(*renderSnapshot);
+
+	// The GPU time is a few frames old by now, which the
+	// governor's hold between changes allows for
+	__int64 frameEnd;
+	QueryPerformanceCounter((LARGE_INTEGER*)&frameEnd);
+	float cpuMs = (float)((frameEnd - frameStartTime - (presentEnd - presentStart)) * perfCounterMs);
+	float gpuMs = gpuTimer->GetLastMs();
+	if (governorTrace.is_open())
+		governorTrace << cpuMs << " " << gpuMs << "\n";
+
+	size_t decisionCount = frameGovernor->GetDecisions().size();
+	ApplyFrameQuality(frameGovernor->Update(cpuMs, gpuMs));
+	for (size_t i = decisionCount; i < frameGovernor->GetDecisions().size(); i++)
+		printf("\nGovernor: %s", FrameGovernor::DescribeDecision(frameGovernor->GetDecisions()[i]).c_str());
+
+#if defined(DEBUG) || defined(_DEBUG)
+	// Print the occlusion culling stats about once a second
+	if (totalTime - lastStatsTime >= 1.0f)
+	{
+		const ViewCullingStats& viewStats = renderer->GetViewCullingStats();
+		printf("\nView culling: %u objects x %u views, %u visible, %u plane tests %.3fms",
+			viewStats.ObjectCount, viewStats.ViewCount, viewStats.VisibleCount,
+			viewStats.PlaneTests, viewStats.CullMs);
+
+		const StaticBatchStats& batchStats = renderer->GetStaticBatchStats();
+		printf("\nStatic batches: %u/%u pieces visible in %u draws",
+			batchStats.VisiblePieces, batchStats.Entities, batchStats.Draws);
+
+		printf("\nGeometry: %u vertex/index buffer binds, %u meshes in %u+%u+%u split heap pages, %u free ranges, %u compactions",
+			renderer->GetGeometryBinds(), geometryHeap->GetStats().Meshes,
+			geometryHeap->GetStats().VertexPages, geometryHeap->GetStats().IndexPages,
+			geometryHeap->GetStats().SplitPages, geometryHeap->GetStats().FreeRanges,
+			geometryHeap->GetStats().Compactions);
+
+		const InstancingStats& instancingStats = renderer->GetInstancingStats();
+		printf("\nInstancing: %u packets in %u draws (%u instanced), %u material binds",
+			instancingStats.Packets, instancingStats.Draws, instancingStats.InstancedDraws,
+			instancingStats.MaterialBinds);
+
+		const DepthPassStats& depthStats = renderer->GetDepthPassStats();
+		printf("\nDepth prepass: %u draws (%u split), %u vertex bytes fetched (%u interleaved)",
+			depthStats.Draws, depthStats.SplitDraws, depthStats.FetchBytes, depthStats.InterleavedBytes);
+
+		const DynamicMeshStats& dynamicStats = renderer->GetDynamicMeshStats();
+		printf("\nDynamic meshes: %u drawn, %u uploaded, %u vertex + %u index bytes written (%u if whole), %u discards",
+			dynamicStats.Meshes, dynamicStats.Uploads, dynamicStats.VertexBytes, dynamicStats.IndexBytes,
+			dynamicStats.WholeBytes, dynamicStats.Discards);
+
+		const OcclusionStats& stats = renderer->GetOcclusionStats();
+		printf("\nOcclusion: %u occluders (%u tris) %.3fms, %u/%u culled %.3fms",
+			stats.OccluderCount, stats.OccluderTriangles, stats.RasterizeMs,
+			stats.CulledCount, stats.TestedCount, stats.TestMs);
+
+		const ShadowCascadeStats& shadowStats = renderer->GetShadowCascadeStats();
+		printf("\nShadows: %u cascades, casters %u/%u/%u/%u of %u/%u/%u/%u candidates, fit %.3fms",
+			shadowStats.Cascades, shadowStats.Casters[0], shadowStats.Casters[1], shadowStats.Casters[2], shadowStats.Casters[3],
+			shadowStats.Candidates[0], shadowStats.Candidates[1], shadowStats.Candidates[2], shadowStats.Candidates[3],
+			shadowStats.FitMs);
+
+		const ClusterStats& lightStats = renderer->GetClusterStats();
+		printf("\nLights: %u point, %u spot (%u capped), %u cluster refs (%u dropped) binned in %.3fms, %u bytes uploaded",
+			lightStats.PointLightCount, lightStats.SpotLightCount, lightStats.CappedCount,
+			lightStats.IndexCount, lightStats.OverflowCount, lightStats.BinMs,
+			lightManager->GetUploadedBytes());
+
+		const FrameQuality& quality = frameGovernor->GetQuality();
+		printf("\nFrame governor: %.2fms of %.2fms, resolution scale %.2f, LOD bias %.1f, %u lights, %u decisions",
+			frameGovernor->GetFilteredMs(), frameGovernor->GetSettings().TargetMs,
+			quality.ResolutionScale, quality.LodBias, quality.MaxLights,
+			(unsigned int)frameGovernor->GetDecisions().size());
+
+		const ConstantBufferStats& cbStats = renderer->GetConstantBufferStats();
+		printf("\nConstants: %u uploads, %u bytes, %u wrap stalls %.3fms (%s, %u pooled buffers)",
+			cbStats.Uploads, cbStats.BytesUploaded, cbStats.WrapStalls, cbStats.StallMs,
+			cbStats.OffsetBinding ? "ring" : "pooled", cbStats.PooledBuffers);
+
+		const SimpleShaderUploadStats& uploadStats = ISimpleShader::GetUploadStats();
+		printf("\nConstant buffers: %u copied (%u changed bytes), %u unchanged and skipped",
+			uploadStats.Uploads, uploadStats.ChangedBytes, uploadStats.SkippedUploads);
+
+		const PipelineStateStats& stateStats = renderer->GetPipelineStateStats();
+		printf("\nPipeline states: %u distinct, %u binds (%u skipped), %u state changes",
+			stateStats.States, stateStats.Binds, stateStats.SkippedBinds, stateStats.StateChanges);
+
+		const CommandQueueStats& queueStats = renderer->GetCommandQueueStats();
+		printf("\nDraw packets: %u in %u slices (%u bytes), record %.3fms, merge %.3fms, submit %.3fms",
+			queueStats.Packets, queueStats.Slices, queueStats.Bytes,
+			queueStats.RecordMs, queueStats.MergeMs, queueStats.SubmitMs);
+		lastStatsTime = totalTime;
+	}
+#endif
 }
 
 
@@ -2,15 +2,24 @@
 
 #include "DXCore.h"
 #include "SimpleShader.h"
+#include "ShaderPermutations.h"
+#include "InputLayoutCache.h"
+#include "RenderGraph.h"
 #include <DirectXMath.h>
 #include "Mesh.h"
+#include "DynamicMesh.h"
 #include "Entity.h"
 #include "Renderer.h"
 #include "InputManager.h"
 #include "Camera.h"
 #include "Material.h"
-#include "Lights.h"
+#include "LightManager.h"
+#include "JobSystem.h"
 #include "WICTextureLoader.h"
+#include "TextureArrays.h"
+#include "FrameGovernor.h"
+#include "GpuTimer.h"
+#include <fstream>
 
 class Camera;
 
@@ -28,6 +37,7 @@ public:
 	void OnResize();
 	void Update(float deltaTime, float totalTime);
 	void Draw(float deltaTime, float totalTime);
+	void StepSimulation();
 
 	// Overridden mouse input helper methods
 	void OnMouseDown (WPARAM buttonState, int x, int y);
@@ -47,6 +57,13 @@ public:
 
 	// Get Camera Position
 	XMFLOAT3& GetCameraPostion();
+
+	// Frame time the governor keeps to, 60Hz by default
+	void SetFrameBudget(float milliseconds);
+
+	// Appends every frame's CPU and GPU time to a trace file
+	// for --governor-replay
+	void SetGovernorTrace(const std::string& path);
 private:
 
 	// Game Instance
@@ -54,19 +71,58 @@ private:
 
 	// Initialization helper methods - feel free to customize, combine, etc.
 	void LoadShaders(); 
+	void LoadPrecompiledShaders();
 	void CreateMatrices();
 	void CreateBasicGeometry();
 
 	// Wrappers for DirectX shaders to provide simplified functionality
 	SimpleVertexShader* vertexShader;
 	SimplePixelShader* pixelShader;
+	SimpleVertexShader* depthShader;	// Position-only, for the depth prepass
+
+	// Variants for materials whose texture is a slice of an
+	// array, null when the library couldn't be built
+	SimpleVertexShader* instancedVertexShader;
+	SimplePixelShader* arrayPixelShader;
+
+	// Every compiled variant of the scene shaders, null when
+	// the precompiled .cso files are used instead
+	ShaderPermutationLibrary* shaderLibrary;
+	InputLayoutCache* inputLayoutCache;
+
+	// Vertex and index buffers every Mesh is suballocated from
+	GeometryHeap* geometryHeap;
+
+	// Grid under the scene with a bump travelling across it,
+	// rewriting only the rows the bump left or entered
+	DynamicMesh* rippleMesh;
+	unsigned int rippleRowBegin;
+	unsigned int rippleRowEnd;
+	void UpdateRipple(float totalTime);
 
 	//Texture
 	ID3D11ShaderResourceView* earthSRV;
 	ID3D11ShaderResourceView* metalSRV;
 	ID3D11ShaderResourceView* metalRustSRV;
 	ID3D11ShaderResourceView* crateSRV;
+	ID3D11ShaderResourceView* earthSpecSRV;
 	ID3D11SamplerState* sampler;
+	float samplerLodBias;
+
+	// Recreates the sampler with another mip LOD bias and gives
+	// it to every material
+	void SetLodBias(float lodBias);
+
+	// The textures above, packed into arrays by size
+	TextureArrayPacker* textureArrays;
+	TextureHandle earthTexture;
+	TextureHandle crateTexture;
+	TextureHandle metalTexture;
+	TextureHandle metalRustTexture;
+	TextureHandle earthSpecTexture;
+
+	// Material using the texture's array when it was packed
+	Material* CreateMaterial(ID3D11ShaderResourceView* texture, TextureHandle arrayTexture);
 
 	// Keeps track of the old mouse position.  Useful for 
 	// determining how far the mouse moved in a single frame.
@@ -84,16 +140,60 @@ private:
 	//Renderer object
 	Renderer* renderer;
 
+	// The frame's passes, rebuilt every Draw()
+	RenderGraph* renderGraph;
+
 	//InputManager Object
 	InputManager* inputMgr;
 
 	//Camera Object
 	Camera* camera;
 
-	//Array of all Directional Lights
-	std::vector<DirectionalLight> dirLights;
-
-	//Array of all point lights
-	std::vector<PointLight> pointLights;
+	//All lights in the scene
+	LightManager* lightManager;
+
+	// Worker threads shared by the engine systems
+	JobSystem* jobSystem;
+
+	// Fills the scene with small coloured point lights
+	void CreateLightField(unsigned int count);
+
+	// Last time the culling stats were printed
+	float lastStatsTime;
+
+	// Trades resolution, texture detail and lights for frame
+	// time.  The CPU time is the main thread's, from the start
+	// of StepSimulation() to the simulation join, minus Present().
+	FrameGovernor* frameGovernor;
+	GpuTimer* gpuTimer;
+	std::ofstream governorTrace;
+	double perfCounterMs;
+	__int64 frameStartTime;
+	float resolutionScale;		// Of the snapshots extracted from now on
+	void ApplyFrameQuality(const FrameQuality& quality);
+
+	// Stretches a scene rendered at a lower resolution over the back buffer
+	SimpleVertexShader* upscaleVertexShader;
+	SimplePixelShader* upscalePixelShader;
+	ID3D11SamplerState* upscaleSampler;
+
+	// Copies the camera, visible entities and lights for the render side
+	void ExtractSnapshot(RenderSnapshot& snapshot);
+
+	// Times per-entity shader parameter setup, by name against handles
+	void BenchmarkShaderParameters();
+
+	// Double-buffered render snapshots.  The simulation fills one
+	// while Draw() submits the other; they're swapped once per
+	// frame, after the simulation job has been waited on.
+	RenderSnapshot snapshots[2];
+	RenderSnapshot* simulationSnapshot;
+	RenderSnapshot* renderSnapshot;
+	unsigned long long snapshotFrame;
+
+	// Overlap the simulation of the next frame with drawing this one?
+	bool pipelineEnabled;
+	bool simulationPending;
+	JobCounter simulationJob;
 };
 
@@ -0,0 +1,195 @@
+"""
+Generates ShaderConstants.h from the cbuffers in the project's HLSL files
+
+Each cbuffer becomes a C++ struct laid out with HLSL packing rules: a
+variable never straddles a 16 byte register, and the buffer size is rounded
+up to a whole register.  Padding is made explicit and every offset is
+checked with a static_assert, so the struct and the shader can't drift
+apart without a compile error.
+
+Conditional blocks are resolved with no feature defines set, i.e. for the
+default permutation.  Run from the project directory; the pre-build event
+does this when Python is available.
+"""
+
+import os
+import re
+import sys
+
+SHADERS = ["VertexShader.hlsl", "PixelShader.hlsl", "DepthVertexShader.hlsl", "UpscalePixelShader.hlsl"]
+OUTPUT = "ShaderConstants.h"
+
+# HLSL type -> (C++ type, size in bytes)
+TYPES = {
+    "float": ("float", 4),
+    "float2": ("DirectX::XMFLOAT2", 8),
+    "float3": ("DirectX::XMFLOAT3", 12),
+    "float4": ("DirectX::XMFLOAT4", 16),
+    "int": ("int", 4),
+    "int2": ("DirectX::XMINT2", 8),
+    "int3": ("DirectX::XMINT3", 12),
+    "int4": ("DirectX::XMINT4", 16),
+    "uint": ("unsigned int", 4),
+    "uint2": ("DirectX::XMUINT2", 8),
+    "uint3": ("DirectX::XMUINT3", 12),
+    "uint4": ("DirectX::XMUINT4", 16),
+    "bool": ("int", 4),
+    "matrix": ("DirectX::XMFLOAT4X4", 64),
+    "float4x4": ("DirectX::XMFLOAT4X4", 64),
+}
+
+
+def strip_comments(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    return re.sub(r"//[^\n]*", "", text)
+
+
+def resolve_conditionals(text, defines):
+    """Keeps the lines active for the given defines (name -> value)"""
+    output = []
+    stack = []  # (this branch active, any branch taken, parent active)
+    active = True
+    for line in text.splitlines():
+        directive = line.strip()
+        match = re.match(r"#\s*(if|ifdef|ifndef|elif|else|endif)\b\s*(.*)", directive)
+        if not match:
+            if active:
+                output.append(line)
+            continue
+
+        keyword, condition = match.group(1), match.group(2).strip()
+        if keyword in ("if", "ifdef", "ifndef"):
+            if keyword == "ifdef":
+                value = condition in defines
+            elif keyword == "ifndef":
+                value = condition not in defines
+            else:
+                value = evaluate(condition, defines)
+            stack.append((value, value, active))
+            active = active and value
+        elif keyword == "elif":
+            _, taken, parent = stack.pop()
+            value = not taken and evaluate(condition, defines)
+            stack.append((value, taken or value, parent))
+            active = parent and value
+        elif keyword == "else":
+            _, taken, parent = stack.pop()
+            stack.append((not taken, True, parent))
+            active = parent and not taken
+        else:
+            _, _, parent = stack.pop()
+            active = parent
+    return "\n".join(output)
+
+
+def evaluate(condition, defines):
+    expression = re.sub(r"defined\s*\(\s*(\w+)\s*\)", lambda m: "1" if m.group(1) in defines else "0", condition)
+    expression = re.sub(r"[A-Za-z_]\w*", lambda m: str(defines.get(m.group(0), 0)), expression)
+    expression = expression.replace("!", " not ").replace("&&", " and ").replace("||", " or ")
+    expression = expression.replace(" not =", "!=")
+    return bool(eval(expression))
+
+
+def parse_cbuffers(path):
+    with open(path) as f:
+        text = resolve_conditionals(strip_comments(f.read()), {})
+
+    buffers = []
+    for match in re.finditer(r"cbuffer\s+(\w+)\s*(?::\s*register\s*\(\s*b(\d+)\s*\))?\s*\{(.*?)\}", text, re.S):
+        name, register, body = match.group(1), match.group(2), match.group(3)
+        variables = []
+        for declaration in body.split(";"):
+            declaration = declaration.strip()
+            if not declaration:
+                continue
+            parts = declaration.split()
+            if len(parts) != 2 or parts[0] not in TYPES or not re.match(r"^\w+$", parts[1]):
+                sys.exit("%s: unsupported cbuffer variable '%s' in %s" % (path, declaration, name))
+            variables.append((parts[0], parts[1]))
+        buffers.append((name, int(register or 0), variables))
+    return buffers
+
+
+def pascal_case(name):
+    return name[0].upper() + name[1:]
+
+
+def generate_struct(prefix, name, register, variables):
+    struct = prefix + pascal_case(name)
+    lines = []
+    asserts = []
+    offset = 0
+    padding = 0
+    for hlsl_type, variable in variables:
+        cpp_type, size = TYPES[hlsl_type]
+
+        # Variables don't cross a 16 byte register boundary, and
+        # anything a register or larger starts on a new one
+        if size >= 16 or offset // 16 != (offset + size - 1) // 16:
+            aligned = (offset + 15) // 16 * 16
+            if aligned > offset:
+                lines.append("\tunsigned char padding%d[%d];" % (padding, aligned - offset))
+                padding += 1
+                offset = aligned
+
+        lines.append("\t%s %s;" % (cpp_type, variable))
+        asserts.append("static_assert(offsetof(%s, %s) == %d, \"%s.%s offset differs from HLSL packing\");"
+                       % (struct, variable, offset, name, variable))
+        offset += size
+
+    total = (offset + 15) // 16 * 16
+    if total > offset:
+        lines.append("\tunsigned char padding%d[%d];" % (padding, total - offset))
+
+    result = []
+    result.append("// cbuffer %s : register(b%d)" % (name, register))
+    result.append("struct %s" % struct)
+    result.append("{")
+    result.append("\tstatic const unsigned int NameHash = SHADER_NAME(\"%s\");" % name)
+    result.append("\tstatic const unsigned int Register = %d;" % register)
+    result.append("")
+    result.extend(lines)
+    result.append("};")
+    result.append("static_assert(sizeof(%s) == %d, \"%s size differs from HLSL packing\");" % (struct, total, name))
+    result.extend(asserts)
+    return "\n".join(result)
+
+
+def main():
+    directory = os.path.dirname(os.path.abspath(__file__))
+    structs = []
+    for shader in SHADERS:
+        prefix = os.path.splitext(shader)[0]
+        for name, register, variables in parse_cbuffers(os.path.join(directory, shader)):
+            structs.append(generate_struct(prefix, name, register, variables))
+
+    header = [
+        "#pragma once",
+        "// Generated by GenerateShaderConstants.py from %s - do not edit" % ", ".join(SHADERS),
+        "#include <stddef.h>",
+        "#include <DirectXMath.h>",
+        "#include \"SimpleShader.h\"",
+        "",
+        "// --------------------------------------------------------",
+        "// Constant buffers of the default shader permutations, laid",
+        "// out like HLSL packs them.  Fill one and upload it with",
+        "// ISimpleShader::SetConstants().",
+        "// --------------------------------------------------------",
+        "",
+        "\n\n".join(structs),
+        "",
+    ]
+    contents = "\n".join(header)
+
+    # Only touch the file when it changes, so it doesn't force a rebuild
+    path = os.path.join(directory, OUTPUT)
+    if os.path.exists(path):
+        with open(path) as f:
+            if f.read() == contents:
+                return
+    with open(path, "w", newline="\n") as f:
+        f.write(contents)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,433 @@
+#include "GeometryHeap.h"
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+
+RangeAllocator::RangeAllocator(unsigned int size)
+{
+	Reset(size);
+}
+
+void RangeAllocator::Reset(unsigned int size, unsigned int used)
+{
+	this->size = size;
+	freeCount = size - used;
+	freeRanges.clear();
+	if (freeCount > 0)
+	{
+		Range range = { used, freeCount };
+		freeRanges.push_back(range);
+	}
+}
+
+bool RangeAllocator::Allocate(unsigned int count, unsigned int & offset)
+{
+	if (count == 0)
+	{
+		offset = 0;
+		return true;
+	}
+
+	for (size_t i = 0; i < freeRanges.size(); i++)
+	{
+		if (freeRanges[i].Count < count)
+			continue;
+
+		offset = freeRanges[i].Offset;
+		freeRanges[i].Offset += count;
+		freeRanges[i].Count -= count;
+		if (freeRanges[i].Count == 0)
+			freeRanges.erase(freeRanges.begin() + i);
+
+		freeCount -= count;
+		return true;
+	}
+
+	return false;
+}
+
+// --------------------------------------------------------
+// Inserts the range in offset order and merges it with the
+// free ranges it touches
+// --------------------------------------------------------
+void RangeAllocator::Free(unsigned int offset, unsigned int count)
+{
+	if (count == 0)
+		return;
+
+	freeCount += count;
+
+	size_t i = 0;
+	while (i < freeRanges.size() && freeRanges[i].Offset < offset)
+		i++;
+
+	bool joinsPrevious = i > 0 && freeRanges[i - 1].Offset + freeRanges[i - 1].Count == offset;
+	bool joinsNext = i < freeRanges.size() && offset + count == freeRanges[i].Offset;
+
+	if (joinsPrevious && joinsNext)
+	{
+		freeRanges[i - 1].Count += count + freeRanges[i].Count;
+		freeRanges.erase(freeRanges.begin() + i);
+	}
+	else if (joinsPrevious)
+	{
+		freeRanges[i - 1].Count += count;
+	}
+	else if (joinsNext)
+	{
+		freeRanges[i].Offset = offset;
+		freeRanges[i].Count += count;
+	}
+	else
+	{
+		Range range = { offset, count };
+		freeRanges.insert(freeRanges.begin() + i, range);
+	}
+}
+
+unsigned int RangeAllocator::GetLargestFreeRange() const
+{
+	unsigned int largest = 0;
+	for (size_t i = 0; i < freeRanges.size(); i++)
+		largest = max(largest, freeRanges[i].Count);
+	return largest;
+}
+
+GeometryHeap* GeometryHeap::instance;
+
+GeometryHeap::GeometryHeap(ID3D11Device * device, ID3D11DeviceContext * context, unsigned int vertexPageSize, unsigned int indexPageSize)
+{
+	instance = this;
+	this->device = device;
+	this->context = context;
+	this->vertexPageSize = vertexPageSize;
+	this->indexPageSize = indexPageSize;
+	ZeroMemory(&stats, sizeof(GeometryHeapStats));
+}
+
+GeometryHeap::~GeometryHeap()
+{
+	for (size_t i = 0; i < vertexPages.size(); i++)
+		vertexPages[i].Buffer->Release();
+	for (size_t i = 0; i < splitPages.size(); i++)
+	{
+		splitPages[i].Buffer->Release();
+		splitPages[i].AttributeBuffer->Release();
+	}
+	for (size_t i = 0; i < indexPages.size(); i++)
+		indexPages[i].Buffer->Release();
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+GeometryHeap * GeometryHeap::Instance()
+{
+	return instance;
+}
+
+ID3D11Buffer * GeometryHeap::CreatePageBuffer(unsigned int size, unsigned int stride, UINT bindFlags)
+{
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.ByteWidth = stride * size;
+	desc.BindFlags = bindFlags;
+
+	ID3D11Buffer* buffer = nullptr;
+	if (FAILED(device->CreateBuffer(&desc, 0, &buffer)))
+		return nullptr;
+	stats.BufferCreates++;
+	return buffer;
+}
+
+bool GeometryHeap::AllocateRange(std::vector<Page>& pages, unsigned int count, unsigned int pageSize, unsigned int stride, unsigned int attributeStride, UINT bindFlags, unsigned int & page, unsigned int & offset)
+{
+	for (page = 0; page < pages.size(); page++)
+	{
+		if (pages[page].Allocator.Allocate(count, offset))
+			return true;
+	}
+
+	Page added;
+	added.Buffer = CreatePageBuffer(max(count, pageSize), stride, bindFlags);
+	added.AttributeBuffer = nullptr;
+	if (!added.Buffer)
+		return false;
+
+	if (attributeStride > 0)
+	{
+		added.AttributeBuffer = CreatePageBuffer(max(count, pageSize), attributeStride, bindFlags);
+		if (!added.AttributeBuffer)
+		{
+			added.Buffer->Release();
+			return false;
+		}
+	}
+
+	added.Allocator.Reset(max(count, pageSize));
+	added.Allocator.Allocate(count, offset);
+	page = (unsigned int)pages.size();
+	pages.push_back(added);
+	return true;
+}
+
+void GeometryHeap::Upload(ID3D11Buffer * buffer, unsigned int offset, unsigned int count, unsigned int stride, const void * data)
+{
+	if (count == 0)
+		return;
+
+	D3D11_BOX box = {};
+	box.left = offset * stride;
+	box.right = (offset + count) * stride;
+	box.bottom = 1;
+	box.back = 1;
+	context->UpdateSubresource(buffer, 0, &box, data, 0, 0);
+	stats.Uploads++;
+}
+
+GeometryHandle GeometryHeap::Allocate(const Vertex * vertices, unsigned int vertexCount, const UINT * indices, unsigned int indexCount, VertexStreams streams)
+{
+	Allocation allocation;
+	allocation.Split = streams == VERTEX_STREAMS_SPLIT;
+	allocation.VertexCount = vertexCount;
+	allocation.IndexCount = indexCount;
+	allocation.Live = true;
+
+	std::vector<Page>& pages = allocation.Split ? splitPages : vertexPages;
+	bool allocated = allocation.Split ?
+		AllocateRange(pages, vertexCount, vertexPageSize, sizeof(VertexPosition), sizeof(VertexAttributes), D3D11_BIND_VERTEX_BUFFER, allocation.VertexPage, allocation.VertexOffset) :
+		AllocateRange(pages, vertexCount, vertexPageSize, sizeof(Vertex), 0, D3D11_BIND_VERTEX_BUFFER, allocation.VertexPage, allocation.VertexOffset);
+	if (!allocated)
+		return GEOMETRY_INVALID;
+
+	if (!AllocateRange(indexPages, indexCount, indexPageSize, sizeof(UINT), 0, D3D11_BIND_INDEX_BUFFER, allocation.IndexPage, allocation.IndexOffset))
+	{
+		pages[allocation.VertexPage].Allocator.Free(allocation.VertexOffset, vertexCount);
+		return GEOMETRY_INVALID;
+	}
+
+	if (allocation.Split)
+	{
+		std::vector<VertexPosition> positions(vertexCount);
+		std::vector<VertexAttributes> attributes(vertexCount);
+		for (unsigned int i = 0; i < vertexCount; i++)
+		{
+			positions[i].Position = vertices[i].Position;
+			attributes[i].Normal = vertices[i].Normal;
+			attributes[i].UV = vertices[i].UV;
+		}
+		if (vertexCount > 0)
+		{
+			Upload(pages[allocation.VertexPage].Buffer, allocation.VertexOffset, vertexCount, sizeof(VertexPosition), &positions[0]);
+			Upload(pages[allocation.VertexPage].AttributeBuffer, allocation.VertexOffset, vertexCount, sizeof(VertexAttributes), &attributes[0]);
+		}
+	}
+	else
+	{
+		Upload(pages[allocation.VertexPage].Buffer, allocation.VertexOffset, vertexCount, sizeof(Vertex), vertices);
+	}
+	Upload(indexPages[allocation.IndexPage].Buffer, allocation.IndexOffset, indexCount, sizeof(UINT), indices);
+
+	GeometryHandle handle;
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+		allocations[handle] = allocation;
+	}
+	else
+	{
+		handle = (GeometryHandle)allocations.size();
+		allocations.push_back(allocation);
+	}
+
+	UpdateStats();
+	return handle;
+}
+
+void GeometryHeap::Free(GeometryHandle handle)
+{
+	if (handle >= allocations.size() || !allocations[handle].Live)
+		return;
+
+	Allocation& allocation = allocations[handle];
+	std::vector<Page>& pages = allocation.Split ? splitPages : vertexPages;
+	pages[allocation.VertexPage].Allocator.Free(allocation.VertexOffset, allocation.VertexCount);
+	indexPages[allocation.IndexPage].Allocator.Free(allocation.IndexOffset, allocation.IndexCount);
+	allocation.Live = false;
+	freeHandles.push_back(handle);
+	UpdateStats();
+}
+
+ID3D11Buffer * GeometryHeap::GetVertexBuffer(GeometryHandle handle) const
+{
+	const Allocation& allocation = allocations[handle];
+	return (allocation.Split ? splitPages : vertexPages)[allocation.VertexPage].Buffer;
+}
+
+ID3D11Buffer * GeometryHeap::GetAttributeBuffer(GeometryHandle handle) const
+{
+	const Allocation& allocation = allocations[handle];
+	return allocation.Split ? splitPages[allocation.VertexPage].AttributeBuffer : nullptr;
+}
+
+ID3D11Buffer * GeometryHeap::GetIndexBuffer(GeometryHandle handle) const
+{
+	return indexPages[allocations[handle].IndexPage].Buffer;
+}
+
+int GeometryHeap::GetBaseVertex(GeometryHandle handle) const
+{
+	return (int)allocations[handle].VertexOffset;
+}
+
+unsigned int GeometryHeap::GetStartIndex(GeometryHandle handle) const
+{
+	return allocations[handle].IndexOffset;
+}
+
+unsigned int GeometryHeap::Compact()
+{
+	unsigned int compacted = 0;
+	for (unsigned int page = 0; page < vertexPages.size(); page++)
+	{
+		if (vertexPages[page].Allocator.GetFreeRangeCount() > 1 &&
+			CompactPage(vertexPages, page, sizeof(Vertex), 0, D3D11_BIND_VERTEX_BUFFER, true))
+			compacted++;
+	}
+	for (unsigned int page = 0; page < splitPages.size(); page++)
+	{
+		if (splitPages[page].Allocator.GetFreeRangeCount() > 1 &&
+			CompactPage(splitPages, page, sizeof(VertexPosition), sizeof(VertexAttributes), D3D11_BIND_VERTEX_BUFFER, true))
+			compacted++;
+	}
+	for (unsigned int page = 0; page < indexPages.size(); page++)
+	{
+		if (indexPages[page].Allocator.GetFreeRangeCount() > 1 &&
+			CompactPage(indexPages, page, sizeof(UINT), 0, D3D11_BIND_INDEX_BUFFER, false))
+			compacted++;
+	}
+
+	stats.Compactions += compacted;
+	UpdateStats();
+	return compacted;
+}
+
+// --------------------------------------------------------
+// D3D11 can't copy between overlapping ranges of one buffer,
+// so the live ranges are copied, in offset order, to the
+// start of a new buffer that then replaces the old one.
+// Split pages move their attribute buffer the same way.
+// --------------------------------------------------------
+bool GeometryHeap::CompactPage(std::vector<Page>& pages, unsigned int page, unsigned int stride, unsigned int attributeStride, UINT bindFlags, bool vertices)
+{
+	bool split = &pages == &splitPages;
+	std::vector<std::pair<unsigned int, GeometryHandle>> live;
+	for (GeometryHandle handle = 0; handle < allocations.size(); handle++)
+	{
+		const Allocation& allocation = allocations[handle];
+		if (!allocation.Live)
+			continue;
+		if (vertices && allocation.Split == split && allocation.VertexPage == page)
+			live.push_back(std::make_pair(allocation.VertexOffset, handle));
+		else if (!vertices && allocation.IndexPage == page)
+			live.push_back(std::make_pair(allocation.IndexOffset, handle));
+	}
+	std::sort(live.begin(), live.end());
+
+	unsigned int capacity = pages[page].Allocator.GetSize();
+	ID3D11Buffer* packed = CreatePageBuffer(capacity, stride, bindFlags);
+	if (!packed)
+		return false;
+
+	ID3D11Buffer* packedAttributes = nullptr;
+	if (attributeStride > 0)
+	{
+		packedAttributes = CreatePageBuffer(capacity, attributeStride, bindFlags);
+		if (!packedAttributes)
+		{
+			packed->Release();
+			return false;
+		}
+	}
+
+	unsigned int used = 0;
+	for (size_t i = 0; i < live.size(); i++)
+	{
+		Allocation& allocation = allocations[live[i].second];
+		unsigned int& offset = vertices ? allocation.VertexOffset : allocation.IndexOffset;
+		unsigned int count = vertices ? allocation.VertexCount : allocation.IndexCount;
+		if (count > 0)
+		{
+			D3D11_BOX box = {};
+			box.left = offset * stride;
+			box.right = (offset + count) * stride;
+			box.bottom = 1;
+			box.back = 1;
+			context->CopySubresourceRegion(packed, 0, used * stride, 0, 0, pages[page].Buffer, 0, &box);
+
+			if (packedAttributes)
+			{
+				box.left = offset * attributeStride;
+				box.right = (offset + count) * attributeStride;
+				context->CopySubresourceRegion(packedAttributes, 0, used * attributeStride, 0, 0, pages[page].AttributeBuffer, 0, &box);
+			}
+		}
+
+		offset = used;
+		used += count;
+	}
+
+	pages[page].Buffer->Release();
+	pages[page].Buffer = packed;
+	if (packedAttributes)
+	{
+		pages[page].AttributeBuffer->Release();
+		pages[page].AttributeBuffer = packedAttributes;
+	}
+	pages[page].Allocator.Reset(capacity, used);
+	return true;
+}
+
+void GeometryHeap::UpdateStats()
+{
+	stats.Meshes = (unsigned int)(allocations.size() - freeHandles.size());
+	stats.VertexPages = (unsigned int)vertexPages.size();
+	stats.SplitPages = (unsigned int)splitPages.size();
+	stats.IndexPages = (unsigned int)indexPages.size();
+	stats.UsedBytes = 0;
+	stats.CapacityBytes = 0;
+	stats.FreeRanges = 0;
+
+	for (size_t i = 0; i < vertexPages.size(); i++)
+	{
+		const RangeAllocator& allocator = vertexPages[i].Allocator;
+		stats.UsedBytes += (allocator.GetSize() - allocator.GetFreeCount()) * sizeof(Vertex);
+		stats.CapacityBytes += allocator.GetSize() * sizeof(Vertex);
+		stats.FreeRanges += allocator.GetFreeRangeCount();
+	}
+	for (size_t i = 0; i < splitPages.size(); i++)
+	{
+		const RangeAllocator& allocator = splitPages[i].Allocator;
+		stats.UsedBytes += (allocator.GetSize() - allocator.GetFreeCount()) * (sizeof(VertexPosition) + sizeof(VertexAttributes));
+		stats.CapacityBytes += allocator.GetSize() * (sizeof(VertexPosition) + sizeof(VertexAttributes));
+		stats.FreeRanges += allocator.GetFreeRangeCount();
+	}
+	for (size_t i = 0; i < indexPages.size(); i++)
+	{
+		const RangeAllocator& allocator = indexPages[i].Allocator;
+		stats.UsedBytes += (allocator.GetSize() - allocator.GetFreeCount()) * sizeof(UINT);
+		stats.CapacityBytes += allocator.GetSize() * sizeof(UINT);
+		stats.FreeRanges += allocator.GetFreeRangeCount();
+	}
+}
+
+std::string GeometryHeap::Describe() const
+{
+	char line[256];
+	sprintf_s(line, "Geometry heap: %u meshes in %u vertex, %u split and %u index pages, %.1fKB of %.1fKB used, %u free ranges, %u buffers created, %u uploads",
+		stats.Meshes, stats.VertexPages, stats.SplitPages, stats.IndexPages,
+		stats.UsedBytes / 1024.0f, stats.CapacityBytes / 1024.0f,
+		stats.FreeRanges, stats.BufferCreates, stats.Uploads);
+	return line;
+}
@@ -0,0 +1,156 @@
+#pragma once
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include "Vertex.h"
+
+typedef unsigned int GeometryHandle;
+static const GeometryHandle GEOMETRY_INVALID = 0xffffffff;
+
+// --------------------------------------------------------
+// First-fit free list over [0, size) with coalescing, in
+// whatever unit the caller uses (vertices, indices)
+// --------------------------------------------------------
+class RangeAllocator
+{
+public:
+	RangeAllocator(unsigned int size = 0);
+
+	// Everything below used is allocated, the rest is free
+	void Reset(unsigned int size, unsigned int used = 0);
+
+	bool Allocate(unsigned int count, unsigned int& offset);
+	void Free(unsigned int offset, unsigned int count);
+
+	unsigned int GetSize() const { return size; }
+	unsigned int GetFreeCount() const { return freeCount; }
+	unsigned int GetFreeRangeCount() const { return (unsigned int)freeRanges.size(); }
+	unsigned int GetLargestFreeRange() const;
+
+private:
+	struct Range
+	{
+		unsigned int Offset;
+		unsigned int Count;
+	};
+
+	unsigned int size;
+	unsigned int freeCount;
+	std::vector<Range> freeRanges;		// Sorted by offset, never adjacent
+};
+
+// --------------------------------------------------------
+// Stats of the geometry heap
+// --------------------------------------------------------
+struct GeometryHeapStats
+{
+	unsigned int Meshes;			// Live allocations
+	unsigned int VertexPages;
+	unsigned int SplitPages;		// Position and attribute buffer pairs
+	unsigned int IndexPages;
+	unsigned int UsedBytes;
+	unsigned int CapacityBytes;
+	unsigned int FreeRanges;		// More than one per page means fragmentation
+	unsigned int BufferCreates;		// Calls to CreateBuffer, pages included
+	unsigned int Uploads;
+	unsigned int Compactions;		// Pages repacked
+};
+
+// --------------------------------------------------------
+// Vertex and index buffers shared by every mesh
+//
+// Geometry lives in a few large pages (D3D11_USAGE_DEFAULT
+// buffers) that meshes are suballocated from, so creating a
+// mesh is an UpdateSubresource instead of two CreateBuffer
+// calls, and draws of different meshes share their vertex and
+// index buffer binds, using BaseVertexLocation and
+// StartIndexLocation instead.  Meshes larger than a page get a
+// page of their own.
+//
+// Split stream meshes get pages of their own, each a position
+// buffer and an attribute buffer that share one allocator, so
+// a vertex has the same index in both and one BaseVertexLocation
+// works for the two streams.
+//
+// Handles stay valid across Compact(), which repacks fragmented
+// pages into new buffers, so look up the buffers and offsets
+// when drawing rather than keeping them.  Only use the heap
+// from the thread that owns the immediate context, and don't
+// compact while a snapshot referencing the old buffers is
+// still to be drawn.
+// --------------------------------------------------------
+class GeometryHeap
+{
+	static GeometryHeap* instance;
+
+public:
+	// Page sizes are in vertices (of sizeof(Vertex)) and indices
+	GeometryHeap(ID3D11Device* device, ID3D11DeviceContext* context,
+		unsigned int vertexPageSize = 256 * 1024, unsigned int indexPageSize = 1024 * 1024);
+	~GeometryHeap();
+	static GeometryHeap* Instance();
+
+	// Copies the geometry into the heap.  Indices are relative
+	// to the mesh's first vertex.
+	GeometryHandle Allocate(const Vertex* vertices, unsigned int vertexCount, const UINT* indices, unsigned int indexCount,
+		VertexStreams streams = VERTEX_STREAMS_INTERLEAVED);
+	void Free(GeometryHandle handle);
+
+	// For split meshes the vertex buffer holds the positions and
+	// the attribute buffer the rest, otherwise there's no
+	// attribute buffer
+	ID3D11Buffer* GetVertexBuffer(GeometryHandle handle) const;
+	ID3D11Buffer* GetAttributeBuffer(GeometryHandle handle) const;
+	ID3D11Buffer* GetIndexBuffer(GeometryHandle handle) const;
+	int GetBaseVertex(GeometryHandle handle) const;
+	unsigned int GetStartIndex(GeometryHandle handle) const;
+
+	// Repacks every page with more than one free range and
+	// returns the number of pages repacked
+	unsigned int Compact();
+
+	const GeometryHeapStats& GetStats() const { return stats; }
+	std::string Describe() const;
+
+private:
+	struct Page
+	{
+		ID3D11Buffer* Buffer;
+		ID3D11Buffer* AttributeBuffer;		// Split pages only
+		RangeAllocator Allocator;
+	};
+
+	struct Allocation
+	{
+		bool Split;						// VertexPage is one of the split pages
+		unsigned int VertexPage;
+		unsigned int VertexOffset;
+		unsigned int VertexCount;
+		unsigned int IndexPage;
+		unsigned int IndexOffset;
+		unsigned int IndexCount;
+		bool Live;
+	};
+
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	unsigned int vertexPageSize;
+	unsigned int indexPageSize;
+
+	std::vector<Page> vertexPages;
+	std::vector<Page> splitPages;
+	std::vector<Page> indexPages;
+	std::vector<Allocation> allocations;
+	std::vector<GeometryHandle> freeHandles;
+	GeometryHeapStats stats;
+
+	// Finds room in an existing page or adds one.  Pages get an
+	// attribute buffer too when attributeStride isn't 0.
+	bool AllocateRange(std::vector<Page>& pages, unsigned int count, unsigned int pageSize, unsigned int stride, unsigned int attributeStride, UINT bindFlags, unsigned int& page, unsigned int& offset);
+	ID3D11Buffer* CreatePageBuffer(unsigned int size, unsigned int stride, UINT bindFlags);
+	void Upload(ID3D11Buffer* buffer, unsigned int offset, unsigned int count, unsigned int stride, const void* data);
+
+	// Moves a page's live ranges to the start of a new buffer
+	bool CompactPage(std::vector<Page>& pages, unsigned int page, unsigned int stride, unsigned int attributeStride, UINT bindFlags, bool vertices);
+	void UpdateStats();
+};
@@ -0,0 +1,97 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	this->context = context;
+	current = 0;
+	timing = false;
+	lastMs = -1.0f;
+
+	D3D11_QUERY_DESC disjointDesc = {};
+	disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	D3D11_QUERY_DESC timestampDesc = {};
+	timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+
+	for (unsigned int i = 0; i < SLOTS; i++)
+	{
+		Slot& slot = slots[i];
+		slot.Disjoint = nullptr;
+		slot.Begin = nullptr;
+		slot.End = nullptr;
+		slot.Pending = false;
+
+		if (FAILED(device->CreateQuery(&disjointDesc, &slot.Disjoint)) ||
+			FAILED(device->CreateQuery(&timestampDesc, &slot.Begin)) ||
+			FAILED(device->CreateQuery(&timestampDesc, &slot.End)))
+		{
+			if (slot.Disjoint) { slot.Disjoint->Release(); slot.Disjoint = nullptr; }
+			if (slot.Begin) { slot.Begin->Release(); slot.Begin = nullptr; }
+		}
+	}
+}
+
+GpuTimer::~GpuTimer()
+{
+	for (unsigned int i = 0; i < SLOTS; i++)
+	{
+		if (slots[i].Disjoint) { slots[i].Disjoint->Release(); }
+		if (slots[i].Begin) { slots[i].Begin->Release(); }
+		if (slots[i].End) { slots[i].End->Release(); }
+	}
+}
+
+void GpuTimer::BeginFrame()
+{
+	Poll();
+
+	Slot& slot = slots[current];
+	timing = slot.Disjoint && !slot.Pending;
+	if (!timing)
+		return;
+
+	context->Begin(slot.Disjoint);
+	context->End(slot.Begin);
+}
+
+void GpuTimer::EndFrame()
+{
+	if (timing)
+	{
+		Slot& slot = slots[current];
+		context->End(slot.End);
+		context->End(slot.Disjoint);
+		slot.Pending = true;
+		timing = false;
+	}
+	current = (current + 1) % SLOTS;
+}
+
+// --------------------------------------------------------
+// Slots are queued in ring order, the one about to be reused
+// being the oldest, and the GPU finishes them in that order,
+// so the first one not done ends the search
+// --------------------------------------------------------
+void GpuTimer::Poll()
+{
+	for (unsigned int n = 0; n < SLOTS; n++)
+	{
+		Slot& slot = slots[(current + n) % SLOTS];
+		if (!slot.Pending)
+			continue;
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64 begin, end;
+		if (context->GetData(slot.Disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			context->GetData(slot.Begin, &begin, sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			context->GetData(slot.End, &end, sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			return;
+
+		slot.Pending = false;
+
+		// The clock changed speed part way, the timestamps can't be trusted
+		if (disjoint.Disjoint || disjoint.Frequency == 0)
+			continue;
+
+		lastMs = (float)((double)(end - begin) * 1000.0 / (double)disjoint.Frequency);
+	}
+}
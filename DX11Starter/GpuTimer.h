@@ -0,0 +1,46 @@
+#pragma once
+#include <d3d11.h>
+
+// --------------------------------------------------------
+// Measures how long the GPU spends on each frame
+//
+// Every frame gets a disjoint query with a timestamp at each
+// end, from a ring of SLOTS.  Results are read back a few
+// frames later without waiting: GetLastMs() is the newest
+// frame the GPU has finished, and stays negative until the
+// first one has.  A frame whose slot is still in flight when
+// it begins isn't timed, rather than stalling for it.
+// --------------------------------------------------------
+class GpuTimer
+{
+public:
+	static const unsigned int SLOTS = 4;
+
+	GpuTimer(ID3D11Device* device, ID3D11DeviceContext* context);
+	~GpuTimer();
+
+	// Around everything the frame submits
+	void BeginFrame();
+	void EndFrame();
+
+	// GPU time of the newest finished frame, in milliseconds
+	float GetLastMs() const { return lastMs; }
+
+private:
+	struct Slot
+	{
+		ID3D11Query* Disjoint;
+		ID3D11Query* Begin;
+		ID3D11Query* End;
+		bool Pending;				// Queued, result not read yet
+	};
+
+	ID3D11DeviceContext* context;
+	Slot slots[SLOTS];
+	unsigned int current;
+	bool timing;					// Between BeginFrame() and EndFrame() of a timed frame
+	float lastMs;
+
+	// Reads back every finished slot, oldest first
+	void Poll();
+};
@@ -0,0 +1,121 @@
+#include "InputLayoutCache.h"
+#include "ShaderReflection.h"
+#include <string>
+
+InputLayoutCache* InputLayoutCache::instance;
+
+// Bytes per element of the formats vertex streams use, 0 if unknown
+static unsigned int FormatBytes(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32_FLOAT: case DXGI_FORMAT_R32_UINT: case DXGI_FORMAT_R32_SINT:
+	case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UINT: case DXGI_FORMAT_R16G16_FLOAT:
+		return 4;
+	case DXGI_FORMAT_R32G32_FLOAT: case DXGI_FORMAT_R32G32_UINT: case DXGI_FORMAT_R32G32_SINT:
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		return 8;
+	case DXGI_FORMAT_R32G32B32_FLOAT: case DXGI_FORMAT_R32G32B32_UINT: case DXGI_FORMAT_R32G32B32_SINT:
+		return 12;
+	case DXGI_FORMAT_R32G32B32A32_FLOAT: case DXGI_FORMAT_R32G32B32A32_UINT: case DXGI_FORMAT_R32G32B32A32_SINT:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+InputLayoutCache::InputLayoutCache(ID3D11Device * device)
+{
+	instance = this;
+	this->device = device;
+	ZeroMemory(&stats, sizeof(InputLayoutCacheStats));
+}
+
+InputLayoutCache::~InputLayoutCache()
+{
+	for (auto it = layouts.begin(); it != layouts.end(); ++it)
+		it->second->Release();
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+InputLayoutCache * InputLayoutCache::Instance()
+{
+	return instance;
+}
+
+// --------------------------------------------------------
+// Builds a key string of every element's values and hashes it.
+// Append-aligned offsets are replaced with the offset they
+// resolve to, so reflected layouts and explicit vertex formats
+// describing the same bytes share a key.
+// --------------------------------------------------------
+unsigned long long InputLayoutCache::HashElements(const D3D11_INPUT_ELEMENT_DESC * elements, unsigned int count)
+{
+	UINT slotOffsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT] = {};
+	bool slotResolved[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+	for (unsigned int s = 0; s < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; s++)
+		slotResolved[s] = true;
+
+	std::string key;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const D3D11_INPUT_ELEMENT_DESC& element = elements[i];
+		UINT slot = element.InputSlot % D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT;
+
+		UINT offset = element.AlignedByteOffset;
+		if (offset == D3D11_APPEND_ALIGNED_ELEMENT && slotResolved[slot])
+			offset = slotOffsets[slot];
+
+		// Once a format of unknown size is appended, later
+		// offsets in that slot stay as given
+		unsigned int bytes = FormatBytes(element.Format);
+		if (bytes == 0 || offset == D3D11_APPEND_ALIGNED_ELEMENT)
+			slotResolved[slot] = false;
+		else
+			slotOffsets[slot] = offset + bytes;
+
+		UINT values[] =
+		{
+			element.SemanticIndex,
+			(UINT)element.Format,
+			element.InputSlot,
+			offset,
+			(UINT)element.InputSlotClass,
+			element.InstanceDataStepRate
+		};
+		key.append(element.SemanticName);
+		key.push_back(0);
+		key.append((const char*)values, sizeof(values));
+	}
+
+	return HashShaderBlob(key.data(), key.size());
+}
+
+ID3D11InputLayout * InputLayoutCache::Acquire(const D3D11_INPUT_ELEMENT_DESC * elements, unsigned int count, const void * bytecode, size_t size)
+{
+	stats.Requests++;
+	unsigned long long key = HashElements(elements, count);
+
+	ID3D11InputLayout* layout;
+	auto it = layouts.find(key);
+	if (it != layouts.end())
+	{
+		layout = it->second;
+	}
+	else
+	{
+		if (FAILED(device->CreateInputLayout(elements, count, bytecode, size, &layout)))
+		{
+			stats.Failed++;
+			return nullptr;
+		}
+
+		stats.Created++;
+		layouts[key] = layout;
+	}
+
+	layout->AddRef();
+	return layout;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <d3d11.h>
+#include <unordered_map>
+#include "VertexFormat.h"
+
+// --------------------------------------------------------
+// Input layout requests since startup
+// --------------------------------------------------------
+struct InputLayoutCacheStats
+{
+	unsigned int Requests;
+	unsigned int Created;
+	unsigned int Failed;
+};
+
+// --------------------------------------------------------
+// Shared input layouts
+//
+// Layouts are keyed by a hash of their element descriptions
+// (semantic names by value, append-aligned offsets resolved),
+// so every vertex shader reading the same vertex format gets
+// the same ID3D11InputLayout.  A layout is validated against
+// the signature of the first shader that asks for it; D3D
+// accepts it for any other shader whose inputs it covers.
+// --------------------------------------------------------
+class InputLayoutCache
+{
+	static InputLayoutCache* instance;
+
+public:
+	InputLayoutCache(ID3D11Device* device);
+	~InputLayoutCache();
+	static InputLayoutCache* Instance();
+
+	// Finds or creates the layout for the elements.  The caller
+	// gets its own reference and must Release() it.
+	ID3D11InputLayout* Acquire(const D3D11_INPUT_ELEMENT_DESC* elements, unsigned int count, const void* bytecode, size_t size);
+
+	// Layout of a vertex struct with a VertexFormat specialization
+	template<typename VertexType>
+	ID3D11InputLayout* Acquire(const void* bytecode, size_t size)
+	{
+		return Acquire(VertexFormat<VertexType>::Elements(), VertexFormat<VertexType>::ElementCount, bytecode, size);
+	}
+
+	static unsigned long long HashElements(const D3D11_INPUT_ELEMENT_DESC* elements, unsigned int count);
+
+	unsigned int GetLayoutCount() const { return (unsigned int)layouts.size(); }
+	const InputLayoutCacheStats& GetStats() const { return stats; }
+
+private:
+	ID3D11Device* device;
+	std::unordered_map<unsigned long long, ID3D11InputLayout*> layouts;
+	InputLayoutCacheStats stats;
+};
@@ -0,0 +1,145 @@
+#include "JobSystem.h"
+
+JobSystem* JobSystem::instance;
+
+JobSystem::JobSystem(unsigned int threadCount)
+{
+	instance = this;
+	quit = false;
+
+	if (threadCount == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(std::thread(&JobSystem::WorkerLoop, this));
+}
+
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		quit = true;
+	}
+	queueSignal.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+JobSystem * JobSystem::Instance()
+{
+	return instance;
+}
+
+unsigned int JobSystem::GetThreadCount()
+{
+	return (unsigned int)workers.size() + 1;
+}
+
+void JobSystem::Run(std::function<void()> job, JobCounter * counter)
+{
+	if (counter)
+		counter->Pending++;
+
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		Job newJob;
+		newJob.Function = std::move(job);
+		newJob.Counter = counter;
+		queue.push_back(std::move(newJob));
+	}
+	queueSignal.notify_one();
+}
+
+void JobSystem::Wait(JobCounter * counter)
+{
+	while (counter->Pending.load() > 0)
+	{
+		// Help out rather than sleeping
+		if (!TryRunOne(counter))
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)>& func)
+{
+	if (count == 0)
+		return;
+	if (grainSize == 0)
+		grainSize = 1;
+
+	// Small ranges aren't worth the hand off
+	if (count <= grainSize)
+	{
+		func(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (unsigned int begin = grainSize; begin < count; begin += grainSize)
+	{
+		unsigned int end = begin + grainSize < count ? begin + grainSize : count;
+		Run([&func, begin, end]() { func(begin, end); }, &counter);
+	}
+
+	// The calling thread takes the first chunk
+	func(0, grainSize);
+	Wait(&counter);
+}
+
+void JobSystem::WorkerLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			queueSignal.wait(lock, [this]() { return quit || !queue.empty(); });
+			if (quit && queue.empty())
+				return;
+
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		Execute(job);
+	}
+}
+
+// --------------------------------------------------------
+// Runs the oldest queued job of the counter, if any.  Jobs of
+// other counters are left to the workers: one of them could
+// take far longer than whatever the caller is waiting for.
+// --------------------------------------------------------
+bool JobSystem::TryRunOne(JobCounter* counter)
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		std::deque<Job>::iterator it = queue.begin();
+		while (it != queue.end() && it->Counter != counter)
+			++it;
+		if (it == queue.end())
+			return false;
+
+		job = std::move(*it);
+		queue.erase(it);
+	}
+
+	Execute(job);
+	return true;
+}
+
+void JobSystem::Execute(Job & job)
+{
+	job.Function();
+	if (job.Counter)
+		job.Counter->Pending--;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --------------------------------------------------------
+// Counter used to wait for a group of jobs.  Incremented
+// when a job is queued, decremented when it finishes.
+// --------------------------------------------------------
+struct JobCounter
+{
+	std::atomic<int> Pending;
+	JobCounter() : Pending(0) { }
+};
+
+// --------------------------------------------------------
+// A small pool of persistent worker threads
+//
+// Threads are created once and sleep on a condition variable
+// when there's no work.  Waiting threads help run the queued
+// jobs of the counter they wait on instead of blocking, so
+// ParallelFor can be called from any thread (including a
+// worker) without deadlocking.  They don't take anyone else's
+// jobs, so a long job queued with Run() (the simulation) is
+// never picked up by a frame-critical ParallelFor.
+// --------------------------------------------------------
+class JobSystem
+{
+	static JobSystem* instance;
+
+public:
+	// threadCount - Number of workers, 0 uses one less than the core count
+	JobSystem(unsigned int threadCount = 0);
+	~JobSystem();
+	static JobSystem* Instance();
+
+	// Number of threads work is spread across (workers + caller)
+	unsigned int GetThreadCount();
+
+	// Queues a single job, counter (optional) is decremented when it's done
+	void Run(std::function<void()> job, JobCounter* counter);
+
+	// Blocks until the counter reaches zero, running its jobs meanwhile
+	void Wait(JobCounter* counter);
+
+	// Calls func(begin, end) over [0, count) in chunks of at most
+	// grainSize, spread across all threads.  Blocks until done.
+	void ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)>& func);
+
+private:
+	struct Job
+	{
+		std::function<void()> Function;
+		JobCounter* Counter;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<Job> queue;
+	std::mutex queueMutex;
+	std::condition_variable queueSignal;
+	bool quit;
+
+	void WorkerLoop();
+	bool TryRunOne(JobCounter* counter);
+	void Execute(Job& job);
+};
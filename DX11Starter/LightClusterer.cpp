@@ -0,0 +1,513 @@
+#include "LightClusterer.h"
+#include "JobSystem.h"
+#include <malloc.h>
+#include <math.h>
+#include <cfloat>
+#include <algorithm>
+#include <emmintrin.h>
+
+LightClusterer::LightClusterer()
+{
+	// Aligned so rows of four clusters can use aligned loads
+	clusterMinX = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+	clusterMinY = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+	clusterMinZ = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+	clusterMaxX = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+	clusterMaxY = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+	clusterMaxZ = (float*)_aligned_malloc(sizeof(float) * CLUSTER_COUNT, 16);
+
+	clusterLights.resize(CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+	clusterPointCounts.resize(CLUSTER_COUNT);
+	clusterSpotCounts.resize(CLUSTER_COUNT);
+	grid.resize(CLUSTER_COUNT);
+
+	ZeroMemory(&boundsProjection, sizeof(XMFLOAT4X4));
+	ZeroMemory(&stats, sizeof(ClusterStats));
+	ZeroMemory(sliceOverflow, sizeof(sliceOverflow));
+	clusterParams = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	xScale = 1.0f;
+	yScale = 1.0f;
+	pointCount = 0;
+	spotCount = 0;
+	maxLights = 0xffffffff;
+
+	device = nullptr;
+	gridBuffer = nullptr;
+	indexBuffer = nullptr;
+	gridSRV = nullptr;
+	indexSRV = nullptr;
+	indexCapacity = 0;
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+}
+
+
+LightClusterer::~LightClusterer()
+{
+	_aligned_free(clusterMinX);
+	_aligned_free(clusterMinY);
+	_aligned_free(clusterMinZ);
+	_aligned_free(clusterMaxX);
+	_aligned_free(clusterMaxY);
+	_aligned_free(clusterMaxZ);
+
+	if (gridSRV) { gridSRV->Release(); }
+	if (indexSRV) { indexSRV->Release(); }
+	if (gridBuffer) { gridBuffer->Release(); }
+	if (indexBuffer) { indexBuffer->Release(); }
+}
+
+// --------------------------------------------------------
+// Creates the structured buffers with a starting capacity
+// --------------------------------------------------------
+void LightClusterer::Init(ID3D11Device * device)
+{
+	this->device = device;
+
+	unsigned int gridCapacity = 0;
+	EnsureBuffer(&gridBuffer, &gridSRV, sizeof(ClusterEntry), CLUSTER_COUNT, &gridCapacity);
+	EnsureBuffer(&indexBuffer, &indexSRV, sizeof(unsigned int), CLUSTER_COUNT * 8, &indexCapacity);
+}
+
+// --------------------------------------------------------
+// Bins all lights into the cluster grid and uploads the
+// grid and the light index list to the GPU
+// --------------------------------------------------------
+void LightClusterer::Update(ID3D11DeviceContext * context, const XMFLOAT4X4 & viewMatrix, const XMFLOAT4X4 & projectionMatrix, unsigned int screenWidth, unsigned int screenHeight, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	// Camera matrices are stored transposed for HLSL
+	XMMATRIX view = XMMatrixTranspose(XMLoadFloat4x4(&viewMatrix));
+	XMMATRIX projection = XMMatrixTranspose(XMLoadFloat4x4(&projectionMatrix));
+
+	// Cluster bounds only change with the projection
+	if (memcmp(&boundsProjection, &projectionMatrix, sizeof(XMFLOAT4X4)) != 0)
+	{
+		BuildClusterBounds(projection);
+		boundsProjection = projectionMatrix;
+	}
+
+	clusterParams.x = (float)screenWidth / CLUSTERS_X;
+	clusterParams.y = (float)screenHeight / CLUSTERS_Y;
+
+	GatherSpheres(view, pointLights, spotLights);
+	CapLights();
+
+	// One job per depth slice, slices never share clusters
+	JobSystem* jobs = JobSystem::Instance();
+	if (jobs)
+	{
+		jobs->ParallelFor(CLUSTERS_Z, 1, [this](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int slice = begin; slice < end; slice++)
+				BinSlice(slice);
+		});
+	}
+	else
+	{
+		for (unsigned int slice = 0; slice < CLUSTERS_Z; slice++)
+			BinSlice(slice);
+	}
+
+	Compact();
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+
+	stats.PointLightCount = pointCount;
+	stats.SpotLightCount = spotCount;
+	stats.IndexCount = (unsigned int)lightIndices.size();
+	stats.OverflowCount = 0;
+	for (unsigned int slice = 0; slice < CLUSTERS_Z; slice++)
+		stats.OverflowCount += sliceOverflow[slice];
+	stats.BinMs = (float)((end - start) * perfCounterSeconds * 1000.0);
+
+	Upload(context);
+}
+
+// --------------------------------------------------------
+// Sets the cluster buffers on the pixel shader stage.  These
+// stay bound across shader changes, so once per frame (or per
+// pixel shader with a different layout) is enough.
+// --------------------------------------------------------
+void LightClusterer::BindResources(SimplePixelShader * pixelShader)
+{
+	pixelShader->SetShaderResourceView(pixelShader->GetShaderResourceViewSlot(SHADER_NAME("clusterGrid")), gridSRV);
+	pixelShader->SetShaderResourceView(pixelShader->GetShaderResourceViewSlot(SHADER_NAME("clusterLightIndices")), indexSRV);
+}
+
+// --------------------------------------------------------
+// Calculates the view space AABB of every cluster
+//
+// projection - Untransposed perspective projection matrix
+// --------------------------------------------------------
+void LightClusterer::BuildClusterBounds(const XMMATRIX & projection)
+{
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, projection);
+
+	// Recover the clip planes from a left handed perspective matrix
+	xScale = p._11;
+	yScale = p._22;
+	float nearZ = -p._43 / p._33;
+	float farZ = p._43 / (1.0f - p._33);
+
+	// Exponential slices keep clusters roughly cube shaped
+	for (unsigned int k = 0; k <= CLUSTERS_Z; k++)
+		sliceDepths[k] = nearZ * powf(farZ / nearZ, (float)k / CLUSTERS_Z);
+
+	float depthScale = CLUSTERS_Z / logf(farZ / nearZ);
+	clusterParams.z = depthScale;
+	clusterParams.w = -logf(nearZ) * depthScale;
+
+	for (unsigned int z = 0; z < CLUSTERS_Z; z++)
+	{
+		float depths[2] = { sliceDepths[z], sliceDepths[z + 1] };
+
+		for (unsigned int y = 0; y < CLUSTERS_Y; y++)
+		{
+			// Row 0 is the top of the screen, like SV_POSITION
+			float ndcY[2] = { 1.0f - 2.0f * (y + 1) / CLUSTERS_Y, 1.0f - 2.0f * y / CLUSTERS_Y };
+
+			for (unsigned int x = 0; x < CLUSTERS_X; x++)
+			{
+				float ndcX[2] = { -1.0f + 2.0f * x / CLUSTERS_X, -1.0f + 2.0f * (x + 1) / CLUSTERS_X };
+
+				float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+				for (int d = 0; d < 2; d++)
+				{
+					for (int i = 0; i < 2; i++)
+					{
+						float vx = ndcX[i] * depths[d] / xScale;
+						float vy = ndcY[i] * depths[d] / yScale;
+						minX = min(minX, vx); maxX = max(maxX, vx);
+						minY = min(minY, vy); maxY = max(maxY, vy);
+					}
+				}
+
+				unsigned int c = z * CLUSTERS_PER_SLICE + y * CLUSTERS_X + x;
+				clusterMinX[c] = minX; clusterMaxX[c] = maxX;
+				clusterMinY[c] = minY; clusterMaxY[c] = maxY;
+				clusterMinZ[c] = depths[0]; clusterMaxZ[c] = depths[1];
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Converts all lights to view space bounding spheres (SoA).
+// Point lights come first, then spot lights.
+// --------------------------------------------------------
+void LightClusterer::GatherSpheres(const XMMATRIX & view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights)
+{
+	pointCount = (unsigned int)pointLights.size();
+	spotCount = (unsigned int)spotLights.size();
+
+	unsigned int total = pointCount + spotCount;
+	unsigned int padded = (total + 3) & ~3u;
+	sphereX.resize(padded);
+	sphereY.resize(padded);
+	sphereZ.resize(padded);
+	sphereR.resize(padded);
+
+	for (unsigned int i = 0; i < pointCount; i++)
+	{
+		XMFLOAT3 center;
+		XMStoreFloat3(&center, XMVector3Transform(XMLoadFloat3(&pointLights[i].Position), view));
+		sphereX[i] = center.x;
+		sphereY[i] = center.y;
+		sphereZ[i] = center.z;
+		sphereR[i] = pointLights[i].Range;
+	}
+
+	for (unsigned int i = 0; i < spotCount; i++)
+	{
+		// Tightest sphere around the cone
+		const SpotLight& spot = spotLights[i];
+		float cosAngle = max(spot.SpotAngle, 0.01f);
+		float offset, radius;
+		if (cosAngle <= 0.70710678f)
+		{
+			offset = spot.Range * cosAngle;
+			radius = spot.Range * sqrtf(1.0f - cosAngle * cosAngle);
+		}
+		else
+		{
+			offset = spot.Range / (2.0f * cosAngle);
+			radius = offset;
+		}
+
+		XMVECTOR worldCenter = XMLoadFloat3(&spot.Position) + XMVector3Normalize(XMLoadFloat3(&spot.Direction)) * offset;
+		XMFLOAT3 center;
+		XMStoreFloat3(&center, XMVector3Transform(worldCenter, view));
+
+		sphereX[pointCount + i] = center.x;
+		sphereY[pointCount + i] = center.y;
+		sphereZ[pointCount + i] = center.z;
+		sphereR[pointCount + i] = radius;
+	}
+
+	// Padding spheres sit far behind the camera and never overlap a slice
+	for (unsigned int i = total; i < padded; i++)
+	{
+		sphereX[i] = 0.0f;
+		sphereY[i] = 0.0f;
+		sphereZ[i] = -1e9f;
+		sphereR[i] = 0.0f;
+	}
+}
+
+// --------------------------------------------------------
+// Keeps the maxLights spheres that come closest to the
+// camera and parks the rest with the padding, where no slice
+// picks them up.  Their indices don't change, so the light
+// buffers LightManager uploaded still line up.
+// --------------------------------------------------------
+void LightClusterer::CapLights()
+{
+	unsigned int total = pointCount + spotCount;
+	stats.CappedCount = 0;
+	if (total <= maxLights)
+		return;
+
+	lightDistances.resize(total);
+	lightOrder.resize(total);
+	for (unsigned int i = 0; i < total; i++)
+	{
+		lightDistances[i] = sqrtf(sphereX[i] * sphereX[i] + sphereY[i] * sphereY[i] + sphereZ[i] * sphereZ[i]) - sphereR[i];
+		lightOrder[i] = i;
+	}
+
+	// Ties go to the lower index, so the same lights are kept every frame
+	const std::vector<float>& distances = lightDistances;
+	std::nth_element(lightOrder.begin(), lightOrder.begin() + maxLights, lightOrder.end(),
+		[&distances](unsigned int a, unsigned int b)
+	{
+		return distances[a] < distances[b] || (distances[a] == distances[b] && a < b);
+	});
+
+	for (unsigned int n = maxLights; n < total; n++)
+	{
+		unsigned int i = lightOrder[n];
+		sphereX[i] = 0.0f;
+		sphereY[i] = 0.0f;
+		sphereZ[i] = -1e9f;
+		sphereR[i] = 0.0f;
+	}
+	stats.CappedCount = total - maxLights;
+}
+
+// --------------------------------------------------------
+// Bins every light into the clusters of one depth slice.
+// Only touches this slice's clusters, so slices can run on
+// separate threads.
+// --------------------------------------------------------
+void LightClusterer::BinSlice(unsigned int slice)
+{
+	unsigned int first = slice * CLUSTERS_PER_SLICE;
+	for (unsigned int c = first; c < first + CLUSTERS_PER_SLICE; c++)
+	{
+		clusterPointCounts[c] = 0;
+		clusterSpotCounts[c] = 0;
+	}
+	sliceOverflow[slice] = 0;
+
+	float sliceNear = sliceDepths[slice];
+	float sliceFar = sliceDepths[slice + 1];
+
+	// Find the lights overlapping this slice's depth range, 4 at a time
+	std::vector<unsigned int>& list = candidates[slice];
+	list.clear();
+
+	__m128 nearV = _mm_set1_ps(sliceNear);
+	__m128 farV = _mm_set1_ps(sliceFar);
+	unsigned int padded = (unsigned int)sphereZ.size();
+	for (unsigned int i = 0; i < padded; i += 4)
+	{
+		__m128 z = _mm_loadu_ps(&sphereZ[i]);
+		__m128 r = _mm_loadu_ps(&sphereR[i]);
+		__m128 overlap = _mm_and_ps(
+			_mm_cmple_ps(_mm_sub_ps(z, r), farV),
+			_mm_cmpge_ps(_mm_add_ps(z, r), nearV));
+
+		int mask = _mm_movemask_ps(overlap);
+		for (unsigned int b = 0; b < 4; b++)
+		{
+			if (mask & (1 << b))
+				list.push_back(i + b);
+		}
+	}
+
+	for (unsigned int n = 0; n < list.size(); n++)
+	{
+		unsigned int light = list[n];
+		float cx = sphereX[light];
+		float cy = sphereY[light];
+		float cz = sphereZ[light];
+		float r = sphereR[light];
+
+		// Screen tiles covered by the sphere's box within this slice.  x/z is
+		// monotonic in both x and z, so the extremes are at the box corners.
+		float zMin = max(cz - r, sliceNear);
+		float zMax = min(cz + r, sliceFar);
+		float left = (cx - r) * xScale, right = (cx + r) * xScale;
+		float bottom = (cy - r) * yScale, top = (cy + r) * yScale;
+		float ndcMinX = min(left / zMin, left / zMax);
+		float ndcMaxX = max(right / zMin, right / zMax);
+		float ndcMinY = min(bottom / zMin, bottom / zMax);
+		float ndcMaxY = max(top / zMin, top / zMax);
+
+		int tileX0 = (int)floorf((ndcMinX * 0.5f + 0.5f) * CLUSTERS_X);
+		int tileX1 = (int)floorf((ndcMaxX * 0.5f + 0.5f) * CLUSTERS_X);
+		int tileY0 = (int)floorf((0.5f - ndcMaxY * 0.5f) * CLUSTERS_Y);
+		int tileY1 = (int)floorf((0.5f - ndcMinY * 0.5f) * CLUSTERS_Y);
+		if (tileX1 < 0 || tileY1 < 0 || tileX0 >= (int)CLUSTERS_X || tileY0 >= (int)CLUSTERS_Y)
+			continue;
+		tileX0 = max(tileX0, 0); tileX1 = min(tileX1, (int)CLUSTERS_X - 1);
+		tileY0 = max(tileY0, 0); tileY1 = min(tileY1, (int)CLUSTERS_Y - 1);
+
+		__m128 sx = _mm_set1_ps(cx);
+		__m128 sy = _mm_set1_ps(cy);
+		__m128 sz = _mm_set1_ps(cz);
+		__m128 radiusSq = _mm_set1_ps(r * r);
+		__m128 zero = _mm_setzero_ps();
+
+		for (int ty = tileY0; ty <= tileY1; ty++)
+		{
+			unsigned int rowStart = first + ty * CLUSTERS_X;
+
+			// Sphere vs. AABB for 4 neighbouring clusters at once
+			for (int tx = tileX0 & ~3; tx <= tileX1; tx += 4)
+			{
+				unsigned int c = rowStart + tx;
+				__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(clusterMinX + c), sx), _mm_sub_ps(sx, _mm_load_ps(clusterMaxX + c))), zero);
+				__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(clusterMinY + c), sy), _mm_sub_ps(sy, _mm_load_ps(clusterMaxY + c))), zero);
+				__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(clusterMinZ + c), sz), _mm_sub_ps(sz, _mm_load_ps(clusterMaxZ + c))), zero);
+				__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+				int mask = _mm_movemask_ps(_mm_cmple_ps(distSq, radiusSq));
+				for (int b = 0; b < 4; b++)
+				{
+					int x = tx + b;
+					if (!(mask & (1 << b)) || x < tileX0 || x > tileX1)
+						continue;
+
+					unsigned int cluster = rowStart + x;
+					unsigned int count = clusterPointCounts[cluster] + clusterSpotCounts[cluster];
+					if (count >= MAX_LIGHTS_PER_CLUSTER)
+					{
+						sliceOverflow[slice]++;
+						continue;
+					}
+
+					// Candidates are sorted, so every point light lands before the spot lights
+					if (light < pointCount)
+					{
+						clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER + count] = light;
+						clusterPointCounts[cluster]++;
+					}
+					else
+					{
+						clusterLights[cluster * MAX_LIGHTS_PER_CLUSTER + count] = light - pointCount;
+						clusterSpotCounts[cluster]++;
+					}
+				}
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Packs the per cluster lists into one index list
+// --------------------------------------------------------
+void LightClusterer::Compact()
+{
+	unsigned int offset = 0;
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		grid[c].Offset = offset;
+		grid[c].PointCount = clusterPointCounts[c];
+		grid[c].SpotCount = clusterSpotCounts[c];
+		grid[c].Padding = 0;
+		offset += clusterPointCounts[c] + clusterSpotCounts[c];
+	}
+
+	lightIndices.resize(offset);
+	for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+	{
+		unsigned int count = grid[c].PointCount + grid[c].SpotCount;
+		if (count > 0)
+			memcpy(&lightIndices[grid[c].Offset], &clusterLights[c * MAX_LIGHTS_PER_CLUSTER], sizeof(unsigned int) * count);
+	}
+}
+
+// --------------------------------------------------------
+// Copies this frame's cluster data to the GPU
+// --------------------------------------------------------
+void LightClusterer::Upload(ID3D11DeviceContext * context)
+{
+	if (!device)
+		return;
+
+	if (gridBuffer)
+		UploadBuffer(context, gridBuffer, &grid[0], sizeof(ClusterEntry) * CLUSTER_COUNT);
+
+	if (!lightIndices.empty() && EnsureBuffer(&indexBuffer, &indexSRV, sizeof(unsigned int), (unsigned int)lightIndices.size(), &indexCapacity))
+		UploadBuffer(context, indexBuffer, &lightIndices[0], sizeof(unsigned int) * (unsigned int)lightIndices.size());
+}
+
+// --------------------------------------------------------
+// Makes sure a structured buffer can hold count elements,
+// recreating it at twice the size if it can't
+//
+// Returns true if the buffer is usable
+// --------------------------------------------------------
+bool LightClusterer::EnsureBuffer(ID3D11Buffer ** buffer, ID3D11ShaderResourceView ** srv, unsigned int stride, unsigned int count, unsigned int * capacity)
+{
+	if (*buffer && count <= *capacity)
+		return true;
+
+	unsigned int newCapacity = max(count, *capacity * 2);
+
+	if (*srv) { (*srv)->Release(); *srv = nullptr; }
+	if (*buffer) { (*buffer)->Release(); *buffer = nullptr; }
+	*capacity = 0;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = stride * newCapacity;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = stride;
+	if (FAILED(device->CreateBuffer(&desc, 0, buffer)))
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = newCapacity;
+	if (FAILED(device->CreateShaderResourceView(*buffer, &srvDesc, srv)))
+		return false;
+
+	*capacity = newCapacity;
+	return true;
+}
+
+// --------------------------------------------------------
+// Overwrites the start of a dynamic buffer
+// --------------------------------------------------------
+void LightClusterer::UploadBuffer(ID3D11DeviceContext * context, ID3D11Buffer * buffer, const void * data, unsigned int size)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		return;
+
+	memcpy(mapped.pData, data, size);
+	context->Unmap(buffer, 0);
+}
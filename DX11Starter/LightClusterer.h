@@ -0,0 +1,151 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "Lights.h"
+#include "SimpleShader.h"
+
+// For the DirectX Math library
+using namespace DirectX;
+
+// --------------------------------------------------------
+// One entry of the cluster grid as seen by the pixel shader
+// (uint4 in HLSL).  The cluster's point light indices start
+// at Offset in the index list and are followed by its spot
+// light indices.
+// --------------------------------------------------------
+struct ClusterEntry
+{
+	unsigned int Offset;
+	unsigned int PointCount;
+	unsigned int SpotCount;
+	unsigned int Padding;
+};
+
+// --------------------------------------------------------
+// Per-frame statistics of the light binning
+// --------------------------------------------------------
+struct ClusterStats
+{
+	unsigned int PointLightCount;
+	unsigned int SpotLightCount;
+	unsigned int IndexCount;		// Total light references across all clusters
+	unsigned int OverflowCount;		// References dropped because a cluster was full
+	unsigned int CappedCount;		// Lights left out by SetMaxLights()
+	float BinMs;					// CPU time spent binning
+};
+
+// --------------------------------------------------------
+// Clustered forward lighting, CPU side
+//
+// The view frustum is split into a 16x9 grid of screen tiles
+// and 24 exponentially spaced depth slices.  Every frame the
+// point and spot lights are binned into the clusters they touch
+// (sphere vs. cluster AABB, 4 clusters per SSE test, one job per
+// depth slice) and the results are uploaded to structured
+// buffers the pixel shader indexes with its own cluster.  The
+// lights themselves are uploaded by LightManager.
+//
+// The grid dimensions must match the defines in PixelShader.hlsl
+// --------------------------------------------------------
+class LightClusterer
+{
+public:
+	static const unsigned int CLUSTERS_X = 16;
+	static const unsigned int CLUSTERS_Y = 9;
+	static const unsigned int CLUSTERS_Z = 24;
+	static const unsigned int CLUSTERS_PER_SLICE = CLUSTERS_X * CLUSTERS_Y;
+	static const unsigned int CLUSTER_COUNT = CLUSTERS_PER_SLICE * CLUSTERS_Z;
+	static const unsigned int MAX_LIGHTS_PER_CLUSTER = 128;
+
+	LightClusterer();
+	~LightClusterer();
+
+	// Creates the GPU buffers
+	void Init(ID3D11Device* device);
+
+	// Bins the lights for this frame and uploads the results
+	//
+	// viewMatrix, projectionMatrix - Camera matrices (transposed for HLSL, like Camera stores them)
+	void Update(
+		ID3D11DeviceContext* context,
+		const XMFLOAT4X4& viewMatrix,
+		const XMFLOAT4X4& projectionMatrix,
+		unsigned int screenWidth,
+		unsigned int screenHeight,
+		const std::vector<PointLight>& pointLights,
+		const std::vector<SpotLight>& spotLights);
+
+	// Bins only the count lights nearest the camera, point and
+	// spot lights together; the rest aren't shaded at all
+	void SetMaxLights(unsigned int count) { maxLights = count; }
+	unsigned int GetMaxLights() const { return maxLights; }
+
+	// Binds the cluster buffers through the given pixel shader
+	void BindResources(SimplePixelShader* pixelShader);
+
+	// (tile width, tile height, depth slice scale, depth slice bias)
+	const XMFLOAT4& GetClusterParams() const { return clusterParams; }
+
+	const ClusterStats& GetStats() const { return stats; }
+
+private:
+	// Cluster bounds in view space, SoA and 16 byte aligned so
+	// four neighbouring clusters of a row load as one register
+	float* clusterMinX;
+	float* clusterMinY;
+	float* clusterMinZ;
+	float* clusterMaxX;
+	float* clusterMaxY;
+	float* clusterMaxZ;
+	float sliceDepths[CLUSTERS_Z + 1];
+	XMFLOAT4X4 boundsProjection;
+	float xScale;
+	float yScale;
+
+	// View space light bounding spheres, SoA padded to a multiple of 4
+	std::vector<float> sphereX;
+	std::vector<float> sphereY;
+	std::vector<float> sphereZ;
+	std::vector<float> sphereR;
+	unsigned int pointCount;
+	unsigned int spotCount;
+	unsigned int maxLights;
+	std::vector<float> lightDistances;		// Capping scratch space
+	std::vector<unsigned int> lightOrder;
+
+	// Per slice binning scratch space
+	std::vector<unsigned int> candidates[CLUSTERS_Z];
+	std::vector<unsigned int> clusterLights;		// MAX_LIGHTS_PER_CLUSTER per cluster
+	std::vector<unsigned int> clusterPointCounts;
+	std::vector<unsigned int> clusterSpotCounts;
+	unsigned int sliceOverflow[CLUSTERS_Z];
+
+	// Final, compacted results
+	std::vector<ClusterEntry> grid;
+	std::vector<unsigned int> lightIndices;
+
+	// GPU buffers and views
+	ID3D11Device* device;
+	ID3D11Buffer* gridBuffer;
+	ID3D11Buffer* indexBuffer;
+	ID3D11ShaderResourceView* gridSRV;
+	ID3D11ShaderResourceView* indexSRV;
+	unsigned int indexCapacity;
+
+	XMFLOAT4 clusterParams;
+	ClusterStats stats;
+	double perfCounterSeconds;
+
+	void BuildClusterBounds(const XMMATRIX& projection);
+	void GatherSpheres(const XMMATRIX& view, const std::vector<PointLight>& pointLights, const std::vector<SpotLight>& spotLights);
+	void CapLights();
+	void BinSlice(unsigned int slice);
+	void BinLights(unsigned int slice, unsigned int firstLight, unsigned int lastLight, std::vector<unsigned int>& counts);
+	void Compact();
+	void Upload(ID3D11DeviceContext* context);
+
+	// Creates (or grows) a dynamic structured buffer and its view
+	bool EnsureBuffer(ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv, unsigned int stride, unsigned int count, unsigned int* capacity);
+	void UploadBuffer(ID3D11DeviceContext* context, ID3D11Buffer* buffer, const void* data, unsigned int size);
+};
@@ -0,0 +1,242 @@
+#include "LightManager.h"
+#include <limits.h>
+
+LightManager::LightManager()
+{
+	device = nullptr;
+	uploadedBytes = 0;
+
+	InitBuffer(directionalBuffer, sizeof(DirectionalLight), 8);
+	InitBuffer(pointBuffer, sizeof(PointLight), 256);
+	InitBuffer(spotBuffer, sizeof(SpotLight), 64);
+
+	for (unsigned int i = 0; i < LIGHT_LIST_COUNT; i++)
+	{
+		changes[i].BaseRevision = 0;
+		changes[i].Revision = 0;
+		changes[i].DirtyBegin = UINT_MAX;
+		changes[i].DirtyEnd = 0;
+	}
+}
+
+
+LightManager::~LightManager()
+{
+	ReleaseBuffer(directionalBuffer);
+	ReleaseBuffer(pointBuffer);
+	ReleaseBuffer(spotBuffer);
+}
+
+// --------------------------------------------------------
+// Creates the structured buffers with their starting capacity
+// --------------------------------------------------------
+void LightManager::Init(ID3D11Device * device)
+{
+	this->device = device;
+
+	CreateBuffer(directionalBuffer, directionalBuffer.Capacity);
+	CreateBuffer(pointBuffer, pointBuffer.Capacity);
+	CreateBuffer(spotBuffer, spotBuffer.Capacity);
+}
+
+unsigned int LightManager::AddDirectionalLight(const DirectionalLight & light)
+{
+	directionalLights.push_back(light);
+	MarkDirty(LIGHT_LIST_DIRECTIONAL, (unsigned int)directionalLights.size() - 1);
+	return (unsigned int)directionalLights.size() - 1;
+}
+
+unsigned int LightManager::AddPointLight(const PointLight & light)
+{
+	pointLights.push_back(light);
+	MarkDirty(LIGHT_LIST_POINT, (unsigned int)pointLights.size() - 1);
+	return (unsigned int)pointLights.size() - 1;
+}
+
+unsigned int LightManager::AddSpotLight(const SpotLight & light)
+{
+	spotLights.push_back(light);
+	MarkDirty(LIGHT_LIST_SPOT, (unsigned int)spotLights.size() - 1);
+	return (unsigned int)spotLights.size() - 1;
+}
+
+void LightManager::SetDirectionalLight(unsigned int index, const DirectionalLight & light)
+{
+	if (index >= directionalLights.size())
+		return;
+
+	directionalLights[index] = light;
+	MarkDirty(LIGHT_LIST_DIRECTIONAL, index);
+}
+
+void LightManager::SetPointLight(unsigned int index, const PointLight & light)
+{
+	if (index >= pointLights.size())
+		return;
+
+	pointLights[index] = light;
+	MarkDirty(LIGHT_LIST_POINT, index);
+}
+
+void LightManager::SetSpotLight(unsigned int index, const SpotLight & light)
+{
+	if (index >= spotLights.size())
+		return;
+
+	spotLights[index] = light;
+	MarkDirty(LIGHT_LIST_SPOT, index);
+}
+
+// --------------------------------------------------------
+// Copies a list into the snapshot if the snapshot doesn't
+// already hold its current revision, and hands over the
+// changes made since the last extraction
+// --------------------------------------------------------
+template<typename T>
+static void ExtractList(const std::vector<T>& lights, std::vector<T>& copy, LightListChanges& changes, LightListChanges& copyChanges)
+{
+	if (copyChanges.Revision != changes.Revision || copy.size() != lights.size())
+		copy = lights;
+
+	copyChanges = changes;
+	changes.BaseRevision = changes.Revision;
+	changes.DirtyBegin = UINT_MAX;
+	changes.DirtyEnd = 0;
+}
+
+void LightManager::Extract(LightSnapshot & snapshot)
+{
+	ExtractList(directionalLights, snapshot.DirectionalLights, changes[LIGHT_LIST_DIRECTIONAL], snapshot.Changes[LIGHT_LIST_DIRECTIONAL]);
+	ExtractList(pointLights, snapshot.PointLights, changes[LIGHT_LIST_POINT], snapshot.Changes[LIGHT_LIST_POINT]);
+	ExtractList(spotLights, snapshot.SpotLights, changes[LIGHT_LIST_SPOT], snapshot.Changes[LIGHT_LIST_SPOT]);
+}
+
+// --------------------------------------------------------
+// Sends the lights changed in the snapshot to the GPU.
+// Unchanged lists cost nothing.
+// --------------------------------------------------------
+void LightManager::Upload(ID3D11DeviceContext * context, const LightSnapshot & snapshot)
+{
+	uploadedBytes = 0;
+	if (!device)
+		return;
+
+	UploadBuffer(context, directionalBuffer, snapshot.DirectionalLights.empty() ? nullptr : &snapshot.DirectionalLights[0], (unsigned int)snapshot.DirectionalLights.size(), snapshot.Changes[LIGHT_LIST_DIRECTIONAL]);
+	UploadBuffer(context, pointBuffer, snapshot.PointLights.empty() ? nullptr : &snapshot.PointLights[0], (unsigned int)snapshot.PointLights.size(), snapshot.Changes[LIGHT_LIST_POINT]);
+	UploadBuffer(context, spotBuffer, snapshot.SpotLights.empty() ? nullptr : &snapshot.SpotLights[0], (unsigned int)snapshot.SpotLights.size(), snapshot.Changes[LIGHT_LIST_SPOT]);
+}
+
+// --------------------------------------------------------
+// Point and spot lights are only reached through the cluster
+// lists, so only the directional lights need a count
+// --------------------------------------------------------
+void LightManager::BindResources(SimplePixelShader * pixelShader)
+{
+	pixelShader->SetShaderResourceView(pixelShader->GetShaderResourceViewSlot(SHADER_NAME("directionalLights")), directionalBuffer.SRV);
+	pixelShader->SetShaderResourceView(pixelShader->GetShaderResourceViewSlot(SHADER_NAME("pointLights")), pointBuffer.SRV);
+	pixelShader->SetShaderResourceView(pixelShader->GetShaderResourceViewSlot(SHADER_NAME("spotLights")), spotBuffer.SRV);
+}
+
+void LightManager::InitBuffer(LightBuffer & buffer, unsigned int stride, unsigned int capacity)
+{
+	buffer.Buffer = nullptr;
+	buffer.SRV = nullptr;
+	buffer.Stride = stride;
+	buffer.Capacity = capacity;
+	buffer.Revision = 0;
+}
+
+void LightManager::MarkDirty(LightList list, unsigned int index)
+{
+	changes[list].Revision++;
+	if (index < changes[list].DirtyBegin) changes[list].DirtyBegin = index;
+	if (index + 1 > changes[list].DirtyEnd) changes[list].DirtyEnd = index + 1;
+}
+
+void LightManager::ReleaseBuffer(LightBuffer & buffer)
+{
+	if (buffer.SRV) { buffer.SRV->Release(); buffer.SRV = nullptr; }
+	if (buffer.Buffer) { buffer.Buffer->Release(); buffer.Buffer = nullptr; }
+}
+
+// --------------------------------------------------------
+// Copies the dirty range of a light list.  A list that has
+// outgrown its buffer gets a new one twice the size and is
+// copied in full, as is a list whose previous revision never
+// made it to the GPU (a snapshot was skipped).
+// --------------------------------------------------------
+void LightManager::UploadBuffer(ID3D11DeviceContext * context, LightBuffer & buffer, const void * data, unsigned int count, const LightListChanges& listChanges)
+{
+	if (buffer.Buffer && listChanges.Revision == buffer.Revision)
+		return;
+
+	unsigned int dirtyBegin = listChanges.DirtyBegin;
+	unsigned int dirtyEnd = listChanges.DirtyEnd;
+	if (listChanges.BaseRevision != buffer.Revision)
+	{
+		dirtyBegin = 0;
+		dirtyEnd = count;
+	}
+
+	if (count > buffer.Capacity || !buffer.Buffer)
+	{
+		unsigned int capacity = buffer.Capacity * 2 > count ? buffer.Capacity * 2 : count;
+		if (!CreateBuffer(buffer, capacity))
+			return;
+
+		dirtyBegin = 0;
+		dirtyEnd = count;
+	}
+
+	if (dirtyEnd > count)
+		dirtyEnd = count;
+	buffer.Revision = listChanges.Revision;
+	if (dirtyBegin >= dirtyEnd)
+		return;
+
+	// Default usage buffer, so only the changed lights are copied
+	D3D11_BOX box = {};
+	box.left = dirtyBegin * buffer.Stride;
+	box.right = dirtyEnd * buffer.Stride;
+	box.bottom = 1;
+	box.back = 1;
+	context->UpdateSubresource(buffer.Buffer, 0, &box, (const char*)data + box.left, 0, 0);
+
+	uploadedBytes += box.right - box.left;
+}
+
+// --------------------------------------------------------
+// (Re)creates a structured buffer and its view
+//
+// Returns true if the buffer is usable
+// --------------------------------------------------------
+bool LightManager::CreateBuffer(LightBuffer & buffer, unsigned int capacity)
+{
+	ReleaseBuffer(buffer);
+	if (capacity == 0)
+		capacity = 1;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.ByteWidth = buffer.Stride * capacity;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	desc.CPUAccessFlags = 0;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	desc.StructureByteStride = buffer.Stride;
+	if (FAILED(device->CreateBuffer(&desc, 0, &buffer.Buffer)))
+		return false;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = capacity;
+	if (FAILED(device->CreateShaderResourceView(buffer.Buffer, &srvDesc, &buffer.SRV)))
+	{
+		ReleaseBuffer(buffer);
+		return false;
+	}
+
+	buffer.Capacity = capacity;
+	return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <d3d11.h>
+#include <vector>
+#include "Lights.h"
+#include "SimpleShader.h"
+
+enum LightList
+{
+	LIGHT_LIST_DIRECTIONAL,
+	LIGHT_LIST_POINT,
+	LIGHT_LIST_SPOT,
+	LIGHT_LIST_COUNT
+};
+
+// --------------------------------------------------------
+// Changes to one light list.  Revision goes up with every
+// change; the dirty range covers the lights changed since
+// BaseRevision.
+// --------------------------------------------------------
+struct LightListChanges
+{
+	unsigned int BaseRevision;
+	unsigned int Revision;
+	unsigned int DirtyBegin;
+	unsigned int DirtyEnd;
+};
+
+// --------------------------------------------------------
+// Copy of the lights handed to the render thread.  Lists are
+// only copied again when their revision changed.
+// --------------------------------------------------------
+struct LightSnapshot
+{
+	std::vector<DirectionalLight> DirectionalLights;
+	std::vector<PointLight> PointLights;
+	std::vector<SpotLight> SpotLights;
+	LightListChanges Changes[LIGHT_LIST_COUNT];
+
+	LightSnapshot()
+	{
+		for (unsigned int i = 0; i < LIGHT_LIST_COUNT; i++)
+		{
+			LightListChanges empty = { 0, 0, 0, 0 };
+			Changes[i] = empty;
+		}
+	}
+};
+
+// --------------------------------------------------------
+// Owns every light in the scene and mirrors them into
+// structured buffers the pixel shader loops over
+//
+// Lights can be added or changed at any time; changes are
+// only recorded, and Extract() hands them to the render thread
+// in a LightSnapshot.  Upload() then copies the changed range
+// of each list to the GPU.  Light indices are stable, so they
+// double as handles.
+//
+// The lists and Extract() belong to the simulation side, the
+// GPU buffers, Upload() and BindResources() to the render side.
+// --------------------------------------------------------
+class LightManager
+{
+public:
+	LightManager();
+	~LightManager();
+
+	// Creates the GPU buffers
+	void Init(ID3D11Device* device);
+
+	// Adds a light and returns its index
+	unsigned int AddDirectionalLight(const DirectionalLight& light);
+	unsigned int AddPointLight(const PointLight& light);
+	unsigned int AddSpotLight(const SpotLight& light);
+
+	// Replaces an existing light
+	void SetDirectionalLight(unsigned int index, const DirectionalLight& light);
+	void SetPointLight(unsigned int index, const PointLight& light);
+	void SetSpotLight(unsigned int index, const SpotLight& light);
+
+	const std::vector<DirectionalLight>& GetDirectionalLights() const { return directionalLights; }
+	const std::vector<PointLight>& GetPointLights() const { return pointLights; }
+	const std::vector<SpotLight>& GetSpotLights() const { return spotLights; }
+
+	// Copies the lists changed since the last call into a snapshot
+	void Extract(LightSnapshot& snapshot);
+
+	// Copies every light changed in the snapshot to the GPU, call once per frame
+	void Upload(ID3D11DeviceContext* context, const LightSnapshot& snapshot);
+
+	// Binds the light buffers through the given pixel shader
+	void BindResources(SimplePixelShader* pixelShader);
+
+	// Bytes sent to the GPU by the last Upload()
+	unsigned int GetUploadedBytes() const { return uploadedBytes; }
+
+private:
+	// GPU copy of one light list
+	struct LightBuffer
+	{
+		ID3D11Buffer* Buffer;
+		ID3D11ShaderResourceView* SRV;
+		unsigned int Stride;
+		unsigned int Capacity;
+
+		// Revision of the list the buffer holds
+		unsigned int Revision;
+	};
+
+	std::vector<DirectionalLight> directionalLights;
+	std::vector<PointLight> pointLights;
+	std::vector<SpotLight> spotLights;
+
+	LightBuffer directionalBuffer;
+	LightBuffer pointBuffer;
+	LightBuffer spotBuffer;
+
+	// Changes since the last Extract()
+	LightListChanges changes[LIGHT_LIST_COUNT];
+
+	ID3D11Device* device;
+	unsigned int uploadedBytes;
+
+	void InitBuffer(LightBuffer& buffer, unsigned int stride, unsigned int capacity);
+	void MarkDirty(LightList list, unsigned int index);
+	void ReleaseBuffer(LightBuffer& buffer);
+
+	// Grows the buffer if needed and copies the dirty range
+	void UploadBuffer(ID3D11DeviceContext* context, LightBuffer& buffer, const void* data, unsigned int count, const LightListChanges& listChanges);
+	bool CreateBuffer(LightBuffer& buffer, unsigned int capacity);
+};
@@ -4,15 +4,36 @@
 
 using namespace DirectX;
 
+// --------------------------------------------------------
+// Light structs are copied straight into structured buffers,
+// so their layout must match PixelShader.hlsl and stay a
+// multiple of 16 bytes
+// --------------------------------------------------------
+
 struct DirectionalLight
 {
 	XMFLOAT4 AmbientColor;
 	XMFLOAT4 DiffuseColor;
 	XMFLOAT3 Direction;
+	float Padding;
 };
 
 struct PointLight
 {
 	XMFLOAT4 Color;
 	XMFLOAT3 Position;
-};
\ No newline at end of file
+	float Range;		// Distance at which the light fades out completely
+};
+
+struct SpotLight
+{
+	XMFLOAT4 Color;
+	XMFLOAT3 Position;
+	float Range;		// Distance at which the light fades out completely
+	XMFLOAT3 Direction;
+	float SpotAngle;	// Cosine of the cone's half angle
+};
+
+static_assert(sizeof(DirectionalLight) % 16 == 0, "DirectionalLight must be a multiple of 16 bytes");
+static_assert(sizeof(PointLight) % 16 == 0, "PointLight must be a multiple of 16 bytes");
+static_assert(sizeof(SpotLight) % 16 == 0, "SpotLight must be a multiple of 16 bytes");
@@ -1,6 +1,15 @@
 
 #include <Windows.h>
 #include "Game.h"
+#include "DrawStream.h"
+#include "CommandBuffer.h"
+#include "RenderGraph.h"
+#include "ViewCuller.h"
+#include "FrameGovernor.h"
+#include "ShadowCascades.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
 
 // --------------------------------------------------------
 // Entry point for a graphical (non-console) Windows application
@@ -18,10 +27,57 @@ int WINAPI WinMain(
 	_CrtSetDbgFlag( _CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF );
 #endif
 
+	// Frame governor trace replay, checked before --replay,
+	// which its name contains
+	std::string commandLine(lpCmdLine);
+	if (commandLine.find("--governor-replay") != std::string::npos)
+		return RunFrameGovernorReplay(commandLine);
+
+	// Draw stream replay harness, runs instead of the game
+	if (commandLine.find("--replay") != std::string::npos)
+		return RunDrawStreamReplay(commandLine);
+
+	// Headless draw packet benchmark, also instead of the game
+	if (commandLine.find("--command-benchmark") != std::string::npos)
+		return RunCommandQueueBenchmark(commandLine);
+
+	// Headless render graph memory report
+	if (commandLine.find("--render-graph-report") != std::string::npos)
+		return RunRenderGraphReport(commandLine);
+
+	// Headless multi-view culling benchmark
+	if (commandLine.find("--culling-benchmark") != std::string::npos)
+		return RunViewCullingBenchmark(commandLine);
+
+	// Headless shadow cascade fitting and caster culling report
+	if (commandLine.find("--shadow-cascades") != std::string::npos)
+		return RunShadowCascadeReport(commandLine);
+
 	// Create the Game object using
 	// the app handle we got from WinMain
 	Game dxGame(hInstance);
 
+	// Optional frame rate cap, e.g. for kiosks: --fps-cap 60
+	size_t capArgument = commandLine.find("--fps-cap");
+	if (capArgument != std::string::npos)
+	{
+		float cap = (float)atof(commandLine.c_str() + capArgument + strlen("--fps-cap"));
+		dxGame.SetFrameRateCap(cap);
+
+		// No point buying back time the cap sleeps away
+		if (cap > 0.0f)
+			dxGame.SetFrameBudget(1000.0f / cap);
+	}
+
+	// Record frame times for the governor: --governor-trace frames.txt
+	size_t traceArgument = commandLine.find("--governor-trace");
+	if (traceArgument != std::string::npos)
+	{
+		std::string tracePath;
+		std::istringstream(commandLine.substr(traceArgument + strlen("--governor-trace"))) >> tracePath;
+		dxGame.SetGovernorTrace(tracePath);
+	}
+
 	// Result variable for function calls below
 	HRESULT hr = S_OK;
 
@@ -1,6 +1,27 @@
 #include "Material.h"
+#include "ShaderConstants.h"
 
+// Puts a resource in a table of consecutive registers, growing
+// the table to cover the slot.  Registers in between stay null.
+template<typename T>
+static void AddToTable(unsigned int slot, unsigned int& startSlot, std::vector<T*>& table, T* resource)
+{
+	if (table.empty())
+		startSlot = slot;
+
+	if (slot < startSlot)
+	{
+		table.insert(table.begin(), startSlot - slot, (T*)nullptr);
+		startSlot = slot;
+	}
+
+	if (slot - startSlot >= table.size())
+		table.resize(slot - startSlot + 1, nullptr);
 
+	table[slot - startSlot] = resource;
+}
+
+unsigned int Material::nextId = 0;
 
 Material::Material(SimpleVertexShader* vShader, SimplePixelShader* pShader, ID3D11ShaderResourceView* srvIn, ID3D11SamplerState* samplerIn)
 {
@@ -8,6 +29,46 @@ Material::Material(SimpleVertexShader* vShader, SimplePixelShader* pShader, ID3D
 	pixelShader = pShader;
 	srv = srvIn;
 	sampler = samplerIn;
+	id = nextId++;
+	bindGroup = id;
+	textureSlice = 0;
+
+	pipelineState = nullptr;
+	if (PipelineStateCache::Instance())
+	{
+		PipelineStateDesc desc;
+		desc.SetDefaults();
+		desc.VertexShader = vertexShader;
+		desc.PixelShader = pixelShader;
+
+		// The depth prepass already wrote this surface's depth
+		desc.DepthStencil.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+		pipelineState = PipelineStateCache::Instance()->Create(desc);
+	}
+
+	worldParameter = vertexShader->GetParameter(SHADER_NAME("world"));
+	viewParameter = vertexShader->GetParameter(SHADER_NAME("view"));
+	projectionParameter = vertexShader->GetParameter(SHADER_NAME("projection"));
+
+	// The buffer holding the tint is the material's, laid out
+	// like the shader's copy of it
+	constantBufferIndex = 0;
+	srvStartSlot = 0;
+	samplerStartSlot = 0;
+	SimpleShaderParameter tint = pixelShader->GetParameter(SHADER_NAME("tint"));
+	if (tint.IsValid())
+	{
+		const SimpleConstantBuffer* cb = pixelShader->GetBufferInfo(tint.ConstantBufferIndex);
+		constantBufferIndex = tint.ConstantBufferIndex;
+		constants.assign(cb->LocalDataBuffer, cb->LocalDataBuffer + cb->Size);
+	}
+
+	XMFLOAT4 white(1.0f, 1.0f, 1.0f, 1.0f);
+	float specularPower = 128.0f;
+	SetConstant(SHADER_NAME("tint"), &white, sizeof(XMFLOAT4));
+	SetConstant(SHADER_NAME("specularPower"), &specularPower, sizeof(float));
+	SetTexture(SHADER_NAME("diffuseTexture"), srv);
+	SetSampler(SHADER_NAME("basicSampler"), sampler);
 }
 
 
@@ -15,6 +76,7 @@ Material::~Material()
 {
 	vertexShader = nullptr;
 	pixelShader = nullptr;
+	pipelineState = nullptr;
 	srv = nullptr;
 	sampler = nullptr;
 }
@@ -38,3 +100,113 @@ ID3D11SamplerState * Material::GetSamplerState()
 {
 	return sampler;
 }
+
+void Material::SetSamplerState(ID3D11SamplerState * samplerState)
+{
+	sampler = samplerState;
+	SetSampler(SHADER_NAME("basicSampler"), sampler);
+}
+
+bool Material::SetConstant(unsigned int nameHash, const void * data, unsigned int size)
+{
+	SimpleShaderParameter parameter = pixelShader->GetParameter(nameHash);
+	if (constants.empty() || !parameter.IsValid() || parameter.ConstantBufferIndex != constantBufferIndex || parameter.Size != size)
+		return false;
+
+	memcpy(&constants[parameter.ByteOffset], data, size);
+	return true;
+}
+
+bool Material::SetTexture(unsigned int nameHash, ID3D11ShaderResourceView * texture)
+{
+	SimpleShaderSlot slot = pixelShader->GetShaderResourceViewSlot(nameHash);
+	if (!slot.IsValid())
+		return false;
+
+	AddToTable(slot.BindIndex, srvStartSlot, srvTable, texture);
+	return true;
+}
+
+bool Material::SetSampler(unsigned int nameHash, ID3D11SamplerState * samplerState)
+{
+	SimpleShaderSlot slot = pixelShader->GetSamplerSlot(nameHash);
+	if (!slot.IsValid())
+		return false;
+
+	AddToTable(slot.BindIndex, samplerStartSlot, samplerTable, samplerState);
+	return true;
+}
+
+bool Material::BindsLike(const Material * other) const
+{
+	return
+		vertexShader == other->vertexShader &&
+		pixelShader == other->pixelShader &&
+		pipelineState == other->pipelineState &&
+		constantBufferIndex == other->constantBufferIndex &&
+		constants == other->constants &&
+		srvStartSlot == other->srvStartSlot &&
+		srvTable == other->srvTable &&
+		samplerStartSlot == other->samplerStartSlot &&
+		samplerTable == other->samplerTable;
+}
+
+void Material::GroupByBinds(const std::vector<Material*>& materials)
+{
+	for (size_t i = 0; i < materials.size(); i++)
+	{
+		materials[i]->bindGroup = materials[i]->id;
+		for (size_t j = 0; j < i; j++)
+		{
+			if (materials[i]->BindsLike(materials[j]))
+			{
+				materials[i]->bindGroup = materials[j]->bindGroup;
+				break;
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// The whole buffer is written in one go when the shader uses
+// the default layout; other permutations (e.g. instancing,
+// without the world matrix) go through the handles.
+// --------------------------------------------------------
+void Material::SetTransforms(const XMFLOAT4X4 & worldMatrix, const XMFLOAT4X4 & viewMatrix, const XMFLOAT4X4 & projectionMatrix)
+{
+	VertexShaderExternalData constants;
+	constants.world = worldMatrix;
+	constants.view = viewMatrix;
+	constants.projection = projectionMatrix;
+	if (vertexShader->SetConstants(constants))
+		return;
+
+	vertexShader->SetMatrix4x4(worldParameter, worldMatrix);
+	vertexShader->SetMatrix4x4(viewParameter, viewMatrix);
+	vertexShader->SetMatrix4x4(projectionParameter, projectionMatrix);
+}
+
+// --------------------------------------------------------
+// Nothing here depends on the draw, so the renderer only
+// calls it when the material changes
+// --------------------------------------------------------
+void Material::Bind()
+{
+	if (!constants.empty())
+	{
+		pixelShader->SetBufferData(constantBufferIndex, &constants[0], (unsigned int)constants.size());
+		pixelShader->CopyBufferData(constantBufferIndex);
+	}
+
+	if (!srvTable.empty())
+		pixelShader->SetShaderResourceViews(srvStartSlot, (unsigned int)srvTable.size(), &srvTable[0]);
+
+	if (!samplerTable.empty())
+		pixelShader->SetSamplerStates(samplerStartSlot, (unsigned int)samplerTable.size(), &samplerTable[0]);
+}
+
+void Material::Prepare(const XMFLOAT4X4 & worldMatrix, const XMFLOAT4X4 & viewMatrix, const XMFLOAT4X4 & projectionMatrix)
+{
+	SetTransforms(worldMatrix, viewMatrix, projectionMatrix);
+	Bind();
+}
@@ -1,23 +1,102 @@
 #pragma once
 #include "SimpleShader.h"
+#include "PipelineState.h"
 
 using namespace DirectX;
 
+// --------------------------------------------------------
+// Shaders plus everything a draw binds per material
+//
+// The pixel shader's MaterialConstants buffer is kept as a
+// ready-made image laid out by the shader's reflection, and
+// the textures and samplers as tables covering consecutive
+// registers.  Binding a material is one buffer copy (skipped
+// by the shader if the data didn't change) and one call each
+// for the SRV and sampler ranges.
+//
+// A material whose texture is a slice of a texture array
+// passes the slice per instance instead of binding it, so
+// materials that differ only by slice bind the same things.
+// GroupByBinds() gives those materials one bind group, which
+// draws sort by and the renderer instances across.
+// --------------------------------------------------------
 class Material
 {
 private:
 	SimpleVertexShader* vertexShader;
 	SimplePixelShader* pixelShader;
+	const PipelineState* pipelineState;
+
+	// Creation order, used in draw sort keys
+	unsigned int id;
+	static unsigned int nextId;
+
+	// Id of the first material binding the same things
+	unsigned int bindGroup;
+	unsigned int textureSlice;
 	ID3D11ShaderResourceView* srv;
 	ID3D11SamplerState* sampler;
 
+	// Parameter handles, resolved once when the material is made
+	SimpleShaderParameter worldParameter;
+	SimpleShaderParameter viewParameter;
+	SimpleShaderParameter projectionParameter;
+
+	// Image of the pixel shader's material constant buffer
+	unsigned int constantBufferIndex;
+	std::vector<unsigned char> constants;
+
+	// Resources for consecutive registers, starting at the start slots
+	unsigned int srvStartSlot;
+	std::vector<ID3D11ShaderResourceView*> srvTable;
+	unsigned int samplerStartSlot;
+	std::vector<ID3D11SamplerState*> samplerTable;
+
 public:
 	Material(SimpleVertexShader* vShader, SimplePixelShader* pShader, ID3D11ShaderResourceView* srvIn, ID3D11SamplerState* samplerIn);
 	~Material();
 
 	SimpleVertexShader* GetVertexShader();
 	SimplePixelShader* GetPixelShader();
+	unsigned int GetId() const { return id; }
+	unsigned int GetBindGroup() const { return bindGroup; }
+
+	// Slice of the texture array set as the diffuse texture,
+	// passed to the shader per instance
+	void SetTextureSlice(unsigned int slice) { textureSlice = slice; }
+	unsigned int GetTextureSlice() const { return textureSlice; }
+
+	// True if Bind() on either would leave the same state
+	bool BindsLike(const Material* other) const;
+
+	// Puts materials that bind alike in one group.  Call once
+	// they're set up; each is its own group until then.
+	static void GroupByBinds(const std::vector<Material*>& materials);
+
+	// Default states for the shaders, if a PipelineStateCache
+	// existed when the material was made, unless replaced.  The
+	// state's shaders must be this material's.
+	const PipelineState* GetPipelineState() const { return pipelineState; }
+	void SetPipelineState(const PipelineState* state) { pipelineState = state; }
 	ID3D11ShaderResourceView* GetSRV();
 	ID3D11SamplerState* GetSamplerState();
+
+	// Replaces the sampler given at creation, e.g. for a new LOD bias
+	void SetSamplerState(ID3D11SamplerState* samplerState);
+
+	// Material values, by pixel shader name hash (see SHADER_NAME).
+	// Only variables of the material constant buffer can be set.
+	bool SetConstant(unsigned int nameHash, const void* data, unsigned int size);
+	bool SetTexture(unsigned int nameHash, ID3D11ShaderResourceView* texture);
+	bool SetSampler(unsigned int nameHash, ID3D11SamplerState* samplerState);
+
+	// Sets the WVP matrices (transposed for HLSL)
+	void SetTransforms(const XMFLOAT4X4& worldMatrix, const XMFLOAT4X4& viewMatrix, const XMFLOAT4X4& projectionMatrix);
+
+	// Copies the material constants and binds the textures and samplers
+	void Bind();
+
+	// SetTransforms() and Bind() together
+	void Prepare(const XMFLOAT4X4& worldMatrix, const XMFLOAT4X4& viewMatrix, const XMFLOAT4X4& projectionMatrix);
 };
 
@@ -1,23 +1,40 @@
 #include "Mesh.h"
 #include <vector>
 #include <fstream>
+#include <cfloat>
 
 // For the DirectX Math library
 using namespace DirectX;
 
+unsigned int Mesh::nextId = 0;
+
 Mesh::Mesh()
 {
+	id = nextId++;
+	vertexBuffer = nullptr;
+	attributeBuffer = nullptr;
+	indexBuffer = nullptr;
+	geometry = GEOMETRY_INVALID;
+	streams = VERTEX_STREAMS_INTERLEAVED;
+	indexCount = 0;
+	boundsMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
 }
 
 
-Mesh::Mesh(Vertex * vertices, int indicesInVertexBuffer, int * indices, int indicesInIndexBuffer, ID3D11Device * device)
+Mesh::Mesh(Vertex * vertices, int indicesInVertexBuffer, int * indices, int indicesInIndexBuffer, ID3D11Device * device, VertexStreams streams)
+	: Mesh()
 {
-	InitializeVertexBuffer(vertices, indicesInVertexBuffer, device);
-	InitializeIndexBuffer((UINT*)indices, indicesInIndexBuffer, device);
+	this->streams = streams;
+	StoreCPUGeometry(vertices, indicesInVertexBuffer, (UINT*)indices, indicesInIndexBuffer);
+	CreateBuffers(vertices, indicesInVertexBuffer, (UINT*)indices, indicesInIndexBuffer, device);
 }
 
-Mesh::Mesh(std::string parameter, ID3D11Device* device)
+Mesh::Mesh(std::string parameter, ID3D11Device* device, VertexStreams streams)
+	: Mesh()
 {
+	this->streams = streams;
+
 	// File input object
 	std::ifstream obj (parameter);
 
@@ -202,8 +219,8 @@ Mesh::Mesh(std::string parameter, ID3D11Device* device)
 	// - "vertCounter" is BOTH the number of vertices and the number of indices
 	// - Yes, the indices are a bit redundant here (one per vertex)
 
-	InitializeVertexBuffer(&verts[0], vertCounter, device);
-	InitializeIndexBuffer(&indices[0], vertCounter, device);
+	StoreCPUGeometry(&verts[0], vertCounter, &indices[0], vertCounter);
+	CreateBuffers(&verts[0], vertCounter, &indices[0], vertCounter, device);
 }
 
 Mesh::~Mesh()
@@ -211,25 +228,132 @@ Mesh::~Mesh()
 	// Release any (and all!) DirectX objects
 	// we've made in the Mesh class
 	if (vertexBuffer) { vertexBuffer->Release(); }
+	if (attributeBuffer) { attributeBuffer->Release(); }
 	if (indexBuffer) { indexBuffer->Release(); }
+	if (geometry != GEOMETRY_INVALID && GeometryHeap::Instance())
+		GeometryHeap::Instance()->Free(geometry);
+}
+
+void Mesh::CreateBuffers(Vertex * vertices, int vertexCount, UINT * indices, int indexCount, ID3D11Device * device)
+{
+	// Small meshes are the common case, so share the heap's
+	// buffers instead of creating two of our own
+	GeometryHeap* heap = GeometryHeap::Instance();
+	if (heap)
+	{
+		geometry = heap->Allocate(vertices, vertexCount, indices, indexCount, streams);
+		if (geometry != GEOMETRY_INVALID)
+		{
+			this->indexCount = indexCount;
+			return;
+		}
+	}
+
+	if (streams == VERTEX_STREAMS_SPLIT)
+		InitializeSplitVertexBuffers(vertices, vertexCount, device);
+	else
+		InitializeVertexBuffer(vertices, vertexCount, device);
+	InitializeIndexBuffer(indices, indexCount, device);
 }
 
 ID3D11Buffer * Mesh::GetVertexBuffer() const
 {
+	if (geometry != GEOMETRY_INVALID)
+		return GeometryHeap::Instance()->GetVertexBuffer(geometry);
 	return vertexBuffer;
 }
 
+ID3D11Buffer * Mesh::GetAttributeBuffer() const
+{
+	if (geometry != GEOMETRY_INVALID)
+		return GeometryHeap::Instance()->GetAttributeBuffer(geometry);
+	return attributeBuffer;
+}
+
+unsigned int Mesh::GetVertexStride() const
+{
+	return streams == VERTEX_STREAMS_SPLIT ? sizeof(VertexPosition) : sizeof(Vertex);
+}
+
 ID3D11Buffer * Mesh::GetIndexBuffer() const
 {
+	if (geometry != GEOMETRY_INVALID)
+		return GeometryHeap::Instance()->GetIndexBuffer(geometry);
 	return indexBuffer;
 }
 
+int Mesh::GetBaseVertex() const
+{
+	if (geometry != GEOMETRY_INVALID)
+		return GeometryHeap::Instance()->GetBaseVertex(geometry);
+	return 0;
+}
+
+unsigned int Mesh::GetStartIndex() const
+{
+	if (geometry != GEOMETRY_INVALID)
+		return GeometryHeap::Instance()->GetStartIndex(geometry);
+	return 0;
+}
+
 int Mesh::GetIndexCount() const
 {
 	// TODO: insert return statement here
 	return indexCount;
 }
 
+const XMFLOAT3 & Mesh::GetBoundsMin() const
+{
+	return boundsMin;
+}
+
+const XMFLOAT3 & Mesh::GetBoundsMax() const
+{
+	return boundsMax;
+}
+
+const std::vector<XMFLOAT3>& Mesh::GetPositions() const
+{
+	return positions;
+}
+
+const std::vector<UINT>& Mesh::GetIndices() const
+{
+	return cpuIndices;
+}
+
+const std::vector<Vertex>& Mesh::GetVertices() const
+{
+	return cpuVertices;
+}
+
+void Mesh::StoreCPUGeometry(Vertex * vertices, int vertexCount, UINT * indices, int indicesInIndexBuffer)
+{
+	positions.resize(vertexCount);
+	cpuVertices.assign(vertices, vertices + vertexCount);
+	cpuIndices.assign(indices, indices + indicesInIndexBuffer);
+
+	XMVECTOR vMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR vMax = XMVectorReplicate(-FLT_MAX);
+	for (int i = 0; i < vertexCount; i++)
+	{
+		positions[i] = vertices[i].Position;
+
+		XMVECTOR p = XMLoadFloat3(&vertices[i].Position);
+		vMin = XMVectorMin(vMin, p);
+		vMax = XMVectorMax(vMax, p);
+	}
+
+	if (vertexCount == 0)
+	{
+		vMin = XMVectorZero();
+		vMax = XMVectorZero();
+	}
+
+	XMStoreFloat3(&boundsMin, vMin);
+	XMStoreFloat3(&boundsMax, vMax);
+}
+
 void Mesh::InitializeVertexBuffer(Vertex * vertices, int indicesInVertexBuffer, ID3D11Device* device)
 {
 	// Create the VERTEX BUFFER description -----------------------------------
@@ -253,6 +377,31 @@ void Mesh::InitializeVertexBuffer(Vertex * vertices, int indicesInVertexBuffer,
 	device->CreateBuffer(&vbd, &initialVertexData, &vertexBuffer);
 }
 
+void Mesh::InitializeSplitVertexBuffers(Vertex * vertices, int vertexCount, ID3D11Device * device)
+{
+	std::vector<VertexPosition> positionStream(vertexCount);
+	std::vector<VertexAttributes> attributeStream(vertexCount);
+	for (int i = 0; i < vertexCount; i++)
+	{
+		positionStream[i].Position = vertices[i].Position;
+		attributeStream[i].Normal = vertices[i].Normal;
+		attributeStream[i].UV = vertices[i].UV;
+	}
+
+	D3D11_BUFFER_DESC vbd = {};
+	vbd.Usage = D3D11_USAGE_IMMUTABLE;
+	vbd.ByteWidth = sizeof(VertexPosition) * vertexCount;
+	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA positionData = {};
+	positionData.pSysMem = &positionStream[0];
+	device->CreateBuffer(&vbd, &positionData, &vertexBuffer);
+
+	vbd.ByteWidth = sizeof(VertexAttributes) * vertexCount;
+	D3D11_SUBRESOURCE_DATA attributeData = {};
+	attributeData.pSysMem = &attributeStream[0];
+	device->CreateBuffer(&vbd, &attributeData, &attributeBuffer);
+}
+
 void Mesh::InitializeIndexBuffer(UINT * indices, int indicesInIndexBuffer, ID3D11Device* device)
 {
 	indexCount = indicesInIndexBuffer;
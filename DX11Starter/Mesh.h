@@ -1,33 +1,92 @@
 #pragma once
 
 #include <DirectXMath.h>
+#include <vector>
 #include "DXCore.h"
 #include "Vertex.h"
+#include "GeometryHeap.h"
 
 class Mesh
 {
 public:
 	Mesh();
-	Mesh(Vertex* vertices, int indicesInVertexBuffer, int* indices, int indicesInIndexBuffer, ID3D11Device* device);
-	Mesh(std::string parameter, ID3D11Device* device);
-	~Mesh();
-	ID3D11Buffer* GetVertexBuffer() const;
-	ID3D11Buffer* GetIndexBuffer() const;
+	Mesh(Vertex* vertices, int indicesInVertexBuffer, int* indices, int indicesInIndexBuffer, ID3D11Device* device,
+		VertexStreams streams = VERTEX_STREAMS_INTERLEAVED);
+	Mesh(std::string parameter, ID3D11Device* device, VertexStreams streams = VERTEX_STREAMS_INTERLEAVED);
+	virtual ~Mesh();
+	virtual ID3D11Buffer* GetVertexBuffer() const;
+	virtual ID3D11Buffer* GetIndexBuffer() const;
 	int GetIndexCount() const;
 
+	// Creation order, used in draw sort keys
+	unsigned int GetId() const { return id; }
+
+	// Split meshes keep only positions in the vertex buffer, and
+	// normals and UVs in the attribute buffer (null otherwise)
+	VertexStreams GetVertexStreams() const { return streams; }
+	ID3D11Buffer* GetAttributeBuffer() const;
+	unsigned int GetVertexStride() const;
+
+	// Where the mesh starts in its buffers, non-zero when it's
+	// suballocated from the GeometryHeap
+	virtual int GetBaseVertex() const;
+	virtual unsigned int GetStartIndex() const;
+
+	// Dynamic meshes change their buffers and offsets when they're
+	// uploaded, so look those up after the upload, on the render side
+	virtual bool IsDynamic() const { return false; }
+
+	// Object space bounding box of the mesh
+	const DirectX::XMFLOAT3& GetBoundsMin() const;
+	const DirectX::XMFLOAT3& GetBoundsMax() const;
+
+	// CPU copy of the geometry, used by the software occlusion rasterizer
+	const std::vector<DirectX::XMFLOAT3>& GetPositions() const;
+	const std::vector<UINT>& GetIndices() const;
+
+	// Full vertices, for static batching
+	const std::vector<Vertex>& GetVertices() const;
+
+protected:
+	//The number of indices in Mesh's Index Buffer
+	int indexCount;
+
+	// Object space bounds
+	DirectX::XMFLOAT3 boundsMin;
+	DirectX::XMFLOAT3 boundsMax;
+
 private:
-	// Buffers to hold actual geometry data
+	unsigned int id;
+	static unsigned int nextId;
+
+	// Buffers to hold actual geometry data, unless the mesh
+	// lives in the GeometryHeap
 	ID3D11Buffer* vertexBuffer;
+	ID3D11Buffer* attributeBuffer;
 	ID3D11Buffer* indexBuffer;
+	GeometryHandle geometry;
+	VertexStreams streams;
+
+	// Copies the geometry to the heap if there is one, or to
+	// buffers of its own
+	void CreateBuffers(Vertex* vertices, int vertexCount, UINT* indices, int indexCount, ID3D11Device* device);
 
 	// Initialize VertexBuffer
 	void InitializeVertexBuffer(Vertex* vertices, int indicesInVertexBuffer, ID3D11Device* device);
+
+	// Initialize the position and attribute buffers of a split mesh
+	void InitializeSplitVertexBuffers(Vertex* vertices, int vertexCount, ID3D11Device* device);
 	
 	// Initialize IndexBuffer
 	void InitializeIndexBuffer(UINT* indices, int indicesInIndexBuffer, ID3D11Device* device);
 
-	//The number of indices in Mesh's Index Buffer
-	int indexCount;
+	// CPU side positions, vertices and indices
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<Vertex> cpuVertices;
+	std::vector<UINT> cpuIndices;
+
+	// Keeps a CPU copy of the geometry and calculates the bounds
+	void StoreCPUGeometry(Vertex* vertices, int vertexCount, UINT* indices, int indicesInIndexBuffer);
 
 
 };
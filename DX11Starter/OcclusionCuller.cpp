@@ -0,0 +1,331 @@
+#include "OcclusionCuller.h"
+#include <malloc.h>
+#include <math.h>
+#include <cfloat>
+#include <emmintrin.h>
+#include <algorithm>
+
+// Triangles with a vertex closer than this (clip w) are skipped,
+// which only ever makes the occluder set smaller (conservative)
+static const float NEAR_W = 0.0001f;
+
+OcclusionCuller::OcclusionCuller()
+{
+	tilesX = BUFFER_WIDTH / TILE_WIDTH;
+	tilesY = BUFFER_HEIGHT / TILE_HEIGHT;
+
+	// 16 byte aligned so every tile row can be loaded with _mm_load_ps
+	depth = (float*)_aligned_malloc(sizeof(float) * BUFFER_WIDTH * BUFFER_HEIGHT, 16);
+	tileMaxDepth = new float[tilesX * tilesY];
+
+	XMStoreFloat4x4(&viewProjection, XMMatrixIdentity());
+	ZeroMemory(&stats, sizeof(OcclusionStats));
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+	rasterizeTicks = 0;
+	testTicks = 0;
+}
+
+
+OcclusionCuller::~OcclusionCuller()
+{
+	_aligned_free(depth);
+	delete[] tileMaxDepth;
+}
+
+// --------------------------------------------------------
+// Resets the depth buffer to the far plane and the stats
+// --------------------------------------------------------
+void OcclusionCuller::BeginFrame(const XMMATRIX & viewProj)
+{
+	XMStoreFloat4x4(&viewProjection, viewProj);
+
+	__m128 farDepth = _mm_set1_ps(1.0f);
+	for (int i = 0; i < BUFFER_WIDTH * BUFFER_HEIGHT; i += 4)
+		_mm_store_ps(depth + i, farDepth);
+
+	for (int t = 0; t < tilesX * tilesY; t++)
+		tileMaxDepth[t] = 1.0f;
+
+	ZeroMemory(&stats, sizeof(OcclusionStats));
+	rasterizeTicks = 0;
+	testTicks = 0;
+}
+
+// --------------------------------------------------------
+// Projects every triangle of the mesh and rasterizes it
+//
+// mesh  - The occluder, using its CPU side geometry
+// world - Untransposed world matrix of the occluder
+// --------------------------------------------------------
+void OcclusionCuller::RasterizeOccluder(Mesh * mesh, const XMMATRIX & world)
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	const std::vector<XMFLOAT3>& positions = mesh->GetPositions();
+	const std::vector<UINT>& indices = mesh->GetIndices();
+
+	XMMATRIX worldViewProj = world * XMLoadFloat4x4(&viewProjection);
+
+	// Project all vertices once to screen space, keeping w
+	// so triangles crossing the near plane can be rejected
+	std::vector<XMFLOAT4>& screen = projected;
+	screen.resize(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		XMVECTOR clip = XMVector4Transform(XMVectorSetW(XMLoadFloat3(&positions[i]), 1.0f), worldViewProj);
+		float w = XMVectorGetW(clip);
+		if (w < NEAR_W)
+		{
+			screen[i] = XMFLOAT4(0.0f, 0.0f, 0.0f, -1.0f);
+			continue;
+		}
+
+		XMVECTOR ndc = clip / XMVectorSplatW(clip);
+		screen[i].x = (XMVectorGetX(ndc) * 0.5f + 0.5f) * BUFFER_WIDTH;
+		screen[i].y = (0.5f - XMVectorGetY(ndc) * 0.5f) * BUFFER_HEIGHT;
+		screen[i].z = XMVectorGetZ(ndc);
+		screen[i].w = w;
+	}
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const XMFLOAT4& a = screen[indices[i]];
+		const XMFLOAT4& b = screen[indices[i + 1]];
+		const XMFLOAT4& c = screen[indices[i + 2]];
+		if (a.w < 0.0f || b.w < 0.0f || c.w < 0.0f)
+			continue;
+
+		RasterizeTriangle(XMFLOAT3(a.x, a.y, a.z), XMFLOAT3(b.x, b.y, b.z), XMFLOAT3(c.x, c.y, c.z));
+		stats.OccluderTriangles++;
+	}
+
+	stats.OccluderCount++;
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	rasterizeTicks += end - start;
+}
+
+// --------------------------------------------------------
+// Half-space rasterization of a single screen space triangle,
+// 4 pixels at a time.  Depth is interpolated linearly in
+// screen space and min'd into the buffer.
+// --------------------------------------------------------
+void OcclusionCuller::RasterizeTriangle(const XMFLOAT3 & v0, const XMFLOAT3 & in1, const XMFLOAT3 & in2)
+{
+	XMFLOAT3 v1 = in1;
+	XMFLOAT3 v2 = in2;
+
+	// Twice the signed area, make the winding consistent
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (fabsf(area) < 1e-6f)
+		return;
+	if (area < 0.0f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	// Bounding rectangle clipped to the buffer
+	int minX = max((int)floorf(min(v0.x, min(v1.x, v2.x))), 0);
+	int maxX = min((int)ceilf(max(v0.x, max(v1.x, v2.x))), BUFFER_WIDTH - 1);
+	int minY = max((int)floorf(min(v0.y, min(v1.y, v2.y))), 0);
+	int maxY = min((int)ceilf(max(v0.y, max(v1.y, v2.y))), BUFFER_HEIGHT - 1);
+	if (minX > maxX || minY > maxY)
+		return;
+
+	// Edge equations E(x, y) = A*x + B*y + C, positive inside
+	float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = -(a0 * v1.x + b0 * v1.y);	// Opposite v0
+	float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = -(a1 * v2.x + b1 * v2.y);	// Opposite v1
+	float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = -(a2 * v0.x + b2 * v0.y);	// Opposite v2
+
+	// Depth plane from the barycentric weights
+	float invArea = 1.0f / area;
+	float zA = (a0 * v0.z + a1 * v1.z + a2 * v2.z) * invArea;
+	float zB = (b0 * v0.z + b1 * v1.z + b2 * v2.z) * invArea;
+	float zC = (c0 * v0.z + c1 * v1.z + c2 * v2.z) * invArea;
+
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 laneOffset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+	int tileMinX = minX / TILE_WIDTH, tileMaxX = maxX / TILE_WIDTH;
+	int tileMinY = minY / TILE_HEIGHT, tileMaxY = maxY / TILE_HEIGHT;
+
+	for (int ty = tileMinY; ty <= tileMaxY; ty++)
+	{
+		for (int tx = tileMinX; tx <= tileMaxX; tx++)
+		{
+			int tileIndex = ty * tilesX + tx;
+			float* tileDepth = depth + tileIndex * TILE_WIDTH * TILE_HEIGHT;
+			bool written = false;
+
+			for (int row = 0; row < TILE_HEIGHT; row++)
+			{
+				__m128 py = _mm_set1_ps((float)(ty * TILE_HEIGHT + row) + 0.5f);
+
+				for (int half = 0; half < TILE_WIDTH; half += 4)
+				{
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)(tx * TILE_WIDTH + half)), laneOffset);
+
+					__m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_mul_ps(_mm_set1_ps(b0), py)), _mm_set1_ps(c0));
+					__m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_mul_ps(_mm_set1_ps(b1), py)), _mm_set1_ps(c1));
+					__m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_mul_ps(_mm_set1_ps(b2), py)), _mm_set1_ps(c2));
+
+					__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+
+					__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), px), _mm_mul_ps(_mm_set1_ps(zB), py)), _mm_set1_ps(zC));
+					z = _mm_min_ps(_mm_max_ps(z, zero), one);
+
+					float* dst = tileDepth + row * TILE_WIDTH + half;
+					__m128 current = _mm_load_ps(dst);
+					__m128 nearer = _mm_min_ps(current, z);
+					_mm_store_ps(dst, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+					written = true;
+				}
+			}
+
+			if (written)
+				UpdateTileMax(tileIndex);
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Recalculates the farthest depth of a single tile
+// --------------------------------------------------------
+void OcclusionCuller::UpdateTileMax(int tileIndex)
+{
+	const float* tileDepth = depth + tileIndex * TILE_WIDTH * TILE_HEIGHT;
+
+	__m128 farthest = _mm_load_ps(tileDepth);
+	for (int i = 4; i < TILE_WIDTH * TILE_HEIGHT; i += 4)
+		farthest = _mm_max_ps(farthest, _mm_load_ps(tileDepth + i));
+
+	// Horizontal max of the 4 lanes
+	farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+	farthest = _mm_max_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+	tileMaxDepth[tileIndex] = _mm_cvtss_f32(farthest);
+}
+
+// --------------------------------------------------------
+// Tests a world space bounding box against the depth buffer
+//
+// The box's screen rectangle is compared at its nearest depth,
+// first against the per tile farthest depth and then, only for
+// tiles that can't reject it, against single pixels.
+//
+// Returns true if any part of the box may be visible
+// --------------------------------------------------------
+bool OcclusionCuller::IsVisible(const XMFLOAT3 & boundsMin, const XMFLOAT3 & boundsMax)
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	stats.TestedCount++;
+	bool visible = false;
+
+	XMMATRIX viewProj = XMLoadFloat4x4(&viewProjection);
+	XMVECTOR screenMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR screenMax = XMVectorReplicate(-FLT_MAX);
+
+	for (int corner = 0; corner < 8 && !visible; corner++)
+	{
+		XMVECTOR p = XMVectorSet(
+			(corner & 1) ? boundsMax.x : boundsMin.x,
+			(corner & 2) ? boundsMax.y : boundsMin.y,
+			(corner & 4) ? boundsMax.z : boundsMin.z,
+			1.0f);
+		XMVECTOR clip = XMVector4Transform(p, viewProj);
+
+		// Box crosses the near plane, can't be rejected
+		if (XMVectorGetW(clip) < NEAR_W)
+		{
+			visible = true;
+			break;
+		}
+
+		XMVECTOR ndc = clip / XMVectorSplatW(clip);
+		screenMin = XMVectorMin(screenMin, ndc);
+		screenMax = XMVectorMax(screenMax, ndc);
+	}
+
+	if (!visible)
+	{
+		// Screen rectangle in buffer pixels (y flipped)
+		int minX = (int)floorf((XMVectorGetX(screenMin) * 0.5f + 0.5f) * BUFFER_WIDTH);
+		int maxX = (int)ceilf((XMVectorGetX(screenMax) * 0.5f + 0.5f) * BUFFER_WIDTH);
+		int minY = (int)floorf((0.5f - XMVectorGetY(screenMax) * 0.5f) * BUFFER_HEIGHT);
+		int maxY = (int)ceilf((0.5f - XMVectorGetY(screenMin) * 0.5f) * BUFFER_HEIGHT);
+		float nearestDepth = max(XMVectorGetZ(screenMin), 0.0f);
+
+		minX = max(minX, 0); maxX = min(maxX, BUFFER_WIDTH - 1);
+		minY = max(minY, 0); maxY = min(maxY, BUFFER_HEIGHT - 1);
+
+		// Off screen boxes are left to the frustum and the GPU
+		if (minX > maxX || minY > maxY)
+			visible = true;
+
+		__m128 boxDepth = _mm_set1_ps(nearestDepth);
+		__m128 laneX = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		__m128 rectMinX = _mm_set1_ps((float)minX);
+		__m128 rectMaxX = _mm_set1_ps((float)maxX);
+
+		for (int ty = minY / TILE_HEIGHT; ty <= maxY / TILE_HEIGHT && !visible; ty++)
+		{
+			for (int tx = minX / TILE_WIDTH; tx <= maxX / TILE_WIDTH && !visible; tx++)
+			{
+				int tileIndex = ty * tilesX + tx;
+
+				// Coarse reject, the whole tile is in front of the box
+				if (nearestDepth > tileMaxDepth[tileIndex])
+					continue;
+
+				const float* tileDepth = depth + tileIndex * TILE_WIDTH * TILE_HEIGHT;
+				for (int row = 0; row < TILE_HEIGHT && !visible; row++)
+				{
+					int y = ty * TILE_HEIGHT + row;
+					if (y < minY || y > maxY)
+						continue;
+
+					for (int half = 0; half < TILE_WIDTH; half += 4)
+					{
+						__m128 px = _mm_add_ps(_mm_set1_ps((float)(tx * TILE_WIDTH + half)), laneX);
+						__m128 inRect = _mm_and_ps(_mm_cmpge_ps(px, rectMinX), _mm_cmple_ps(px, rectMaxX));
+						__m128 passes = _mm_cmple_ps(boxDepth, _mm_load_ps(tileDepth + row * TILE_WIDTH + half));
+
+						if (_mm_movemask_ps(_mm_and_ps(inRect, passes)) != 0)
+						{
+							visible = true;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if (!visible)
+		stats.CulledCount++;
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	testTicks += end - start;
+
+	return visible;
+}
+
+// --------------------------------------------------------
+// Converts the accumulated timings to milliseconds
+// --------------------------------------------------------
+void OcclusionCuller::EndFrame()
+{
+	stats.RasterizeMs = (float)(rasterizeTicks * perfCounterSeconds * 1000.0);
+	stats.TestMs = (float)(testTicks * perfCounterSeconds * 1000.0);
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <DirectXMath.h>
+#include <Windows.h>
+#include "Mesh.h"
+
+// For the DirectX Math library
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Per-frame statistics of the occlusion culling stage
+// --------------------------------------------------------
+struct OcclusionStats
+{
+	unsigned int OccluderCount;		// Meshes rasterized into the buffer
+	unsigned int OccluderTriangles;	// Triangles rasterized into the buffer
+	unsigned int TestedCount;		// Bounding boxes tested
+	unsigned int CulledCount;		// Bounding boxes found to be hidden
+	float RasterizeMs;				// Time spent rasterizing occluders
+	float TestMs;					// Time spent testing bounding boxes
+};
+
+// --------------------------------------------------------
+// CPU occlusion culler
+//
+// Occluder triangles are rasterized into a small depth buffer
+// laid out in 8x4 pixel tiles (two SSE registers per tile row).
+// Each tile also keeps its farthest depth, which is the coarse
+// level of the hierarchy: a box that is behind the farthest
+// depth of every tile it touches is hidden without looking at
+// single pixels.
+//
+// Depth follows D3D conventions: 0 is near, 1 is far.
+// --------------------------------------------------------
+class OcclusionCuller
+{
+public:
+	static const int TILE_WIDTH = 8;
+	static const int TILE_HEIGHT = 4;
+	static const int BUFFER_WIDTH = 320;
+	static const int BUFFER_HEIGHT = 180;
+
+	OcclusionCuller();
+	~OcclusionCuller();
+
+	// Clears the buffer and sets the view-projection (untransposed)
+	void BeginFrame(const XMMATRIX& viewProjection);
+
+	// Rasterizes a mesh's triangles into the depth buffer
+	void RasterizeOccluder(Mesh* mesh, const XMMATRIX& world);
+
+	// Returns true if any part of the box may be visible
+	bool IsVisible(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+
+	// Finishes the timing for this frame
+	void EndFrame();
+
+	const OcclusionStats& GetStats() const { return stats; }
+
+private:
+	int tilesX;
+	int tilesY;
+
+	// Per pixel depth (tiled) and per tile farthest depth
+	float* depth;
+	float* tileMaxDepth;
+
+	XMFLOAT4X4 viewProjection;
+
+	// Scratch space for projected occluder vertices
+	std::vector<XMFLOAT4> projected;
+
+	// Timing
+	double perfCounterSeconds;
+	__int64 rasterizeTicks;
+	__int64 testTicks;
+
+	OcclusionStats stats;
+
+	void RasterizeTriangle(const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2);
+	void UpdateTileMax(int tileIndex);
+};
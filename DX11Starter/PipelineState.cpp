@@ -0,0 +1,236 @@
+#include "PipelineState.h"
+#include "ShaderReflection.h"
+#include <algorithm>
+
+PipelineStateCache* PipelineStateCache::instance;
+
+void PipelineStateDesc::SetDefaults()
+{
+	VertexShader = nullptr;
+	PixelShader = nullptr;
+
+	// Zeroed first so the UINT8 masks' padding is deterministic
+	ZeroMemory(&Blend, sizeof(D3D11_BLEND_DESC));
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		Blend.RenderTarget[i].SrcBlend = D3D11_BLEND_ONE;
+		Blend.RenderTarget[i].DestBlend = D3D11_BLEND_ZERO;
+		Blend.RenderTarget[i].BlendOp = D3D11_BLEND_OP_ADD;
+		Blend.RenderTarget[i].SrcBlendAlpha = D3D11_BLEND_ONE;
+		Blend.RenderTarget[i].DestBlendAlpha = D3D11_BLEND_ZERO;
+		Blend.RenderTarget[i].BlendOpAlpha = D3D11_BLEND_OP_ADD;
+		Blend.RenderTarget[i].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+	}
+
+	ZeroMemory(&Rasterizer, sizeof(D3D11_RASTERIZER_DESC));
+	Rasterizer.FillMode = D3D11_FILL_SOLID;
+	Rasterizer.CullMode = D3D11_CULL_BACK;
+	Rasterizer.DepthClipEnable = TRUE;
+
+	ZeroMemory(&DepthStencil, sizeof(D3D11_DEPTH_STENCIL_DESC));
+	DepthStencil.DepthEnable = TRUE;
+	DepthStencil.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+	DepthStencil.DepthFunc = D3D11_COMPARISON_LESS;
+	DepthStencil.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+	DepthStencil.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+	D3D11_DEPTH_STENCILOP_DESC stencilOp = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_COMPARISON_ALWAYS };
+	DepthStencil.FrontFace = stencilOp;
+	DepthStencil.BackFace = stencilOp;
+
+	Topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+}
+
+PipelineState::PipelineState()
+{
+	id = 0;
+	hash = 0;
+	vertexShader = nullptr;
+	pixelShader = nullptr;
+	inputLayout = nullptr;
+	splitInputLayout = nullptr;
+	vertexShaderObject = nullptr;
+	pixelShaderObject = nullptr;
+	blendState = nullptr;
+	rasterizerState = nullptr;
+	depthStencilState = nullptr;
+	topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+}
+
+PipelineState::~PipelineState()
+{
+	if (blendState) blendState->Release();
+	if (rasterizerState) rasterizerState->Release();
+	if (depthStencilState) depthStencilState->Release();
+}
+
+PipelineStateCache::PipelineStateCache(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	instance = this;
+	this->device = device;
+	this->context = context;
+	bound = nullptr;
+	boundInputLayout = nullptr;
+	ZeroMemory(&stats, sizeof(PipelineStateStats));
+}
+
+PipelineStateCache::~PipelineStateCache()
+{
+	for (size_t i = 0; i < states.size(); i++)
+		delete states[i];
+
+	if (instance == this)
+		instance = nullptr;
+}
+
+PipelineStateCache * PipelineStateCache::Instance()
+{
+	return instance;
+}
+
+bool PipelineStateCache::SameObjects(const PipelineState & a, const PipelineState & b)
+{
+	return
+		a.vertexShader == b.vertexShader &&
+		a.pixelShader == b.pixelShader &&
+		a.inputLayout == b.inputLayout &&
+		a.vertexShaderObject == b.vertexShaderObject &&
+		a.pixelShaderObject == b.pixelShaderObject &&
+		a.blendState == b.blendState &&
+		a.rasterizerState == b.rasterizerState &&
+		a.depthStencilState == b.depthStencilState &&
+		a.topology == b.topology;
+}
+
+// --------------------------------------------------------
+// Resolves the description to D3D objects, then searches the
+// states with the same hash for one using the same objects
+// --------------------------------------------------------
+const PipelineState * PipelineStateCache::Create(const PipelineStateDesc & desc)
+{
+	if (!desc.VertexShader || !desc.VertexShader->IsShaderValid() ||
+		!desc.PixelShader || !desc.PixelShader->IsShaderValid())
+		return nullptr;
+
+	PipelineState* state = new PipelineState();
+	state->vertexShader = desc.VertexShader;
+	state->pixelShader = desc.PixelShader;
+	if (desc.VertexShader->GetPerInstanceCompatible())
+	{
+		// Instance data goes after the vertex streams, whichever way they're stored
+		state->inputLayout = desc.VertexShader->GetInputLayout(
+			VertexFormat<InstancedVertex>::Elements(), VertexFormat<InstancedVertex>::ElementCount);
+		state->splitInputLayout = desc.VertexShader->GetInputLayout(
+			VertexFormat<InstancedSplitVertex>::Elements(), VertexFormat<InstancedSplitVertex>::ElementCount);
+	}
+	else
+	{
+		state->inputLayout = desc.VertexShader->GetInputLayout();
+		state->splitInputLayout = desc.VertexShader->GetInputLayout(
+			VertexFormat<SplitVertex>::Elements(), VertexFormat<SplitVertex>::ElementCount);
+	}
+	state->vertexShaderObject = desc.VertexShader->GetDirectXShader();
+	state->pixelShaderObject = desc.PixelShader->GetDirectXShader();
+	state->topology = desc.Topology;
+
+	if (FAILED(device->CreateBlendState(&desc.Blend, &state->blendState)) ||
+		FAILED(device->CreateRasterizerState(&desc.Rasterizer, &state->rasterizerState)) ||
+		FAILED(device->CreateDepthStencilState(&desc.DepthStencil, &state->depthStencilState)))
+	{
+		delete state;
+		return nullptr;
+	}
+
+	const void* objects[] =
+	{
+		state->vertexShader, state->pixelShader, state->inputLayout,
+		state->vertexShaderObject, state->pixelShaderObject,
+		state->blendState, state->rasterizerState, state->depthStencilState,
+		(const void*)(size_t)state->topology
+	};
+	state->hash = HashShaderBlob(objects, sizeof(objects));
+
+	std::pair<unsigned long long, unsigned int> key(state->hash, 0);
+	auto it = std::lower_bound(lookup.begin(), lookup.end(), key);
+	for (; it != lookup.end() && it->first == state->hash; ++it)
+	{
+		if (SameObjects(*states[it->second], *state))
+		{
+			delete state;
+			return states[it->second];
+		}
+	}
+
+	state->id = (unsigned int)states.size();
+	states.push_back(state);
+	lookup.insert(it, std::make_pair(state->hash, state->id));
+	stats.States++;
+	return state;
+}
+
+// --------------------------------------------------------
+// Sets only what differs from the last bound state
+// --------------------------------------------------------
+void PipelineStateCache::Bind(const PipelineState * state, VertexStreams streams)
+{
+	ID3D11InputLayout* inputLayout = streams == VERTEX_STREAMS_SPLIT ? state->splitInputLayout : state->inputLayout;
+
+	stats.Binds++;
+	if (state == bound && inputLayout == boundInputLayout)
+	{
+		stats.SkippedBinds++;
+		return;
+	}
+
+	const PipelineState* previous = bound;
+	bound = state;
+
+	if (!previous || inputLayout != boundInputLayout)
+	{
+		context->IASetInputLayout(inputLayout);
+		boundInputLayout = inputLayout;
+		stats.StateChanges++;
+	}
+	if (!previous || previous->topology != state->topology)
+	{
+		context->IASetPrimitiveTopology(state->topology);
+		stats.StateChanges++;
+	}
+	if (!previous || previous->vertexShaderObject != state->vertexShaderObject)
+	{
+		context->VSSetShader(state->vertexShaderObject, 0, 0);
+		stats.StateChanges++;
+	}
+	if (!previous || previous->pixelShaderObject != state->pixelShaderObject)
+	{
+		context->PSSetShader(state->pixelShaderObject, 0, 0);
+		stats.StateChanges++;
+	}
+	if (!previous || previous->rasterizerState != state->rasterizerState)
+	{
+		context->RSSetState(state->rasterizerState);
+		stats.StateChanges++;
+	}
+	if (!previous || previous->blendState != state->blendState)
+	{
+		context->OMSetBlendState(state->blendState, 0, 0xffffffff);
+		stats.StateChanges++;
+	}
+	if (!previous || previous->depthStencilState != state->depthStencilState)
+	{
+		context->OMSetDepthStencilState(state->depthStencilState, 0);
+		stats.StateChanges++;
+	}
+}
+
+void PipelineStateCache::Invalidate()
+{
+	bound = nullptr;
+	boundInputLayout = nullptr;
+}
+
+void PipelineStateCache::ResetStats()
+{
+	unsigned int created = stats.States;
+	ZeroMemory(&stats, sizeof(PipelineStateStats));
+	stats.States = created;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <d3d11.h>
+#include <vector>
+#include "SimpleShader.h"
+#include "Vertex.h"
+
+// --------------------------------------------------------
+// Everything a PipelineState is made from.  SetDefaults()
+// gives D3D11's default states and a triangle list.
+// --------------------------------------------------------
+struct PipelineStateDesc
+{
+	SimpleVertexShader* VertexShader;
+	SimplePixelShader* PixelShader;
+	D3D11_BLEND_DESC Blend;
+	D3D11_RASTERIZER_DESC Rasterizer;
+	D3D11_DEPTH_STENCIL_DESC DepthStencil;
+	D3D11_PRIMITIVE_TOPOLOGY Topology;
+
+	void SetDefaults();
+};
+
+// --------------------------------------------------------
+// Bind counters since the last ResetStats()
+// --------------------------------------------------------
+struct PipelineStateStats
+{
+	unsigned int States;			// Distinct states created, never reset
+	unsigned int Binds;
+	unsigned int SkippedBinds;		// State was already bound
+	unsigned int StateChanges;		// Individual D3D calls made by binds
+};
+
+// --------------------------------------------------------
+// An immutable bundle of the shaders, input layout, fixed
+// function states and topology of a draw.  Only made by a
+// PipelineStateCache, which returns the same object for
+// identical descriptions, so two states are equal exactly
+// when their pointers (or ids) are.
+// --------------------------------------------------------
+class PipelineState
+{
+	friend class PipelineStateCache;
+
+public:
+	// Dense id in creation order, for sorting draws
+	unsigned int GetId() const { return id; }
+	unsigned long long GetHash() const { return hash; }
+
+	SimpleVertexShader* GetVertexShader() const { return vertexShader; }
+	SimplePixelShader* GetPixelShader() const { return pixelShader; }
+
+	// The fixed function parts, e.g. for draw stream captures
+	ID3D11BlendState* GetBlendState() const { return blendState; }
+	ID3D11RasterizerState* GetRasterizerState() const { return rasterizerState; }
+	ID3D11DepthStencilState* GetDepthStencilState() const { return depthStencilState; }
+	D3D11_PRIMITIVE_TOPOLOGY GetTopology() const { return topology; }
+
+private:
+	PipelineState();
+	~PipelineState();
+
+	unsigned int id;
+	unsigned long long hash;
+
+	SimpleVertexShader* vertexShader;
+	SimplePixelShader* pixelShader;
+
+	// Not owned: the shader objects belong to the shaders,
+	// the states are referenced
+	ID3D11InputLayout* inputLayout;
+	ID3D11InputLayout* splitInputLayout;		// For split stream meshes, null if the shader can't read them
+	ID3D11VertexShader* vertexShaderObject;
+	ID3D11PixelShader* pixelShaderObject;
+	ID3D11BlendState* blendState;
+	ID3D11RasterizerState* rasterizerState;
+	ID3D11DepthStencilState* depthStencilState;
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+};
+
+// --------------------------------------------------------
+// Creates and binds pipeline states
+//
+// The blend, rasterizer and depth states are created through
+// the device, which already returns one object per distinct
+// description.  A pipeline state is then hashed from those
+// objects, the shaders and the topology, and looked up among
+// the existing ones before a new one is made.
+//
+// Bind() remembers what it bound last: binding the same state
+// again costs a pointer compare, and a different one only sets
+// the parts that differ.  Code that changes pipeline state
+// behind its back must call Invalidate().
+// --------------------------------------------------------
+class PipelineStateCache
+{
+	static PipelineStateCache* instance;
+
+public:
+	PipelineStateCache(ID3D11Device* device, ID3D11DeviceContext* context);
+	~PipelineStateCache();
+	static PipelineStateCache* Instance();
+
+	// Finds or makes the state for the description, or returns
+	// null if the shaders are invalid or a state can't be made
+	const PipelineState* Create(const PipelineStateDesc& desc);
+
+	// Sets the state's shaders and fixed function states, with
+	// the input layout for the way the mesh stores its vertices.
+	// The shaders' constant buffers are not touched.
+	void Bind(const PipelineState* state, VertexStreams streams = VERTEX_STREAMS_INTERLEAVED);
+
+	// Forgets what is bound, so the next Bind() sets everything
+	void Invalidate();
+
+	void ResetStats();
+	const PipelineStateStats& GetStats() const { return stats; }
+
+private:
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+
+	std::vector<PipelineState*> states;							// By id
+	std::vector<std::pair<unsigned long long, unsigned int>> lookup;	// Hash to id, sorted by hash
+	const PipelineState* bound;
+	ID3D11InputLayout* boundInputLayout;
+
+	PipelineStateStats stats;
+
+	static bool SameObjects(const PipelineState& a, const PipelineState& b);
+};
@@ -1,14 +1,56 @@
-
 // Struct representing the data we expect to receive from earlier pipeline stages
 // - Should match the output of our corresponding vertex shader
 // - The name of the struct itself is unimportant
 // - The variable names don't have to match other shaders (just the semantics)
 // - Each variable must have a semantic, which defines its usage
 
+// Cluster grid dimensions - must match LightClusterer
+#define CLUSTERS_X 16
+#define CLUSTERS_Y 9
+#define CLUSTERS_Z 24
+
+// Light layouts - must match Lights.h
+struct DirectionalLight
+{
+	float4 AmbientColor;
+	float4 DiffuseColor;
+	float3 Direction;
+	float Padding;
+};
+
+struct PointLight
+{
+	float4 Color;
+	float3 Position;
+	float Range;
+};
+
+struct SpotLight
+{
+	float4 Color;
+	float3 Position;
+	float Range;
+	float3 Direction;
+	float SpotAngle;
+};
+
 //Texture Vars
+#if TEXTURE_ARRAY
+Texture2DArray diffuseTexture	: register(t0);	// Material's texture is one slice
+#else
 Texture2D diffuseTexture	: register(t0);
+#endif
 SamplerState basicSampler	: register(s0);
 
+// Lights, filled by LightManager
+StructuredBuffer<DirectionalLight> directionalLights	: register(t1);
+StructuredBuffer<PointLight> pointLights				: register(t2);
+StructuredBuffer<SpotLight> spotLights					: register(t3);
+
+// Clustered light lists, filled by LightClusterer each frame
+StructuredBuffer<uint4> clusterGrid				: register(t4);	// offset, point count, spot count
+StructuredBuffer<uint> clusterLightIndices		: register(t5);
+
 struct VertexToPixel
 {
 	// Data type
@@ -21,28 +63,46 @@ struct VertexToPixel
 	float3 normal		: NORMAL;
 	float3 worldPos		: WORLDPOS;
 	float2 uv			: TEXCOORD;
+	float viewDepth		: VIEWDEPTH;
+#if TEXTURE_ARRAY
+	nointerpolation float textureSlice	: TEXTURESLICE;	// Needs the INSTANCING vertex shader
+#endif
 };
 
-struct DirectionalLight
+// Only changes once per frame
+cbuffer ExternalData : register(b0)
 {
-	float4 AmbientColor;
-	float4 DiffuseColor;
-	float3 Direction;
+	float3 cameraPosition;
+	uint directionalLightCount;
+	float4 clusterParams;	// tile width, tile height, depth slice scale, depth slice bias
 };
 
-struct PointLight
+// Changes per material, Material keeps a ready-made copy
+cbuffer MaterialConstants : register(b1)
 {
-	float4 Color;
-	float3 Position;
+	float4 tint;
+	float specularPower;
 };
 
-cbuffer ExternalData : register(b0)
+// --------------------------------------------------------
+// Diffuse (returned) and specular (out) from a light at a
+// position, with a smooth falloff to zero at the light's range
+// --------------------------------------------------------
+float3 LocalLight(float3 lightPos, float range, float3 color, float3 normal, float3 worldPos, float3 dirToCamera, out float3 dirToLight, out float specular)
 {
-	DirectionalLight light;
-	DirectionalLight light2;
-	PointLight pointLight;
-	float3 cameraPosition;
-};
+	float3 toLight = lightPos - worldPos;
+	float dist = length(toLight);
+	dirToLight = toLight / max(dist, 0.0001f);
+
+	float attenuation = saturate(1.0f - dist / range);
+	attenuation *= attenuation;
+
+	float diffuse = saturate(dot(normal, dirToLight));
+	float3 reflectionVector = reflect(-dirToLight, normal);
+	specular = pow(saturate(dot(reflectionVector, dirToCamera)), specularPower) * attenuation;
+
+	return color * diffuse * attenuation;
+}
 
 // --------------------------------------------------------
 // The entry point (main method) for our pixel shader
@@ -55,31 +115,68 @@ cbuffer ExternalData : register(b0)
 // --------------------------------------------------------
 float4 main(VertexToPixel input) : SV_TARGET
 {
-	float4 surfaceColor = diffuseTexture.Sample(basicSampler, input.uv);
+#if TEXTURE_ARRAY
+	float4 surfaceColor = diffuseTexture.Sample(basicSampler, float3(input.uv, input.textureSlice)) * tint;
+#else
+	float4 surfaceColor = diffuseTexture.Sample(basicSampler, input.uv) * tint;
+#endif
+
+#if ALPHA_TEST
+	clip(surfaceColor.a - 0.5f);
+#endif
 
 	// Normalize the normal vector
 	input.normal = normalize(input.normal);
 
-	// Negate light dir (fromDir) to get direction of light
-	float3 lightDir = normalize(-light.Direction);
-	float3 light2Dir = normalize(-light2.Direction);
+	// Every directional light affects every pixel
+	float4 directionalLight = float4(0.0f, 0.0f, 0.0f, 0.0f);
+	for (uint d = 0; d < directionalLightCount; d++)
+	{
+		DirectionalLight light = directionalLights[d];
 
-	// Calculate N dot L
-	float lightAmount = saturate(dot(input.normal, lightDir));
-	float light2Amount = saturate(dot(input.normal, light2Dir));
+		// Negate light dir (fromDir) to get direction of light, then N dot L
+		float lightAmount = saturate(dot(input.normal, normalize(-light.Direction)));
+		directionalLight += light.DiffuseColor * lightAmount + light.AmbientColor;
+	}
 
-	float3 dirToPointLight = normalize(pointLight.Position - input.worldPos);
-	float pointLightAmount = saturate(dot(input.normal, dirToPointLight));
+	// Point and spot light totals
+	float3 localLight = float3(0.0f, 0.0f, 0.0f);
+	float specularLight = 0.0f;
 
+#if !DIRECTIONAL_ONLY
 	float3 dirToCamera = normalize(cameraPosition - input.worldPos);
-	float3 reflectionVector = reflect(-dirToPointLight, input.normal);
-	float specularLight = pow(saturate(dot(reflectionVector, dirToCamera)), 128);
+
+	// Find this pixel's cluster
+	uint3 cluster;
+	cluster.xy = min(uint2(input.position.xy / clusterParams.xy), uint2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+	cluster.z = (uint)clamp(log(input.viewDepth) * clusterParams.z + clusterParams.w, 0.0f, CLUSTERS_Z - 1);
+	uint4 entry = clusterGrid[(cluster.z * CLUSTERS_Y + cluster.y) * CLUSTERS_X + cluster.x];
+
+	// Only the lights binned into this cluster
+	float3 dirToLight;
+	float specular;
+	for (uint p = 0; p < entry.y; p++)
+	{
+		PointLight pointLight = pointLights[clusterLightIndices[entry.x + p]];
+		localLight += LocalLight(pointLight.Position, pointLight.Range, pointLight.Color.rgb, input.normal, input.worldPos, dirToCamera, dirToLight, specular);
+		specularLight += specular;
+	}
+
+	for (uint s = 0; s < entry.z; s++)
+	{
+		SpotLight spotLight = spotLights[clusterLightIndices[entry.x + entry.y + s]];
+		float3 spotColor = LocalLight(spotLight.Position, spotLight.Range, spotLight.Color.rgb, input.normal, input.worldPos, dirToCamera, dirToLight, specular);
+
+		// Fade out towards the edge of the cone
+		float cosAngle = dot(-dirToLight, normalize(spotLight.Direction));
+		float cone = saturate((cosAngle - spotLight.SpotAngle) / max(1.0f - spotLight.SpotAngle, 0.0001f));
+		localLight += spotColor * cone;
+		specularLight += specular * cone;
+	}
+#endif
 
 	return surfaceColor * 
-		((light.DiffuseColor * lightAmount) +
-		(light.AmbientColor) +
-		(light2.DiffuseColor * light2Amount) +
-		(light2.AmbientColor) +
-		(pointLight.Color * pointLightAmount)) +
+		(directionalLight +
+		float4(localLight, 0.0f)) +
 		(specularLight);
-}
\ No newline at end of file
+}
@@ -0,0 +1,654 @@
+#include "RenderGraph.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static const unsigned int NO_INDEX = 0xffffffff;
+
+// Format of the texture behind the views, typeless for depth
+// buffers that are also sampled
+static DXGI_FORMAT GetTextureFormat(const RenderGraphTextureDesc& desc)
+{
+	if ((desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) && (desc.BindFlags & D3D11_BIND_SHADER_RESOURCE))
+	{
+		switch (desc.Format)
+		{
+		case DXGI_FORMAT_D32_FLOAT: return DXGI_FORMAT_R32_TYPELESS;
+		case DXGI_FORMAT_D24_UNORM_S8_UINT: return DXGI_FORMAT_R24G8_TYPELESS;
+		case DXGI_FORMAT_D16_UNORM: return DXGI_FORMAT_R16_TYPELESS;
+		default: break;
+		}
+	}
+	return desc.Format;
+}
+
+static DXGI_FORMAT GetShaderResourceFormat(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_D32_FLOAT: return DXGI_FORMAT_R32_FLOAT;
+	case DXGI_FORMAT_D24_UNORM_S8_UINT: return DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+	case DXGI_FORMAT_D16_UNORM: return DXGI_FORMAT_R16_UNORM;
+	default: return format;
+	}
+}
+
+unsigned long long RenderGraph::GetTextureBytes(const RenderGraphTextureDesc & desc)
+{
+	unsigned int bytesPerPixel;
+	switch (desc.Format)
+	{
+	case DXGI_FORMAT_R8_UNORM:
+		bytesPerPixel = 1; break;
+	case DXGI_FORMAT_R16_FLOAT: case DXGI_FORMAT_R16_UNORM: case DXGI_FORMAT_D16_UNORM:
+		bytesPerPixel = 2; break;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT: case DXGI_FORMAT_R32G32_FLOAT: case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+		bytesPerPixel = 8; break;
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		bytesPerPixel = 16; break;
+	default:
+		bytesPerPixel = 4; break;
+	}
+	return (unsigned long long)desc.Width * desc.Height * bytesPerPixel;
+}
+
+// --------------------------------------------------------
+// Builder
+// --------------------------------------------------------
+RenderGraphResource RenderGraphBuilder::CreateTexture(const char * name, const RenderGraphTextureDesc & desc)
+{
+	return Write(graph->AddResource(name, desc, false));
+}
+
+RenderGraphResource RenderGraphBuilder::Read(RenderGraphResource resource)
+{
+	std::vector<RenderGraphResource>& reads = graph->passes[pass].Reads;
+	if (std::find(reads.begin(), reads.end(), resource) == reads.end())
+	{
+		reads.push_back(resource);
+		graph->resources[resource].Readers.push_back(pass);
+	}
+	return resource;
+}
+
+RenderGraphResource RenderGraphBuilder::Write(RenderGraphResource resource)
+{
+	std::vector<RenderGraphResource>& writes = graph->passes[pass].Writes;
+	if (std::find(writes.begin(), writes.end(), resource) == writes.end())
+	{
+		writes.push_back(resource);
+		graph->resources[resource].Writers.push_back(pass);
+	}
+	return resource;
+}
+
+void RenderGraphBuilder::SetSideEffects()
+{
+	graph->passes[pass].SideEffects = true;
+}
+
+// --------------------------------------------------------
+// Graph
+// --------------------------------------------------------
+RenderGraph::RenderGraph()
+{
+	ZeroMemory(&stats, sizeof(RenderGraphStats));
+	compiled = false;
+}
+
+RenderGraph::~RenderGraph()
+{
+	ReleaseTextures();
+}
+
+void RenderGraph::Reset()
+{
+	resources.clear();
+	passes.clear();
+	order.clear();
+	physicalTextures.clear();
+	compiled = false;
+}
+
+RenderGraphResource RenderGraph::AddResource(const char * name, const RenderGraphTextureDesc & desc, bool imported)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Desc = desc;
+	resource.Imported = imported;
+	resource.ImportedRTV = nullptr;
+	resource.ImportedDSV = nullptr;
+	resource.Physical = NO_INDEX;
+	resource.FirstUse = NO_INDEX;
+	resource.LastUse = 0;
+	resources.push_back(resource);
+	compiled = false;
+	return (RenderGraphResource)resources.size() - 1;
+}
+
+RenderGraphResource RenderGraph::ImportRenderTarget(const char * name, ID3D11RenderTargetView * rtv)
+{
+	RenderGraphTextureDesc desc = { 0, 0, DXGI_FORMAT_UNKNOWN, D3D11_BIND_RENDER_TARGET };
+	RenderGraphResource resource = AddResource(name, desc, true);
+	resources[resource].ImportedRTV = rtv;
+	return resource;
+}
+
+RenderGraphResource RenderGraph::ImportDepthStencil(const char * name, ID3D11DepthStencilView * dsv)
+{
+	RenderGraphTextureDesc desc = { 0, 0, DXGI_FORMAT_UNKNOWN, D3D11_BIND_DEPTH_STENCIL };
+	RenderGraphResource resource = AddResource(name, desc, true);
+	resources[resource].ImportedDSV = dsv;
+	return resource;
+}
+
+void RenderGraph::AddPass(
+	const char * name,
+	const std::function<void(RenderGraphBuilder&)>& setup,
+	const std::function<void(const RenderGraph&, ID3D11DeviceContext*)>& execute)
+{
+	Pass pass;
+	pass.Name = name;
+	pass.Execute = execute;
+	pass.SideEffects = false;
+	pass.Culled = false;
+	passes.push_back(pass);
+	compiled = false;
+
+	RenderGraphBuilder builder(this, (unsigned int)passes.size() - 1);
+	setup(builder);
+}
+
+bool RenderGraph::Compile()
+{
+	__int64 perfFreq, start, end;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	ZeroMemory(&stats, sizeof(RenderGraphStats));
+	order.clear();
+	physicalTextures.clear();
+	for (size_t r = 0; r < resources.size(); r++)
+	{
+		resources[r].Physical = NO_INDEX;
+		resources[r].FirstUse = NO_INDEX;
+		resources[r].LastUse = 0;
+	}
+
+	CullPasses();
+	compiled = OrderPasses();
+	if (compiled)
+		AssignTextures();
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.Passes = (unsigned int)passes.size();
+	stats.CulledPasses = (unsigned int)(passes.size() - order.size());
+	stats.CompileMs = (float)((end - start) * 1000.0 / perfFreq);
+	return compiled;
+}
+
+// --------------------------------------------------------
+// Walks back from the passes that write imported resources
+// or have side effects.  A needed pass needs every earlier
+// writer of the resources it reads or writes, since writes
+// keep the previous contents.
+// --------------------------------------------------------
+void RenderGraph::CullPasses()
+{
+	std::vector<unsigned int> worklist;
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		Pass& pass = passes[p];
+		pass.Culled = !pass.SideEffects;
+		for (size_t w = 0; w < pass.Writes.size() && pass.Culled; w++)
+			if (resources[pass.Writes[w]].Imported) pass.Culled = false;
+
+		if (!pass.Culled)
+			worklist.push_back(p);
+	}
+
+	while (!worklist.empty())
+	{
+		unsigned int p = worklist.back();
+		worklist.pop_back();
+
+		std::vector<RenderGraphResource> used(passes[p].Reads);
+		used.insert(used.end(), passes[p].Writes.begin(), passes[p].Writes.end());
+		for (size_t u = 0; u < used.size(); u++)
+		{
+			const std::vector<unsigned int>& writers = resources[used[u]].Writers;
+			for (size_t w = 0; w < writers.size() && writers[w] < p; w++)
+			{
+				if (passes[writers[w]].Culled)
+				{
+					passes[writers[w]].Culled = false;
+					worklist.push_back(writers[w]);
+				}
+			}
+		}
+	}
+}
+
+// --------------------------------------------------------
+// Topological sort of the surviving passes.  Every write of a
+// resource makes a new version of it, in the order passes were
+// added.  A version's writer runs after the previous writer,
+// its readers after it and before the next writer, so no read
+// sees a later write.  A pass that reads and writes a resource
+// reads the version before its own.  Ties go to the pass added
+// first.  Fails on a cycle.
+// --------------------------------------------------------
+bool RenderGraph::OrderPasses()
+{
+	std::vector<std::vector<unsigned int>> successors(passes.size());
+	std::vector<unsigned int> inDegree(passes.size(), 0);
+
+	auto addEdge = [&](unsigned int from, unsigned int to)
+	{
+		std::vector<unsigned int>& next = successors[from];
+		if (from != to && std::find(next.begin(), next.end(), to) == next.end())
+		{
+			next.push_back(to);
+			inDegree[to]++;
+		}
+	};
+
+	std::vector<unsigned int> versionReaders;
+	for (size_t r = 0; r < resources.size(); r++)
+	{
+		// Both lists are in the order passes were added
+		const Resource& resource = resources[r];
+		unsigned int lastWriter = NO_INDEX;
+		versionReaders.clear();
+		size_t w = 0, i = 0;
+		while (w < resource.Writers.size() || i < resource.Readers.size())
+		{
+			bool read = i < resource.Readers.size() &&
+				(w == resource.Writers.size() || resource.Readers[i] <= resource.Writers[w]);
+			if (read)
+			{
+				unsigned int reader = resource.Readers[i++];
+				if (passes[reader].Culled)
+					continue;
+				if (lastWriter != NO_INDEX)
+					addEdge(lastWriter, reader);
+				versionReaders.push_back(reader);
+			}
+			else
+			{
+				unsigned int writer = resource.Writers[w++];
+				if (passes[writer].Culled)
+					continue;
+				if (lastWriter != NO_INDEX)
+					addEdge(lastWriter, writer);
+				for (size_t v = 0; v < versionReaders.size(); v++)
+					addEdge(versionReaders[v], writer);
+				versionReaders.clear();
+				lastWriter = writer;
+			}
+		}
+	}
+
+	unsigned int live = 0;
+	std::vector<bool> done(passes.size(), false);
+	for (unsigned int p = 0; p < passes.size(); p++)
+		if (!passes[p].Culled) live++;
+
+	while (order.size() < live)
+	{
+		unsigned int next = NO_INDEX;
+		for (unsigned int p = 0; p < passes.size() && next == NO_INDEX; p++)
+			if (!passes[p].Culled && !done[p] && inDegree[p] == 0) next = p;
+
+		if (next == NO_INDEX)
+			return false;
+
+		done[next] = true;
+		order.push_back(next);
+		for (size_t s = 0; s < successors[next].size(); s++)
+			inDegree[successors[next][s]]--;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Finds each transient's first and last pass, then hands
+// out textures first fit: a transient takes a texture of the
+// same desc whose last user runs before its first one
+// --------------------------------------------------------
+void RenderGraph::AssignTextures()
+{
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		const Pass& pass = passes[order[i]];
+		std::vector<RenderGraphResource> used(pass.Reads);
+		used.insert(used.end(), pass.Writes.begin(), pass.Writes.end());
+		for (size_t u = 0; u < used.size(); u++)
+		{
+			Resource& resource = resources[used[u]];
+			if (resource.FirstUse == NO_INDEX)
+				resource.FirstUse = i;
+			resource.LastUse = i;
+		}
+	}
+
+	std::vector<unsigned int> transients;
+	for (unsigned int r = 0; r < resources.size(); r++)
+		if (!resources[r].Imported && resources[r].FirstUse != NO_INDEX) transients.push_back(r);
+
+	std::stable_sort(transients.begin(), transients.end(), [this](unsigned int a, unsigned int b)
+	{
+		return resources[a].FirstUse < resources[b].FirstUse;
+	});
+
+	for (size_t t = 0; t < transients.size(); t++)
+	{
+		Resource& resource = resources[transients[t]];
+		unsigned long long bytes = GetTextureBytes(resource.Desc);
+		stats.Transients++;
+		stats.UnaliasedBytes += bytes;
+
+		for (unsigned int p = 0; p < physicalTextures.size() && resource.Physical == NO_INDEX; p++)
+		{
+			PhysicalTexture& physical = physicalTextures[p];
+			if (physical.Desc == resource.Desc && physical.LastUse < resource.FirstUse)
+			{
+				resource.Physical = p;
+				physical.LastUse = resource.LastUse;
+			}
+		}
+
+		if (resource.Physical == NO_INDEX)
+		{
+			PhysicalTexture physical;
+			physical.Desc = resource.Desc;
+			physical.LastUse = resource.LastUse;
+			physical.Pooled = NO_INDEX;
+			resource.Physical = (unsigned int)physicalTextures.size();
+			physicalTextures.push_back(physical);
+			stats.AliasedBytes += bytes;
+		}
+	}
+	stats.PhysicalTextures = (unsigned int)physicalTextures.size();
+
+	for (unsigned int i = 0; i < order.size(); i++)
+	{
+		unsigned long long live = 0;
+		for (size_t t = 0; t < transients.size(); t++)
+		{
+			const Resource& resource = resources[transients[t]];
+			if (resource.FirstUse <= i && resource.LastUse >= i)
+				live += GetTextureBytes(resource.Desc);
+		}
+		stats.PeakLiveBytes = max(stats.PeakLiveBytes, live);
+	}
+}
+
+bool RenderGraph::CreatePooledTexture(ID3D11Device * device, PooledTexture & texture)
+{
+	const RenderGraphTextureDesc& desc = texture.Desc;
+
+	D3D11_TEXTURE2D_DESC texDesc = {};
+	texDesc.Width = desc.Width;
+	texDesc.Height = desc.Height;
+	texDesc.MipLevels = 1;
+	texDesc.ArraySize = 1;
+	texDesc.Format = GetTextureFormat(desc);
+	texDesc.SampleDesc.Count = 1;
+	texDesc.Usage = D3D11_USAGE_DEFAULT;
+	texDesc.BindFlags = desc.BindFlags;
+	if (FAILED(device->CreateTexture2D(&texDesc, 0, &texture.Texture)))
+		return false;
+
+	if (desc.BindFlags & D3D11_BIND_RENDER_TARGET)
+	{
+		D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
+		rtvDesc.Format = desc.Format;
+		rtvDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+		if (FAILED(device->CreateRenderTargetView(texture.Texture, &rtvDesc, &texture.RTV)))
+			return false;
+	}
+
+	if (desc.BindFlags & D3D11_BIND_DEPTH_STENCIL)
+	{
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = desc.Format;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+		if (FAILED(device->CreateDepthStencilView(texture.Texture, &dsvDesc, &texture.DSV)))
+			return false;
+	}
+
+	if (desc.BindFlags & D3D11_BIND_SHADER_RESOURCE)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = GetShaderResourceFormat(desc.Format);
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		if (FAILED(device->CreateShaderResourceView(texture.Texture, &srvDesc, &texture.SRV)))
+			return false;
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------
+// Matches this frame's physical textures to pooled ones of
+// the same desc, so textures are only created when the frame
+// needs more of a kind than any frame before
+// --------------------------------------------------------
+void RenderGraph::Execute(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	if (!compiled)
+		return;
+
+	for (size_t p = 0; p < pool.size(); p++)
+		pool[p].Taken = false;
+
+	for (size_t i = 0; i < physicalTextures.size(); i++)
+	{
+		PhysicalTexture& physical = physicalTextures[i];
+		physical.Pooled = NO_INDEX;
+		for (unsigned int p = 0; p < pool.size() && physical.Pooled == NO_INDEX; p++)
+			if (!pool[p].Taken && pool[p].Desc == physical.Desc) physical.Pooled = p;
+
+		if (physical.Pooled == NO_INDEX)
+		{
+			PooledTexture texture = { physical.Desc, nullptr, nullptr, nullptr, nullptr, false };
+			if (!CreatePooledTexture(device, texture))
+			{
+				if (texture.Texture) texture.Texture->Release();
+				if (texture.RTV) texture.RTV->Release();
+				if (texture.DSV) texture.DSV->Release();
+				if (texture.SRV) texture.SRV->Release();
+				return;
+			}
+			physical.Pooled = (unsigned int)pool.size();
+			pool.push_back(texture);
+		}
+		pool[physical.Pooled].Taken = true;
+	}
+
+	ID3D11ShaderResourceView* nullSRVs[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT] = {};
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const Pass& pass = passes[order[i]];
+		pass.Execute(*this, context);
+
+		// Release transients from the pipeline so the next pass
+		// can bind them the other way around
+		bool readTransient = false;
+		bool wroteTransient = false;
+		for (size_t r = 0; r < pass.Reads.size(); r++)
+			if (!resources[pass.Reads[r]].Imported) readTransient = true;
+		for (size_t w = 0; w < pass.Writes.size(); w++)
+			if (!resources[pass.Writes[w]].Imported) wroteTransient = true;
+
+		if (readTransient)
+			context->PSSetShaderResources(0, D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, nullSRVs);
+		if (wroteTransient)
+			context->OMSetRenderTargets(0, 0, 0);
+	}
+}
+
+void RenderGraph::ReleaseTextures()
+{
+	for (size_t p = 0; p < pool.size(); p++)
+	{
+		if (pool[p].Texture) pool[p].Texture->Release();
+		if (pool[p].RTV) pool[p].RTV->Release();
+		if (pool[p].DSV) pool[p].DSV->Release();
+		if (pool[p].SRV) pool[p].SRV->Release();
+	}
+	pool.clear();
+	compiled = false;
+}
+
+const RenderGraph::PooledTexture * RenderGraph::GetPooled(RenderGraphResource resource) const
+{
+	unsigned int physical = resources[resource].Physical;
+	if (physical == NO_INDEX || physicalTextures[physical].Pooled == NO_INDEX)
+		return nullptr;
+	return &pool[physicalTextures[physical].Pooled];
+}
+
+ID3D11RenderTargetView * RenderGraph::GetRenderTargetView(RenderGraphResource resource) const
+{
+	if (resources[resource].Imported)
+		return resources[resource].ImportedRTV;
+
+	const PooledTexture* texture = GetPooled(resource);
+	return texture ? texture->RTV : nullptr;
+}
+
+ID3D11DepthStencilView * RenderGraph::GetDepthStencilView(RenderGraphResource resource) const
+{
+	if (resources[resource].Imported)
+		return resources[resource].ImportedDSV;
+
+	const PooledTexture* texture = GetPooled(resource);
+	return texture ? texture->DSV : nullptr;
+}
+
+ID3D11ShaderResourceView * RenderGraph::GetShaderResourceView(RenderGraphResource resource) const
+{
+	const PooledTexture* texture = GetPooled(resource);
+	return texture ? texture->SRV : nullptr;
+}
+
+std::string RenderGraph::Describe() const
+{
+	std::ostringstream text;
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const Pass& pass = passes[order[i]];
+		text << "  " << i << ": " << pass.Name;
+		for (size_t w = 0; w < pass.Writes.size(); w++)
+		{
+			const Resource& resource = resources[pass.Writes[w]];
+			text << (w == 0 ? " -> " : ", ") << resource.Name;
+			if (!resource.Imported)
+				text << " [texture " << resource.Physical << "]";
+		}
+		text << "\n";
+	}
+
+	for (size_t p = 0; p < passes.size(); p++)
+		if (passes[p].Culled) text << "  culled: " << passes[p].Name << "\n";
+
+	return text.str();
+}
+
+// --------------------------------------------------------
+// Compiles the passes a frame with shadows, SSAO, HDR and
+// bloom would have, plus a debug pass nothing reads, without
+// touching a GPU
+// --------------------------------------------------------
+int RunRenderGraphReport(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	unsigned int width = 1920;
+	unsigned int height = 1080;
+
+	unsigned int sizeArgs = 0;
+	while (args >> arg)
+	{
+		if (arg == "--render-graph-report")
+			continue;
+		unsigned int value = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+		if (sizeArgs++ == 0) width = value;
+		else height = value;
+	}
+
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+
+	const unsigned int sampled = D3D11_BIND_SHADER_RESOURCE;
+	RenderGraphTextureDesc depthDesc = { width, height, DXGI_FORMAT_D32_FLOAT, D3D11_BIND_DEPTH_STENCIL | sampled };
+	RenderGraphTextureDesc shadowDesc = { 2048, 2048, DXGI_FORMAT_D32_FLOAT, D3D11_BIND_DEPTH_STENCIL | sampled };
+	RenderGraphTextureDesc aoDesc = { width / 2, height / 2, DXGI_FORMAT_R8_UNORM, D3D11_BIND_RENDER_TARGET | sampled };
+	RenderGraphTextureDesc hdrDesc = { width, height, DXGI_FORMAT_R16G16B16A16_FLOAT, D3D11_BIND_RENDER_TARGET | sampled };
+	RenderGraphTextureDesc bloomDesc = { width / 2, height / 2, DXGI_FORMAT_R16G16B16A16_FLOAT, D3D11_BIND_RENDER_TARGET | sampled };
+	RenderGraphTextureDesc ldrDesc = { width, height, DXGI_FORMAT_R8G8B8A8_UNORM, D3D11_BIND_RENDER_TARGET | sampled };
+
+	auto nothing = [](const RenderGraph&, ID3D11DeviceContext*) { };
+	RenderGraph graph;
+	RenderGraphResource backBuffer = graph.ImportRenderTarget("Back Buffer", nullptr);
+	RenderGraphResource depth, shadowMap, ao, aoBlurred, hdr, bloomHalf, bloomA, bloomB, ldr;
+
+	graph.AddPass("Depth Prepass", [&](RenderGraphBuilder& b) { depth = b.CreateTexture("Depth", depthDesc); }, nothing);
+	graph.AddPass("Shadow Map", [&](RenderGraphBuilder& b) { shadowMap = b.CreateTexture("Shadow Map", shadowDesc); }, nothing);
+	graph.AddPass("SSAO", [&](RenderGraphBuilder& b) { b.Read(depth); ao = b.CreateTexture("AO", aoDesc); }, nothing);
+	graph.AddPass("SSAO Blur", [&](RenderGraphBuilder& b) { b.Read(ao); aoBlurred = b.CreateTexture("AO Blurred", aoDesc); }, nothing);
+	graph.AddPass("Scene", [&](RenderGraphBuilder& b)
+	{
+		b.Read(shadowMap);
+		b.Read(aoBlurred);
+		b.Read(depth);		// Depth test against the prepass, no writes
+		hdr = b.CreateTexture("HDR", hdrDesc);
+	}, nothing);
+	graph.AddPass("Bloom Downsample", [&](RenderGraphBuilder& b) { b.Read(hdr); bloomHalf = b.CreateTexture("Bloom Half", bloomDesc); }, nothing);
+	graph.AddPass("Bloom Blur H", [&](RenderGraphBuilder& b) { b.Read(bloomHalf); bloomA = b.CreateTexture("Bloom A", bloomDesc); }, nothing);
+	graph.AddPass("Bloom Blur V", [&](RenderGraphBuilder& b) { b.Read(bloomA); bloomB = b.CreateTexture("Bloom B", bloomDesc); }, nothing);
+	graph.AddPass("Tonemap", [&](RenderGraphBuilder& b) { b.Read(hdr); b.Read(bloomB); ldr = b.CreateTexture("LDR", ldrDesc); }, nothing);
+	graph.AddPass("Debug Overlay", [&](RenderGraphBuilder& b) { b.Read(depth); b.CreateTexture("Debug", ldrDesc); }, nothing);
+	graph.AddPass("FXAA", [&](RenderGraphBuilder& b) { b.Read(ldr); b.Write(backBuffer); }, nothing);
+
+	std::ostringstream report;
+	if (!graph.Compile())
+	{
+		report << "Render graph has a cycle\n";
+	}
+	else
+	{
+		const RenderGraphStats& stats = graph.GetStats();
+		char line[512];
+		sprintf_s(line,
+			"%ux%u: %u passes (%u culled), %u transients in %u textures, compiled in %.3fms\n"
+			"transient memory: %.1fMB unaliased, %.1fMB aliased, %.1fMB peak live\n",
+			width, height, stats.Passes, stats.CulledPasses, stats.Transients, stats.PhysicalTextures, stats.CompileMs,
+			stats.UnaliasedBytes / (1024.0 * 1024.0), stats.AliasedBytes / (1024.0 * 1024.0), stats.PeakLiveBytes / (1024.0 * 1024.0));
+		report << line << graph.Describe();
+	}
+
+	// A pass reading a resource must run before the next pass
+	// that writes it, even though nothing orders them otherwise
+	RenderGraph hazards;
+	RenderGraphResource hazardBackBuffer = hazards.ImportRenderTarget("Back Buffer", nullptr);
+	RenderGraphResource x, y;
+	hazards.AddPass("A", [&](RenderGraphBuilder& b) { x = b.CreateTexture("X", ldrDesc); }, nothing);
+	hazards.AddPass("B", [&](RenderGraphBuilder& b) { b.Read(x); y = b.CreateTexture("Y", ldrDesc); }, nothing);
+	hazards.AddPass("C", [&](RenderGraphBuilder& b) { b.Write(x); }, nothing);
+	hazards.AddPass("D", [&](RenderGraphBuilder& b) { b.Read(x); b.Read(y); b.Write(hazardBackBuffer); }, nothing);
+
+	const unsigned int expected[] = { 0, 1, 2, 3 };
+	bool hazardsOrdered = hazards.Compile() &&
+		hazards.GetOrder().size() == 4 && std::equal(expected, expected + 4, hazards.GetOrder().begin());
+	report << "write after read: " << (hazardsOrdered ? "ordered" : "FAILED, B reads C's write") << "\n";
+
+	printf("%s", report.str().c_str());
+	std::ofstream results("render_graph.results.txt", std::ios::app);
+	results << report.str();
+	return hazardsOrdered ? 0 : 1;
+}
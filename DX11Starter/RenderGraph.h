@@ -0,0 +1,205 @@
+#pragma once
+#include <d3d11.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef unsigned int RenderGraphResource;
+static const RenderGraphResource RENDER_GRAPH_INVALID = 0xffffffff;
+
+// --------------------------------------------------------
+// A transient 2D texture.  Format is the format of the views;
+// depth formats read as shader resources get a typeless
+// texture.  Transients alias only with identical descs.
+// --------------------------------------------------------
+struct RenderGraphTextureDesc
+{
+	unsigned int Width;
+	unsigned int Height;
+	DXGI_FORMAT Format;
+	unsigned int BindFlags;		// D3D11_BIND_RENDER_TARGET or _DEPTH_STENCIL, plus _SHADER_RESOURCE
+
+	bool operator==(const RenderGraphTextureDesc& other) const
+	{
+		return Width == other.Width && Height == other.Height && Format == other.Format && BindFlags == other.BindFlags;
+	}
+};
+
+// --------------------------------------------------------
+// Results of the last Compile()
+// --------------------------------------------------------
+struct RenderGraphStats
+{
+	unsigned int Passes;
+	unsigned int CulledPasses;
+	unsigned int Transients;			// Used by passes that survived culling
+	unsigned int PhysicalTextures;		// Transients after aliasing
+	unsigned long long UnaliasedBytes;	// Every transient in its own texture
+	unsigned long long AliasedBytes;	// The physical textures
+	unsigned long long PeakLiveBytes;	// Most transient bytes in use by one pass
+	float CompileMs;
+};
+
+class RenderGraph;
+
+// --------------------------------------------------------
+// Handed to a pass's setup function to declare what it uses
+// --------------------------------------------------------
+class RenderGraphBuilder
+{
+	friend class RenderGraph;
+
+public:
+	// A texture that only lives for this frame, written first by this pass
+	RenderGraphResource CreateTexture(const char* name, const RenderGraphTextureDesc& desc);
+
+	// Sampled as a shader resource
+	RenderGraphResource Read(RenderGraphResource resource);
+
+	// Rendered to (render target or depth), previous contents kept
+	RenderGraphResource Write(RenderGraphResource resource);
+
+	// The pass matters even though nothing reads what it writes
+	void SetSideEffects();
+
+private:
+	RenderGraphBuilder(RenderGraph* graph, unsigned int pass) : graph(graph), pass(pass) { }
+
+	RenderGraph* graph;
+	unsigned int pass;
+};
+
+// --------------------------------------------------------
+// Frame graph of render passes
+//
+// Passes are added every frame with a setup function, run
+// immediately to declare reads and writes, and an execute
+// function.  Compile() then works out, without a device:
+//  - which passes contribute to an imported resource (e.g.
+//    the back buffer) or have side effects; others are culled
+//  - an order where each write of a resource runs after the
+//    previous write and its readers, and before the reads
+//    added after it, so a read sees the write added before it
+//  - each transient's lifetime, and which transients can
+//    share one texture because their lifetimes don't overlap
+//
+// D3D11 can't place two resources in the same memory, so
+// aliased transients share one pooled texture, which needs
+// identical descs.  Contents of a transient are undefined
+// when the pass that creates it starts.  Execute() unbinds
+// shader resources after passes that read transients, so no
+// texture is bound for reading while it's rendered to.
+// --------------------------------------------------------
+class RenderGraph
+{
+	friend class RenderGraphBuilder;
+
+public:
+	RenderGraph();
+	~RenderGraph();
+
+	// Clears the passes and resources, keeping the texture pool
+	void Reset();
+
+	// Resources owned outside the graph, e.g. DXCore's back buffer
+	RenderGraphResource ImportRenderTarget(const char* name, ID3D11RenderTargetView* rtv);
+	RenderGraphResource ImportDepthStencil(const char* name, ID3D11DepthStencilView* dsv);
+
+	void AddPass(
+		const char* name,
+		const std::function<void(RenderGraphBuilder&)>& setup,
+		const std::function<void(const RenderGraph&, ID3D11DeviceContext*)>& execute);
+
+	// Culls, orders and assigns textures.  Needs no device.
+	bool Compile();
+
+	// Creates any pooled textures still missing and runs the
+	// compiled passes in order
+	void Execute(ID3D11Device* device, ID3D11DeviceContext* context);
+
+	// Frees the pooled textures, e.g. when the window resizes
+	void ReleaseTextures();
+
+	// Views of a resource, valid inside an execute function
+	ID3D11RenderTargetView* GetRenderTargetView(RenderGraphResource resource) const;
+	ID3D11DepthStencilView* GetDepthStencilView(RenderGraphResource resource) const;
+	ID3D11ShaderResourceView* GetShaderResourceView(RenderGraphResource resource) const;
+	const RenderGraphTextureDesc& GetDesc(RenderGraphResource resource) const { return resources[resource].Desc; }
+
+	const RenderGraphStats& GetStats() const { return stats; }
+
+	// Indices of the surviving passes, in execution order
+	const std::vector<unsigned int>& GetOrder() const { return order; }
+
+	// Pass names in execution order, with culled ones marked
+	std::string Describe() const;
+
+	static unsigned long long GetTextureBytes(const RenderGraphTextureDesc& desc);
+
+private:
+	struct Resource
+	{
+		std::string Name;
+		RenderGraphTextureDesc Desc;
+		bool Imported;
+		ID3D11RenderTargetView* ImportedRTV;
+		ID3D11DepthStencilView* ImportedDSV;
+		std::vector<unsigned int> Writers;	// Passes, in the order they were added
+		std::vector<unsigned int> Readers;
+		unsigned int Physical;				// Index into physicalTextures
+		unsigned int FirstUse;				// In execution order
+		unsigned int LastUse;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		std::function<void(const RenderGraph&, ID3D11DeviceContext*)> Execute;
+		std::vector<RenderGraphResource> Reads;
+		std::vector<RenderGraphResource> Writes;
+		bool SideEffects;
+		bool Culled;
+	};
+
+	// A texture some transients share this frame
+	struct PhysicalTexture
+	{
+		RenderGraphTextureDesc Desc;
+		unsigned int LastUse;
+		unsigned int Pooled;				// Index into pool once executed
+	};
+
+	struct PooledTexture
+	{
+		RenderGraphTextureDesc Desc;
+		ID3D11Texture2D* Texture;
+		ID3D11RenderTargetView* RTV;
+		ID3D11DepthStencilView* DSV;
+		ID3D11ShaderResourceView* SRV;
+		bool Taken;
+	};
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<unsigned int> order;		// Surviving passes, in execution order
+	std::vector<PhysicalTexture> physicalTextures;
+	std::vector<PooledTexture> pool;
+	RenderGraphStats stats;
+	bool compiled;
+
+	RenderGraphResource AddResource(const char* name, const RenderGraphTextureDesc& desc, bool imported);
+	void CullPasses();
+	bool OrderPasses();
+	void AssignTextures();
+	bool CreatePooledTexture(ID3D11Device* device, PooledTexture& texture);
+	const PooledTexture* GetPooled(RenderGraphResource resource) const;
+};
+
+// --------------------------------------------------------
+// Headless report on a typical frame's passes, and a check
+// that reads are ordered before later writes:
+//   --render-graph-report [width] [height]
+//
+// Returns the process exit code
+// --------------------------------------------------------
+int RunRenderGraphReport(const std::string& commandLine);
@@ -0,0 +1,64 @@
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include "Mesh.h"
+#include "Material.h"
+#include "LightManager.h"
+#include "ShadowCascades.h"
+
+// For the DirectX Math library
+using namespace DirectX;
+
+// --------------------------------------------------------
+// One visible entity, or a range of a static batch, as
+// extracted for the render thread
+// --------------------------------------------------------
+struct RenderItem
+{
+	Mesh* MeshObj;			// Null for static batches
+	Material* MaterialObj;
+	ID3D11Buffer* VertexBuffer;
+	ID3D11Buffer* AttributeBuffer;	// Split stream meshes only
+	ID3D11Buffer* IndexBuffer;
+	unsigned int IndexCount;
+	unsigned int StartIndex;
+	int BaseVertex;
+	XMFLOAT4X4 World;		// Interpolated, transposed for HLSL
+};
+
+// --------------------------------------------------------
+// Everything the render thread needs to draw one frame
+//
+// Filled by Renderer::Extract() on the simulation side and
+// not changed again until it has been drawn, so the next
+// frame can be simulated while this one is submitted.  Meshes,
+// materials and shaders are only referenced; Update() must not
+// change them.
+// --------------------------------------------------------
+struct RenderSnapshot
+{
+	unsigned long long Frame;		// 0 until the first extraction
+	float TotalTime;				// Simulated time, interpolated
+	float Interpolation;			// Between the last two simulation steps
+
+	// Camera matrices are transposed for HLSL
+	XMFLOAT4X4 View;
+	XMFLOAT4X4 Projection;
+	XMFLOAT3 CameraPosition;
+	unsigned int ScreenWidth;		// Size drawn at, the back buffer's times the scale
+	unsigned int ScreenHeight;
+	float ResolutionScale;
+
+	// Entities that survived culling
+	std::vector<RenderItem> Items;
+
+	LightSnapshot Lights;
+
+	// Cascades of the first directional light and what casts
+	// into each, none when shadows are off
+	unsigned int ShadowCascadeCount;
+	ShadowCascade ShadowCascades[SHADOW_MAX_CASCADES];
+	std::vector<RenderItem> ShadowCasters[SHADOW_MAX_CASCADES];
+
+	RenderSnapshot() : Frame(0), TotalTime(0.0f), Interpolation(0.0f), ScreenWidth(0), ScreenHeight(0), ResolutionScale(1.0f), ShadowCascadeCount(0) { }
+};
@@ -1,74 +1,557 @@
 #include "Renderer.h"
-#include "Game.h"
+#include "ShaderConstants.h"
+#include "JobSystem.h"
+#include <algorithm>
 
 
 Renderer::Renderer()
 {
+	viewCuller = new ViewCuller();
+	staticBatcher = new StaticBatcher();
+	occlusionCuller = new OcclusionCuller();
+	occlusionCullingEnabled = true;
+	shadowCascades = new ShadowCascadeFitter();
+	shadowsEnabled = true;
+	lightClusterer = new LightClusterer();
+	device = nullptr;
+	recorder = nullptr;
+	constantBufferRing = nullptr;
+	frameFence = nullptr;
+	depthShader = nullptr;
+	ZeroMemory(&depthPassStats, sizeof(DepthPassStats));
+	pipelineStates = nullptr;
+	commandQueue = new CommandQueue();
+	commandBackend = nullptr;
 }
 
 
 Renderer::~Renderer()
 {
+	delete viewCuller;
+	delete staticBatcher;
+	delete occlusionCuller;
+	delete shadowCascades;
+	delete lightClusterer;
+	delete recorder;
+	delete constantBufferRing;
+	delete frameFence;
+	delete pipelineStates;
+	delete commandQueue;
+	delete commandBackend;
 }
 
-void Renderer::DrawEntity(Entity* entity, ID3D11DeviceContext*	context)
+void Renderer::Init(ID3D11Device * device)
 {
-	// Set buffers in the input assembler
-	//  - Do this ONCE PER OBJECT you're drawing, since each object might
-	//    have different geometry.
-	UINT stride = sizeof(Vertex);
-	UINT offset = 0;
+	this->device = device;
+	lightClusterer->Init(device);
 
-	ID3D11Buffer* vPointer = nullptr;
+	// The device keeps its own reference to the immediate context
+	ID3D11DeviceContext* context = nullptr;
+	device->GetImmediateContext(&context);
+	constantBufferRing = new ConstantBufferRing(device, context);
+	frameFence = new FrameFence(device, context);
+	pipelineStates = new PipelineStateCache(device, context);
+	commandBackend = new D3D11CommandBackend(context, pipelineStates);
+	context->Release();
+}
+
+void Renderer::CullEntities(std::vector<Entity*>& entities, RenderSnapshot& snapshot)
+{
+	snapshot.Items.clear();
+
+	// Camera matrices are stored transposed for HLSL
+	XMMATRIX viewProj =
+		XMMatrixTranspose(XMLoadFloat4x4(&snapshot.View)) *
+		XMMatrixTranspose(XMLoadFloat4x4(&snapshot.Projection));
+
+	// Every view is tested in one pass over the bounds, the
+	// camera is view 0.  Batched static entities are culled as
+	// pieces of their batches, after the other entities.
+	bool batched = staticBatcher->GetPieceCount() > 0;
+	viewCuller->Clear();
+	unsigned int cameraView = viewCuller->AddFrustum(viewProj);
+
+	// The cascades' receiver and caster volumes go through the
+	// same pass, after the camera
+	bool shadows = shadowsEnabled && !snapshot.Lights.DirectionalLights.empty();
+	snapshot.ShadowCascadeCount = 0;
+	for (unsigned int c = 0; c < SHADOW_MAX_CASCADES; c++)
+		snapshot.ShadowCasters[c].clear();
+	if (shadows)
+	{
+		shadowCascades->Fit(snapshot.View, snapshot.Projection, snapshot.Lights.DirectionalLights[0].Direction);
+		shadowCascades->AddViews(*viewCuller);
+	}
+	culledEntities.clear();
+	for (unsigned int i = 0; i < entities.size(); i++)
+	{
+		if (batched && entities[i]->IsStatic())
+			continue;
+
+		XMFLOAT3 boundsMin, boundsMax;
+		entities[i]->GetWorldBounds(boundsMin, boundsMax);
+		viewCuller->AddObject(boundsMin, boundsMax);
+		culledEntities.push_back(i);
+	}
+
+	unsigned int firstPiece = viewCuller->GetObjectCount();
+	for (unsigned int b = 0; b < staticBatcher->GetBatchCount(); b++)
+	{
+		const StaticBatch& batch = staticBatcher->GetBatch(b);
+		for (size_t p = 0; p < batch.Pieces.size(); p++)
+			viewCuller->AddObject(batch.Pieces[p].BoundsMin, batch.Pieces[p].BoundsMax);
+	}
+	viewCuller->Cull();
+
+	if (shadows)
+	{
+		shadowCascades->SelectCasters(*viewCuller, cameraView);
+		snapshot.ShadowCascadeCount = shadowCascades->GetCascadeCount();
+		for (unsigned int c = 0; c < snapshot.ShadowCascadeCount; c++)
+			snapshot.ShadowCascades[c] = shadowCascades->GetCascade(c);
+
+		// Occluded from the camera doesn't mean unlit, so casters
+		// skip the occlusion test
+		for (unsigned int o = 0; o < culledEntities.size(); o++)
+		{
+			unsigned int mask = shadowCascades->GetCasterMask(o);
+			for (unsigned int c = 0; mask != 0; c++, mask >>= 1)
+			{
+				if (mask & 1)
+					AddItem(entities[culledEntities[o]], snapshot, snapshot.ShadowCasters[c]);
+			}
+		}
+
+		// Before the camera's ranges, so the batcher's stats are
+		// the camera's
+		for (unsigned int c = 0; c < snapshot.ShadowCascadeCount; c++)
+		{
+			staticBatcher->AddVisibleRanges([&](unsigned int index, const StaticBatchPiece& piece)
+			{
+				return (shadowCascades->GetCasterMask(firstPiece + index) & (1u << c)) != 0;
+			}, snapshot.ShadowCasters[c]);
+		}
+	}
+
+	if (occlusionCullingEnabled)
+	{
+		occlusionCuller->BeginFrame(viewProj);
+
+		// Fill the depth buffer with the selected occluders first,
+		// batched ones are left to the rasterizer's clipping.
+		// Occluders go where they're drawn, so nothing is hidden
+		// by where one will be at the end of the step.
+		for (unsigned int i = 0; i < entities.size(); i++)
+		{
+			if (batched && entities[i]->IsStatic() && entities[i]->IsOccluder())
+				occlusionCuller->RasterizeOccluder(entities[i]->GetMesh(), entities[i]->GetInterpolatedWorldMatrixCPU(snapshot.Interpolation));
+		}
+		for (unsigned int c = 0; c < culledEntities.size(); c++)
+		{
+			Entity* entity = entities[culledEntities[c]];
+			if (entity->IsOccluder() && viewCuller->IsVisible(c, cameraView))
+				occlusionCuller->RasterizeOccluder(entity->GetMesh(), entity->GetInterpolatedWorldMatrixCPU(snapshot.Interpolation));
+		}
+	}
+
+	// Then test everything else in the frustum against it
+	for (unsigned int c = 0; c < culledEntities.size(); c++)
+	{
+		if (!viewCuller->IsVisible(c, cameraView))
+			continue;
+
+		Entity* entity = entities[culledEntities[c]];
+		if (occlusionCullingEnabled && !entity->IsOccluder())
+		{
+			XMFLOAT3 boundsMin, boundsMax;
+			entity->GetWorldBounds(boundsMin, boundsMax);
+			if (!occlusionCuller->IsVisible(boundsMin, boundsMax))
+				continue;
+		}
+
+		AddItem(entity, snapshot, snapshot.Items);
+	}
+
+	// Runs of visible pieces become one draw each
+	staticBatcher->AddVisibleRanges([&](unsigned int index, const StaticBatchPiece& piece)
+	{
+		if (!viewCuller->IsVisible(firstPiece + index, cameraView))
+			return false;
+		return !occlusionCullingEnabled || occlusionCuller->IsVisible(piece.BoundsMin, piece.BoundsMax);
+	}, snapshot.Items);
+
+	if (occlusionCullingEnabled)
+		occlusionCuller->EndFrame();
+}
+
+void Renderer::AddItem(Entity * entity, const RenderSnapshot & snapshot, std::vector<RenderItem>& items)
+{
+	RenderItem item;
+	item.MeshObj = entity->GetMesh();
+	item.MaterialObj = entity->GetMaterial();
+	item.World = entity->GetInterpolatedWorldMatrix(snapshot.Interpolation);
+
+	// Dynamic meshes are looked up when recording, after their upload
+	if (item.MeshObj->IsDynamic())
+	{
+		item.VertexBuffer = nullptr;
+		item.AttributeBuffer = nullptr;
+		item.IndexBuffer = nullptr;
+		item.IndexCount = 0;
+		item.StartIndex = 0;
+		item.BaseVertex = 0;
+		items.push_back(item);
+		return;
+	}
+
+	item.VertexBuffer = item.MeshObj->GetVertexBuffer();
+	item.AttributeBuffer = item.MeshObj->GetAttributeBuffer();
+	item.IndexBuffer = item.MeshObj->GetIndexBuffer();
+	item.IndexCount = item.MeshObj->GetIndexCount();
+	item.StartIndex = item.MeshObj->GetStartIndex();
+	item.BaseVertex = item.MeshObj->GetBaseVertex();
+	items.push_back(item);
+}
+
+void Renderer::SetShadowsEnabled(bool enabled)
+{
+	shadowsEnabled = enabled;
+}
+
+const ShadowCascadeStats & Renderer::GetShadowCascadeStats() const
+{
+	return shadowCascades->GetStats();
+}
+
+void Renderer::SetOcclusionCullingEnabled(bool enabled)
+{
+	occlusionCullingEnabled = enabled;
+}
+
+bool Renderer::BuildStaticBatches(ID3D11Device * device, std::vector<Entity*>& entities)
+{
+	return staticBatcher->Build(device, entities);
+}
+
+const StaticBatchStats & Renderer::GetStaticBatchStats() const
+{
+	return staticBatcher->GetStats();
+}
+
+std::string Renderer::DescribeStaticBatches() const
+{
+	return staticBatcher->Describe();
+}
+
+const ViewCullingStats & Renderer::GetViewCullingStats() const
+{
+	return viewCuller->GetStats();
+}
+
+const OcclusionStats & Renderer::GetOcclusionStats() const
+{
+	return occlusionCuller->GetStats();
+}
+
+const ClusterStats & Renderer::GetClusterStats() const
+{
+	return lightClusterer->GetStats();
+}
+
+void Renderer::SetMaxLights(unsigned int count)
+{
+	lightClusterer->SetMaxLights(count);
+}
+
+const ConstantBufferStats & Renderer::GetConstantBufferStats() const
+{
+	return constantBufferRing->GetStats();
+}
+
+const PipelineStateStats & Renderer::GetPipelineStateStats() const
+{
+	return pipelineStates->GetStats();
+}
+
+const CommandQueueStats & Renderer::GetCommandQueueStats() const
+{
+	return commandQueue->GetStats();
+}
+
+unsigned int Renderer::GetGeometryBinds() const
+{
+	return commandBackend ? commandBackend->VertexBufferBinds + commandBackend->IndexBufferBinds : 0;
+}
+
+const InstancingStats & Renderer::GetInstancingStats() const
+{
+	return commandBackend->Instancing;
+}
+
+const DynamicMeshStats & Renderer::GetDynamicMeshStats() const
+{
+	return DynamicMesh::GetFrameStats();
+}
+
+void Renderer::SetDepthShader(SimpleVertexShader * shader)
+{
+	depthShader = shader;
+}
+
+const DepthPassStats & Renderer::GetDepthPassStats() const
+{
+	return depthPassStats;
+}
+
+void Renderer::CaptureNextFrame(const std::string & path)
+{
+	capturePath = path;
+}
+
+// --------------------------------------------------------
+// Sets the per-frame pixel shader data (camera, lights and
+// cluster lookup) the first time a shader is used this frame
+// and binds the light buffers.  Nothing here changes per entity.
+// --------------------------------------------------------
+void Renderer::PreparePixelShader(SimplePixelShader * pixelShader, const RenderSnapshot& snapshot, LightManager * lightManager)
+{
+	lightManager->BindResources(pixelShader);
+	lightClusterer->BindResources(pixelShader);
+
+	if (std::find(preparedPixelShaders.begin(), preparedPixelShaders.end(), pixelShader) != preparedPixelShaders.end())
+		return;
+
+	PixelShaderExternalData constants;
+	constants.cameraPosition = snapshot.CameraPosition;
+	constants.directionalLightCount = (unsigned int)snapshot.Lights.DirectionalLights.size();
+	constants.clusterParams = lightClusterer->GetClusterParams();
+	pixelShader->SetConstants(constants);
+	pixelShader->CopyAllBufferData();
+	preparedPixelShaders.push_back(pixelShader);
+
+	if (!capturePath.empty())
+		recorder->RecordConstants(pixelShader, DS_STAGE_PIXEL);
+}
+
+// --------------------------------------------------------
+// Runs on the simulation side, so everything the render side
+// needs from the entities is copied here
+// --------------------------------------------------------
+void Renderer::Extract(std::vector<Entity*>& entities, LightManager * lightManager, RenderSnapshot & snapshot)
+{
+	// Lights first, the shadow cascades follow the sun
+	lightManager->Extract(snapshot.Lights);
+	CullEntities(entities, snapshot);
+}
 
-	vPointer = entity->GetMesh()->GetVertexBuffer();
-	context->IASetVertexBuffers(0, 1, &vPointer, &stride, &offset);
-	context->IASetIndexBuffer(entity->GetMesh()->GetIndexBuffer(), DXGI_FORMAT_R32_UINT, 0);
+static void RefreshItemGeometry(std::vector<RenderItem>& items)
+{
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		RenderItem& item = items[i];
+		if (!item.MeshObj || item.MeshObj->IsDynamic())
+			continue;
+		item.VertexBuffer = item.MeshObj->GetVertexBuffer();
+		item.AttributeBuffer = item.MeshObj->GetAttributeBuffer();
+		item.IndexBuffer = item.MeshObj->GetIndexBuffer();
+		item.StartIndex = item.MeshObj->GetStartIndex();
+		item.BaseVertex = item.MeshObj->GetBaseVertex();
+	}
+}
 
-	context->DrawIndexed(
-		entity->GetMesh()->GetIndexCount(),     // The number of indices to use (we could draw a subset if we wanted)
-		0,     // Offset to the first index we want to use
-		0);    // Offset to add to each index when looking up vertices
+void Renderer::RefreshGeometry(RenderSnapshot & snapshot)
+{
+	RefreshItemGeometry(snapshot.Items);
+	for (unsigned int i = 0; i < snapshot.ShadowCascadeCount; i++)
+		RefreshItemGeometry(snapshot.ShadowCasters[i]);
 }
 
-void Renderer::Draw(std::vector<Entity*> entities, ID3D11DeviceContext * context, XMFLOAT4X4& viewMatrix, XMFLOAT4X4& projectionMatrix, DirectionalLight* dirLights, PointLight* pointLights)
+// --------------------------------------------------------
+// Runs on worker threads: only reads the snapshot, materials
+// and meshes.  Packets sort by pipeline state, then material,
+// then extraction order.
+// --------------------------------------------------------
+void Renderer::RecordItems(const RenderSnapshot & snapshot, unsigned int begin, unsigned int end, CommandBuffer & buffer)
 {
-	for (std::vector<Entity*>::iterator it = entities.begin(); it != entities.end(); ++it)
+	for (unsigned int i = begin; i < end; i++)
 	{
-		(*it)->PrepareMaterial(viewMatrix, projectionMatrix);
+		const RenderItem& item = snapshot.Items[i];
+		const PipelineState* state = item.MaterialObj->GetPipelineState();
+
+		DrawPacket* packet = buffer.AddDraw();
+		packet->SortKey = MakeDrawSortKey(state ? state->GetId() : 0xffff, item.MaterialObj->GetBindGroup(),
+			item.MeshObj ? item.MeshObj->GetId() : 0xfff, i);
+		packet->State = state;
+		packet->MaterialObj = item.MaterialObj;
+		packet->View = &mainView;
+		packet->VertexStride = item.AttributeBuffer ? sizeof(VertexPosition) : sizeof(Vertex);
+		packet->World = item.World;
+
+		// Uploaded on the render thread before recording started
+		if (item.MeshObj && item.MeshObj->IsDynamic())
+		{
+			packet->VertexBuffer = item.MeshObj->GetVertexBuffer();
+			packet->AttributeBuffer = nullptr;
+			packet->IndexBuffer = item.MeshObj->GetIndexBuffer();
+			packet->IndexCount = item.MeshObj->GetIndexCount();
+			packet->StartIndex = item.MeshObj->GetStartIndex();
+			packet->BaseVertex = item.MeshObj->GetBaseVertex();
+			continue;
+		}
+
+		packet->VertexBuffer = item.VertexBuffer;
+		packet->AttributeBuffer = item.AttributeBuffer;
+		packet->IndexBuffer = item.IndexBuffer;
+		packet->IndexCount = item.IndexCount;
+		packet->StartIndex = item.StartIndex;
+		packet->BaseVertex = item.BaseVertex;
+	}
+}
 
-		// Once you've set all of the data you care to change for
-		// the next draw call, you need to actually send it to the GPU
-		//  - If you skip this, the "SetMatrix" calls above won't make it to the GPU!
-		(*it)->GetMaterial()->GetVertexShader()->CopyAllBufferData();
+// --------------------------------------------------------
+// Every dynamic mesh in the snapshot uploads once, however
+// many items draw it
+// --------------------------------------------------------
+void Renderer::UploadDynamicMeshes(const RenderSnapshot & snapshot, ID3D11DeviceContext * context)
+{
+	DynamicMesh::ResetFrameStats();
+	for (size_t i = 0; i < snapshot.Items.size(); i++)
+	{
+		Mesh* mesh = snapshot.Items[i].MeshObj;
+		if (mesh && mesh->IsDynamic())
+			static_cast<DynamicMesh*>(mesh)->Upload(context, frameFence);
+	}
+}
 
-		(*it)->GetMaterial()->GetPixelShader()->SetData(
-			"light",  // The name of the (eventual) variable in the shader
-			&dirLights[0],   // The address of the data to copy
-			sizeof(DirectionalLight)); // The size of the data to copy
+// --------------------------------------------------------
+// Draws every item with the depth shader alone.  Split stream
+// meshes bind only their position stream; the rest read whole
+// interleaved vertices through the same layout.  The states
+// are D3D11's defaults, the scene pass binds its own after.
+// --------------------------------------------------------
+void Renderer::DrawDepth(const RenderSnapshot & snapshot, ID3D11DeviceContext * context)
+{
+	ZeroMemory(&depthPassStats, sizeof(DepthPassStats));
+	if (!depthShader)
+		return;
 
-		(*it)->GetMaterial()->GetPixelShader()->SetData(
-			"light2",  // The name of the (eventual) variable in the shader
-			&dirLights[1],   // The address of the data to copy
-			sizeof(DirectionalLight)); // The size of the data to copy
+	depthShader->SetShader();
+	context->PSSetShader(nullptr, nullptr, 0);
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->OMSetBlendState(nullptr, nullptr, 0xffffffff);
+	context->OMSetDepthStencilState(nullptr, 0);
+	context->RSSetState(nullptr);
 
-		(*it)->GetMaterial()->GetPixelShader()->SetData(
-			"pointLight",  // The name of the (eventual) variable in the shader
-			&pointLights[0],   // The address of the data to copy
-			sizeof(PointLight)); // The size of the data to copy
+	DepthVertexShaderExternalData constants;
+	constants.view = snapshot.View;
+	constants.projection = snapshot.Projection;
 
-		(*it)->GetMaterial()->GetPixelShader()->SetFloat3("cameraPosition", Game::Instance()->GetCameraPostion());
+	ID3D11Buffer* boundVertexBuffer = nullptr;
+	ID3D11Buffer* boundIndexBuffer = nullptr;
+	for (size_t i = 0; i < snapshot.Items.size(); i++)
+	{
+		const RenderItem& item = snapshot.Items[i];
+		ID3D11Buffer* vertexBuffer = item.VertexBuffer;
+		ID3D11Buffer* indexBuffer = item.IndexBuffer;
+		unsigned int indexCount = item.IndexCount;
+		unsigned int startIndex = item.StartIndex;
+		int baseVertex = item.BaseVertex;
+		if (item.MeshObj && item.MeshObj->IsDynamic())
+		{
+			vertexBuffer = item.MeshObj->GetVertexBuffer();
+			indexBuffer = item.MeshObj->GetIndexBuffer();
+			indexCount = item.MeshObj->GetIndexCount();
+			startIndex = item.MeshObj->GetStartIndex();
+			baseVertex = item.MeshObj->GetBaseVertex();
+		}
+		if (!vertexBuffer || !indexBuffer || indexCount == 0)
+			continue;
 
-		(*it)->GetMaterial()->GetPixelShader()->CopyAllBufferData();
+		UINT stride = item.AttributeBuffer ? sizeof(VertexPosition) : sizeof(Vertex);
+		if (vertexBuffer != boundVertexBuffer)
+		{
+			boundVertexBuffer = vertexBuffer;
+			UINT offset = 0;
+			context->IASetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+		}
+		if (indexBuffer != boundIndexBuffer)
+		{
+			boundIndexBuffer = indexBuffer;
+			context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+		}
 
-		// Set the vertex and pixel shaders to use for the next Draw() command
-		//  - These don't technically need to be set every frame...YET
-		//  - Once you start applying different shaders to different objects,
-		//    you'll need to swap the current shaders before each draw
-		(*it)->GetMaterial()->GetVertexShader()->SetShader();
-		(*it)->GetMaterial()->GetPixelShader()->SetShader();
+		constants.world = item.World;
+		depthShader->SetConstants(constants);
+		depthShader->CopyAllBufferData();
+		depthShader->SetConstantBuffers();
+		context->DrawIndexed(indexCount, startIndex, baseVertex);
 
-		DrawEntity(*it, context);
+		depthPassStats.Draws++;
+		if (item.AttributeBuffer)
+			depthPassStats.SplitDraws++;
+		depthPassStats.FetchBytes += indexCount * stride;
+		depthPassStats.InterleavedBytes += indexCount * sizeof(Vertex);
+	}
+}
+
+void Renderer::Draw(const RenderSnapshot& snapshot, ID3D11DeviceContext * context, LightManager* lightManager)
+{
+	constantBufferRing->BeginFrame();
+	ISimpleShader::ResetUploadStats();
+
+	// Other passes set state directly, so bind everything again
+	pipelineStates->ResetStats();
+	pipelineStates->Invalidate();
+
+	// Upload the changed lights, then bin them, once for the whole frame
+	lightManager->Upload(context, snapshot.Lights);
+	lightClusterer->Update(
+		context, snapshot.View, snapshot.Projection,
+		snapshot.ScreenWidth, snapshot.ScreenHeight,
+		snapshot.Lights.PointLights, snapshot.Lights.SpotLights);
+
+	preparedPixelShaders.clear();
+
+	UploadDynamicMeshes(snapshot, context);
+	DrawDepth(snapshot, context);
+
+	if (!capturePath.empty())
+	{
+		if (!recorder)
+			recorder = new DrawStreamRecorder(device, context);
+		recorder->Begin();
+	}
+
+	// Record the packets across the job system, a few hundred
+	// draws per slice, then translate them on this thread
+	mainView.View = snapshot.View;
+	mainView.Projection = snapshot.Projection;
+
+	unsigned int itemCount = (unsigned int)snapshot.Items.size();
+	unsigned int sliceCount = (itemCount + 255) / 256;
+	unsigned int threadCount = JobSystem::Instance() ? JobSystem::Instance()->GetThreadCount() : 1;
+	if (sliceCount > threadCount)
+		sliceCount = threadCount;
+
+	commandQueue->Record(itemCount, sliceCount, [&](unsigned int begin, unsigned int end, CommandBuffer& buffer)
+	{
+		RecordItems(snapshot, begin, end, buffer);
+	});
+
+	commandBackend->PixelShaderChanged = [&](SimplePixelShader* pixelShader)
+	{
+		PreparePixelShader(pixelShader, snapshot, lightManager);
+	};
+	commandBackend->SetRecorder(capturePath.empty() ? nullptr : recorder);
+	commandQueue->Submit(commandBackend);
+	commandBackend->PixelShaderChanged = nullptr;
+
+	if (!capturePath.empty())
+	{
+		recorder->Save(capturePath);
+		capturePath.clear();
 	}
 
+	constantBufferRing->EndFrame();
+	frameFence->EndFrame();
 }
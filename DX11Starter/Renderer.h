@@ -3,15 +3,160 @@
 #include "Entity.h"
 #include <vector>
 #include "Lights.h"
+#include "ViewCuller.h"
+#include "StaticBatch.h"
+#include "OcclusionCuller.h"
+#include "LightClusterer.h"
+#include "LightManager.h"
+#include "DrawStream.h"
+#include "ConstantBufferRing.h"
+#include "FrameFence.h"
+#include "DynamicMesh.h"
+#include "PipelineState.h"
+#include "CommandBuffer.h"
+#include "RenderSnapshot.h"
+
+// --------------------------------------------------------
+// Depth prepass draws of the last frame.  Bytes count one
+// vertex fetch per index, ignoring the post-transform cache.
+// --------------------------------------------------------
+struct DepthPassStats
+{
+	unsigned int Draws;
+	unsigned int SplitDraws;		// Read only the 12 byte position stream
+	unsigned int FetchBytes;		// Vertex bytes the pass read
+	unsigned int InterleavedBytes;	// What it would read if every mesh were interleaved
+};
 
 class Renderer
 {
 private:
-	void DrawEntity(Entity* entity, ID3D11DeviceContext* context);
+	// Frustum culling of every view, before occlusion
+	ViewCuller* viewCuller;
+	std::vector<unsigned int> culledEntities;	// Entity index of each culled object
+
+	// Static entities merged per material
+	StaticBatcher* staticBatcher;
+
+	// Software occlusion culling stage
+	OcclusionCuller* occlusionCuller;
+	bool occlusionCullingEnabled;
+
+	// Cascades of the first directional light, culled in the
+	// same pass as the camera
+	ShadowCascadeFitter* shadowCascades;
+	bool shadowsEnabled;
+
+	// Adds the entities that survive culling to the snapshot
+	void CullEntities(std::vector<Entity*>& entities, RenderSnapshot& snapshot);
+	void AddItem(Entity* entity, const RenderSnapshot& snapshot, std::vector<RenderItem>& items);
+
+	// Bins point and spot lights for clustered shading
+	LightClusterer* lightClusterer;
+
+	// Pixel shaders whose per-frame data is already set this frame
+	std::vector<SimplePixelShader*> preparedPixelShaders;
+
+	void PreparePixelShader(SimplePixelShader* pixelShader, const RenderSnapshot& snapshot, LightManager* lightManager);
+
+	// Draw stream capture of the next frame, if one was requested
+	ID3D11Device* device;
+	DrawStreamRecorder* recorder;
+	std::string capturePath;
+
+	// Per-frame constant buffer memory for every SimpleShader
+	ConstantBufferRing* constantBufferRing;
+
+	// When the GPU is done with a frame, for dynamic meshes
+	FrameFence* frameFence;
+
+	// Writes what changed in the snapshot's dynamic meshes
+	void UploadDynamicMeshes(const RenderSnapshot& snapshot, ID3D11DeviceContext* context);
+
+	// Position-only pass filling the depth buffer before the
+	// scene pass, which then only shades the nearest surface
+	SimpleVertexShader* depthShader;
+	DepthPassStats depthPassStats;
+	void DrawDepth(const RenderSnapshot& snapshot, ID3D11DeviceContext* context);
+
+	// Shared pipeline states of every material
+	PipelineStateCache* pipelineStates;
+
+	// Draw packets, recorded in parallel and submitted in sort order
+	CommandQueue* commandQueue;
+	D3D11CommandBackend* commandBackend;
+	DrawView mainView;
+
+	// Records the draw packets of items [begin, end)
+	void RecordItems(const RenderSnapshot& snapshot, unsigned int begin, unsigned int end, CommandBuffer& buffer);
 
 public:
 	Renderer();
 	~Renderer();
-	void Draw(std::vector<Entity*> entities, ID3D11DeviceContext* context, XMFLOAT4X4& viewMatrix, XMFLOAT4X4& projectionMatrix, DirectionalLight* dirLights, PointLight* pointLights);
+
+	// Creates GPU resources, call once DirectX is initialized
+	void Init(ID3D11Device* device);
+
+	// Simulation side: culls the entities and copies what's visible and
+	// the lights into the snapshot.  The camera fields and the
+	// interpolation must already be set.
+	void Extract(std::vector<Entity*>& entities, LightManager* lightManager, RenderSnapshot& snapshot);
+
+	// Looks the geometry of an extracted snapshot up again, after
+	// GeometryHeap::Compact() has moved it
+	void RefreshGeometry(RenderSnapshot& snapshot);
+
+	// Render side: submits a snapshot, touching no entity or camera state
+	void Draw(const RenderSnapshot& snapshot, ID3D11DeviceContext* context, LightManager* lightManager);
+
+	// Merges the entities flagged static, which are then drawn
+	// as ranges of their batches instead of one by one
+	bool BuildStaticBatches(ID3D11Device* device, std::vector<Entity*>& entities);
+	const StaticBatchStats& GetStaticBatchStats() const;
+	std::string DescribeStaticBatches() const;
+
+	// Frustum culling of the last extracted frame
+	const ViewCullingStats& GetViewCullingStats() const;
+
+	// Shadow cascade fitting and caster culling.  Extract() fills
+	// the snapshot's cascades and caster lists when enabled.
+	void SetShadowsEnabled(bool enabled);
+	const ShadowCascadeStats& GetShadowCascadeStats() const;
+
+	// Occlusion culling controls
+	void SetOcclusionCullingEnabled(bool enabled);
+	const OcclusionStats& GetOcclusionStats() const;
+
+	// Light binning stats
+	const ClusterStats& GetClusterStats() const;
+
+	// Shades only the count point and spot lights nearest the camera
+	void SetMaxLights(unsigned int count);
+
+	// Constant buffer upload stats of the last frame
+	const ConstantBufferStats& GetConstantBufferStats() const;
+
+	// Pipeline state binds of the last frame
+	const PipelineStateStats& GetPipelineStateStats() const;
+
+	// Draw packet recording and submission of the last frame
+	const CommandQueueStats& GetCommandQueueStats() const;
+
+	// Vertex and index buffer binds of the last frame
+	unsigned int GetGeometryBinds() const;
+
+	// Draw calls and material binds of the last frame
+	const InstancingStats& GetInstancingStats() const;
+
+	// Dynamic mesh uploads of the last frame
+	const DynamicMeshStats& GetDynamicMeshStats() const;
+
+	// Vertex shader of the depth prepass, reading only POSITION.
+	// Null skips the prepass.
+	void SetDepthShader(SimpleVertexShader* shader);
+	const DepthPassStats& GetDepthPassStats() const;
+
+	// Records everything the next frame submits into a capture file
+	void CaptureNextFrame(const std::string& path);
 };
 
@@ -0,0 +1,67 @@
+#include "RingAllocator.h"
+
+RingAllocator::RingAllocator(unsigned int capacity, unsigned int alignment)
+{
+	this->capacity = capacity;
+	this->alignment = alignment;
+	head = 0;
+	used = 0;
+	frameBytes = 0;
+	nextFrameId = 1;
+}
+
+// --------------------------------------------------------
+// Allocations never straddle the end of the ring: if the
+// range doesn't fit before the end, the rest of the ring is
+// skipped (and counted as used) and it starts over at zero
+// --------------------------------------------------------
+unsigned int RingAllocator::Allocate(unsigned int size)
+{
+	unsigned int alignedSize = (size + alignment - 1) & ~(alignment - 1);
+	if (alignedSize == 0 || alignedSize > capacity)
+		return INVALID_OFFSET;
+
+	// The free space is the used range's complement, starting at head
+	unsigned int free = capacity - used;
+	unsigned int untilEnd = capacity - head;
+
+	unsigned int padding = 0;
+	if (alignedSize > untilEnd)
+		padding = untilEnd;
+
+	if (padding + alignedSize > free)
+		return INVALID_OFFSET;
+
+	unsigned int offset = padding > 0 ? 0 : head;
+	head = offset + alignedSize;
+	if (head == capacity)
+		head = 0;
+
+	used += padding + alignedSize;
+	frameBytes += padding + alignedSize;
+	return offset;
+}
+
+unsigned long long RingAllocator::EndFrame()
+{
+	Frame frame;
+	frame.Id = nextFrameId++;
+	frame.Bytes = frameBytes;
+	frames.push_back(frame);
+
+	frameBytes = 0;
+	return frame.Id;
+}
+
+void RingAllocator::Retire(unsigned long long frameId)
+{
+	while (!frames.empty() && frames.front().Id <= frameId)
+	{
+		used -= frames.front().Bytes;
+		frames.pop_front();
+	}
+
+	// Empty ring, start over so the next frame doesn't wrap
+	if (used == 0)
+		head = 0;
+}
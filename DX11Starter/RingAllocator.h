@@ -0,0 +1,64 @@
+#pragma once
+#include <deque>
+
+// --------------------------------------------------------
+// Frame paced ring allocator
+//
+// Hands out aligned ranges of a fixed size ring.  Every frame's
+// allocations are tagged with a frame id when the frame ends,
+// and stay in use until that frame is retired (i.e. the GPU is
+// known to be done with it).  Allocation fails rather than
+// overwriting memory of a frame that's still in flight.
+//
+// Pure bookkeeping, it never touches the memory itself, so it
+// can be tested without a device.
+// --------------------------------------------------------
+class RingAllocator
+{
+public:
+	static const unsigned int INVALID_OFFSET = 0xffffffff;
+
+	// capacity - Size of the ring in bytes
+	// alignment - Every allocation starts on a multiple of this (power of two)
+	RingAllocator(unsigned int capacity, unsigned int alignment);
+
+	// Returns the offset of size free bytes, or INVALID_OFFSET if
+	// the ring is full of in-flight frames
+	unsigned int Allocate(unsigned int size);
+
+	// Closes the current frame's allocations and returns its id
+	unsigned long long EndFrame();
+
+	// Frees every frame with an id up to and including frameId
+	void Retire(unsigned long long frameId);
+
+	// Oldest frame still holding memory (only valid with frames in flight)
+	unsigned long long GetOldestFrame() const { return frames.front().Id; }
+	bool HasFramesInFlight() const { return !frames.empty(); }
+
+	// Id the current (open) frame will get from EndFrame
+	unsigned long long GetCurrentFrame() const { return nextFrameId; }
+
+	unsigned int GetCapacity() const { return capacity; }
+	unsigned int GetUsed() const { return used; }
+
+	// Bytes allocated in the open frame, including alignment and wrap padding
+	unsigned int GetFrameBytes() const { return frameBytes; }
+
+private:
+	struct Frame
+	{
+		unsigned long long Id;
+		unsigned int Bytes;		// Everything the frame holds, padding included
+	};
+
+	unsigned int capacity;
+	unsigned int alignment;
+
+	unsigned int head;		// Next free byte
+	unsigned int used;		// Bytes held by closed and open frames
+
+	unsigned int frameBytes;
+	unsigned long long nextFrameId;
+	std::deque<Frame> frames;
+};
@@ -0,0 +1,83 @@
+#pragma once
+// Generated by GenerateShaderConstants.py from VertexShader.hlsl, PixelShader.hlsl, DepthVertexShader.hlsl, UpscalePixelShader.hlsl - do not edit
+#include <stddef.h>
+#include <DirectXMath.h>
+#include "SimpleShader.h"
+
+// --------------------------------------------------------
+// Constant buffers of the default shader permutations, laid
+// out like HLSL packs them.  Fill one and upload it with
+// ISimpleShader::SetConstants().
+// --------------------------------------------------------
+
+// cbuffer externalData : register(b0)
+struct VertexShaderExternalData
+{
+	static const unsigned int NameHash = SHADER_NAME("externalData");
+	static const unsigned int Register = 0;
+
+	DirectX::XMFLOAT4X4 world;
+	DirectX::XMFLOAT4X4 view;
+	DirectX::XMFLOAT4X4 projection;
+};
+static_assert(sizeof(VertexShaderExternalData) == 192, "externalData size differs from HLSL packing");
+static_assert(offsetof(VertexShaderExternalData, world) == 0, "externalData.world offset differs from HLSL packing");
+static_assert(offsetof(VertexShaderExternalData, view) == 64, "externalData.view offset differs from HLSL packing");
+static_assert(offsetof(VertexShaderExternalData, projection) == 128, "externalData.projection offset differs from HLSL packing");
+
+// cbuffer ExternalData : register(b0)
+struct PixelShaderExternalData
+{
+	static const unsigned int NameHash = SHADER_NAME("ExternalData");
+	static const unsigned int Register = 0;
+
+	DirectX::XMFLOAT3 cameraPosition;
+	unsigned int directionalLightCount;
+	DirectX::XMFLOAT4 clusterParams;
+};
+static_assert(sizeof(PixelShaderExternalData) == 32, "ExternalData size differs from HLSL packing");
+static_assert(offsetof(PixelShaderExternalData, cameraPosition) == 0, "ExternalData.cameraPosition offset differs from HLSL packing");
+static_assert(offsetof(PixelShaderExternalData, directionalLightCount) == 12, "ExternalData.directionalLightCount offset differs from HLSL packing");
+static_assert(offsetof(PixelShaderExternalData, clusterParams) == 16, "ExternalData.clusterParams offset differs from HLSL packing");
+
+// cbuffer MaterialConstants : register(b1)
+struct PixelShaderMaterialConstants
+{
+	static const unsigned int NameHash = SHADER_NAME("MaterialConstants");
+	static const unsigned int Register = 1;
+
+	DirectX::XMFLOAT4 tint;
+	float specularPower;
+	unsigned char padding0[12];
+};
+static_assert(sizeof(PixelShaderMaterialConstants) == 32, "MaterialConstants size differs from HLSL packing");
+static_assert(offsetof(PixelShaderMaterialConstants, tint) == 0, "MaterialConstants.tint offset differs from HLSL packing");
+static_assert(offsetof(PixelShaderMaterialConstants, specularPower) == 16, "MaterialConstants.specularPower offset differs from HLSL packing");
+
+// cbuffer externalData : register(b0)
+struct DepthVertexShaderExternalData
+{
+	static const unsigned int NameHash = SHADER_NAME("externalData");
+	static const unsigned int Register = 0;
+
+	DirectX::XMFLOAT4X4 world;
+	DirectX::XMFLOAT4X4 view;
+	DirectX::XMFLOAT4X4 projection;
+};
+static_assert(sizeof(DepthVertexShaderExternalData) == 192, "externalData size differs from HLSL packing");
+static_assert(offsetof(DepthVertexShaderExternalData, world) == 0, "externalData.world offset differs from HLSL packing");
+static_assert(offsetof(DepthVertexShaderExternalData, view) == 64, "externalData.view offset differs from HLSL packing");
+static_assert(offsetof(DepthVertexShaderExternalData, projection) == 128, "externalData.projection offset differs from HLSL packing");
+
+// cbuffer externalData : register(b0)
+struct UpscalePixelShaderExternalData
+{
+	static const unsigned int NameHash = SHADER_NAME("externalData");
+	static const unsigned int Register = 0;
+
+	DirectX::XMFLOAT2 uvScale;
+	DirectX::XMFLOAT2 uvMax;
+};
+static_assert(sizeof(UpscalePixelShaderExternalData) == 16, "externalData size differs from HLSL packing");
+static_assert(offsetof(UpscalePixelShaderExternalData, uvScale) == 0, "externalData.uvScale offset differs from HLSL packing");
+static_assert(offsetof(UpscalePixelShaderExternalData, uvMax) == 8, "externalData.uvMax offset differs from HLSL packing");
@@ -0,0 +1,240 @@
+#include "ShaderPermutations.h"
+#include "ShaderReflection.h"
+#include "JobSystem.h"
+#include <fstream>
+#include <sstream>
+
+// Define names of the ShaderFeature bits, in bit order
+static const char* featureDefines[SHADER_FEATURE_COUNT] =
+{
+	"ALPHA_TEST",
+	"INSTANCING",
+	"DIRECTIONAL_ONLY",
+	"TEXTURE_ARRAY"
+};
+
+static const char* stageTargets[] =
+{
+	"vs_5_0",
+	"ps_5_0"
+};
+
+#if defined(DEBUG) || defined(_DEBUG)
+static const UINT compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#else
+static const UINT compileFlags = D3DCOMPILE_OPTIMIZATION_LEVEL3;
+#endif
+
+ShaderPermutationLibrary::ShaderPermutationLibrary(ID3D11Device * device, ID3D11DeviceContext * context, const std::wstring & cacheDirectory)
+{
+	this->device = device;
+	this->context = context;
+	this->cacheDirectory = cacheDirectory;
+	ZeroMemory(&stats, sizeof(ShaderPermutationStats));
+}
+
+ShaderPermutationLibrary::~ShaderPermutationLibrary()
+{
+	ReleaseVariants();
+}
+
+unsigned int ShaderPermutationLibrary::AddProgram(const std::wstring & sourceFile, ShaderProgramStage stage, unsigned int featureMask)
+{
+	Program program;
+	program.SourceFile = sourceFile;
+	program.Stage = stage;
+	program.FeatureMask = featureMask & ((1 << SHADER_FEATURE_COUNT) - 1);
+	program.Variants.resize(1 << SHADER_FEATURE_COUNT, nullptr);
+	programs.push_back(program);
+	return (unsigned int)programs.size() - 1;
+}
+
+// --------------------------------------------------------
+// Reads every source once, then preprocesses and compiles all
+// variants across the job system.  Shader creation needs the
+// results in order and is cheap, so it stays on this thread.
+// --------------------------------------------------------
+bool ShaderPermutationLibrary::Build()
+{
+	__int64 perfFreq, start, end;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	ReleaseVariants();
+	ZeroMemory(&stats, sizeof(ShaderPermutationStats));
+	CreateDirectoryW(cacheDirectory.c_str(), NULL);
+
+	std::vector<std::string> sources(programs.size());
+	for (size_t p = 0; p < programs.size(); p++)
+	{
+		std::ifstream in(programs[p].SourceFile, std::ios::binary);
+		if (!in.is_open())
+			return false;
+
+		std::stringstream contents;
+		contents << in.rdbuf();
+		sources[p] = contents.str();
+	}
+
+	// Every subset of each program's feature mask
+	std::vector<BuildItem> items;
+	for (size_t p = 0; p < programs.size(); p++)
+	{
+		unsigned int mask = programs[p].FeatureMask;
+		unsigned int features = mask;
+		while (true)
+		{
+			BuildItem item = { (unsigned int)p, features, std::wstring(), nullptr, false, false };
+			items.push_back(item);
+			if (features == 0)
+				break;
+			features = (features - 1) & mask;
+		}
+	}
+
+	JobSystem* jobs = JobSystem::Instance();
+	if (jobs)
+	{
+		jobs->ParallelFor((unsigned int)items.size(), 1, [&](unsigned int begin, unsigned int end)
+		{
+			for (unsigned int i = begin; i < end; i++)
+				BuildVariant(items[i], sources[items[i].ProgramIndex]);
+		});
+	}
+	else
+	{
+		for (size_t i = 0; i < items.size(); i++)
+			BuildVariant(items[i], sources[items[i].ProgramIndex]);
+	}
+
+	// Create the shaders, loading from the cache file when there
+	// is one so the reflection cache next to it is used too
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		BuildItem& item = items[i];
+		stats.Variants++;
+		if (!item.Bytecode)
+		{
+			stats.Failed++;
+			continue;
+		}
+
+		if (item.CacheHit) stats.CacheHits++;
+		else stats.Compiled++;
+
+		ISimpleShader* shader;
+		if (programs[item.ProgramIndex].Stage == SHADER_PROGRAM_VERTEX)
+			shader = new SimpleVertexShader(device, context);
+		else
+			shader = new SimplePixelShader(device, context);
+
+		bool loaded = item.Written ?
+			shader->LoadShaderFile(item.CacheFile.c_str()) :
+			shader->LoadShaderBlob(item.Bytecode->GetBufferPointer(), item.Bytecode->GetBufferSize());
+		item.Bytecode->Release();
+
+		if (!loaded)
+		{
+			delete shader;
+			stats.Failed++;
+			continue;
+		}
+
+		programs[item.ProgramIndex].Variants[item.Features] = shader;
+	}
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.BuildMs = (float)((end - start) * 1000.0 / perfFreq);
+	return stats.Failed == 0;
+}
+
+// --------------------------------------------------------
+// Preprocesses one variant to find its content key, then
+// either loads the cached bytecode or compiles and stores it.
+// Runs on worker threads and only touches its own item.
+// --------------------------------------------------------
+void ShaderPermutationLibrary::BuildVariant(BuildItem & item, const std::string & source)
+{
+	const Program& program = programs[item.ProgramIndex];
+	std::string sourceName(program.SourceFile.begin(), program.SourceFile.end());
+	const char* target = stageTargets[program.Stage];
+
+	D3D_SHADER_MACRO macros[SHADER_FEATURE_COUNT + 1];
+	unsigned int macroCount = 0;
+	for (unsigned int f = 0; f < SHADER_FEATURE_COUNT; f++)
+	{
+		if (item.Features & (1 << f))
+		{
+			macros[macroCount].Name = featureDefines[f];
+			macros[macroCount].Definition = "1";
+			macroCount++;
+		}
+	}
+	macros[macroCount].Name = NULL;
+	macros[macroCount].Definition = NULL;
+
+	// The preprocessed text has every include and define applied,
+	// so it changes exactly when this variant's code does
+	ID3DBlob* preprocessed = nullptr;
+	ID3DBlob* errors = nullptr;
+	HRESULT hr = D3DPreprocess(source.c_str(), source.size(), sourceName.c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE, &preprocessed, &errors);
+	if (errors) { OutputDebugStringA((const char*)errors->GetBufferPointer()); errors->Release(); }
+	if (FAILED(hr))
+		return;
+
+	std::ostringstream settings;
+	settings << target << '|' << compileFlags << '|';
+	std::string key = settings.str();
+	key.append((const char*)preprocessed->GetBufferPointer(), preprocessed->GetBufferSize());
+	preprocessed->Release();
+
+	wchar_t keyName[32];
+	swprintf_s(keyName, L"%016llx.cso", HashShaderBlob(key.data(), key.size()));
+	item.CacheFile = cacheDirectory + L"/" + keyName;
+
+	if (SUCCEEDED(D3DReadFileToBlob(item.CacheFile.c_str(), &item.Bytecode)))
+	{
+		item.CacheHit = true;
+		item.Written = true;
+		return;
+	}
+
+	hr = D3DCompile(source.c_str(), source.size(), sourceName.c_str(), macros, D3D_COMPILE_STANDARD_FILE_INCLUDE,
+		"main", target, compileFlags, 0, &item.Bytecode, &errors);
+	if (errors) { OutputDebugStringA((const char*)errors->GetBufferPointer()); errors->Release(); }
+	if (FAILED(hr))
+	{
+		item.Bytecode = nullptr;
+		return;
+	}
+
+	item.Written = SUCCEEDED(D3DWriteBlobToFile(item.Bytecode, item.CacheFile.c_str(), TRUE));
+}
+
+SimpleVertexShader * ShaderPermutationLibrary::GetVertexShader(unsigned int program, unsigned int features) const
+{
+	if (program >= programs.size() || programs[program].Stage != SHADER_PROGRAM_VERTEX)
+		return nullptr;
+
+	return (SimpleVertexShader*)programs[program].Variants[features & programs[program].FeatureMask];
+}
+
+SimplePixelShader * ShaderPermutationLibrary::GetPixelShader(unsigned int program, unsigned int features) const
+{
+	if (program >= programs.size() || programs[program].Stage != SHADER_PROGRAM_PIXEL)
+		return nullptr;
+
+	return (SimplePixelShader*)programs[program].Variants[features & programs[program].FeatureMask];
+}
+
+void ShaderPermutationLibrary::ReleaseVariants()
+{
+	for (size_t p = 0; p < programs.size(); p++)
+	{
+		for (size_t v = 0; v < programs[p].Variants.size(); v++)
+		{
+			delete programs[p].Variants[v];
+			programs[p].Variants[v] = nullptr;
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include "SimpleShader.h"
+
+// --------------------------------------------------------
+// Features a shader variant can be compiled with.  Each bit
+// is passed to the HLSL as a #define of the same name (minus
+// the SHADER_FEATURE_ prefix) set to 1.
+// --------------------------------------------------------
+enum ShaderFeature
+{
+	SHADER_FEATURE_ALPHA_TEST		= 1 << 0,	// Clips texels with alpha below one half
+	SHADER_FEATURE_INSTANCING		= 1 << 1,	// World matrix from a per-instance vertex stream
+	SHADER_FEATURE_DIRECTIONAL_ONLY	= 1 << 2,	// No clustered point and spot lights
+	SHADER_FEATURE_TEXTURE_ARRAY	= 1 << 3,	// Diffuse texture is a slice of an array, picked per instance
+	SHADER_FEATURE_COUNT			= 4
+};
+
+enum ShaderProgramStage
+{
+	SHADER_PROGRAM_VERTEX,
+	SHADER_PROGRAM_PIXEL
+};
+
+// --------------------------------------------------------
+// Results of the last Build()
+// --------------------------------------------------------
+struct ShaderPermutationStats
+{
+	unsigned int Variants;
+	unsigned int CacheHits;
+	unsigned int Compiled;
+	unsigned int Failed;
+	float BuildMs;
+};
+
+// --------------------------------------------------------
+// Compiles every feature combination of a set of HLSL files
+//
+// Each variant is preprocessed with its defines and the
+// preprocessed text (with all includes expanded) is hashed,
+// together with the target and compile flags, into a content
+// key.  Compiled code is stored in the cache directory under
+// that key, so after an edit only the variants whose
+// preprocessed source actually changed are compiled again.
+// Variants are preprocessed and compiled in parallel on the
+// JobSystem; the shader objects are created afterwards on the
+// calling thread.
+//
+// Variants are looked up by feature bits, which index a flat
+// table per program.
+// --------------------------------------------------------
+class ShaderPermutationLibrary
+{
+public:
+	ShaderPermutationLibrary(ID3D11Device* device, ID3D11DeviceContext* context, const std::wstring& cacheDirectory);
+	~ShaderPermutationLibrary();
+
+	// Registers an HLSL file (entry point "main") and the
+	// ShaderFeature bits it reacts to, returns the program id
+	unsigned int AddProgram(const std::wstring& sourceFile, ShaderProgramStage stage, unsigned int featureMask);
+
+	// Compiles, or loads from the cache, every variant of every
+	// program.  Returns false if a source is missing or a variant
+	// fails to compile.
+	bool Build();
+
+	// The variant with the given features.  Bits the program
+	// doesn't react to are ignored.
+	SimpleVertexShader* GetVertexShader(unsigned int program, unsigned int features) const;
+	SimplePixelShader* GetPixelShader(unsigned int program, unsigned int features) const;
+
+	const ShaderPermutationStats& GetStats() const { return stats; }
+
+private:
+	struct Program
+	{
+		std::wstring SourceFile;
+		ShaderProgramStage Stage;
+		unsigned int FeatureMask;
+		std::vector<ISimpleShader*> Variants;	// Indexed by features & FeatureMask
+	};
+
+	// One variant being built
+	struct BuildItem
+	{
+		unsigned int ProgramIndex;
+		unsigned int Features;
+		std::wstring CacheFile;
+		ID3DBlob* Bytecode;
+		bool CacheHit;
+		bool Written;
+	};
+
+	ID3D11Device* device;
+	ID3D11DeviceContext* context;
+	std::wstring cacheDirectory;
+	std::vector<Program> programs;
+	ShaderPermutationStats stats;
+
+	void BuildVariant(BuildItem& item, const std::string& source);
+	void ReleaseVariants();
+};
@@ -0,0 +1,332 @@
+#include "ShaderReflection.h"
+#include "SimpleShader.h"
+#include <algorithm>
+#include <fstream>
+
+static ShaderReflectionStats reflectionStats = {};
+
+// Appends a name to the string block and returns its offset
+static unsigned int AddString(std::vector<char>& strings, const char* text)
+{
+	unsigned int offset = (unsigned int)strings.size();
+	strings.insert(strings.end(), text, text + strlen(text) + 1);
+	return offset;
+}
+
+static void FillSignature(ShaderReflectionData::Signature& element, const D3D11_SIGNATURE_PARAMETER_DESC& paramDesc, std::vector<char>& strings)
+{
+	element.SemanticNameOffset = AddString(strings, paramDesc.SemanticName);
+	element.SemanticIndex = paramDesc.SemanticIndex;
+	element.ComponentType = paramDesc.ComponentType;
+	element.Mask = paramDesc.Mask;
+	element.Stream = paramDesc.Stream;
+}
+
+// Copies count elements out of the file, advancing offset
+template<typename T>
+static bool ReadArray(const std::vector<char>& file, size_t& offset, unsigned int count, std::vector<T>& result)
+{
+	size_t bytes = (size_t)count * sizeof(T);
+	if (offset + bytes > file.size())
+		return false;
+
+	result.resize(count);
+	if (bytes > 0)
+		memcpy(&result[0], &file[offset], bytes);
+	offset += bytes;
+	return true;
+}
+
+// --------------------------------------------------------
+// SimpleShader finds names by hash alone, so two names of one
+// table with the same hash would be confused.  Names are only
+// known when reflecting; cache files are checked for repeated
+// hashes instead.
+// --------------------------------------------------------
+static bool CheckNameHashes(std::vector<std::pair<unsigned int, std::string>>& names)
+{
+	std::sort(names.begin(), names.end());
+	for (size_t i = 1; i < names.size(); i++)
+	{
+		if (names[i].first != names[i - 1].first)
+			continue;
+
+		std::string message = "Shader names '" + names[i - 1].second + "' and '" + names[i].second + "' have the same hash\n";
+		OutputDebugStringA(message.c_str());
+		return false;
+	}
+	return true;
+}
+
+template<typename T>
+static bool HashesUnique(const std::vector<T>& entries)
+{
+	std::vector<unsigned int> hashes(entries.size());
+	for (size_t i = 0; i < entries.size(); i++)
+		hashes[i] = entries[i].NameHash;
+
+	std::sort(hashes.begin(), hashes.end());
+	return std::adjacent_find(hashes.begin(), hashes.end()) == hashes.end();
+}
+
+template<typename T>
+static void WriteArray(std::ofstream& out, const std::vector<T>& data)
+{
+	if (!data.empty())
+		out.write((const char*)&data[0], data.size() * sizeof(T));
+}
+
+void ShaderReflectionData::Clear()
+{
+	ConstantBuffers.clear();
+	Variables.clear();
+	Resources.clear();
+	Inputs.clear();
+	Outputs.clear();
+	Strings.clear();
+	ThreadGroupSize[0] = ThreadGroupSize[1] = ThreadGroupSize[2] = 0;
+	ThreadsTotal = 0;
+}
+
+unsigned long long HashShaderBlob(const void * bytecode, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)bytecode;
+	unsigned long long hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+// --------------------------------------------------------
+// Walks the shader's bound resources, constant buffers and
+// signatures once and keeps what SimpleShader uses
+// --------------------------------------------------------
+bool ReflectShader(const void * bytecode, size_t size, ShaderReflectionData & data)
+{
+	data.Clear();
+
+	ID3D11ShaderReflection* refl;
+	HRESULT hr = D3DReflect(bytecode, size, IID_ID3D11ShaderReflection, (void**)&refl);
+	if (FAILED(hr))
+		return false;
+
+	D3D11_SHADER_DESC shaderDesc;
+	refl->GetDesc(&shaderDesc);
+
+	std::vector<std::pair<unsigned int, std::string>> resourceNames;
+	std::vector<std::pair<unsigned int, std::string>> variableNames;
+
+	for (unsigned int r = 0; r < shaderDesc.BoundResources; r++)
+	{
+		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
+		refl->GetResourceBindingDesc(r, &resourceDesc);
+
+		ShaderReflectionData::Resource resource;
+		resource.NameHash = HashShaderName(resourceDesc.Name);
+		resourceNames.push_back(std::make_pair(resource.NameHash, std::string(resourceDesc.Name)));
+		resource.Type = resourceDesc.Type;
+		resource.BindIndex = resourceDesc.BindPoint;
+		data.Resources.push_back(resource);
+	}
+
+	for (unsigned int b = 0; b < shaderDesc.ConstantBuffers; b++)
+	{
+		ID3D11ShaderReflectionConstantBuffer* cb = refl->GetConstantBufferByIndex(b);
+
+		D3D11_SHADER_BUFFER_DESC bufferDesc;
+		cb->GetDesc(&bufferDesc);
+
+		D3D11_SHADER_INPUT_BIND_DESC bindDesc;
+		refl->GetResourceBindingDescByName(bufferDesc.Name, &bindDesc);
+
+		ShaderReflectionData::ConstantBuffer buffer;
+		buffer.NameOffset = AddString(data.Strings, bufferDesc.Name);
+		buffer.NameHash = HashShaderName(bufferDesc.Name);
+		buffer.BindIndex = bindDesc.BindPoint;
+		buffer.Size = bufferDesc.Size;
+		buffer.FirstVariable = (unsigned int)data.Variables.size();
+		buffer.VariableCount = bufferDesc.Variables;
+		data.ConstantBuffers.push_back(buffer);
+
+		for (unsigned int v = 0; v < bufferDesc.Variables; v++)
+		{
+			D3D11_SHADER_VARIABLE_DESC varDesc;
+			cb->GetVariableByIndex(v)->GetDesc(&varDesc);
+
+			ShaderReflectionData::Variable variable;
+			variable.NameHash = HashShaderName(varDesc.Name);
+			variableNames.push_back(std::make_pair(variable.NameHash, std::string(varDesc.Name)));
+			variable.ByteOffset = varDesc.StartOffset;
+			variable.Size = varDesc.Size;
+			data.Variables.push_back(variable);
+		}
+	}
+
+	for (unsigned int i = 0; i < shaderDesc.InputParameters; i++)
+	{
+		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
+		refl->GetInputParameterDesc(i, &paramDesc);
+
+		ShaderReflectionData::Signature element;
+		FillSignature(element, paramDesc, data.Strings);
+		data.Inputs.push_back(element);
+	}
+
+	for (unsigned int i = 0; i < shaderDesc.OutputParameters; i++)
+	{
+		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
+		refl->GetOutputParameterDesc(i, &paramDesc);
+
+		ShaderReflectionData::Signature element;
+		FillSignature(element, paramDesc, data.Strings);
+		data.Outputs.push_back(element);
+	}
+
+	data.ThreadsTotal = refl->GetThreadGroupSize(
+		&data.ThreadGroupSize[0],
+		&data.ThreadGroupSize[1],
+		&data.ThreadGroupSize[2]);
+
+	refl->Release();
+	return CheckNameHashes(resourceNames) && CheckNameHashes(variableNames);
+}
+
+// --------------------------------------------------------
+// Reads the whole file and checks every table fits in it
+// before copying them out
+// --------------------------------------------------------
+bool LoadShaderReflection(const std::wstring & path, unsigned long long blobHash, ShaderReflectionData & data)
+{
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in.is_open())
+		return false;
+
+	size_t size = (size_t)in.tellg();
+	if (size < sizeof(ShaderReflectionHeader))
+		return false;
+
+	std::vector<char> file(size);
+	in.seekg(0);
+	in.read(&file[0], size);
+	if (!in.good())
+		return false;
+
+	ShaderReflectionHeader header;
+	memcpy(&header, &file[0], sizeof(ShaderReflectionHeader));
+	if (header.Magic != SHADER_REFLECTION_MAGIC ||
+		header.Version != SHADER_REFLECTION_VERSION ||
+		header.BlobHash != blobHash)
+		return false;
+
+	size_t offset = sizeof(ShaderReflectionHeader);
+	if (!ReadArray(file, offset, header.ConstantBufferCount, data.ConstantBuffers) ||
+		!ReadArray(file, offset, header.VariableCount, data.Variables) ||
+		!ReadArray(file, offset, header.ResourceCount, data.Resources) ||
+		!ReadArray(file, offset, header.InputCount, data.Inputs) ||
+		!ReadArray(file, offset, header.OutputCount, data.Outputs) ||
+		!ReadArray(file, offset, header.StringBytes, data.Strings))
+		return false;
+
+	// Names must be terminated inside the block
+	if (!data.Strings.empty() && data.Strings.back() != 0)
+		return false;
+
+	for (size_t i = 0; i < data.ConstantBuffers.size(); i++)
+	{
+		// Subtracted rather than added, so a huge count can't wrap
+		const ShaderReflectionData::ConstantBuffer& cb = data.ConstantBuffers[i];
+		if (cb.NameOffset >= header.StringBytes ||
+			cb.VariableCount > header.VariableCount ||
+			cb.FirstVariable > header.VariableCount - cb.VariableCount)
+			return false;
+
+		// Variables are copied into the buffer's local data
+		for (unsigned int v = 0; v < cb.VariableCount; v++)
+		{
+			const ShaderReflectionData::Variable& variable = data.Variables[cb.FirstVariable + v];
+			if (variable.Size > cb.Size || variable.ByteOffset > cb.Size - variable.Size)
+				return false;
+		}
+	}
+
+	// Lookups would be ambiguous; reflecting again reports the names
+	if (!HashesUnique(data.Variables) || !HashesUnique(data.Resources))
+		return false;
+
+	for (size_t i = 0; i < data.Inputs.size(); i++)
+		if (data.Inputs[i].SemanticNameOffset >= header.StringBytes) return false;
+
+	for (size_t i = 0; i < data.Outputs.size(); i++)
+		if (data.Outputs[i].SemanticNameOffset >= header.StringBytes) return false;
+
+	memcpy(data.ThreadGroupSize, header.ThreadGroupSize, sizeof(header.ThreadGroupSize));
+	data.ThreadsTotal = header.ThreadsTotal;
+	return true;
+}
+
+bool SaveShaderReflection(const std::wstring & path, unsigned long long blobHash, const ShaderReflectionData & data)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out.is_open())
+		return false;
+
+	ShaderReflectionHeader header;
+	header.Magic = SHADER_REFLECTION_MAGIC;
+	header.Version = SHADER_REFLECTION_VERSION;
+	header.BlobHash = blobHash;
+	header.ConstantBufferCount = (unsigned int)data.ConstantBuffers.size();
+	header.VariableCount = (unsigned int)data.Variables.size();
+	header.ResourceCount = (unsigned int)data.Resources.size();
+	header.InputCount = (unsigned int)data.Inputs.size();
+	header.OutputCount = (unsigned int)data.Outputs.size();
+	header.StringBytes = (unsigned int)data.Strings.size();
+	memcpy(header.ThreadGroupSize, data.ThreadGroupSize, sizeof(header.ThreadGroupSize));
+	header.ThreadsTotal = data.ThreadsTotal;
+	out.write((const char*)&header, sizeof(header));
+
+	WriteArray(out, data.ConstantBuffers);
+	WriteArray(out, data.Variables);
+	WriteArray(out, data.Resources);
+	WriteArray(out, data.Inputs);
+	WriteArray(out, data.Outputs);
+	WriteArray(out, data.Strings);
+	return out.good();
+}
+
+// --------------------------------------------------------
+// A missing or stale cache is rebuilt in place.  Failing to
+// write it (e.g. a read-only install) only costs the next
+// startup another reflection pass.
+// --------------------------------------------------------
+bool LoadOrReflectShader(const std::wstring & shaderFile, const void * bytecode, size_t size, ShaderReflectionData & data)
+{
+	__int64 perfFreq, start, end;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	std::wstring cacheFile = shaderFile + L".refl";
+	unsigned long long blobHash = HashShaderBlob(bytecode, size);
+
+	bool loaded = LoadShaderReflection(cacheFile, blobHash, data);
+	if (loaded)
+	{
+		reflectionStats.CacheHits++;
+	}
+	else
+	{
+		if (!ReflectShader(bytecode, size, data))
+			return false;
+
+		SaveShaderReflection(cacheFile, blobHash, data);
+		reflectionStats.Reflected++;
+	}
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	reflectionStats.ReflectionMs += (float)((end - start) * 1000.0 / perfFreq);
+	return true;
+}
+
+const ShaderReflectionStats & GetShaderReflectionStats()
+{
+	return reflectionStats;
+}
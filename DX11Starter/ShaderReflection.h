@@ -0,0 +1,120 @@
+#pragma once
+#include <d3d11.h>
+#include <string>
+#include <vector>
+
+// --------------------------------------------------------
+// Shader reflection cache
+//
+// Everything SimpleShader needs from D3DReflect, flattened into
+// a few arrays.  Names are kept once in a string block and
+// referenced by offset, next to their SHADER_NAME hash.  The
+// data is saved next to each .cso (PixelShader.cso.refl) and
+// reused while the hash of the bytecode still matches, so a
+// load is one file read instead of a reflection pass.
+//
+// File layout:
+//   ShaderReflectionHeader
+//   ConstantBufferCount x ShaderReflectionData::ConstantBuffer
+//   VariableCount       x ShaderReflectionData::Variable
+//   ResourceCount       x ShaderReflectionData::Resource
+//   InputCount          x ShaderReflectionData::Signature
+//   OutputCount         x ShaderReflectionData::Signature
+//   StringBytes of names
+// --------------------------------------------------------
+
+#define SHADER_REFLECTION_MAGIC 0x31465253	// "SRF1"
+#define SHADER_REFLECTION_VERSION 1
+
+struct ShaderReflectionData
+{
+	struct ConstantBuffer
+	{
+		unsigned int NameOffset;
+		unsigned int NameHash;
+		unsigned int BindIndex;
+		unsigned int Size;
+		unsigned int FirstVariable;		// Variables of a buffer are contiguous
+		unsigned int VariableCount;
+	};
+
+	struct Variable
+	{
+		unsigned int NameHash;
+		unsigned int ByteOffset;
+		unsigned int Size;
+	};
+
+	struct Resource
+	{
+		unsigned int NameHash;
+		unsigned int Type;				// D3D_SHADER_INPUT_TYPE
+		unsigned int BindIndex;
+	};
+
+	// Input or output signature element
+	struct Signature
+	{
+		unsigned int SemanticNameOffset;
+		unsigned int SemanticIndex;
+		unsigned int ComponentType;		// D3D_REGISTER_COMPONENT_TYPE
+		unsigned int Mask;
+		unsigned int Stream;
+	};
+
+	std::vector<ConstantBuffer> ConstantBuffers;
+	std::vector<Variable> Variables;
+	std::vector<Resource> Resources;
+	std::vector<Signature> Inputs;
+	std::vector<Signature> Outputs;
+	std::vector<char> Strings;
+
+	// Compute shaders only
+	unsigned int ThreadGroupSize[3];
+	unsigned int ThreadsTotal;
+
+	const char* GetString(unsigned int offset) const { return &Strings[offset]; }
+	void Clear();
+};
+
+struct ShaderReflectionHeader
+{
+	unsigned int Magic;
+	unsigned int Version;
+	unsigned long long BlobHash;
+	unsigned int ConstantBufferCount;
+	unsigned int VariableCount;
+	unsigned int ResourceCount;
+	unsigned int InputCount;
+	unsigned int OutputCount;
+	unsigned int StringBytes;
+	unsigned int ThreadGroupSize[3];
+	unsigned int ThreadsTotal;
+};
+
+// --------------------------------------------------------
+// Shader loads since startup, and the time spent getting
+// their reflection data
+// --------------------------------------------------------
+struct ShaderReflectionStats
+{
+	unsigned int CacheHits;
+	unsigned int Reflected;
+	float ReflectionMs;
+};
+
+// Key of a shader's cache file (64 bit FNV-1a of the bytecode)
+unsigned long long HashShaderBlob(const void* bytecode, size_t size);
+
+// Runs D3DReflect and flattens the results
+bool ReflectShader(const void* bytecode, size_t size, ShaderReflectionData& data);
+
+// Reads a cache file; fails if it's missing, corrupt or for other bytecode
+bool LoadShaderReflection(const std::wstring& path, unsigned long long blobHash, ShaderReflectionData& data);
+bool SaveShaderReflection(const std::wstring& path, unsigned long long blobHash, const ShaderReflectionData& data);
+
+// Reflection of a compiled shader file, from its cache when
+// valid, otherwise reflected and written to the cache
+bool LoadOrReflectShader(const std::wstring& shaderFile, const void* bytecode, size_t size, ShaderReflectionData& data);
+
+const ShaderReflectionStats& GetShaderReflectionStats();
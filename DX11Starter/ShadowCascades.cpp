@@ -0,0 +1,438 @@
+#include "ShadowCascades.h"
+#include <Windows.h>
+#include <math.h>
+#include <cfloat>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+void ShadowCascadeSettings::SetDefaults()
+{
+	CascadeCount = 4;
+	SplitLambda = 0.75f;
+	MaxDistance = 100.0f;
+	ShadowMapSize = 2048;
+}
+
+ShadowCascadeFitter::ShadowCascadeFitter()
+{
+	settings.SetDefaults();
+	cascadeCount = 0;
+	ZeroMemory(cascades, sizeof(cascades));
+	ZeroMemory(volumes, sizeof(volumes));
+	ZeroMemory(&stats, sizeof(ShadowCascadeStats));
+	lightRight = XMFLOAT3(1.0f, 0.0f, 0.0f);
+	lightUp = XMFLOAT3(0.0f, 1.0f, 0.0f);
+	lightForward = XMFLOAT3(0.0f, 0.0f, 1.0f);
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+}
+
+void ShadowCascadeFitter::Fit(const XMFLOAT4X4 & viewMatrix, const XMFLOAT4X4 & projectionMatrix, const XMFLOAT3 & lightDirection)
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	// Camera matrices are stored transposed for HLSL
+	XMMATRIX view = XMMatrixTranspose(XMLoadFloat4x4(&viewMatrix));
+	XMFLOAT4X4 p;
+	XMStoreFloat4x4(&p, XMMatrixTranspose(XMLoadFloat4x4(&projectionMatrix)));
+
+	// Recover the clip planes from a left handed perspective matrix
+	float xScale = p._11;
+	float yScale = p._22;
+	float nearZ = -p._43 / p._33;
+	float farZ = min(p._43 / (1.0f - p._33), settings.MaxDistance);
+
+	cascadeCount = min(settings.CascadeCount, SHADOW_MAX_CASCADES);
+	stats.Cascades = cascadeCount;
+
+	// Light space axes, as XMMatrixLookToLH makes them
+	XMVECTOR forward = XMVector3Normalize(XMLoadFloat3(&lightDirection));
+	XMVECTOR up = fabsf(XMVectorGetY(forward)) > 0.99f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+	XMVECTOR right = XMVector3Normalize(XMVector3Cross(up, forward));
+	up = XMVector3Cross(forward, right);
+	XMStoreFloat3(&lightRight, right);
+	XMStoreFloat3(&lightUp, up);
+	XMStoreFloat3(&lightForward, forward);
+	XMMATRIX lightView = XMMatrixLookToLH(XMVectorZero(), forward, up);
+
+	XMMATRIX inverseView = XMMatrixInverse(nullptr, view);
+	float fovY = 2.0f * atanf(1.0f / yScale);
+	float aspect = yScale / xScale;
+	float size = (float)settings.ShadowMapSize;
+
+	float splitNear = nearZ;
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		// Practical split scheme: logarithmic splits match the
+		// perspective's texel density, uniform ones keep the
+		// near cascades from getting too thin
+		float fraction = (float)(c + 1) / cascadeCount;
+		float logSplit = nearZ * powf(farZ / nearZ, fraction);
+		float uniformSplit = nearZ + (farZ - nearZ) * fraction;
+		float splitFar = settings.SplitLambda * logSplit + (1.0f - settings.SplitLambda) * uniformSplit;
+
+		// Smallest sphere around the slice with its centre on the
+		// view axis.  It depends only on the depths and the
+		// projection, so turning the camera never resizes it.
+		float nearSq = splitNear * splitNear * (1.0f / (xScale * xScale) + 1.0f / (yScale * yScale));
+		float farSq = splitFar * splitFar * (1.0f / (xScale * xScale) + 1.0f / (yScale * yScale));
+		float centerZ = (splitFar * splitFar + farSq - splitNear * splitNear - nearSq) / (2.0f * (splitFar - splitNear));
+		centerZ = min(max(centerZ, splitNear), splitFar);
+		float radius = sqrtf(farSq + (splitFar - centerZ) * (splitFar - centerZ));
+
+		// Rounded up, so float noise can't change the size either
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		// One texel of border on each side keeps the sphere
+		// covered once the box is snapped
+		float texel = 2.0f * radius / (size - 2.0f);
+		float half = texel * size * 0.5f;
+
+		XMFLOAT3 center;
+		XMStoreFloat3(&center, XMVector3Transform(XMVector3Transform(XMVectorSet(0.0f, 0.0f, centerZ, 1.0f), inverseView), lightView));
+		float snappedX = floorf(center.x / texel + 0.5f) * texel;
+		float snappedY = floorf(center.y / texel + 0.5f) * texel;
+
+		Volume& volume = volumes[c];
+		volume.MinX = snappedX - half;
+		volume.MaxX = snappedX + half;
+		volume.MinY = snappedY - half;
+		volume.MaxY = snappedY + half;
+		volume.MinZ = center.z - radius;
+		volume.MaxZ = center.z + radius;
+
+		XMMATRIX sliceProjection = XMMatrixPerspectiveFovLH(fovY, aspect, splitNear, splitFar);
+		ViewCuller::ExtractFrustumPlanes(view * sliceProjection, volume.SlicePlanes);
+
+		// Casters lie between the slice and the light.  The box's
+		// sides and far end bound them, and so does every slice
+		// plane whose inside the light travels into, since moving
+		// a point towards the light can't take it out through one.
+		XMFLOAT4 boxPlanes[5] =
+		{
+			XMFLOAT4(lightRight.x, lightRight.y, lightRight.z, -volume.MinX),
+			XMFLOAT4(-lightRight.x, -lightRight.y, -lightRight.z, volume.MaxX),
+			XMFLOAT4(lightUp.x, lightUp.y, lightUp.z, -volume.MinY),
+			XMFLOAT4(-lightUp.x, -lightUp.y, -lightUp.z, volume.MaxY),
+			XMFLOAT4(-lightForward.x, -lightForward.y, -lightForward.z, volume.MaxZ)
+		};
+		volume.CasterPlaneCount = 0;
+		for (unsigned int i = 0; i < 5; i++)
+			volume.CasterPlanes[volume.CasterPlaneCount++] = boxPlanes[i];
+		for (unsigned int i = 0; i < 6; i++)
+		{
+			const XMFLOAT4& plane = volume.SlicePlanes[i];
+			if (plane.x * lightForward.x + plane.y * lightForward.y + plane.z * lightForward.z <= 0.0f)
+				volume.CasterPlanes[volume.CasterPlaneCount++] = plane;
+		}
+		volume.ReceiverView = ViewCuller::MAX_VIEWS;
+		volume.CasterView = ViewCuller::MAX_VIEWS;
+
+		ShadowCascade& cascade = cascades[c];
+		cascade.SplitNear = splitNear;
+		cascade.SplitFar = splitFar;
+		cascade.TexelSize = texel;
+		cascade.LightOrigin = XMFLOAT2(volume.MinX, volume.MinY);
+		XMStoreFloat4x4(&cascade.View, XMMatrixTranspose(lightView));
+		XMStoreFloat4x4(&cascade.Projection, XMMatrixTranspose(
+			XMMatrixOrthographicOffCenterLH(volume.MinX, volume.MaxX, volume.MinY, volume.MaxY, volume.MinZ, volume.MaxZ)));
+
+		splitNear = splitFar;
+	}
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.FitMs = (float)((end - start) * perfCounterSeconds * 1000.0);
+}
+
+void ShadowCascadeFitter::AddViews(ViewCuller & culler)
+{
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		volumes[c].ReceiverView = culler.AddView(volumes[c].SlicePlanes, 6);
+		volumes[c].CasterView = culler.AddView(volumes[c].CasterPlanes, volumes[c].CasterPlaneCount);
+	}
+}
+
+unsigned int ShadowCascadeFitter::GetCasterPlanes(unsigned int cascade, XMFLOAT4 * planes) const
+{
+	const Volume& volume = volumes[cascade];
+	for (unsigned int i = 0; i < volume.CasterPlaneCount; i++)
+		planes[i] = volume.CasterPlanes[i];
+	return volume.CasterPlaneCount;
+}
+
+// --------------------------------------------------------
+// The extruded volume only knows the slice.  A candidate
+// whose shadow can't land on anything visible is dropped:
+// it must overlap the light space box of the slice's visible
+// receivers across the light, and start before the farthest
+// of them along it.
+// --------------------------------------------------------
+void ShadowCascadeFitter::SelectCasters(const ViewCuller & culler, unsigned int cameraView)
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	unsigned int objectCount = culler.GetObjectCount();
+	casterMasks.assign(objectCount, 0);
+	lightBounds.resize(objectCount * 6);
+
+	// Views the culler had no room for see nothing
+	unsigned int receiverBit[SHADOW_MAX_CASCADES], casterBit[SHADOW_MAX_CASCADES];
+	unsigned int receiverBits = 0, casterBits = 0;
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		stats.Receivers[c] = stats.Candidates[c] = stats.Casters[c] = 0;
+		bool added = volumes[c].ReceiverView < ViewCuller::MAX_VIEWS && volumes[c].CasterView < ViewCuller::MAX_VIEWS;
+		receiverBit[c] = added ? 1u << volumes[c].ReceiverView : 0;
+		casterBit[c] = added ? 1u << volumes[c].CasterView : 0;
+		receiverBits |= receiverBit[c];
+		casterBits |= casterBit[c];
+	}
+	unsigned int cameraBit = cameraView < ViewCuller::MAX_VIEWS ? 1u << cameraView : 0;
+
+	float receiverBounds[SHADOW_MAX_CASCADES][5];		// Min x, max x, min y, max y, max z
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		receiverBounds[c][0] = receiverBounds[c][2] = FLT_MAX;
+		receiverBounds[c][1] = receiverBounds[c][3] = receiverBounds[c][4] = -FLT_MAX;
+	}
+
+	// Light space boxes of everything that matters to a cascade
+	for (unsigned int i = 0; i < objectCount; i++)
+	{
+		unsigned int mask = culler.GetVisibility(i);
+		if (!(mask & casterBits) && !((mask & cameraBit) && (mask & receiverBits)))
+			continue;
+
+		XMFLOAT3 center, extent;
+		culler.GetBounds(i, center, extent);
+		const XMFLOAT3* axes[3] = { &lightRight, &lightUp, &lightForward };
+		float* bounds = &lightBounds[i * 6];
+		for (unsigned int a = 0; a < 3; a++)
+		{
+			float c = center.x * axes[a]->x + center.y * axes[a]->y + center.z * axes[a]->z;
+			float e = extent.x * fabsf(axes[a]->x) + extent.y * fabsf(axes[a]->y) + extent.z * fabsf(axes[a]->z);
+			bounds[a * 2] = c - e;
+			bounds[a * 2 + 1] = c + e;
+		}
+
+		if (!(mask & cameraBit))
+			continue;
+		for (unsigned int c = 0; c < cascadeCount; c++)
+		{
+			if (!(mask & receiverBit[c]))
+				continue;
+
+			stats.Receivers[c]++;
+			float* receivers = receiverBounds[c];
+			receivers[0] = min(receivers[0], bounds[0]);
+			receivers[1] = max(receivers[1], bounds[1]);
+			receivers[2] = min(receivers[2], bounds[2]);
+			receivers[3] = max(receivers[3], bounds[3]);
+			receivers[4] = max(receivers[4], bounds[5]);
+		}
+	}
+
+	float casterMinZ[SHADOW_MAX_CASCADES];
+	for (unsigned int c = 0; c < cascadeCount; c++)
+		casterMinZ[c] = FLT_MAX;
+
+	for (unsigned int i = 0; i < objectCount; i++)
+	{
+		unsigned int mask = culler.GetVisibility(i) & casterBits;
+		if (!mask)
+			continue;
+
+		const float* bounds = &lightBounds[i * 6];
+		for (unsigned int c = 0; c < cascadeCount; c++)
+		{
+			if (!(mask & casterBit[c]))
+				continue;
+
+			stats.Candidates[c]++;
+			const float* receivers = receiverBounds[c];
+			if (bounds[1] < receivers[0] || bounds[0] > receivers[1] ||
+				bounds[3] < receivers[2] || bounds[2] > receivers[3] ||
+				bounds[4] > receivers[4])
+				continue;
+
+			casterMasks[i] |= 1u << c;
+			stats.Casters[c]++;
+			casterMinZ[c] = min(casterMinZ[c], bounds[4]);
+		}
+	}
+
+	// Depth only needs to reach from the nearest caster to the
+	// farthest receiver, which is all the precision goes to
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		const Volume& volume = volumes[c];
+		float nearZ = stats.Casters[c] > 0 ? casterMinZ[c] : volume.MinZ;
+		float farZ = stats.Receivers[c] > 0 ? min(receiverBounds[c][4], volume.MaxZ) : volume.MaxZ;
+		if (farZ <= nearZ)
+			farZ = nearZ + 0.01f;
+
+		XMStoreFloat4x4(&cascades[c].Projection, XMMatrixTranspose(
+			XMMatrixOrthographicOffCenterLH(volume.MinX, volume.MaxX, volume.MinY, volume.MaxY, nearZ, farZ)));
+	}
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.FitMs += (float)((end - start) * perfCounterSeconds * 1000.0);
+}
+
+std::string ShadowCascadeFitter::Describe() const
+{
+	std::ostringstream report;
+	char line[256];
+	for (unsigned int c = 0; c < cascadeCount; c++)
+	{
+		sprintf_s(line, "Cascade %u: depth %.2f-%.2f, %.4f units per texel, %u receivers, %u casters of %u candidates\n",
+			c, cascades[c].SplitNear, cascades[c].SplitFar, cascades[c].TexelSize,
+			stats.Receivers[c], stats.Casters[c], stats.Candidates[c]);
+		report << line;
+	}
+	return report.str();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ------ HEADLESS REPORT -----------------------------------------------------
+///////////////////////////////////////////////////////////////////////////////
+
+// Scalar version of the culler's box test, to check it against.
+// The sums are grouped the same way so the rounding matches.
+static bool BoxInsidePlanes(const XMFLOAT3& center, const XMFLOAT3& extent, const XMFLOAT4* planes, unsigned int planeCount)
+{
+	for (unsigned int p = 0; p < planeCount; p++)
+	{
+		const XMFLOAT4& plane = planes[p];
+		float distance = (center.x * plane.x + center.y * plane.y) + (center.z * plane.z + plane.w);
+		float radius = (extent.x * fabsf(plane.x) + extent.y * fabsf(plane.y)) + extent.z * fabsf(plane.z);
+		if (distance + radius < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------
+// Towers and crates scattered over a level, a camera near the
+// middle and a low sun, so tall casters outside the view
+// still shadow what's in it.  Runs on the calling thread.
+// --------------------------------------------------------
+int RunShadowCascadeReport(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	unsigned int objects = 20000;
+
+	while (args >> arg)
+	{
+		if (arg != "--shadow-cascades")
+			objects = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+	}
+
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+
+	XMFLOAT3 sun(0.5f, -0.6f, 0.3f);
+	XMVECTOR eye = XMVectorSet(0.0f, 2.0f, 0.0f, 0.0f);
+	XMVECTOR look = XMVectorSet(0.0f, -0.1f, 1.0f, 0.0f);
+	XMVECTOR worldUp = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(0.25f * XM_PI, 16.0f / 9.0f, 0.1f, 500.0f);
+
+	XMFLOAT4X4 viewMatrix, projectionMatrix;
+	XMStoreFloat4x4(&viewMatrix, XMMatrixTranspose(XMMatrixLookToLH(eye, look, worldUp)));
+	XMStoreFloat4x4(&projectionMatrix, XMMatrixTranspose(projection));
+
+	ShadowCascadeSettings settings;
+	settings.SetDefaults();
+	settings.MaxDistance = 200.0f;
+
+	ShadowCascadeFitter fitter;
+	fitter.SetSettings(settings);
+	fitter.Fit(viewMatrix, projectionMatrix, sun);
+
+	ViewCuller culler;
+	unsigned int cameraView = culler.AddFrustum(XMMatrixLookToLH(eye, look, worldUp) * projection);
+	fitter.AddViews(culler);
+
+	srand(1);
+	for (unsigned int i = 0; i < objects; i++)
+	{
+		float x = (rand() / (float)RAND_MAX - 0.5f) * 600.0f;
+		float z = (rand() / (float)RAND_MAX - 0.5f) * 600.0f;
+		float size = 0.5f + rand() / (float)RAND_MAX * 2.0f;
+		float height = (i % 10 == 0) ? 10.0f + rand() / (float)RAND_MAX * 30.0f : size * 2.0f;
+		culler.AddObject(XMFLOAT3(x - size, 0.0f, z - size), XMFLOAT3(x + size, height, z + size));
+	}
+
+	culler.Cull();
+	fitter.SelectCasters(culler, cameraView);
+
+	// The SIMD pass against a plain scalar test of every caster volume
+	unsigned int mismatches = 0;
+	for (unsigned int c = 0; c < fitter.GetCascadeCount(); c++)
+	{
+		XMFLOAT4 planes[ViewCuller::MAX_PLANES];
+		unsigned int planeCount = fitter.GetCasterPlanes(c, planes);
+		for (unsigned int i = 0; i < objects; i++)
+		{
+			XMFLOAT3 center, extent;
+			culler.GetBounds(i, center, extent);
+			if (BoxInsidePlanes(center, extent, planes, planeCount) != culler.IsVisible(i, fitter.GetCasterView(c)))
+				mismatches++;
+		}
+	}
+
+	std::ostringstream report;
+	char line[256];
+	sprintf_s(line, "%u objects, %u cascades of %u texels, %u views culled in %.3fms, selection %.3fms (headless, one thread)\n",
+		objects, fitter.GetCascadeCount(), settings.ShadowMapSize, culler.GetViewCount(),
+		culler.GetStats().CullMs, fitter.GetStats().FitMs);
+	report << line;
+	sprintf_s(line, "camera: %u visible\n", culler.GetVisibleCount(cameraView));
+	report << line;
+	report << fitter.Describe();
+
+	// Moving the camera must move each cascade by whole texels
+	// without resizing it; turning it mustn't resize it either
+	ShadowCascade before[SHADOW_MAX_CASCADES];
+	for (unsigned int c = 0; c < fitter.GetCascadeCount(); c++)
+		before[c] = fitter.GetCascade(c);
+
+	unsigned int snapFailures = 0;
+	for (unsigned int step = 1; step <= 10; step++)
+	{
+		XMVECTOR movedEye = eye + XMVectorSet(0.173f * step, 0.031f * step, 0.297f * step, 0.0f);
+		XMVECTOR turnedLook = XMVector3Transform(look, XMMatrixRotationY(0.05f * step));
+		XMStoreFloat4x4(&viewMatrix, XMMatrixTranspose(XMMatrixLookToLH(movedEye, turnedLook, worldUp)));
+		fitter.Fit(viewMatrix, projectionMatrix, sun);
+
+		for (unsigned int c = 0; c < fitter.GetCascadeCount(); c++)
+		{
+			const ShadowCascade& after = fitter.GetCascade(c);
+			float texel = before[c].TexelSize;
+			float dx = (after.LightOrigin.x - before[c].LightOrigin.x) / texel;
+			float dy = (after.LightOrigin.y - before[c].LightOrigin.y) / texel;
+			if (after.TexelSize != texel ||
+				fabsf(dx - floorf(dx + 0.5f)) > 0.01f || fabsf(dy - floorf(dy + 0.5f)) > 0.01f)
+				snapFailures++;
+		}
+	}
+
+	sprintf_s(line, "%u SIMD/scalar mismatches, %u snapping failures over 10 camera moves\n", mismatches, snapFailures);
+	report << line;
+
+	printf("%s", report.str().c_str());
+	std::ofstream results("shadow_cascades.results.txt", std::ios::app);
+	results << report.str();
+	return mismatches == 0 && snapFailures == 0 ? 0 : 1;
+}
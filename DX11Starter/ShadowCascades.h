@@ -0,0 +1,142 @@
+#pragma once
+#include <DirectXMath.h>
+#include <string>
+#include <vector>
+#include "ViewCuller.h"
+
+// For the DirectX Math library
+using namespace DirectX;
+
+static const unsigned int SHADOW_MAX_CASCADES = 4;
+
+// --------------------------------------------------------
+// How the camera's view is covered by cascades
+// --------------------------------------------------------
+struct ShadowCascadeSettings
+{
+	unsigned int CascadeCount;		// Up to SHADOW_MAX_CASCADES
+	float SplitLambda;				// 0 is uniform splits, 1 logarithmic
+	float MaxDistance;				// Shadows end here, or at the far plane if nearer
+	unsigned int ShadowMapSize;		// Texels along each side of a cascade
+
+	void SetDefaults();
+};
+
+// --------------------------------------------------------
+// One cascade as fitted for a frame
+// --------------------------------------------------------
+struct ShadowCascade
+{
+	float SplitNear;				// View space depth range the cascade covers
+	float SplitFar;
+	float TexelSize;				// World units per shadow map texel
+	XMFLOAT2 LightOrigin;			// Light space corner of the map, in whole texels
+	XMFLOAT4X4 View;				// Light view and orthographic projection,
+	XMFLOAT4X4 Projection;			// transposed for HLSL
+};
+
+// --------------------------------------------------------
+// Per-frame statistics, per cascade
+// --------------------------------------------------------
+struct ShadowCascadeStats
+{
+	unsigned int Cascades;
+	unsigned int Receivers[SHADOW_MAX_CASCADES];	// Visible objects in the cascade's slice
+	unsigned int Candidates[SHADOW_MAX_CASCADES];	// In the extruded volume
+	unsigned int Casters[SHADOW_MAX_CASCADES];		// Of those, over a receiver
+	float FitMs;					// Fitting and caster selection, not the culling pass
+};
+
+// --------------------------------------------------------
+// CPU side of cascaded shadow maps for one directional light
+//
+// Fit() splits the camera's depth range with the practical
+// split scheme (a blend of uniform and logarithmic splits)
+// and covers each slice with a bounding sphere, whose size
+// doesn't change as the camera turns.  The orthographic box
+// around it is moved in whole shadow map texels, so static
+// shadows don't shimmer when the camera moves.
+//
+// AddViews() then gives the ViewCuller two volumes per
+// cascade, tested with the camera in its one SIMD pass:
+//  - the slice itself, for the receivers
+//  - the slice swept towards the light: the box's sides and
+//    far end, plus every slice plane the sweep can't cross,
+//    for the casters
+// SelectCasters() keeps the candidates whose light space box
+// is over the box of the slice's visible receivers, and fits
+// each cascade's depth range to its casters and receivers.
+// --------------------------------------------------------
+class ShadowCascadeFitter
+{
+public:
+	ShadowCascadeFitter();
+
+	void SetSettings(const ShadowCascadeSettings& settings) { this->settings = settings; }
+	const ShadowCascadeSettings& GetSettings() const { return settings; }
+
+	// Camera matrices transposed for HLSL, like Camera stores
+	// them.  The light direction is the way the light travels.
+	void Fit(const XMFLOAT4X4& viewMatrix, const XMFLOAT4X4& projectionMatrix, const XMFLOAT3& lightDirection);
+
+	// Adds every cascade's receiver and caster volumes after
+	// the views already there
+	void AddViews(ViewCuller& culler);
+
+	// After the culler's Cull(): works out which objects cast
+	// into which cascade.  Receivers must be in the camera view.
+	void SelectCasters(const ViewCuller& culler, unsigned int cameraView);
+
+	// Bit c is set when the object casts into cascade c
+	unsigned int GetCasterMask(unsigned int object) const { return casterMasks[object]; }
+
+	unsigned int GetCascadeCount() const { return cascadeCount; }
+	const ShadowCascade& GetCascade(unsigned int cascade) const { return cascades[cascade]; }
+	const ShadowCascadeStats& GetStats() const { return stats; }
+
+	// The caster volume, world space planes and its view in the culler
+	unsigned int GetCasterPlanes(unsigned int cascade, XMFLOAT4* planes) const;
+	unsigned int GetCasterView(unsigned int cascade) const { return volumes[cascade].CasterView; }
+
+	std::string Describe() const;
+
+private:
+	struct Volume
+	{
+		// Light space box the shadow map covers, snapped to texels
+		float MinX, MaxX, MinY, MaxY;
+		float MinZ, MaxZ;				// Of the bounding sphere
+
+		XMFLOAT4 SlicePlanes[6];
+		XMFLOAT4 CasterPlanes[ViewCuller::MAX_PLANES];
+		unsigned int CasterPlaneCount;
+		unsigned int ReceiverView;
+		unsigned int CasterView;
+	};
+
+	ShadowCascadeSettings settings;
+	unsigned int cascadeCount;
+	ShadowCascade cascades[SHADOW_MAX_CASCADES];
+	Volume volumes[SHADOW_MAX_CASCADES];
+
+	// World space axes of light space
+	XMFLOAT3 lightRight;
+	XMFLOAT3 lightUp;
+	XMFLOAT3 lightForward;
+
+	std::vector<unsigned int> casterMasks;
+	std::vector<float> lightBounds;		// Min x, max x, min y, max y, min z, max z per object
+	ShadowCascadeStats stats;
+	double perfCounterSeconds;
+};
+
+// --------------------------------------------------------
+// Headless report on a level of boxes under a sun: the
+// cascade splits, receivers and casters per cascade, checks
+// of the SIMD culling against a scalar test and of the texel
+// snapping as the camera moves:
+//   --shadow-cascades [objects]
+//
+// Returns the process exit code
+// --------------------------------------------------------
+int RunShadowCascadeReport(const std::string& commandLine);
@@ -1,9 +1,50 @@
 #include "SimpleShader.h"
+#include "InputLayoutCache.h"
+#include <algorithm>
+#include <assert.h>
+
+// Orders (hash, value) table entries by hash
+template<typename T>
+static bool CompareHashEntries(const std::pair<unsigned int, T>& a, const std::pair<unsigned int, T>& b)
+{
+	return a.first < b.first;
+}
+
+template<typename T>
+static bool CompareHashKey(const std::pair<unsigned int, T>& entry, unsigned int hash)
+{
+	return entry.first < hash;
+}
+
+// Position of a hash in a sorted table, or -1
+template<typename T>
+static int FindHashEntry(const std::vector<std::pair<unsigned int, T>>& table, unsigned int hash)
+{
+	typename std::vector<std::pair<unsigned int, T>>::const_iterator it =
+		std::lower_bound(table.begin(), table.end(), hash, CompareHashKey<T>);
+
+	if (it == table.end() || it->first != hash)
+		return -1;
+	return (int)(it - table.begin());
+}
+
+// Whether two entries of a sorted table share a hash, which
+// would make lookups of either name ambiguous
+template<typename T>
+static bool HasDuplicateHash(const std::vector<std::pair<unsigned int, T>>& table)
+{
+	for (size_t i = 1; i < table.size(); i++)
+		if (table[i].first == table[i - 1].first)
+			return true;
+	return false;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // ------ BASE SIMPLE SHADER --------------------------------------------------
 ///////////////////////////////////////////////////////////////////////////////
 
+SimpleShaderUploadStats ISimpleShader::uploadStats = {};
+
 // --------------------------------------------------------
 // Constructor accepts DirectX device & context
 // --------------------------------------------------------
@@ -59,6 +100,8 @@ void ISimpleShader::CleanUp()
 	cbTable.clear();
 	samplerTable.clear();
 	textureTable.clear();
+	shaderResourceViews.clear();
+	samplerStates.clear();
 }
 
 // --------------------------------------------------------
@@ -79,6 +122,43 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		return false;
 	}
 
+	// Reflection comes from the .cso's cache file while it matches
+	if (!LoadOrReflectShader(shaderFile, shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), reflection))
+		return false;
+
+	return InitFromBlob();
+}
+
+// --------------------------------------------------------
+// Same as LoadShaderFile, but from compiled shader code
+// already in memory (e.g. from a draw stream capture)
+//
+// bytecode - The compiled shader
+// size - Size of the compiled shader in bytes
+//
+// Returns true if shader is loaded properly, false otherwise
+// --------------------------------------------------------
+bool ISimpleShader::LoadShaderBlob(const void* bytecode, SIZE_T size)
+{
+	HRESULT hr = D3DCreateBlob(size, &shaderBlob);
+	if (hr != S_OK)
+	{
+		return false;
+	}
+
+	memcpy(shaderBlob->GetBufferPointer(), bytecode, size);
+	if (!ReflectShader(bytecode, size, reflection))
+		return false;
+
+	return InitFromBlob();
+}
+
+// --------------------------------------------------------
+// Creates the shader from shaderBlob and builds the resource
+// arrays and lookup tables from the flattened reflection data
+// --------------------------------------------------------
+bool ISimpleShader::InitFromBlob()
+{
 	// Create the shader - Calls an overloaded version of this abstract
 	// method in the appropriate child class
 	shaderValid = CreateShader(shaderBlob);
@@ -87,42 +167,28 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		return false;
 	}
 
-	// Set up shader reflection to get information about
-	// this shader and its variables,  buffers, etc.
-	ID3D11ShaderReflection* refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)&refl);
-	
-	// Get the description of the shader
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
 	// Create resource arrays
-	constantBufferCount = shaderDesc.ConstantBuffers;
+	constantBufferCount = reflection.ConstantBuffers.size();
 	constantBuffers = new SimpleConstantBuffer[constantBufferCount];
 	
 	// Handle bound resources (like shaders and samplers)
-	unsigned int resourceCount = shaderDesc.BoundResources;
-	for (unsigned int r = 0; r < resourceCount; r++)
+	for (unsigned int r = 0; r < reflection.Resources.size(); r++)
 	{
-		// Get this resource's description
-		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
-		refl->GetResourceBindingDesc(r, &resourceDesc);
+		const ShaderReflectionData::Resource& resource = reflection.Resources[r];
 
 		// Check the type
-		switch (resourceDesc.Type)
+		switch (resource.Type)
 		{
 		case D3D_SIT_TEXTURE: // A texture resource
+		case D3D_SIT_STRUCTURED: // A structured buffer, also bound as an SRV
+		case D3D_SIT_BYTEADDRESS: // A raw buffer, also bound as an SRV
 		{
 			// Create the SRV wrapper
 			SimpleSRV* srv = new SimpleSRV();
-			srv->BindIndex = resourceDesc.BindPoint;	// Shader bind point
+			srv->BindIndex = resource.BindIndex;		// Shader bind point
 			srv->Index = shaderResourceViews.size();	// Raw index
 
-			textureTable.insert(std::pair<std::string, SimpleSRV*>(resourceDesc.Name, srv));
+			textureTable.push_back(std::make_pair(resource.NameHash, srv->Index));
 			shaderResourceViews.push_back(srv);
 		}
 			break;
@@ -131,10 +197,10 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		{
 			// Create the sampler wrapper
 			SimpleSampler* samp = new SimpleSampler();
-			samp->BindIndex = resourceDesc.BindPoint;	// Shader bind point
+			samp->BindIndex = resource.BindIndex;		// Shader bind point
 			samp->Index = samplerStates.size();			// Raw index
 
-			samplerTable.insert(std::pair<std::string, SimpleSampler*>(resourceDesc.Name, samp));
+			samplerTable.push_back(std::make_pair(resource.NameHash, samp->Index));
 			samplerStates.push_back(samp);
 		}
 			break;
@@ -144,23 +210,12 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 	// Loop through all constant buffers
 	for (unsigned int b = 0; b < constantBufferCount; b++)
 	{
-		// Get this buffer
-		ID3D11ShaderReflectionConstantBuffer* cb =
-			refl->GetConstantBufferByIndex(b);
-		
-		// Get the description of this buffer
-		D3D11_SHADER_BUFFER_DESC bufferDesc;
-		cb->GetDesc(&bufferDesc);
-		
-		// Get the description of the resource binding, so
-		// we know exactly how it's bound in the shader
-		D3D11_SHADER_INPUT_BIND_DESC bindDesc;
-		refl->GetResourceBindingDescByName(bufferDesc.Name, &bindDesc);
-		
-		// Set up the buffer and put its pointer in the table
-		constantBuffers[b].BindIndex = bindDesc.BindPoint;
-		constantBuffers[b].Name = bufferDesc.Name;
-		cbTable.insert(std::pair<std::string, SimpleConstantBuffer*>(bufferDesc.Name, &constantBuffers[b]));
+		const ShaderReflectionData::ConstantBuffer& bufferDesc = reflection.ConstantBuffers[b];
+
+		// Set up the buffer and put its index in the table
+		constantBuffers[b].BindIndex = bufferDesc.BindIndex;
+		constantBuffers[b].Name = reflection.GetString(bufferDesc.NameOffset);
+		cbTable.push_back(std::make_pair(bufferDesc.NameHash, b));
 
 		// Create this constant buffer
 		D3D11_BUFFER_DESC newBuffDesc;
@@ -177,37 +232,93 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 		constantBuffers[b].LocalDataBuffer = new unsigned char[bufferDesc.Size];
 		ZeroMemory(constantBuffers[b].LocalDataBuffer, bufferDesc.Size);
 
+		// Until something is copied to the ring, bind the buffer itself
+		constantBuffers[b].Allocation.Buffer = constantBuffers[b].ConstantBuffer;
+		constantBuffers[b].Allocation.FirstConstant = 0;
+		constantBuffers[b].Allocation.NumConstants = 0;
+		constantBuffers[b].Allocation.Frame = 0;
+
+		// The GPU buffer starts out undefined, so the first copy always goes
+		constantBuffers[b].DirtyBegin = 0;
+		constantBuffers[b].DirtyEnd = bufferDesc.Size;
+
 		// Loop through all variables in this buffer
-		for (unsigned int v = 0; v < bufferDesc.Variables; v++)
+		for (unsigned int v = 0; v < bufferDesc.VariableCount; v++)
 		{
-			// Get this variable
-			ID3D11ShaderReflectionVariable* var =
-				cb->GetVariableByIndex(v);
-			
-			// Get the description of the variable and its type
-			D3D11_SHADER_VARIABLE_DESC varDesc;
-			var->GetDesc(&varDesc);
+			const ShaderReflectionData::Variable& varDesc = reflection.Variables[bufferDesc.FirstVariable + v];
 
 			// Create the variable struct
 			SimpleShaderVariable varStruct;
 			varStruct.ConstantBufferIndex = b;
-			varStruct.ByteOffset = varDesc.StartOffset;
+			varStruct.ByteOffset = varDesc.ByteOffset;
 			varStruct.Size = varDesc.Size;
-			
-			// Get a string version
-			std::string varName(varDesc.Name);
 
 			// Add this variable to the table and the constant buffer
-			varTable.insert(std::pair<std::string, SimpleShaderVariable>(varName, varStruct));
+			varTable.push_back(std::make_pair(varDesc.NameHash, varStruct));
 			constantBuffers[b].Variables.push_back(varStruct);
 		}
 	}
 
+	// Sort the tables for binary searching
+	std::sort(varTable.begin(), varTable.end(), CompareHashEntries<SimpleShaderVariable>);
+	std::sort(cbTable.begin(), cbTable.end(), CompareHashEntries<unsigned int>);
+	std::sort(textureTable.begin(), textureTable.end(), CompareHashEntries<unsigned int>);
+	std::sort(samplerTable.begin(), samplerTable.end(), CompareHashEntries<unsigned int>);
+
+	// Handles are only the hash, so two names with the same one
+	// can't be told apart by GetParameter() and the slot lookups
+	assert(!HasDuplicateHash(varTable) && "Two constant buffer variables have the same name hash");
+	assert(!HasDuplicateHash(cbTable) && "Two constant buffers have the same name hash");
+	assert(!HasDuplicateHash(textureTable) && "Two shader resources have the same name hash");
+	assert(!HasDuplicateHash(samplerTable) && "Two samplers have the same name hash");
+
 	// All set
-	refl->Release();
 	return true;
 }
 
+// --------------------------------------------------------
+// Looks up a constant buffer variable by name hash
+//
+// Returns an invalid handle (Size 0) if there's no such variable
+// --------------------------------------------------------
+SimpleShaderParameter ISimpleShader::GetParameter(unsigned int nameHash) const
+{
+	int entry = FindHashEntry(varTable, nameHash);
+	if (entry < 0)
+	{
+		SimpleShaderParameter invalid = { 0, 0, 0 };
+		return invalid;
+	}
+
+	const SimpleShaderVariable& var = varTable[entry].second;
+	SimpleShaderParameter parameter = { var.ConstantBufferIndex, var.ByteOffset, var.Size };
+	return parameter;
+}
+
+// --------------------------------------------------------
+// Looks up an SRV register by name hash
+// --------------------------------------------------------
+SimpleShaderSlot ISimpleShader::GetShaderResourceViewSlot(unsigned int nameHash) const
+{
+	SimpleShaderSlot slot = { SimpleShaderSlot::INVALID };
+	int entry = FindHashEntry(textureTable, nameHash);
+	if (entry >= 0)
+		slot.BindIndex = shaderResourceViews[textureTable[entry].second]->BindIndex;
+	return slot;
+}
+
+// --------------------------------------------------------
+// Looks up a sampler register by name hash
+// --------------------------------------------------------
+SimpleShaderSlot ISimpleShader::GetSamplerSlot(unsigned int nameHash) const
+{
+	SimpleShaderSlot slot = { SimpleShaderSlot::INVALID };
+	int entry = FindHashEntry(samplerTable, nameHash);
+	if (entry >= 0)
+		slot.BindIndex = samplerStates[samplerTable[entry].second]->BindIndex;
+	return slot;
+}
+
 // --------------------------------------------------------
 // Helper for looking up a variable by name and also
 // verifying that it is the requested size
@@ -217,16 +328,15 @@ bool ISimpleShader::LoadShaderFile(LPCWSTR shaderFile)
 // --------------------------------------------------------
 SimpleShaderVariable* ISimpleShader::FindVariable(std::string name, int size)
 {
-	// Look for the key
-	std::unordered_map<std::string, SimpleShaderVariable>::iterator result =
-		varTable.find(name);
+	// Look for the name's hash
+	int entry = FindHashEntry(varTable, HashShaderName(name.c_str()));
 
 	// Did we find the key?
-	if (result == varTable.end())
+	if (entry < 0)
 		return 0;
 
-	// Grab the result from the iterator
-	SimpleShaderVariable* var = &(result->second);
+	// Grab the result from the table
+	SimpleShaderVariable* var = &varTable[entry].second;
 
 	// Is the data size correct ?
 	if (size > 0 && var->Size != size)
@@ -241,16 +351,15 @@ SimpleShaderVariable* ISimpleShader::FindVariable(std::string name, int size)
 // --------------------------------------------------------
 SimpleConstantBuffer* ISimpleShader::FindConstantBuffer(std::string name)
 {
-	// Look for the key
-	std::unordered_map<std::string, SimpleConstantBuffer*>::iterator result =
-		cbTable.find(name);
+	// Look for the name's hash
+	int entry = FindHashEntry(cbTable, HashShaderName(name.c_str()));
 
 	// Did we find the key?
-	if (result == cbTable.end())
+	if (entry < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return &constantBuffers[cbTable[entry].second];
 }
 
 // --------------------------------------------------------
@@ -280,9 +389,7 @@ void ISimpleShader::CopyAllBufferData()
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		// Copy the entire local data buffer
-		deviceContext->UpdateSubresource(
-			constantBuffers[i].ConstantBuffer, 0, 0,
-			constantBuffers[i].LocalDataBuffer, 0, 0);
+		UploadBuffer(&constantBuffers[i]);
 	}
 }
 
@@ -311,9 +418,7 @@ void ISimpleShader::CopyBufferData(unsigned int index)
 	if (!cb) return;
 
 	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer, 0, 0, 
-		cb->LocalDataBuffer, 0, 0);
+	UploadBuffer(cb);
 }
 
 // --------------------------------------------------------
@@ -333,9 +438,86 @@ void ISimpleShader::CopyBufferData(std::string bufferName)
 	if (!cb) return;
 
 	// Copy the data and get out
-	deviceContext->UpdateSubresource(
-		cb->ConstantBuffer, 0, 0, 
-		cb->LocalDataBuffer, 0, 0);
+	UploadBuffer(cb);
+}
+
+// --------------------------------------------------------
+// Copies a buffer's local data to the GPU.  With a ring, the
+// data goes to a fresh slice that's bound by SetShader().
+//
+// Nothing is copied if the data hasn't changed since the last
+// upload, unless that upload was a ring slice from an earlier
+// frame.  Constant buffers can't be partially updated before
+// D3D 11.1, so the dirty range only decides whether to copy.
+// --------------------------------------------------------
+void ISimpleShader::UploadBuffer(SimpleConstantBuffer* cb)
+{
+	ConstantBufferRing* ring = ConstantBufferRing::Instance();
+	bool dirty = cb->DirtyBegin < cb->DirtyEnd;
+	if (!dirty && (!ring || ring->IsCurrent(cb->Allocation)))
+	{
+		uploadStats.SkippedUploads++;
+		return;
+	}
+
+	uploadStats.Uploads++;
+	if (dirty)
+		uploadStats.ChangedBytes += cb->DirtyEnd - cb->DirtyBegin;
+	cb->DirtyBegin = cb->Size;
+	cb->DirtyEnd = 0;
+
+	if (!ring)
+	{
+		deviceContext->UpdateSubresource(
+			cb->ConstantBuffer, 0, 0,
+			cb->LocalDataBuffer, 0, 0);
+		return;
+	}
+
+	cb->Allocation = ring->Upload(cb->LocalDataBuffer, cb->Size);
+}
+
+// --------------------------------------------------------
+// Copies data into a buffer's local data.  Values that are set
+// to what they already were leave the buffer clean.
+// --------------------------------------------------------
+void ISimpleShader::WriteLocalData(SimpleConstantBuffer* cb, unsigned int offset, const void* data, unsigned int size)
+{
+	unsigned char* destination = cb->LocalDataBuffer + offset;
+	if (memcmp(destination, data, size) == 0)
+		return;
+
+	memcpy(destination, data, size);
+	cb->DirtyBegin = min(cb->DirtyBegin, offset);
+	cb->DirtyEnd = max(cb->DirtyEnd, offset + size);
+}
+
+// --------------------------------------------------------
+// Zeroes the shared upload counters, e.g. once per frame
+// --------------------------------------------------------
+void ISimpleShader::ResetUploadStats()
+{
+	SimpleShaderUploadStats empty = {};
+	uploadStats = empty;
+}
+
+// --------------------------------------------------------
+// Binds all constant buffers to a stage
+//
+// Ring slices are only valid during the frame they were made
+// in, so a shader whose data wasn't copied this frame gets its
+// local data uploaded again
+// --------------------------------------------------------
+void ISimpleShader::BindBuffers(ConstantBufferStage stage)
+{
+	ConstantBufferRing* ring = ConstantBufferRing::Instance();
+	for (unsigned int i = 0; i < constantBufferCount; i++)
+	{
+		if (!ring->IsCurrent(constantBuffers[i].Allocation))
+			UploadBuffer(&constantBuffers[i]);
+
+		ring->Bind(stage, constantBuffers[i].BindIndex, constantBuffers[i].Allocation);
+	}
 }
 
 
@@ -357,15 +539,45 @@ bool ISimpleShader::SetData(std::string name, const void* data, unsigned int siz
 		return false;
 
 	// Set the data in the local data buffer
-	memcpy(
-		constantBuffers[var->ConstantBufferIndex].LocalDataBuffer + var->ByteOffset,
-		data,
-		size);
+	WriteLocalData(&constantBuffers[var->ConstantBufferIndex], var->ByteOffset, data, size);
 
 	// Success
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets data through a resolved handle
+//
+// Returns false if the handle is invalid or the size doesn't match
+// --------------------------------------------------------
+bool ISimpleShader::SetData(const SimpleShaderParameter& parameter, const void* data, unsigned int size)
+{
+	if (parameter.Size != size || parameter.ConstantBufferIndex >= constantBufferCount)
+		return false;
+
+	WriteLocalData(&constantBuffers[parameter.ConstantBufferIndex], parameter.ByteOffset, data, size);
+	return true;
+}
+
+// --------------------------------------------------------
+// Overwrites a whole constant buffer's local data
+//
+// index - The index of the buffer (see CopyBufferData)
+// data - The data to set in the buffer
+// size - The size of the data (this must match the buffer's size)
+//
+// Returns true if data is copied, false if the buffer doesn't
+// exist or sizes don't match
+// --------------------------------------------------------
+bool ISimpleShader::SetBufferData(unsigned int index, const void* data, unsigned int size)
+{
+	if (index >= constantBufferCount || constantBuffers[index].Size != size)
+		return false;
+
+	WriteLocalData(&constantBuffers[index], 0, data, size);
+	return true;
+}
+
 // --------------------------------------------------------
 // Sets INTEGER data
 // --------------------------------------------------------
@@ -461,16 +673,15 @@ const SimpleShaderVariable* ISimpleShader::GetVariableInfo(std::string name)
 // --------------------------------------------------------
 const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(std::string name)
 {
-	// Look for the key
-	std::unordered_map<std::string, SimpleSRV*>::iterator result =
-		textureTable.find(name);
+	// Look for the name's hash
+	int entry = FindHashEntry(textureTable, HashShaderName(name.c_str()));
 
 	// Did we find the key?
-	if (result == textureTable.end())
+	if (entry < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return shaderResourceViews[textureTable[entry].second];
 }
 
 
@@ -496,16 +707,15 @@ const SimpleSRV* ISimpleShader::GetShaderResourceViewInfo(unsigned int index)
 // --------------------------------------------------------
 const SimpleSampler* ISimpleShader::GetSamplerInfo(std::string name)
 {
-	// Look for the key
-	std::unordered_map<std::string, SimpleSampler*>::iterator result =
-		samplerTable.find(name);
+	// Look for the name's hash
+	int entry = FindHashEntry(samplerTable, HashShaderName(name.c_str()));
 
 	// Did we find the key?
-	if (result == samplerTable.end())
+	if (entry < 0)
 		return 0;
 
 	// Success
-	return result->second;
+	return samplerStates[samplerTable[entry].second];
 }
 
 // --------------------------------------------------------
@@ -543,6 +753,18 @@ unsigned int ISimpleShader::GetBufferSize(unsigned int index)
 	return constantBuffers[index].Size;
 }
 
+// --------------------------------------------------------
+// Gets the index of a constant buffer by name hash, or -1
+// --------------------------------------------------------
+unsigned int ISimpleShader::GetBufferIndex(unsigned int nameHash) const
+{
+	int entry = FindHashEntry(cbTable, nameHash);
+	if (entry < 0)
+		return -1;
+
+	return cbTable[entry].second;
+}
+
 // --------------------------------------------------------
 // Gets info about a particular constant buffer 
 // by name, if it exists
@@ -604,6 +826,26 @@ SimpleVertexShader::SimpleVertexShader(ID3D11Device * device, ID3D11DeviceContex
 	this->perInstanceCompatible = perInstanceCompatible;
 }
 
+// --------------------------------------------------------
+// Constructor overload which takes a vertex format
+//
+// The input layout is built from these elements (usually a
+// VertexFormat<T> specialization) instead of the reflected
+// input signature.  Semantic names must outlive the shader.
+// --------------------------------------------------------
+SimpleVertexShader::SimpleVertexShader(ID3D11Device * device, ID3D11DeviceContext * context, const D3D11_INPUT_ELEMENT_DESC * vertexElements, unsigned int elementCount)
+	: ISimpleShader(device, context)
+{
+	this->inputLayout = 0;
+	this->shader = 0;
+	this->vertexElements.assign(vertexElements, vertexElements + elementCount);
+
+	this->perInstanceCompatible = false;
+	for (unsigned int i = 0; i < elementCount; i++)
+		if (vertexElements[i].InputSlotClass == D3D11_INPUT_PER_INSTANCE_DATA)
+			this->perInstanceCompatible = true;
+}
+
 // --------------------------------------------------------
 // Destructor - Clean up actual shader (base will be called automatically)
 // --------------------------------------------------------
@@ -620,6 +862,9 @@ void SimpleVertexShader::CleanUp()
 	ISimpleShader::CleanUp();
 	if (shader) { shader->Release(); shader = 0; }
 	if (inputLayout) { inputLayout->Release(); inputLayout = 0; }
+	for (size_t i = 0; i < streamLayouts.size(); i++)
+		if (streamLayouts[i].second) { streamLayouts[i].second->Release(); }
+	streamLayouts.clear();
 }
 
 // --------------------------------------------------------
@@ -651,33 +896,48 @@ bool SimpleVertexShader::CreateShader(ID3DBlob* shaderBlob)
 	if (inputLayout)
 		return true;
 
+	// Layouts are shared between shaders through the cache
+	// when there is one
+	InputLayoutCache* layoutCache = InputLayoutCache::Instance();
+
+	// A vertex format given to the constructor needs no reflection
+	if (!vertexElements.empty())
+	{
+		if (layoutCache)
+		{
+			inputLayout = layoutCache->Acquire(
+				&vertexElements[0],
+				(unsigned int)vertexElements.size(),
+				shaderBlob->GetBufferPointer(),
+				shaderBlob->GetBufferSize());
+		}
+		else
+		{
+			device->CreateInputLayout(
+				&vertexElements[0],
+				vertexElements.size(),
+				shaderBlob->GetBufferPointer(),
+				shaderBlob->GetBufferSize(),
+				&inputLayout);
+		}
+		return true;
+	}
+
 	// Vertex shader was created successfully, so we now use the
-	// shader code to re-reflect and create an input layout that 
+	// reflected input signature to create an input layout that 
 	// matches what the vertex shader expects.  Code adapted from:
 	// https://takinginitiative.wordpress.com/2011/12/11/directx-1011-basic-shader-reflection-automatic-input-layout-creation/
 
-	// Reflect shader info
-	ID3D11ShaderReflection* refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)&refl);
-	
-	// Get shader info
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
-	// Read input layout description from shader info
+	// Read input layout description from the reflection data
 	std::vector<D3D11_INPUT_ELEMENT_DESC> inputLayoutDesc;
-	for (unsigned int i = 0; i< shaderDesc.InputParameters; i++)
+	for (unsigned int i = 0; i < reflection.Inputs.size(); i++)
 	{
-		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-		refl->GetInputParameterDesc(i, &paramDesc);
+		const ShaderReflectionData::Signature& paramDesc = reflection.Inputs[i];
+		const char* semanticName = reflection.GetString(paramDesc.SemanticNameOffset);
 
 		// Check the semantic name for "_PER_INSTANCE"
 		std::string perInstanceStr = "_PER_INSTANCE";
-		std::string sem = paramDesc.SemanticName;
+		std::string sem = semanticName;
 		int lenDiff = sem.size() - perInstanceStr.size();
 		bool isPerInstance = 
 			lenDiff >= 0 &&
@@ -685,7 +945,7 @@ bool SimpleVertexShader::CreateShader(ID3DBlob* shaderBlob)
 
 		// Fill out input element desc
 		D3D11_INPUT_ELEMENT_DESC elementDesc;
-		elementDesc.SemanticName = paramDesc.SemanticName;
+		elementDesc.SemanticName = semanticName;
 		elementDesc.SemanticIndex = paramDesc.SemanticIndex;
 		elementDesc.InputSlot = 0;
 		elementDesc.AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
@@ -732,19 +992,81 @@ bool SimpleVertexShader::CreateShader(ID3DBlob* shaderBlob)
 		inputLayoutDesc.push_back(elementDesc);
 	}
 
-	// Try to create Input Layout
-	HRESULT hr = device->CreateInputLayout(
-		&inputLayoutDesc[0], 
-		inputLayoutDesc.size(), 
-		shaderBlob->GetBufferPointer(), 
-		shaderBlob->GetBufferSize(),
-		&inputLayout);
+	// Nothing to lay out (e.g. vertices generated from SV_VertexID)
+	if (inputLayoutDesc.empty())
+		return true;
 
-	// All done, clean up
-	refl->Release();
+	// Try to create Input Layout, or share an identical one
+	if (layoutCache)
+	{
+		inputLayout = layoutCache->Acquire(
+			&inputLayoutDesc[0],
+			(unsigned int)inputLayoutDesc.size(),
+			shaderBlob->GetBufferPointer(),
+			shaderBlob->GetBufferSize());
+	}
+	else
+	{
+		device->CreateInputLayout(
+			&inputLayoutDesc[0],
+			inputLayoutDesc.size(),
+			shaderBlob->GetBufferPointer(),
+			shaderBlob->GetBufferSize(),
+			&inputLayout);
+	}
+
+	// All done
 	return true;
 }
 
+// --------------------------------------------------------
+// Checks the reflected inputs against the elements first, so
+// a layout D3D would reject is never attempted.  Failures are
+// remembered too.
+// --------------------------------------------------------
+ID3D11InputLayout * SimpleVertexShader::GetInputLayout(const D3D11_INPUT_ELEMENT_DESC * elements, unsigned int count)
+{
+	if (!shaderValid)
+		return 0;
+
+	unsigned long long hash = InputLayoutCache::HashElements(elements, count);
+	for (size_t i = 0; i < streamLayouts.size(); i++)
+	{
+		if (streamLayouts[i].first == hash)
+			return streamLayouts[i].second;
+	}
+
+	bool covered = true;
+	for (unsigned int i = 0; i < reflection.Inputs.size() && covered; i++)
+	{
+		const ShaderReflectionData::Signature& input = reflection.Inputs[i];
+		const char* semanticName = reflection.GetString(input.SemanticNameOffset);
+		if (_strnicmp(semanticName, "SV_", 3) == 0)
+			continue;
+
+		covered = false;
+		for (unsigned int e = 0; e < count; e++)
+		{
+			if (_stricmp(elements[e].SemanticName, semanticName) == 0 &&
+				elements[e].SemanticIndex == input.SemanticIndex)
+				covered = true;
+		}
+	}
+
+	ID3D11InputLayout* layout = 0;
+	if (covered)
+	{
+		InputLayoutCache* layoutCache = InputLayoutCache::Instance();
+		if (layoutCache)
+			layout = layoutCache->Acquire(elements, count, shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize());
+		else
+			device->CreateInputLayout(elements, count, shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), &layout);
+	}
+
+	streamLayouts.push_back(std::make_pair(hash, layout));
+	return layout;
+}
+
 // --------------------------------------------------------
 // Sets the vertex shader, input layout and constant buffers
 // for future DirectX drawing
@@ -758,7 +1080,23 @@ void SimpleVertexShader::SetShaderAndCBs()
 	deviceContext->IASetInputLayout(inputLayout);
 	deviceContext->VSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimpleVertexShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_VERTEX);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->VSSetConstantBuffers(
@@ -812,6 +1150,48 @@ bool SimpleVertexShader::SetSamplerState(std::string name, ID3D11SamplerState* s
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the vertex shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimpleVertexShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->VSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the vertex shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimpleVertexShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->VSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the vertex shader stage
+// --------------------------------------------------------
+void SimpleVertexShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->VSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the vertex shader stage
+// --------------------------------------------------------
+void SimpleVertexShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->VSSetSamplers(startSlot, count, samplerStates);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // ------ SIMPLE PIXEL SHADER -------------------------------------------------
@@ -879,7 +1259,23 @@ void SimplePixelShader::SetShaderAndCBs()
 	// Set the shader
 	deviceContext->PSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimplePixelShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_PIXEL);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->PSSetConstantBuffers(
@@ -933,6 +1329,48 @@ bool SimplePixelShader::SetSamplerState(std::string name, ID3D11SamplerState* sa
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the pixel shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimplePixelShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->PSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the pixel shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimplePixelShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->PSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the pixel shader stage
+// --------------------------------------------------------
+void SimplePixelShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->PSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the pixel shader stage
+// --------------------------------------------------------
+void SimplePixelShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->PSSetSamplers(startSlot, count, samplerStates);
+}
+
 
 
 
@@ -1002,7 +1440,23 @@ void SimpleDomainShader::SetShaderAndCBs()
 	// Set the shader
 	deviceContext->DSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimpleDomainShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_DOMAIN);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->DSSetConstantBuffers(
@@ -1056,6 +1510,48 @@ bool SimpleDomainShader::SetSamplerState(std::string name, ID3D11SamplerState* s
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the domain shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimpleDomainShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->DSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the domain shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimpleDomainShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->DSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the domain shader stage
+// --------------------------------------------------------
+void SimpleDomainShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->DSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the domain shader stage
+// --------------------------------------------------------
+void SimpleDomainShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->DSSetSamplers(startSlot, count, samplerStates);
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1124,7 +1620,23 @@ void SimpleHullShader::SetShaderAndCBs()
 	// Set the shader
 	deviceContext->HSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimpleHullShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers?
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_HULL);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->HSSetConstantBuffers(
@@ -1178,6 +1690,48 @@ bool SimpleHullShader::SetSamplerState(std::string name, ID3D11SamplerState* sam
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the hull shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimpleHullShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->HSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the hull shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimpleHullShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->HSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the hull shader stage
+// --------------------------------------------------------
+void SimpleHullShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->HSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the hull shader stage
+// --------------------------------------------------------
+void SimpleHullShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->HSSetSamplers(startSlot, count, samplerStates);
+}
+
 
 
 
@@ -1255,31 +1809,18 @@ bool SimpleGeometryShader::CreateShaderWithStreamOut(ID3DBlob* shaderBlob)
 	// called more than once on the same object
 	this->CleanUp();
 
-	// Reflect shader info
-	ID3D11ShaderReflection* refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)&refl);
-
-	// Get shader info
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-
 	// Set up the output signature
 	streamOutVertexSize = 0;
 	std::vector<D3D11_SO_DECLARATION_ENTRY> soDecl;
-	for (unsigned int i = 0; i < shaderDesc.OutputParameters; i++)
+	for (unsigned int i = 0; i < reflection.Outputs.size(); i++)
 	{
 		// Get the info about this entry
-		D3D11_SIGNATURE_PARAMETER_DESC paramDesc;
-		refl->GetOutputParameterDesc(i, &paramDesc);
+		const ShaderReflectionData::Signature& paramDesc = reflection.Outputs[i];
 		
 		// Create the SO Declaration
 		D3D11_SO_DECLARATION_ENTRY entry;
 		entry.SemanticIndex  = paramDesc.SemanticIndex;
-		entry.SemanticName   = paramDesc.SemanticName;
+		entry.SemanticName   = reflection.GetString(paramDesc.SemanticNameOffset);
 		entry.Stream         = paramDesc.Stream;
 		entry.StartComponent = 0; // Assume starting at 0
 		entry.OutputSlot     = 0; // Assume the first output slot
@@ -1368,7 +1909,23 @@ void SimpleGeometryShader::SetShaderAndCBs()
 	// Set the shader
 	deviceContext->GSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimpleGeometryShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers?
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_GEOMETRY);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->GSSetConstantBuffers(
@@ -1422,6 +1979,48 @@ bool SimpleGeometryShader::SetSamplerState(std::string name, ID3D11SamplerState*
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the geometry shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimpleGeometryShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->GSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the geometry shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimpleGeometryShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->GSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the geometry shader stage
+// --------------------------------------------------------
+void SimpleGeometryShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->GSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the geometry shader stage
+// --------------------------------------------------------
+void SimpleGeometryShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->GSSetSamplers(startSlot, count, samplerStates);
+}
+
 // --------------------------------------------------------
 // Calculates the number of components specified by a parameter description mask
 //
@@ -1497,34 +2096,19 @@ bool SimpleComputeShader::CreateShader(ID3DBlob* shaderBlob)
 	if (result != S_OK)
 		return false;
 
-	// Set up shader reflection to get information about UAV's
-	ID3D11ShaderReflection* refl;
-	D3DReflect(
-		shaderBlob->GetBufferPointer(),
-		shaderBlob->GetBufferSize(),
-		IID_ID3D11ShaderReflection,
-		(void**)&refl);
-
-	// Get the description of the shader
-	D3D11_SHADER_DESC shaderDesc;
-	refl->GetDesc(&shaderDesc);
-	
 	// Grab the thread info
-	threadsTotal = refl->GetThreadGroupSize(
-		&threadsX,
-		&threadsY,
-		&threadsZ);
+	threadsX = reflection.ThreadGroupSize[0];
+	threadsY = reflection.ThreadGroupSize[1];
+	threadsZ = reflection.ThreadGroupSize[2];
+	threadsTotal = reflection.ThreadsTotal;
 
 	// Loop and get all UAV resources
-	unsigned int resourceCount = shaderDesc.BoundResources;
-	for (unsigned int r = 0; r < resourceCount; r++)
+	for (unsigned int r = 0; r < reflection.Resources.size(); r++)
 	{
-		// Get this resource's description
-		D3D11_SHADER_INPUT_BIND_DESC resourceDesc;
-		refl->GetResourceBindingDesc(r, &resourceDesc);
+		const ShaderReflectionData::Resource& resource = reflection.Resources[r];
 
 		// Check the type, looking for any kind of UAV
-		switch (resourceDesc.Type)
+		switch (resource.Type)
 		{
 		case D3D_SIT_UAV_APPEND_STRUCTURED:
 		case D3D_SIT_UAV_CONSUME_STRUCTURED:
@@ -1532,12 +2116,13 @@ bool SimpleComputeShader::CreateShader(ID3DBlob* shaderBlob)
 		case D3D_SIT_UAV_RWSTRUCTURED:
 		case D3D_SIT_UAV_RWSTRUCTURED_WITH_COUNTER:
 		case D3D_SIT_UAV_RWTYPED:
-			uavTable.insert(std::pair<std::string, unsigned int>(resourceDesc.Name, resourceDesc.BindPoint));
+			uavTable.push_back(std::make_pair(resource.NameHash, resource.BindIndex));
 		}
 	}
+	std::sort(uavTable.begin(), uavTable.end(), CompareHashEntries<unsigned int>);
+	assert(!HasDuplicateHash(uavTable) && "Two UAVs have the same name hash");
 
 	// All set
-	refl->Release();
 	return true;
 }
 
@@ -1553,7 +2138,23 @@ void SimpleComputeShader::SetShaderAndCBs()
 	// Set the shader
 	deviceContext->CSSetShader(shader, 0, 0);
 
+	SetConstantBuffers();
+}
+
+// --------------------------------------------------------
+// Binds the constant buffers, leaving the shader alone
+// --------------------------------------------------------
+void SimpleComputeShader::SetConstantBuffers()
+{
+	if (!shaderValid) return;
+
 	// Set the constant buffers?
+	if (ConstantBufferRing::Instance())
+	{
+		BindBuffers(CB_STAGE_COMPUTE);
+		return;
+	}
+
 	for (unsigned int i = 0; i < constantBufferCount; i++)
 	{
 		deviceContext->CSSetConstantBuffers(
@@ -1660,6 +2261,48 @@ bool SimpleComputeShader::SetSamplerState(std::string name, ID3D11SamplerState*
 	return true;
 }
 
+// --------------------------------------------------------
+// Sets a shader resource view in the compute shader stage
+// through a resolved slot
+// --------------------------------------------------------
+bool SimpleComputeShader::SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->CSSetShaderResources(slot.BindIndex, 1, &srv);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a sampler state in the compute shader stage through a
+// resolved slot
+// --------------------------------------------------------
+bool SimpleComputeShader::SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState)
+{
+	if (!slot.IsValid())
+		return false;
+
+	deviceContext->CSSetSamplers(slot.BindIndex, 1, &samplerState);
+	return true;
+}
+
+// --------------------------------------------------------
+// Sets a range of SRVs in the compute shader stage
+// --------------------------------------------------------
+void SimpleComputeShader::SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs)
+{
+	deviceContext->CSSetShaderResources(startSlot, count, srvs);
+}
+
+// --------------------------------------------------------
+// Sets a range of sampler states in the compute shader stage
+// --------------------------------------------------------
+void SimpleComputeShader::SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates)
+{
+	deviceContext->CSSetSamplers(startSlot, count, samplerStates);
+}
+
 // --------------------------------------------------------
 // Sets an unordered access view in the Compute shader stage
 //
@@ -1688,14 +2331,13 @@ bool SimpleComputeShader::SetUnorderedAccessView(std::string name, ID3D11Unorder
 // --------------------------------------------------------
 int SimpleComputeShader::GetUnorderedAccessViewIndex(std::string name)
 {
-	// Look for the key
-	std::unordered_map<std::string, unsigned int>::iterator result =
-		uavTable.find(name);
+	// Look for the name's hash
+	int entry = FindHashEntry(uavTable, HashShaderName(name.c_str()));
 
 	// Did we find the key?
-	if (result == uavTable.end())
+	if (entry < 0)
 		return -1;
 
 	// Success
-	return result->second;
+	return uavTable[entry].second;
 }
\ No newline at end of file
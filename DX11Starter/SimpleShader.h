@@ -6,9 +6,50 @@
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
 
-#include <unordered_map>
 #include <vector>
 #include <string>
+#include <type_traits>
+
+#include "ConstantBufferRing.h"
+#include "ShaderReflection.h"
+
+// --------------------------------------------------------
+// FNV-1a hash of a shader variable or resource name, used by
+// the handle based lookups.  It's constexpr, so names written
+// as SHADER_NAME("world") are hashed at compile time.
+// --------------------------------------------------------
+inline constexpr unsigned int HashShaderName(const char* name, unsigned int hash = 2166136261u)
+{
+	return *name ? HashShaderName(name + 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+#define SHADER_NAME(name) (std::integral_constant<unsigned int, HashShaderName(name)>::value)
+
+// --------------------------------------------------------
+// Handle to a constant buffer variable, resolved once with
+// GetParameter().  Setting data through a handle does no
+// lookup and no allocation.
+// --------------------------------------------------------
+struct SimpleShaderParameter
+{
+	unsigned int ConstantBufferIndex;
+	unsigned int ByteOffset;
+	unsigned int Size;		// 0 if the shader has no such variable
+
+	bool IsValid() const { return Size != 0; }
+};
+
+// --------------------------------------------------------
+// Handle to an SRV or sampler register, from
+// GetShaderResourceViewSlot() or GetSamplerSlot()
+// --------------------------------------------------------
+struct SimpleShaderSlot
+{
+	static const unsigned int INVALID = 0xffffffff;
+	unsigned int BindIndex;
+
+	bool IsValid() const { return BindIndex != INVALID; }
+};
 
 // --------------------------------------------------------
 // Used by simple shaders to store information about
@@ -34,6 +75,22 @@ struct SimpleConstantBuffer
 	ID3D11Buffer* ConstantBuffer;
 	unsigned char* LocalDataBuffer;
 	std::vector<SimpleShaderVariable> Variables;
+	ConstantBufferAllocation Allocation;	// Where the last copy went this frame
+
+	// Bytes changed since the last upload, empty if DirtyBegin >= DirtyEnd
+	unsigned int DirtyBegin;
+	unsigned int DirtyEnd;
+};
+
+// --------------------------------------------------------
+// Constant buffer copies made and avoided by all shaders,
+// since the last ResetUploadStats()
+// --------------------------------------------------------
+struct SimpleShaderUploadStats
+{
+	unsigned int Uploads;
+	unsigned int SkippedUploads;	// Buffers whose data hadn't changed
+	unsigned int ChangedBytes;		// Dirty range of the uploaded buffers
 };
 
 // --------------------------------------------------------
@@ -66,18 +123,31 @@ public:
 	// Initialization method (since we can't invoke derived class
 	// overrides in the base class constructor)
 	bool LoadShaderFile(LPCWSTR shaderFile);
+	bool LoadShaderBlob(const void* bytecode, SIZE_T size);
 
 	// Simple helpers
 	bool IsShaderValid() { return shaderValid; }
 
 	// Activating the shader and copying data
+	// (with a ConstantBufferRing, copies take effect at the next SetShader)
 	void SetShader();
 	void CopyAllBufferData();
 	void CopyBufferData(unsigned int index);
 	void CopyBufferData(std::string bufferName);
 
+	// Binds just the constant buffers, for when the shader object
+	// itself is bound by something else (e.g. a PipelineState)
+	virtual void SetConstantBuffers() = 0;
+
 	// Sets arbitrary shader data
 	bool SetData(std::string name, const void* data, unsigned int size);
+	bool SetBufferData(unsigned int index, const void* data, unsigned int size);
+
+	// Fills a whole constant buffer from a struct generated into
+	// ShaderConstants.h.  Fails if this shader's buffer of that
+	// name has a different size (e.g. another permutation).
+	template<typename T>
+	bool SetConstants(const T& data) { return SetBufferData(GetBufferIndex(T::NameHash), &data, sizeof(T)); }
 
 	bool SetInt(std::string name, int data);
 	bool SetFloat(std::string name, float data);
@@ -90,30 +160,59 @@ public:
 	bool SetMatrix4x4(std::string name, const float data[16]);
 	bool SetMatrix4x4(std::string name, const DirectX::XMFLOAT4X4 data);
 
+	// Resolving handles, by name or by name hash (see SHADER_NAME).
+	// Missing names give invalid handles, which the setters ignore.
+	SimpleShaderParameter GetParameter(const char* name) const { return GetParameter(HashShaderName(name)); }
+	SimpleShaderParameter GetParameter(unsigned int nameHash) const;
+	SimpleShaderSlot GetShaderResourceViewSlot(const char* name) const { return GetShaderResourceViewSlot(HashShaderName(name)); }
+	SimpleShaderSlot GetShaderResourceViewSlot(unsigned int nameHash) const;
+	SimpleShaderSlot GetSamplerSlot(const char* name) const { return GetSamplerSlot(HashShaderName(name)); }
+	SimpleShaderSlot GetSamplerSlot(unsigned int nameHash) const;
+
+	// Sets data through a resolved handle
+	bool SetData(const SimpleShaderParameter& parameter, const void* data, unsigned int size);
+	bool SetInt(const SimpleShaderParameter& parameter, int data) { return SetData(parameter, &data, sizeof(int)); }
+	bool SetFloat(const SimpleShaderParameter& parameter, float data) { return SetData(parameter, &data, sizeof(float)); }
+	bool SetFloat2(const SimpleShaderParameter& parameter, const DirectX::XMFLOAT2& data) { return SetData(parameter, &data, sizeof(float) * 2); }
+	bool SetFloat3(const SimpleShaderParameter& parameter, const DirectX::XMFLOAT3& data) { return SetData(parameter, &data, sizeof(float) * 3); }
+	bool SetFloat4(const SimpleShaderParameter& parameter, const DirectX::XMFLOAT4& data) { return SetData(parameter, &data, sizeof(float) * 4); }
+	bool SetMatrix4x4(const SimpleShaderParameter& parameter, const DirectX::XMFLOAT4X4& data) { return SetData(parameter, &data, sizeof(float) * 16); }
+
 	// Setting shader resources
 	virtual bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv) = 0;
 	virtual bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState) = 0;
+	virtual bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv) = 0;
+	virtual bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState) = 0;
+
+	// Sets count consecutive registers from startSlot in one call
+	virtual void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs) = 0;
+	virtual void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates) = 0;
 
 	// Getting data about variables and resources
 	const SimpleShaderVariable* GetVariableInfo(std::string name);
 	
 	const SimpleSRV* GetShaderResourceViewInfo(std::string name);
 	const SimpleSRV* GetShaderResourceViewInfo(unsigned int index);
-	unsigned int GetShaderResourceViewCount() { return textureTable.size(); }
+	unsigned int GetShaderResourceViewCount() { return shaderResourceViews.size(); }
 	
 	const SimpleSampler* GetSamplerInfo(std::string name);
 	const SimpleSampler* GetSamplerInfo(unsigned int index);
-	unsigned int GetSamplerCount() { return samplerTable.size(); }
+	unsigned int GetSamplerCount() { return samplerStates.size(); }
 
 	// Get data about constant buffers
 	unsigned int GetBufferCount();
 	unsigned int GetBufferSize(unsigned int index);
+	unsigned int GetBufferIndex(unsigned int nameHash) const;	// -1 if there's no such buffer
 	const SimpleConstantBuffer* GetBufferInfo(std::string name);
 	const SimpleConstantBuffer* GetBufferInfo(unsigned int index);
 	
 	// Misc getters
 	ID3DBlob* GetShaderBlob() { return shaderBlob; }
 
+	// Upload counters shared by every shader
+	static const SimpleShaderUploadStats& GetUploadStats() { return uploadStats; }
+	static void ResetUploadStats();
+
 protected:
 	
 	bool shaderValid;
@@ -124,14 +223,21 @@ protected:
 	// Resource counts
 	unsigned int constantBufferCount;
 	
-	// Maps for variables and buffers
-	SimpleConstantBuffer*		constantBuffers; // For index-based lookup
+	// Resources for index-based lookup
+	SimpleConstantBuffer*		constantBuffers;
 	std::vector<SimpleSRV*>		shaderResourceViews;
 	std::vector<SimpleSampler*>	samplerStates;
-	std::unordered_map<std::string, SimpleConstantBuffer*> cbTable;
-	std::unordered_map<std::string, SimpleShaderVariable> varTable;
-	std::unordered_map<std::string, SimpleSRV*> textureTable;
-	std::unordered_map<std::string, SimpleSampler*> samplerTable;
+
+	// Name lookups, by name hash and sorted by hash.  String
+	// lookups hash the name and search the same tables.
+	std::vector<std::pair<unsigned int, SimpleShaderVariable>> varTable;
+	std::vector<std::pair<unsigned int, unsigned int>> cbTable;			// Index into constantBuffers
+	std::vector<std::pair<unsigned int, unsigned int>> textureTable;		// Index into shaderResourceViews
+	std::vector<std::pair<unsigned int, unsigned int>> samplerTable;		// Index into samplerStates
+
+	// Flattened reflection of the shader, from its cache file when
+	// loaded from disk.  CreateShader() reads signatures from it.
+	ShaderReflectionData reflection;
 
 	// Pure virtual functions for dealing with shader types
 	virtual bool CreateShader(ID3DBlob* shaderBlob) = 0;
@@ -139,6 +245,24 @@ protected:
 
 	virtual void CleanUp();
 
+	// Creates the shader from shaderBlob and the lookup tables from reflection
+	bool InitFromBlob();
+
+	static SimpleShaderUploadStats uploadStats;
+
+	// Copies a buffer's local data to the GPU, through the
+	// ConstantBufferRing if there is one.  Clean buffers are
+	// skipped while their GPU copy is still valid.
+	void UploadBuffer(SimpleConstantBuffer* cb);
+
+	// Copies data into a buffer's local data, growing its dirty
+	// range only if the bytes differ
+	void WriteLocalData(SimpleConstantBuffer* cb, unsigned int offset, const void* data, unsigned int size);
+
+	// Binds every constant buffer to a stage, re-uploading any
+	// whose ring allocation is from an earlier frame
+	void BindBuffers(ConstantBufferStage stage);
+
 	// Helpers for finding data by name
 	SimpleShaderVariable* FindVariable(std::string name, int size);
 	SimpleConstantBuffer* FindConstantBuffer(std::string name);
@@ -152,18 +276,31 @@ class SimpleVertexShader : public ISimpleShader
 public:
 	SimpleVertexShader(ID3D11Device* device, ID3D11DeviceContext* context);
 	SimpleVertexShader(ID3D11Device* device, ID3D11DeviceContext* context, ID3D11InputLayout* inputLayout, bool perInstanceCompatible);
+	SimpleVertexShader(ID3D11Device* device, ID3D11DeviceContext* context, const D3D11_INPUT_ELEMENT_DESC* vertexElements, unsigned int elementCount);
 	~SimpleVertexShader();
 	ID3D11VertexShader* GetDirectXShader() { return shader; }
 	ID3D11InputLayout* GetInputLayout() { return inputLayout; }
 	bool GetPerInstanceCompatible() { return perInstanceCompatible; }
 
+	// Layout for vertices laid out as these elements instead, e.g.
+	// spread over several input slots.  Made on first use; null if
+	// the shader reads an input the elements don't provide.
+	ID3D11InputLayout* GetInputLayout(const D3D11_INPUT_ELEMENT_DESC* elements, unsigned int count);
+
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 
 protected:
 	bool perInstanceCompatible;
 	ID3D11InputLayout* inputLayout;
 	ID3D11VertexShader* shader;
+	std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;	// Compile-time vertex format, if given
+	std::vector<std::pair<unsigned long long, ID3D11InputLayout*>> streamLayouts;	// By element hash
 	bool CreateShader(ID3DBlob* shaderBlob);
 	void SetShaderAndCBs();
 	void CleanUp();
@@ -182,6 +319,11 @@ public:
 
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 
 protected:
 	ID3D11PixelShader* shader;
@@ -202,6 +344,11 @@ public:
 
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 
 protected:
 	ID3D11DomainShader* shader;
@@ -222,6 +369,11 @@ public:
 
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 
 protected:
 	ID3D11HullShader* shader;
@@ -242,6 +394,11 @@ public:
 
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 
 	bool CreateCompatibleStreamOutBuffer(ID3D11Buffer** buffer, int vertexCount);
 
@@ -281,13 +438,18 @@ public:
 
 	bool SetShaderResourceView(std::string name, ID3D11ShaderResourceView* srv);
 	bool SetSamplerState(std::string name, ID3D11SamplerState* samplerState);
+	bool SetShaderResourceView(SimpleShaderSlot slot, ID3D11ShaderResourceView* srv);
+	bool SetSamplerState(SimpleShaderSlot slot, ID3D11SamplerState* samplerState);
+	void SetShaderResourceViews(unsigned int startSlot, unsigned int count, ID3D11ShaderResourceView* const* srvs);
+	void SetConstantBuffers();
+	void SetSamplerStates(unsigned int startSlot, unsigned int count, ID3D11SamplerState* const* samplerStates);
 	bool SetUnorderedAccessView(std::string name, ID3D11UnorderedAccessView* uav, unsigned int appendConsumeOffset = -1);
 
 	int GetUnorderedAccessViewIndex(std::string name);
 
 protected:
 	ID3D11ComputeShader* shader;
-	std::unordered_map<std::string, unsigned int> uavTable;
+	std::vector<std::pair<unsigned int, unsigned int>> uavTable;	// Register by name hash, sorted
 
 	unsigned int threadsX;
 	unsigned int threadsY;
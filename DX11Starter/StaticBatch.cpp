@@ -0,0 +1,215 @@
+#include "StaticBatch.h"
+#include <algorithm>
+#include <cfloat>
+#include <sstream>
+#include <stdio.h>
+
+StaticBatcher::StaticBatcher()
+{
+	pieceCount = 0;
+	ZeroMemory(&stats, sizeof(StaticBatchStats));
+}
+
+StaticBatcher::~StaticBatcher()
+{
+	Release();
+}
+
+void StaticBatcher::Release()
+{
+	for (size_t i = 0; i < batches.size(); i++)
+	{
+		if (batches[i].VertexBuffer) { batches[i].VertexBuffer->Release(); }
+		if (batches[i].IndexBuffer) { batches[i].IndexBuffer->Release(); }
+	}
+	batches.clear();
+	pieceCount = 0;
+	ZeroMemory(&stats, sizeof(StaticBatchStats));
+}
+
+// --------------------------------------------------------
+// Groups the static entities by material, keeping the order
+// they were added in, and bakes their world transforms into
+// copies of the meshes' vertices
+// --------------------------------------------------------
+bool StaticBatcher::Build(ID3D11Device * device, const std::vector<Entity*>& entities)
+{
+	Release();
+
+	std::vector<Material*> materials;
+	std::vector<std::vector<Entity*>> groups;
+	std::vector<Mesh*> sourceMeshes;
+	for (size_t i = 0; i < entities.size(); i++)
+	{
+		Entity* entity = entities[i];
+		if (!entity->IsStatic() || entity->GetMesh()->GetVertices().empty())
+			continue;
+
+		size_t group = std::find(materials.begin(), materials.end(), entity->GetMaterial()) - materials.begin();
+		if (group == materials.size())
+		{
+			materials.push_back(entity->GetMaterial());
+			groups.push_back(std::vector<Entity*>());
+		}
+		groups[group].push_back(entity);
+
+		if (std::find(sourceMeshes.begin(), sourceMeshes.end(), entity->GetMesh()) == sourceMeshes.end())
+			sourceMeshes.push_back(entity->GetMesh());
+		stats.Entities++;
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<UINT> indices;
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		StaticBatch batch;
+		batch.MaterialObj = materials[g];
+		batch.VertexBuffer = nullptr;
+		batch.IndexBuffer = nullptr;
+		vertices.clear();
+		indices.clear();
+
+		for (size_t e = 0; e < groups[g].size(); e++)
+		{
+			Entity* entity = groups[g][e];
+			Mesh* mesh = entity->GetMesh();
+			const std::vector<Vertex>& meshVertices = mesh->GetVertices();
+			const std::vector<UINT>& meshIndices = mesh->GetIndices();
+
+			// Normals go through the inverse transpose, which keeps
+			// them perpendicular under non-uniform scale
+			XMMATRIX world = entity->GetWorldMatrixCPU();
+			XMMATRIX normalMatrix = XMMatrixTranspose(XMMatrixInverse(nullptr, world));
+
+			StaticBatchPiece piece;
+			piece.StartIndex = (unsigned int)indices.size();
+			piece.IndexCount = (unsigned int)meshIndices.size();
+			entity->GetWorldBounds(piece.BoundsMin, piece.BoundsMax);
+
+			UINT baseVertex = (UINT)vertices.size();
+			for (size_t v = 0; v < meshVertices.size(); v++)
+			{
+				Vertex vertex = meshVertices[v];
+				XMStoreFloat3(&vertex.Position, XMVector3Transform(XMLoadFloat3(&vertex.Position), world));
+				XMStoreFloat3(&vertex.Normal, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&vertex.Normal), normalMatrix)));
+				vertices.push_back(vertex);
+			}
+			for (size_t i = 0; i < meshIndices.size(); i++)
+				indices.push_back(baseVertex + meshIndices[i]);
+
+			batch.Pieces.push_back(piece);
+		}
+
+		batch.VertexCount = (unsigned int)vertices.size();
+		batch.IndexCount = (unsigned int)indices.size();
+
+		D3D11_BUFFER_DESC vbd = {};
+		vbd.Usage = D3D11_USAGE_IMMUTABLE;
+		vbd.ByteWidth = sizeof(Vertex) * batch.VertexCount;
+		vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA vertexData = {};
+		vertexData.pSysMem = &vertices[0];
+
+		D3D11_BUFFER_DESC ibd = {};
+		ibd.Usage = D3D11_USAGE_IMMUTABLE;
+		ibd.ByteWidth = sizeof(UINT) * batch.IndexCount;
+		ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA indexData = {};
+		indexData.pSysMem = &indices[0];
+
+		if (FAILED(device->CreateBuffer(&vbd, &vertexData, &batch.VertexBuffer)) ||
+			FAILED(device->CreateBuffer(&ibd, &indexData, &batch.IndexBuffer)))
+		{
+			// Release() frees whichever of the two was created
+			batches.push_back(batch);
+			Release();
+			return false;
+		}
+
+		pieceCount += (unsigned int)batch.Pieces.size();
+		stats.Vertices += batch.VertexCount;
+		stats.Indices += batch.IndexCount;
+		stats.BatchBytes += vbd.ByteWidth + ibd.ByteWidth;
+		batches.push_back(batch);
+	}
+
+	for (size_t m = 0; m < sourceMeshes.size(); m++)
+	{
+		stats.SourceBytes +=
+			(unsigned int)(sourceMeshes[m]->GetVertices().size() * sizeof(Vertex)) +
+			(unsigned int)(sourceMeshes[m]->GetIndices().size() * sizeof(UINT));
+	}
+	stats.Batches = (unsigned int)batches.size();
+	return true;
+}
+
+// --------------------------------------------------------
+// Pieces are consecutive in their batch's index buffer, so a
+// run of visible ones is one contiguous range
+// --------------------------------------------------------
+void StaticBatcher::AddVisibleRanges(const std::function<bool(unsigned int, const StaticBatchPiece&)>& isVisible, std::vector<RenderItem>& items)
+{
+	// Vertices are already in world space
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+
+	stats.VisiblePieces = 0;
+	stats.Draws = 0;
+
+	unsigned int piece = 0;
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		const StaticBatch& batch = batches[b];
+		bool open = false;
+		for (size_t p = 0; p < batch.Pieces.size(); p++, piece++)
+		{
+			if (!isVisible(piece, batch.Pieces[p]))
+			{
+				open = false;
+				continue;
+			}
+
+			stats.VisiblePieces++;
+			if (open)
+			{
+				items.back().IndexCount += batch.Pieces[p].IndexCount;
+				continue;
+			}
+
+			RenderItem item;
+			item.MeshObj = nullptr;
+			item.MaterialObj = batch.MaterialObj;
+			item.VertexBuffer = batch.VertexBuffer;
+			item.AttributeBuffer = nullptr;
+			item.IndexBuffer = batch.IndexBuffer;
+			item.IndexCount = batch.Pieces[p].IndexCount;
+			item.StartIndex = batch.Pieces[p].StartIndex;
+			item.BaseVertex = 0;
+			item.World = identity;
+			items.push_back(item);
+			stats.Draws++;
+			open = true;
+		}
+	}
+}
+
+std::string StaticBatcher::Describe() const
+{
+	std::ostringstream report;
+	char line[256];
+	sprintf_s(line, "Static batches: %u entities in %u batches (%u draws when all in view, was %u), %u vertices, %u indices, %.1fKB batched from %.1fKB of meshes\n",
+		stats.Entities, stats.Batches, stats.Batches, stats.Entities, stats.Vertices, stats.Indices,
+		stats.BatchBytes / 1024.0f, stats.SourceBytes / 1024.0f);
+	report << line;
+
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		const StaticBatch& batch = batches[b];
+		sprintf_s(line, "  material %u: %u pieces, %u vertices, %u indices, %.1fKB\n",
+			batch.MaterialObj->GetId(), (unsigned int)batch.Pieces.size(), batch.VertexCount, batch.IndexCount,
+			(batch.VertexCount * sizeof(Vertex) + batch.IndexCount * sizeof(UINT)) / 1024.0f);
+		report << line;
+	}
+
+	return report.str();
+}
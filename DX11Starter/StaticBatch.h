@@ -0,0 +1,95 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Entity.h"
+#include "RenderSnapshot.h"
+
+// For the DirectX Math library
+using namespace DirectX;
+
+// --------------------------------------------------------
+// One static entity's triangles inside a batch, with its
+// world bounds so it can still be culled on its own
+// --------------------------------------------------------
+struct StaticBatchPiece
+{
+	unsigned int StartIndex;
+	unsigned int IndexCount;
+	XMFLOAT3 BoundsMin;
+	XMFLOAT3 BoundsMax;
+};
+
+// --------------------------------------------------------
+// Every static entity of one material, in world space
+// --------------------------------------------------------
+struct StaticBatch
+{
+	Material* MaterialObj;
+	ID3D11Buffer* VertexBuffer;
+	ID3D11Buffer* IndexBuffer;
+	unsigned int VertexCount;
+	unsigned int IndexCount;
+	std::vector<StaticBatchPiece> Pieces;
+};
+
+// --------------------------------------------------------
+// What batching built, and what the last frame drew of it
+// --------------------------------------------------------
+struct StaticBatchStats
+{
+	unsigned int Entities;			// Static entities merged
+	unsigned int Batches;
+	unsigned int Vertices;
+	unsigned int Indices;
+	unsigned int BatchBytes;		// Vertex and index buffers of the batches
+	unsigned int SourceBytes;		// The distinct meshes the entities use
+	unsigned int VisiblePieces;		// Last frame
+	unsigned int Draws;				// Last frame, one per run of visible pieces
+};
+
+// --------------------------------------------------------
+// Static mesh batching
+//
+// Entities flagged static are transformed into world space
+// once and merged, per material, into one immutable vertex
+// and index buffer.  Each entity stays a piece of its batch
+// with its own index range and bounds, and visible pieces
+// that are next to each other in the index buffer are drawn
+// with one call, so a batch that's entirely in view is a
+// single draw.  Static entities must not move afterwards.
+// --------------------------------------------------------
+class StaticBatcher
+{
+public:
+	StaticBatcher();
+	~StaticBatcher();
+
+	// Merges the static entities, replacing any earlier batches
+	bool Build(ID3D11Device* device, const std::vector<Entity*>& entities);
+
+	// Frees the batches' buffers
+	void Release();
+
+	unsigned int GetBatchCount() const { return (unsigned int)batches.size(); }
+	const StaticBatch& GetBatch(unsigned int index) const { return batches[index]; }
+
+	// Pieces of every batch, numbered in batch order
+	unsigned int GetPieceCount() const { return pieceCount; }
+
+	// Adds an item for every run of consecutive pieces that
+	// isVisible(index, piece) accepts
+	void AddVisibleRanges(const std::function<bool(unsigned int, const StaticBatchPiece&)>& isVisible, std::vector<RenderItem>& items);
+
+	const StaticBatchStats& GetStats() const { return stats; }
+
+	// Memory and draw counts, one line per batch
+	std::string Describe() const;
+
+private:
+	std::vector<StaticBatch> batches;
+	unsigned int pieceCount;
+	StaticBatchStats stats;
+};
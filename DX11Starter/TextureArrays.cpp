@@ -0,0 +1,184 @@
+#include "TextureArrays.h"
+#include <stdio.h>
+
+TextureArrayPacker::TextureArrayPacker()
+{
+	ZeroMemory(&stats, sizeof(TextureArrayStats));
+}
+
+TextureArrayPacker::~TextureArrayPacker()
+{
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (entries[i].Texture) { entries[i].Texture->Release(); }
+	}
+	for (size_t i = 0; i < arrays.size(); i++)
+	{
+		if (arrays[i].SRV) { arrays[i].SRV->Release(); }
+		if (arrays[i].Texture) { arrays[i].Texture->Release(); }
+	}
+}
+
+TextureHandle TextureArrayPacker::Add(ID3D11ShaderResourceView * texture)
+{
+	Entry entry;
+	entry.Texture = nullptr;
+	entry.Array = 0xffffffff;
+	entry.Slice = 0;
+
+	// Anything but a plain 2D texture stays unpacked
+	if (texture)
+	{
+		ID3D11Resource* resource = nullptr;
+		texture->GetResource(&resource);
+		if (resource)
+		{
+			resource->QueryInterface(__uuidof(ID3D11Texture2D), (void**)&entry.Texture);
+			resource->Release();
+		}
+	}
+
+	entries.push_back(entry);
+	stats.Textures++;
+	return (TextureHandle)(entries.size() - 1);
+}
+
+bool TextureArrayPacker::Compatible(const D3D11_TEXTURE2D_DESC & a, const D3D11_TEXTURE2D_DESC & b)
+{
+	return
+		a.Width == b.Width &&
+		a.Height == b.Height &&
+		a.MipLevels == b.MipLevels &&
+		a.Format == b.Format &&
+		a.SampleDesc.Count == b.SampleDesc.Count &&
+		a.SampleDesc.Quality == b.SampleDesc.Quality;
+}
+
+// --------------------------------------------------------
+// Textures are grouped in the order they were added, each
+// going into the first array with the same layout and room
+// left.  Copies stay on the GPU.
+// --------------------------------------------------------
+bool TextureArrayPacker::Build(ID3D11Device * device, ID3D11DeviceContext * context)
+{
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		Entry& entry = entries[i];
+		if (!entry.Texture)
+			continue;
+
+		D3D11_TEXTURE2D_DESC desc;
+		entry.Texture->GetDesc(&desc);
+		if (desc.ArraySize != 1 || desc.SampleDesc.Count != 1 || (desc.MiscFlags & D3D11_RESOURCE_MISC_TEXTURECUBE))
+			continue;
+
+		for (size_t a = 0; a < arrays.size(); a++)
+		{
+			if (Compatible(arrays[a].Desc, desc) && arrays[a].Desc.ArraySize < D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION)
+			{
+				entry.Array = (unsigned int)a;
+				entry.Slice = arrays[a].Desc.ArraySize++;
+				break;
+			}
+		}
+
+		if (entry.Array == 0xffffffff)
+		{
+			Array array;
+			array.Desc = desc;
+			array.Desc.ArraySize = 1;
+			array.Texture = nullptr;
+			array.SRV = nullptr;
+			entry.Array = (unsigned int)arrays.size();
+			entry.Slice = 0;
+			arrays.push_back(array);
+		}
+	}
+
+	bool built = true;
+	for (size_t a = 0; a < arrays.size(); a++)
+	{
+		Array& array = arrays[a];
+		array.Desc.Usage = D3D11_USAGE_DEFAULT;
+		array.Desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		array.Desc.CPUAccessFlags = 0;
+		array.Desc.MiscFlags = 0;
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = array.Desc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MostDetailedMip = 0;
+		srvDesc.Texture2DArray.MipLevels = array.Desc.MipLevels;
+		srvDesc.Texture2DArray.FirstArraySlice = 0;
+		srvDesc.Texture2DArray.ArraySize = array.Desc.ArraySize;
+
+		if (FAILED(device->CreateTexture2D(&array.Desc, 0, &array.Texture)) ||
+			FAILED(device->CreateShaderResourceView(array.Texture, &srvDesc, &array.SRV)))
+		{
+			if (array.Texture) { array.Texture->Release(); array.Texture = nullptr; }
+			built = false;
+		}
+	}
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		Entry& entry = entries[i];
+		if (entry.Array != 0xffffffff && !arrays[entry.Array].SRV)
+			entry.Array = 0xffffffff;
+
+		if (entry.Array != 0xffffffff)
+		{
+			const Array& array = arrays[entry.Array];
+			for (unsigned int mip = 0; mip < array.Desc.MipLevels; mip++)
+			{
+				context->CopySubresourceRegion(
+					array.Texture, D3D11CalcSubresource(mip, entry.Slice, array.Desc.MipLevels),
+					0, 0, 0, entry.Texture, mip, nullptr);
+				stats.Copies++;
+			}
+			stats.Packed++;
+		}
+
+		if (entry.Texture) { entry.Texture->Release(); entry.Texture = nullptr; }
+	}
+
+	for (size_t a = 0; a < arrays.size(); a++)
+	{
+		if (arrays[a].SRV)
+			stats.Arrays++;
+	}
+	return built;
+}
+
+ID3D11ShaderResourceView * TextureArrayPacker::GetArray(TextureHandle handle) const
+{
+	if (handle >= entries.size() || entries[handle].Array == 0xffffffff)
+		return nullptr;
+	return arrays[entries[handle].Array].SRV;
+}
+
+unsigned int TextureArrayPacker::GetSlice(TextureHandle handle) const
+{
+	if (handle >= entries.size())
+		return 0;
+	return entries[handle].Slice;
+}
+
+std::string TextureArrayPacker::Describe() const
+{
+	std::string text;
+	char line[256];
+	sprintf_s(line, "Texture arrays: %u of %u textures packed into %u arrays, %u subresource copies",
+		stats.Packed, stats.Textures, stats.Arrays, stats.Copies);
+	text += line;
+	for (size_t a = 0; a < arrays.size(); a++)
+	{
+		if (!arrays[a].SRV)
+			continue;
+		sprintf_s(line, "\n  Array %u: %u slices of %ux%u, %u mips, format %u",
+			(unsigned int)a, arrays[a].Desc.ArraySize, arrays[a].Desc.Width, arrays[a].Desc.Height,
+			arrays[a].Desc.MipLevels, (unsigned int)arrays[a].Desc.Format);
+		text += line;
+	}
+	return text;
+}
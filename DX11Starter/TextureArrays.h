@@ -0,0 +1,76 @@
+#pragma once
+#include <d3d11.h>
+#include <string>
+#include <vector>
+
+typedef unsigned int TextureHandle;
+static const TextureHandle TEXTURE_INVALID = 0xffffffff;
+
+// --------------------------------------------------------
+// Results of the last Build()
+// --------------------------------------------------------
+struct TextureArrayStats
+{
+	unsigned int Textures;			// Added
+	unsigned int Packed;			// Now a slice of an array
+	unsigned int Arrays;
+	unsigned int Copies;			// Subresources copied, every mip of every slice
+};
+
+// --------------------------------------------------------
+// Packs textures of the same format, size and mip count into
+// Texture2DArrays at load time
+//
+// Materials then refer to an (array, slice) pair instead of
+// a texture of their own, so materials that differ only by
+// texture bind the same SRV and their draws can share one
+// instanced draw, with the slice passed per instance.
+//
+// Add() every texture, then Build() once, which copies every
+// mip of every texture into its array on the GPU with
+// CopySubresourceRegion.  The added textures are not kept and
+// can be released afterwards.  Textures that can't be packed
+// (not a plain 2D texture) keep no array; GetArray() returns
+// null for them.
+// --------------------------------------------------------
+class TextureArrayPacker
+{
+public:
+	TextureArrayPacker();
+	~TextureArrayPacker();
+
+	// Queues a texture for Build()
+	TextureHandle Add(ID3D11ShaderResourceView* texture);
+
+	// Creates the arrays and copies the textures in
+	bool Build(ID3D11Device* device, ID3D11DeviceContext* context);
+
+	// Array holding the texture and its slice in it
+	ID3D11ShaderResourceView* GetArray(TextureHandle handle) const;
+	unsigned int GetSlice(TextureHandle handle) const;
+
+	const TextureArrayStats& GetStats() const { return stats; }
+	std::string Describe() const;
+
+private:
+	struct Entry
+	{
+		ID3D11Texture2D* Texture;		// Until Build()
+		unsigned int Array;				// Index in arrays, or -1
+		unsigned int Slice;
+	};
+
+	struct Array
+	{
+		D3D11_TEXTURE2D_DESC Desc;		// ArraySize is the slice count
+		ID3D11Texture2D* Texture;
+		ID3D11ShaderResourceView* SRV;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<Array> arrays;
+	TextureArrayStats stats;
+
+	// Same layout, so one can be a slice of the other's array
+	static bool Compatible(const D3D11_TEXTURE2D_DESC& a, const D3D11_TEXTURE2D_DESC& b);
+};
@@ -0,0 +1,27 @@
+// The scene is rendered to the top left of a full size
+// texture, so its uv only goes up to the scale
+cbuffer externalData : register(b0)
+{
+	float2 uvScale;		// Rendered size / texture size
+	float2 uvMax;		// Centre of the last rendered texel
+};
+
+Texture2D sceneTexture		: register(t0);
+SamplerState linearSampler	: register(s0);
+
+struct VertexToPixel
+{
+	float4 position		: SV_POSITION;
+	float2 uv			: TEXCOORD;
+};
+
+// --------------------------------------------------------
+// Stretches the rendered region over the back buffer with
+// bilinear filtering.  Clamping to the last texel keeps the
+// filter from blending in what's outside the region.
+// --------------------------------------------------------
+float4 main(VertexToPixel input) : SV_TARGET
+{
+	float2 uv = min(input.uv * uvScale, uvMax);
+	return sceneTexture.Sample(linearSampler, uv);
+}
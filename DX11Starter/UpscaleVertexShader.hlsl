@@ -0,0 +1,19 @@
+struct VertexToPixel
+{
+	float4 position		: SV_POSITION;
+	float2 uv			: TEXCOORD;
+};
+
+// --------------------------------------------------------
+// Fullscreen triangle made from the vertex id alone, drawn
+// with Draw(3, 0) and no vertex or index buffer bound.  Its
+// corners are (-1,1), (3,1) and (-1,-3), which covers the
+// screen with uv 0..1 across it.
+// --------------------------------------------------------
+VertexToPixel main(uint id : SV_VertexID)
+{
+	VertexToPixel output;
+	output.uv = float2((id << 1) & 2, id & 2);
+	output.position = float4(output.uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+	return output;
+}
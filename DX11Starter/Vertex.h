@@ -1,6 +1,7 @@
 #pragma once
 
 #include <DirectXMath.h>
+#include "VertexFormat.h"
 
 // --------------------------------------------------------
 // A custom vertex definition
@@ -13,4 +14,137 @@ struct Vertex
 	//DirectX::XMFLOAT4 Color;        // The color of the vertex
 	DirectX::XMFLOAT3 Normal;
 	DirectX::XMFLOAT2 UV;
-};
\ No newline at end of file
+};
+
+// Matches VertexShaderInput in VertexShader.hlsl
+template<> struct VertexFormat<Vertex>
+{
+	static const unsigned int ElementCount = 3;
+	static const D3D11_INPUT_ELEMENT_DESC* Elements()
+	{
+		static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+		{
+			VERTEX_ELEMENT(Vertex, Position, "POSITION", 0),
+			VERTEX_ELEMENT(Vertex, Normal, "NORMAL", 0),
+			VERTEX_ELEMENT(Vertex, UV, "TEXCOORD", 0)
+		};
+		return elements;
+	}
+};
+
+// --------------------------------------------------------
+// How a mesh stores its vertices
+//
+// Interleaved meshes keep whole Vertex structs in one buffer.
+// Split meshes keep positions in one buffer (slot 0, 12 bytes
+// a vertex) and the rest in another (slot 1), so passes that
+// only need positions, like depth and shadow passes, fetch
+// 12 bytes a vertex instead of 32.
+// --------------------------------------------------------
+enum VertexStreams
+{
+	VERTEX_STREAMS_INTERLEAVED,
+	VERTEX_STREAMS_SPLIT
+};
+
+// Position stream of split meshes
+struct VertexPosition
+{
+	DirectX::XMFLOAT3 Position;
+};
+
+// Attribute stream of split meshes
+struct VertexAttributes
+{
+	DirectX::XMFLOAT3 Normal;
+	DirectX::XMFLOAT2 UV;
+};
+
+// Positions alone, for position-only shaders
+template<> struct VertexFormat<VertexPosition>
+{
+	static const unsigned int ElementCount = 1;
+	static const D3D11_INPUT_ELEMENT_DESC* Elements()
+	{
+		static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+		{
+			VERTEX_ELEMENT_SLOT(VertexPosition, Position, "POSITION", 0, 0)
+		};
+		return elements;
+	}
+};
+
+// Both streams of a split mesh together, matching VertexShaderInput
+struct SplitVertex;
+template<> struct VertexFormat<SplitVertex>
+{
+	static const unsigned int ElementCount = 3;
+	static const D3D11_INPUT_ELEMENT_DESC* Elements()
+	{
+		static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+		{
+			VERTEX_ELEMENT_SLOT(VertexPosition, Position, "POSITION", 0, 0),
+			VERTEX_ELEMENT_SLOT(VertexAttributes, Normal, "NORMAL", 0, 1),
+			VERTEX_ELEMENT_SLOT(VertexAttributes, UV, "TEXCOORD", 0, 1)
+		};
+		return elements;
+	}
+};
+
+// --------------------------------------------------------
+// Per-instance data of instanced draws, read from its own
+// input slot after the vertex streams.  Matches the
+// _PER_INSTANCE inputs of VertexShader.hlsl's INSTANCING
+// variant.
+// --------------------------------------------------------
+static const unsigned int INSTANCE_INPUT_SLOT = 2;
+
+struct InstanceData
+{
+	DirectX::XMFLOAT4X4 World;		// Transposed for HLSL
+	float TextureSlice;				// Of the material's texture array
+};
+
+// Interleaved vertices plus instance data
+struct InstancedVertex;
+template<> struct VertexFormat<InstancedVertex>
+{
+	static const unsigned int ElementCount = 8;
+	static const D3D11_INPUT_ELEMENT_DESC* Elements()
+	{
+		static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+		{
+			VERTEX_ELEMENT(Vertex, Position, "POSITION", 0),
+			VERTEX_ELEMENT(Vertex, Normal, "NORMAL", 0),
+			VERTEX_ELEMENT(Vertex, UV, "TEXCOORD", 0),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 0, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 1, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 2, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 3, INSTANCE_INPUT_SLOT),
+			INSTANCE_ELEMENT_SLOT(InstanceData, TextureSlice, "TEXTURESLICE_PER_INSTANCE", 0, INSTANCE_INPUT_SLOT)
+		};
+		return elements;
+	}
+};
+
+// Split stream vertices plus instance data
+struct InstancedSplitVertex;
+template<> struct VertexFormat<InstancedSplitVertex>
+{
+	static const unsigned int ElementCount = 8;
+	static const D3D11_INPUT_ELEMENT_DESC* Elements()
+	{
+		static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+		{
+			VERTEX_ELEMENT_SLOT(VertexPosition, Position, "POSITION", 0, 0),
+			VERTEX_ELEMENT_SLOT(VertexAttributes, Normal, "NORMAL", 0, 1),
+			VERTEX_ELEMENT_SLOT(VertexAttributes, UV, "TEXCOORD", 0, 1),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 0, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 1, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 2, INSTANCE_INPUT_SLOT),
+			INSTANCE_MATRIX_ROW(InstanceData, World, "WORLD_PER_INSTANCE", 3, INSTANCE_INPUT_SLOT),
+			INSTANCE_ELEMENT_SLOT(InstanceData, TextureSlice, "TEXTURESLICE_PER_INSTANCE", 0, INSTANCE_INPUT_SLOT)
+		};
+		return elements;
+	}
+};
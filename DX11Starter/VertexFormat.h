@@ -0,0 +1,65 @@
+#pragma once
+#include <d3d11.h>
+#include <stddef.h>
+#include <DirectXMath.h>
+
+// --------------------------------------------------------
+// DXGI format of a vertex struct member, by C++ type
+// --------------------------------------------------------
+template<typename T> struct VertexElementFormat;
+
+template<> struct VertexElementFormat<float>				{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32_FLOAT; };
+template<> struct VertexElementFormat<DirectX::XMFLOAT2>	{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32_FLOAT; };
+template<> struct VertexElementFormat<DirectX::XMFLOAT3>	{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32_FLOAT; };
+template<> struct VertexElementFormat<DirectX::XMFLOAT4>	{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32A32_FLOAT; };
+template<> struct VertexElementFormat<unsigned int>			{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32_UINT; };
+template<> struct VertexElementFormat<DirectX::XMUINT2>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32_UINT; };
+template<> struct VertexElementFormat<DirectX::XMUINT3>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32_UINT; };
+template<> struct VertexElementFormat<DirectX::XMUINT4>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32A32_UINT; };
+template<> struct VertexElementFormat<int>					{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32_SINT; };
+template<> struct VertexElementFormat<DirectX::XMINT2>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32_SINT; };
+template<> struct VertexElementFormat<DirectX::XMINT3>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32_SINT; };
+template<> struct VertexElementFormat<DirectX::XMINT4>		{ static const DXGI_FORMAT Format = DXGI_FORMAT_R32G32B32A32_SINT; };
+
+// Per-vertex element in an input slot for a member of a vertex
+// struct, with its format and offset worked out at compile time
+#define VERTEX_ELEMENT_SLOT(VertexType, Member, Semantic, SemanticIndex, Slot) \
+	{ Semantic, SemanticIndex, VertexElementFormat<decltype(VertexType::Member)>::Format, Slot, \
+	  (UINT)offsetof(VertexType, Member), D3D11_INPUT_PER_VERTEX_DATA, 0 }
+
+// The same in slot 0, for interleaved vertices
+#define VERTEX_ELEMENT(VertexType, Member, Semantic, SemanticIndex) \
+	VERTEX_ELEMENT_SLOT(VertexType, Member, Semantic, SemanticIndex, 0)
+
+// Per-instance element, stepping once per instance
+#define INSTANCE_ELEMENT_SLOT(InstanceType, Member, Semantic, SemanticIndex, Slot) \
+	{ Semantic, SemanticIndex, VertexElementFormat<decltype(InstanceType::Member)>::Format, Slot, \
+	  (UINT)offsetof(InstanceType, Member), D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+
+// One row of a per-instance XMFLOAT4X4 member, as semantic index Row
+#define INSTANCE_MATRIX_ROW(InstanceType, Member, Semantic, Row, Slot) \
+	{ Semantic, Row, DXGI_FORMAT_R32G32B32A32_FLOAT, Slot, \
+	  (UINT)(offsetof(InstanceType, Member) + (Row) * sizeof(DirectX::XMFLOAT4)), D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+
+// --------------------------------------------------------
+// Compile-time input layout of a vertex struct
+//
+// Specialize this next to each vertex struct with its element
+// descriptions, so vertex shaders and the InputLayoutCache can
+// build the layout without reflecting the shader:
+//
+//   template<> struct VertexFormat<MyVertex>
+//   {
+//       static const unsigned int ElementCount = 2;
+//       static const D3D11_INPUT_ELEMENT_DESC* Elements()
+//       {
+//           static const D3D11_INPUT_ELEMENT_DESC elements[ElementCount] =
+//           {
+//               VERTEX_ELEMENT(MyVertex, Position, "POSITION", 0),
+//               VERTEX_ELEMENT(MyVertex, UV, "TEXCOORD", 0)
+//           };
+//           return elements;
+//       }
+//   };
+// --------------------------------------------------------
+template<typename T> struct VertexFormat;
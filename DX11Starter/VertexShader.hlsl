@@ -7,7 +7,9 @@
 // - The name of the cbuffer itself is unimportant
 cbuffer externalData : register(b0)
 {
+#if !INSTANCING
 	matrix world;
+#endif
 	matrix view;
 	matrix projection;
 };
@@ -28,6 +30,10 @@ struct VertexShaderInput
 	//float4 color		: COLOR;        // RGBA color
 	float3 normal		: NORMAL;		// Normal
 	float2 uv			: TEXCOORD;		// UV coords
+#if INSTANCING
+	matrix world		: WORLD_PER_INSTANCE;	// From the per-instance stream in slot 2
+	float textureSlice	: TEXTURESLICE_PER_INSTANCE;	// Of the material's texture array
+#endif
 };
 
 // Struct representing the data we're sending down the pipeline
@@ -47,6 +53,10 @@ struct VertexToPixel
 	float3 normal		: NORMAL;		// normal vector
 	float3 worldPos		: WORLDPOS;
 	float2 uv			: TEXCOORD;
+	float viewDepth		: VIEWDEPTH;	// View space Z, used to find the light cluster
+#if INSTANCING
+	nointerpolation float textureSlice	: TEXTURESLICE;	// Last, so other pixel shaders can ignore it
+#endif
 };
 
 // --------------------------------------------------------
@@ -61,6 +71,10 @@ VertexToPixel main( VertexShaderInput input )
 	// Set up output struct
 	VertexToPixel output;
 
+#if INSTANCING
+	matrix world = input.world;
+#endif
+
 	// The vertex's position (input.position) must be converted to world space,
 	// then camera space (relative to our 3D camera), then to proper homogenous 
 	// screen-space coordinates.  This is taken care of by our world, view and
@@ -75,7 +89,11 @@ VertexToPixel main( VertexShaderInput input )
 	//
 	// The result is essentially the position (XY) of the vertex on our 2D 
 	// screen and the distance (Z) from the camera (the "depth" of the pixel)
-	output.position = mul(float4(input.position, 1.0f), worldViewProj);
+	//
+	// Precise, like DepthVertexShader.hlsl, so the depth matches the
+	// prepass bit for bit whatever else is computed from the inputs
+	precise float4 position = mul(float4(input.position, 1.0f), worldViewProj);
+	output.position = position;
 
 	// Pass the color through 
 	// - The values will be interpolated per-pixel by the rasterizer
@@ -84,12 +102,19 @@ VertexToPixel main( VertexShaderInput input )
 
 	output.worldPos = mul(float4(input.position, 1.0f), world).xyz;
 
+	// View space depth for the clustered lighting lookup
+	output.viewDepth = mul(float4(output.worldPos, 1.0f), view).z;
+
 	// Translate the normals
 	output.normal = mul( input.normal, (float3x3)world );
 
 	//Copy uv
 	output.uv = input.uv;
 
+#if INSTANCING
+	output.textureSlice = input.textureSlice;
+#endif
+
 	// Whatever we return will make its way through the pipeline to the
 	// next programmable stage we're using (the pixel shader for now)
 	return output;
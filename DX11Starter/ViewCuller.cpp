@@ -0,0 +1,350 @@
+#include "ViewCuller.h"
+#include "JobSystem.h"
+#include <Windows.h>
+#include <malloc.h>
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <emmintrin.h>
+
+ViewCuller::ViewCuller()
+{
+	// Aligned for the splatted planes
+	views = (ViewPlanes*)_aligned_malloc(sizeof(ViewPlanes) * MAX_VIEWS, 16);
+	viewCount = 0;
+	objectCount = 0;
+	objectCapacity = 0;
+	centerX = centerY = centerZ = nullptr;
+	extentX = extentY = extentZ = nullptr;
+	ZeroMemory(visibleCounts, sizeof(visibleCounts));
+	ZeroMemory(&stats, sizeof(ViewCullingStats));
+
+	__int64 perfFreq;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	perfCounterSeconds = 1.0 / (double)perfFreq;
+
+	Grow(256);
+}
+
+ViewCuller::~ViewCuller()
+{
+	_aligned_free(views);
+	_aligned_free(centerX);
+	_aligned_free(centerY);
+	_aligned_free(centerZ);
+	_aligned_free(extentX);
+	_aligned_free(extentY);
+	_aligned_free(extentZ);
+}
+
+void ViewCuller::Clear()
+{
+	viewCount = 0;
+	objectCount = 0;
+}
+
+// --------------------------------------------------------
+// Gribb/Hartmann extraction from the columns of the matrix,
+// with D3D's near plane at depth 0
+// --------------------------------------------------------
+void ViewCuller::ExtractFrustumPlanes(const XMMATRIX & viewProjection, XMFLOAT4 planes[6])
+{
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+	XMVECTOR extracted[6] =
+	{
+		columns.r[3] + columns.r[0],	// Left
+		columns.r[3] - columns.r[0],	// Right
+		columns.r[3] + columns.r[1],	// Bottom
+		columns.r[3] - columns.r[1],	// Top
+		columns.r[2],					// Near
+		columns.r[3] - columns.r[2]		// Far
+	};
+
+	for (unsigned int i = 0; i < 6; i++)
+		XMStoreFloat4(&planes[i], XMPlaneNormalize(extracted[i]));
+}
+
+unsigned int ViewCuller::AddFrustum(const XMMATRIX & viewProjection)
+{
+	XMFLOAT4 planes[6];
+	ExtractFrustumPlanes(viewProjection, planes);
+	return AddView(planes, 6);
+}
+
+unsigned int ViewCuller::AddView(const XMFLOAT4 * planes, unsigned int planeCount)
+{
+	if (viewCount == MAX_VIEWS || planeCount > MAX_PLANES)
+		return MAX_VIEWS;
+
+	ViewPlanes& view = views[viewCount];
+	view.PlaneCount = planeCount;
+	for (unsigned int i = 0; i < planeCount; i++)
+	{
+		view.Planes[i][0] = _mm_set1_ps(planes[i].x);
+		view.Planes[i][1] = _mm_set1_ps(planes[i].y);
+		view.Planes[i][2] = _mm_set1_ps(planes[i].z);
+		view.Planes[i][3] = _mm_set1_ps(planes[i].w);
+		view.Planes[i][4] = _mm_set1_ps(fabsf(planes[i].x));
+		view.Planes[i][5] = _mm_set1_ps(fabsf(planes[i].y));
+		view.Planes[i][6] = _mm_set1_ps(fabsf(planes[i].z));
+	}
+
+	return viewCount++;
+}
+
+unsigned int ViewCuller::AddObject(const XMFLOAT3 & boundsMin, const XMFLOAT3 & boundsMax)
+{
+	if (objectCount + 4 > objectCapacity)
+		Grow(objectCapacity * 2);
+
+	unsigned int index = objectCount++;
+	centerX[index] = (boundsMin.x + boundsMax.x) * 0.5f;
+	centerY[index] = (boundsMin.y + boundsMax.y) * 0.5f;
+	centerZ[index] = (boundsMin.z + boundsMax.z) * 0.5f;
+	extentX[index] = (boundsMax.x - boundsMin.x) * 0.5f;
+	extentY[index] = (boundsMax.y - boundsMin.y) * 0.5f;
+	extentZ[index] = (boundsMax.z - boundsMin.z) * 0.5f;
+	return index;
+}
+
+void ViewCuller::Grow(unsigned int capacity)
+{
+	float** arrays[] = { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ };
+	for (unsigned int i = 0; i < 6; i++)
+	{
+		float* grown = (float*)_aligned_malloc(sizeof(float) * capacity, 16);
+		if (*arrays[i])
+		{
+			memcpy(grown, *arrays[i], sizeof(float) * objectCount);
+			_aligned_free(*arrays[i]);
+		}
+		*arrays[i] = grown;
+	}
+	objectCapacity = capacity;
+}
+
+void ViewCuller::Cull()
+{
+	__int64 start;
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+
+	// Pad the last group of four, the padding's results are ignored
+	unsigned int padded = (objectCount + 3) & ~3u;
+	for (unsigned int i = objectCount; i < padded; i++)
+	{
+		centerX[i] = centerY[i] = centerZ[i] = 0.0f;
+		extentX[i] = extentY[i] = extentZ[i] = 0.0f;
+	}
+	visibility.resize(padded);
+
+	unsigned int planeTests = 0;
+	unsigned int groups = padded / 4;
+	JobSystem* jobs = JobSystem::Instance();
+	if (jobs && groups > 256)
+	{
+		std::atomic<unsigned int> tests(0);
+		jobs->ParallelFor(groups, 256, [this, &tests](unsigned int begin, unsigned int end)
+		{
+			tests += CullRange(begin * 4, end * 4);
+		});
+		planeTests = tests;
+	}
+	else
+	{
+		planeTests = CullRange(0, padded);
+	}
+
+	ZeroMemory(visibleCounts, sizeof(visibleCounts));
+	stats.VisibleCount = 0;
+	for (unsigned int i = 0; i < objectCount; i++)
+	{
+		unsigned int mask = visibility[i];
+		for (unsigned int v = 0; v < viewCount; v++)
+			visibleCounts[v] += (mask >> v) & 1;
+	}
+	for (unsigned int v = 0; v < viewCount; v++)
+		stats.VisibleCount += visibleCounts[v];
+
+	__int64 end;
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	stats.ObjectCount = objectCount;
+	stats.ViewCount = viewCount;
+	stats.PlaneTests = planeTests;
+	stats.CullMs = (float)((end - start) * perfCounterSeconds * 1000.0);
+}
+
+// --------------------------------------------------------
+// A box is outside a plane when even its corner farthest
+// along the normal is behind it: dot(n, c) + w + dot(|n|, e) < 0
+// --------------------------------------------------------
+unsigned int ViewCuller::CullRange(unsigned int begin, unsigned int end)
+{
+	unsigned int planeTests = 0;
+	__m128 zero = _mm_setzero_ps();
+
+	for (unsigned int i = begin; i < end; i += 4)
+	{
+		// Loaded once for every view
+		__m128 cx = _mm_load_ps(centerX + i);
+		__m128 cy = _mm_load_ps(centerY + i);
+		__m128 cz = _mm_load_ps(centerZ + i);
+		__m128 ex = _mm_load_ps(extentX + i);
+		__m128 ey = _mm_load_ps(extentY + i);
+		__m128 ez = _mm_load_ps(extentZ + i);
+
+		unsigned int masks[4] = { 0, 0, 0, 0 };
+		for (unsigned int v = 0; v < viewCount; v++)
+		{
+			const ViewPlanes& view = views[v];
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (unsigned int p = 0; p < view.PlaneCount; p++)
+			{
+				const __m128* plane = view.Planes[p];
+				__m128 distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(cx, plane[0]), _mm_mul_ps(cy, plane[1])),
+					_mm_add_ps(_mm_mul_ps(cz, plane[2]), plane[3]));
+				__m128 radius = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(ex, plane[4]), _mm_mul_ps(ey, plane[5])),
+					_mm_mul_ps(ez, plane[6]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+				planeTests++;
+
+				// All four already outside this view
+				if (_mm_movemask_ps(inside) == 0)
+					break;
+			}
+
+			int lanes = _mm_movemask_ps(inside);
+			masks[0] |= (unsigned int)(lanes & 1) << v;
+			masks[1] |= (unsigned int)((lanes >> 1) & 1) << v;
+			masks[2] |= (unsigned int)((lanes >> 2) & 1) << v;
+			masks[3] |= (unsigned int)((lanes >> 3) & 1) << v;
+		}
+
+		visibility[i] = masks[0];
+		visibility[i + 1] = masks[1];
+		visibility[i + 2] = masks[2];
+		visibility[i + 3] = masks[3];
+	}
+
+	return planeTests;
+}
+
+// --------------------------------------------------------
+// Boxes scattered over a large level, seen by a camera and
+// four shadow cascades of a sun, either culled together or
+// one view at a time.  Runs on the calling thread only.
+// --------------------------------------------------------
+int RunViewCullingBenchmark(const std::string & commandLine)
+{
+	std::istringstream args(commandLine);
+	std::string arg;
+	unsigned int objects = 100000;
+	unsigned int passes = 50;
+
+	while (args >> arg)
+	{
+		if (arg != "--culling-benchmark")
+			objects = (unsigned int)strtoul(arg.c_str(), nullptr, 10);
+	}
+
+	AllocConsole();
+	FILE* stream;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+
+	// Camera at the middle of the level, cascades of growing size
+	// around it in the sun's view
+	const unsigned int viewCount = 5;
+	XMMATRIX viewProjections[viewCount];
+	viewProjections[0] =
+		XMMatrixLookToLH(XMVectorSet(0.0f, 2.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+		XMMatrixPerspectiveFovLH(0.25f * XM_PI, 16.0f / 9.0f, 0.1f, 500.0f);
+	XMMATRIX sunView = XMMatrixLookToLH(XMVectorSet(0.0f, 200.0f, 0.0f, 0.0f), XMVectorSet(0.3f, -1.0f, 0.2f, 0.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f));
+	for (unsigned int c = 1; c < viewCount; c++)
+	{
+		float size = 20.0f * (float)(1 << (2 * (c - 1)));
+		viewProjections[c] = sunView * XMMatrixOrthographicOffCenterLH(-size, size, -size, size, 0.0f, 400.0f);
+	}
+
+	ViewCuller combined;
+	ViewCuller separate[viewCount];
+	srand(1);
+	for (unsigned int i = 0; i < objects; i++)
+	{
+		float x = (rand() / (float)RAND_MAX - 0.5f) * 2000.0f;
+		float z = (rand() / (float)RAND_MAX - 0.5f) * 2000.0f;
+		float size = 0.5f + rand() / (float)RAND_MAX * 4.0f;
+		XMFLOAT3 boundsMin(x - size, 0.0f, z - size);
+		XMFLOAT3 boundsMax(x + size, size * 2.0f, z + size);
+
+		combined.AddObject(boundsMin, boundsMax);
+		for (unsigned int v = 0; v < viewCount; v++)
+			separate[v].AddObject(boundsMin, boundsMax);
+	}
+	for (unsigned int v = 0; v < viewCount; v++)
+	{
+		combined.AddFrustum(viewProjections[v]);
+		separate[v].AddFrustum(viewProjections[v]);
+	}
+
+	__int64 perfFreq, start, end;
+	QueryPerformanceFrequency((LARGE_INTEGER*)&perfFreq);
+	double msPerTick = 1000.0 / perfFreq / passes;
+
+	// One view alone, the cost a cascade is compared against
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+	for (unsigned int p = 0; p < passes; p++)
+		separate[0].Cull();
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	double singleMs = (end - start) * msPerTick;
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+	for (unsigned int p = 0; p < passes; p++)
+	{
+		for (unsigned int v = 0; v < viewCount; v++)
+			separate[v].Cull();
+	}
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	double separateMs = (end - start) * msPerTick;
+
+	QueryPerformanceCounter((LARGE_INTEGER*)&start);
+	for (unsigned int p = 0; p < passes; p++)
+		combined.Cull();
+	QueryPerformanceCounter((LARGE_INTEGER*)&end);
+	double combinedMs = (end - start) * msPerTick;
+
+	// Both ways must agree on every object
+	unsigned int mismatches = 0;
+	for (unsigned int i = 0; i < objects; i++)
+	{
+		for (unsigned int v = 0; v < viewCount; v++)
+		{
+			if (combined.IsVisible(i, v) != separate[v].IsVisible(i, 0))
+				mismatches++;
+		}
+	}
+
+	std::ostringstream report;
+	char line[256];
+	sprintf_s(line, "%u objects, %u views, %u passes (headless, one thread)\n", objects, viewCount, passes);
+	report << line;
+	sprintf_s(line, "visible: camera %u, cascades %u %u %u %u\n",
+		combined.GetVisibleCount(0), combined.GetVisibleCount(1), combined.GetVisibleCount(2),
+		combined.GetVisibleCount(3), combined.GetVisibleCount(4));
+	report << line;
+	sprintf_s(line, "one view %.3fms, %u views separately %.3fms, together %.3fms\n",
+		singleMs, viewCount, separateMs, combinedMs);
+	report << line;
+	sprintf_s(line, "each extra view costs %.2f of a single view pass, %u mismatches\n",
+		singleMs > 0.0 ? (combinedMs - singleMs) / (viewCount - 1) / singleMs : 0.0, mismatches);
+	report << line;
+
+	printf("%s", report.str().c_str());
+	std::ofstream results("culling_benchmark.results.txt", std::ios::app);
+	results << report.str();
+	return mismatches == 0 ? 0 : 1;
+}
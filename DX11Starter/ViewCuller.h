@@ -0,0 +1,126 @@
+#pragma once
+#include <DirectXMath.h>
+#include <emmintrin.h>
+#include <string>
+#include <vector>
+
+// For the DirectX Math library
+using namespace DirectX;
+
+// --------------------------------------------------------
+// Per-frame statistics of the view culling stage
+// --------------------------------------------------------
+struct ViewCullingStats
+{
+	unsigned int ObjectCount;		// Bounding boxes tested
+	unsigned int ViewCount;
+	unsigned int VisibleCount;		// Object/view pairs found visible
+	unsigned int PlaneTests;		// Plane tests of 4 boxes each
+	float CullMs;
+};
+
+// --------------------------------------------------------
+// Frustum culling of many views in one pass
+//
+// A view is a convex volume of up to MAX_PLANES planes: a
+// camera frustum, a shadow cascade, a cube map face or one
+// player's camera in split screen.  Bounding boxes are kept as
+// SoA centers and extents, so each group of 4 boxes is loaded
+// into registers once and tested against every plane of every
+// view with SSE.  An extra view only costs its plane tests.
+//
+// The result is a bitmask per object with bit v set when the
+// object may be visible in view v.  Planes point inwards:
+// a point p is inside when dot(plane.xyz, p) + plane.w >= 0.
+// --------------------------------------------------------
+class ViewCuller
+{
+public:
+	static const unsigned int MAX_VIEWS = 32;
+	static const unsigned int MAX_PLANES = 12;		// A shadow caster volume can take 11
+
+	ViewCuller();
+	~ViewCuller();
+
+	// Forgets the views and objects of the last frame
+	void Clear();
+
+	// Adds the frustum of a view-projection matrix (untransposed,
+	// D3D depth from 0 to 1) and returns the view's index, or
+	// MAX_VIEWS if there's no room
+	unsigned int AddFrustum(const XMMATRIX& viewProjection);
+
+	// Adds any convex volume of up to MAX_PLANES inward planes
+	unsigned int AddView(const XMFLOAT4* planes, unsigned int planeCount);
+
+	// Adds a world space box and returns the object's index
+	unsigned int AddObject(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+
+	// Tests every object against every view, spread across the
+	// JobSystem when there are enough objects
+	void Cull();
+
+	// Bit v is set when object may be visible in view v
+	unsigned int GetVisibility(unsigned int object) const { return visibility[object]; }
+	bool IsVisible(unsigned int object, unsigned int view) const { return (visibility[object] & (1u << view)) != 0; }
+
+	// Objects visible in one view, counted after Cull()
+	unsigned int GetVisibleCount(unsigned int view) const { return visibleCounts[view]; }
+
+	// World space center and half size of an object's box
+	void GetBounds(unsigned int object, XMFLOAT3& center, XMFLOAT3& extent) const
+	{
+		center = XMFLOAT3(centerX[object], centerY[object], centerZ[object]);
+		extent = XMFLOAT3(extentX[object], extentY[object], extentZ[object]);
+	}
+
+	unsigned int GetViewCount() const { return viewCount; }
+	unsigned int GetObjectCount() const { return objectCount; }
+	const ViewCullingStats& GetStats() const { return stats; }
+
+	// Inward planes of a view-projection's frustum, normalized
+	static void ExtractFrustumPlanes(const XMMATRIX& viewProjection, XMFLOAT4 planes[6]);
+
+private:
+	// Every plane's components and the absolute values of its
+	// normal, each splatted across a register
+	struct ViewPlanes
+	{
+		__m128 Planes[MAX_PLANES][7];
+		unsigned int PlaneCount;
+	};
+
+	ViewPlanes* views;
+	unsigned int viewCount;
+
+	// SoA boxes, 16 byte aligned and padded to a multiple of 4
+	float* centerX;
+	float* centerY;
+	float* centerZ;
+	float* extentX;
+	float* extentY;
+	float* extentZ;
+	unsigned int objectCount;
+	unsigned int objectCapacity;
+
+	std::vector<unsigned int> visibility;
+	unsigned int visibleCounts[MAX_VIEWS];
+
+	ViewCullingStats stats;
+	double perfCounterSeconds;
+
+	void Grow(unsigned int capacity);
+
+	// Culls objects [begin, end), begin a multiple of 4, and
+	// returns the number of plane tests
+	unsigned int CullRange(unsigned int begin, unsigned int end);
+};
+
+// --------------------------------------------------------
+// Headless benchmark of one pass over N views against N
+// single view passes, with 1 camera and 4 shadow cascades:
+//   --culling-benchmark [objects]
+//
+// Returns the process exit code
+// --------------------------------------------------------
+int RunViewCullingBenchmark(const std::string& commandLine);
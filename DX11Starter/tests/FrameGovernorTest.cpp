@@ -0,0 +1,133 @@
+#include "FrameGovernor.h"
+#include "TestCheck.h"
+#include <limits.h>
+#include <fstream>
+#include <sstream>
+
+// --------------------------------------------------------
+// Replays traces/gpu_spike.txt: 200 frames at ~30ms on the
+// GPU, then 300 at ~5ms.  The governor should step down
+// resolution, then LOD bias, then lights, holding between
+// steps, and give every step back newest first.
+// --------------------------------------------------------
+static void TestGpuSpikeTrace(const char* path)
+{
+	FrameGovernorSettings settings;
+	settings.SetDefaults();
+	settings.MaxLights = 64;
+	FrameGovernor governor(settings);
+
+	std::ifstream trace(path);
+	CHECK(trace.good());
+	std::ostringstream report;
+	CHECK_EQUAL(500, ReplayFrameTrace(trace, governor, report));
+
+	struct Step
+	{
+		FrameGovernorKnob Knob;
+		float From;
+		float To;
+	};
+	static const Step degrades[] =
+	{
+		{ FRAME_GOVERNOR_RESOLUTION, 1.0f, 0.9f },
+		{ FRAME_GOVERNOR_RESOLUTION, 0.9f, 0.8f },
+		{ FRAME_GOVERNOR_RESOLUTION, 0.8f, 0.7f },
+		{ FRAME_GOVERNOR_RESOLUTION, 0.7f, 0.6f },
+		{ FRAME_GOVERNOR_RESOLUTION, 0.6f, 0.5f },
+		{ FRAME_GOVERNOR_LOD_BIAS, 0.0f, 0.5f },
+		{ FRAME_GOVERNOR_LOD_BIAS, 0.5f, 1.0f },
+		{ FRAME_GOVERNOR_LOD_BIAS, 1.0f, 1.5f },
+		{ FRAME_GOVERNOR_LOD_BIAS, 1.5f, 2.0f },
+		{ FRAME_GOVERNOR_LIGHTS, 64.0f, 32.0f },
+		{ FRAME_GOVERNOR_LIGHTS, 32.0f, 16.0f },
+		{ FRAME_GOVERNOR_LIGHTS, 16.0f, 8.0f },
+	};
+	const unsigned int steps = sizeof(degrades) / sizeof(degrades[0]);
+
+	const std::vector<FrameGovernorDecision>& decisions = governor.GetDecisions();
+	CHECK_EQUAL(steps * 2, decisions.size());
+	if (decisions.size() != steps * 2)
+	{
+		printf("%s", report.str().c_str());
+		return;
+	}
+
+	for (unsigned int i = 0; i < steps; i++)
+	{
+		// Degrades in order, while over budget on the GPU
+		const FrameGovernorDecision& degrade = decisions[i];
+		CHECK_EQUAL(degrades[i].Knob, degrade.Knob);
+		CHECK(degrade.From == degrades[i].From && degrade.To == degrades[i].To);
+		CHECK(degrade.GpuBound);
+		CHECK(degrade.Frame <= 200);
+
+		// Upgrades in the reverse order, back to the same values
+		const FrameGovernorDecision& upgrade = decisions[steps * 2 - 1 - i];
+		CHECK_EQUAL(degrades[i].Knob, upgrade.Knob);
+		CHECK(upgrade.From == degrades[i].To && upgrade.To == degrades[i].From);
+		CHECK(upgrade.Frame > 200);
+	}
+
+	// Nothing changes for HoldFrames after a change
+	CHECK_EQUAL(settings.HoldFrames, decisions[0].Frame);
+	for (unsigned int i = 1; i < decisions.size(); i++)
+		CHECK(decisions[i].Frame - decisions[i - 1].Frame >= settings.HoldFrames);
+
+	const FrameQuality& quality = governor.GetQuality();
+	CHECK(quality.ResolutionScale == 1.0f);
+	CHECK(quality.LodBias == 0.0f);
+	CHECK_EQUAL(64, quality.MaxLights);
+}
+
+// Over budget on the CPU, resolution isn't touched
+static void TestCpuBound()
+{
+	FrameGovernorSettings settings;
+	settings.SetDefaults();
+	FrameGovernor governor(settings);
+	governor.SetLightCount(64);
+
+	for (unsigned int i = 0; i < 60; i++)
+		governor.Update(30.0f, 5.0f);
+
+	const std::vector<FrameGovernorDecision>& decisions = governor.GetDecisions();
+	CHECK_EQUAL(4, decisions.size());
+	for (unsigned int i = 0; i < decisions.size(); i++)
+	{
+		CHECK(!decisions[i].GpuBound);
+		CHECK_EQUAL(i < 3 ? FRAME_GOVERNOR_LIGHTS : FRAME_GOVERNOR_LOD_BIAS, decisions[i].Knob);
+	}
+	CHECK(governor.GetQuality().ResolutionScale == 1.0f);
+	CHECK_EQUAL(8, governor.GetQuality().MaxLights);
+}
+
+// Until the light count is known, lights aren't a knob
+static void TestUnknownLightCount()
+{
+	FrameGovernor governor;
+	for (unsigned int i = 0; i < 200; i++)
+		governor.Update(5.0f, 30.0f);
+
+	const std::vector<FrameGovernorDecision>& decisions = governor.GetDecisions();
+	for (unsigned int i = 0; i < decisions.size(); i++)
+		CHECK(decisions[i].Knob != FRAME_GOVERNOR_LIGHTS);
+	CHECK_EQUAL(UINT_MAX, governor.GetQuality().MaxLights);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: FrameGovernorTest traces/gpu_spike.txt\n");
+		return 1;
+	}
+
+	TestGpuSpikeTrace(argv[1]);
+	TestCpuBound();
+	TestUnknownLightCount();
+
+	if (testFailures == 0)
+		printf("FrameGovernor: all checks passed\n");
+	return testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "RingAllocator.h"
+#include "TestCheck.h"
+
+// Sizes are rounded up to the alignment and counted in full
+static void TestAlignment()
+{
+	RingAllocator ring(256, 16);
+	CHECK_EQUAL(0, ring.Allocate(1));
+	CHECK_EQUAL(16, ring.Allocate(17));
+	CHECK_EQUAL(48, ring.Allocate(16));
+	CHECK_EQUAL(64, ring.GetUsed());
+	CHECK_EQUAL(64, ring.GetFrameBytes());
+
+	CHECK_EQUAL(RingAllocator::INVALID_OFFSET, ring.Allocate(0));
+	CHECK_EQUAL(RingAllocator::INVALID_OFFSET, ring.Allocate(257));
+	CHECK_EQUAL(64, ring.GetUsed());
+}
+
+// A range that doesn't fit before the end starts over at zero,
+// and the skipped tail counts against the frame that skipped it
+static void TestWrapPadding()
+{
+	RingAllocator ring(256, 16);
+	CHECK_EQUAL(0, ring.Allocate(96));
+	unsigned long long first = ring.EndFrame();
+	CHECK_EQUAL(96, ring.Allocate(96));
+	unsigned long long second = ring.EndFrame();
+	ring.Retire(first);
+	CHECK_EQUAL(96, ring.GetUsed());
+
+	// 64 bytes left before the end, so 96 wraps
+	CHECK_EQUAL(0, ring.Allocate(96));
+	CHECK_EQUAL(64 + 96, ring.GetFrameBytes());
+	CHECK_EQUAL(256, ring.GetUsed());
+
+	// Full: nothing fits until the second frame goes
+	CHECK_EQUAL(RingAllocator::INVALID_OFFSET, ring.Allocate(16));
+	unsigned long long third = ring.EndFrame();
+	ring.Retire(second);
+	CHECK_EQUAL(160, ring.GetUsed());
+	CHECK_EQUAL(96, ring.Allocate(16));
+
+	// The padding goes when the frame holding it does
+	ring.EndFrame();
+	ring.Retire(third);
+	CHECK_EQUAL(16, ring.GetUsed());
+}
+
+// Free space is what the frames in flight don't hold, even
+// when it's in one piece before the head
+static void TestFreeSpace()
+{
+	RingAllocator ring(256, 16);
+	CHECK_EQUAL(0, ring.Allocate(128));
+	unsigned long long first = ring.EndFrame();
+	CHECK_EQUAL(128, ring.Allocate(128));
+	ring.EndFrame();
+
+	CHECK_EQUAL(RingAllocator::INVALID_OFFSET, ring.Allocate(16));
+	ring.Retire(first);
+	CHECK_EQUAL(0, ring.Allocate(128));
+	CHECK_EQUAL(RingAllocator::INVALID_OFFSET, ring.Allocate(16));
+	CHECK_EQUAL(256, ring.GetUsed());
+}
+
+// Retiring a fence frees every frame up to it and no later one
+static void TestRetirement()
+{
+	RingAllocator ring(1024, 16);
+	CHECK(!ring.HasFramesInFlight());
+	CHECK_EQUAL(1, ring.GetCurrentFrame());
+
+	unsigned long long frames[4];
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		ring.Allocate(64 * (i + 1));
+		frames[i] = ring.EndFrame();
+	}
+	CHECK_EQUAL(5, ring.GetCurrentFrame());
+	CHECK_EQUAL(64 + 128 + 192 + 256, ring.GetUsed());
+
+	ring.Retire(frames[1]);
+	CHECK(ring.HasFramesInFlight());
+	CHECK_EQUAL(frames[2], ring.GetOldestFrame());
+	CHECK_EQUAL(192 + 256, ring.GetUsed());
+
+	// Retiring an older fence again changes nothing
+	ring.Retire(frames[0]);
+	CHECK_EQUAL(192 + 256, ring.GetUsed());
+
+	// An empty ring starts over at zero instead of wrapping
+	ring.Retire(frames[3]);
+	CHECK(!ring.HasFramesInFlight());
+	CHECK_EQUAL(0, ring.GetUsed());
+	CHECK_EQUAL(0, ring.Allocate(1000));
+}
+
+int main()
+{
+	TestAlignment();
+	TestWrapPadding();
+	TestFreeSpace();
+	TestRetirement();
+
+	if (testFailures == 0)
+		printf("RingAllocator: all checks passed\n");
+	return testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdio.h>
+
+// --------------------------------------------------------
+// Minimal checks for the tests: a failed check is printed
+// and counted, and main() returns the count
+// --------------------------------------------------------
+static unsigned int testFailures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); testFailures++; } } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+	do { \
+		unsigned long long e = (unsigned long long)(expected), a = (unsigned long long)(actual); \
+		if (e != a) { printf("%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual, a, e); testFailures++; } \
+	} while (0)